@@ -16,7 +16,7 @@ template<typename type> inline void destroy(type* ptr)
 }
 
 namespace internal {
-	template <class type> inline void construct_aux(type* ptr, type* end, true_type) {}
+	template <class type> inline void construct_aux(type*, type*, true_type) {}
 	template <class type> inline void construct_aux(type* ptr, type* end, false_type)
 	{
 		while (ptr != end)
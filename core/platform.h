@@ -76,3 +76,20 @@ static const char *compiler_string = "GNU C Compiler";
 #else
 	#error "Unsupported CPU"
 #endif
+
+// x86 SIMD intrinsics, for the hardware AES and SHA-256 backends.  Functions using them are compiled for the instructions they need with AES_NI_TARGET, SHA_NI_TARGET or AVX2_TARGET, and only called once cpu_features says the processor has them.
+#if defined(CPU_X86) && !defined(PLATFORM_NACL) && (defined(COMPILER_GCC) || defined(COMPILER_VISUALC))
+	#define CPU_X86_INTRINSICS
+	#if defined(COMPILER_GCC)
+		#include <cpuid.h>
+		#include <immintrin.h>
+		#define AES_NI_TARGET __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+		#define SHA_NI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+		#define AVX2_TARGET __attribute__((target("avx2")))
+	#else
+		#include <intrin.h>
+		#define AES_NI_TARGET
+		#define SHA_NI_TARGET
+		#define AVX2_TARGET
+	#endif
+#endif
@@ -0,0 +1,43 @@
+#include "stdio.h"
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/poll.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <sys/ioctl.h>   /* ioctl() */
+#include <linux/filter.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define NO_IPX_SUPPORT
+typedef struct sockaddr_in SOCKADDR_IN;
+typedef struct sockaddr * PSOCKADDR;
+typedef struct sockaddr SOCKADDR;
+typedef struct in_addr IN_ADDR;
+typedef int SOCKET;
+
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR   -1
+
+#define closesocket close
+
+#ifdef __cplusplus
+#include <new>
+#include <queue>
+#endif
@@ -4,6 +4,7 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
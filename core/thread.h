@@ -67,6 +67,31 @@ private:
 	#endif
 };
 
+/// Full memory barrier: no load or store before the barrier may be reordered with a load or store after it, by either the compiler or the CPU.  Used by lock-free structures shared between two threads.
+inline void memory_barrier()
+{
+	#ifdef PLATFORM_WIN32
+		MemoryBarrier();
+	#else
+		__sync_synchronize();
+	#endif
+}
+
+/// Returns the number of processors online, at least 1.
+inline uint32 get_processor_count()
+{
+	#ifdef PLATFORM_WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwNumberOfProcessors ? uint32(info.dwNumberOfProcessors) : 1;
+	#elif defined(PLATFORM_NACL)
+		return 1;
+	#else
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		return count > 0 ? uint32(count) : 1;
+	#endif
+}
+
 /// Platform independent Mutual Exclusion implementation
 class mutex
 {
@@ -174,6 +199,18 @@ public:
 			_return_value = 0;		
 		#endif
 	}
+
+	/// blocks until the thread's run function has returned.
+	void join()
+	{
+		#ifdef PLATFORM_WIN32
+			WaitForSingleObject(_thread, INFINITE);
+			CloseHandle(_thread);
+		#else
+			pthread_join(_thread, NULL);
+		#endif
+		_thread_running = false;
+	}
 protected:
 	uint32 _return_value; ///< Return value from thread function
 	bool _thread_running;
@@ -9,6 +9,7 @@ public:
 	thread_queue(uint32 threadCount)
 	{
 		_current_index = 0;
+		_stopping = false;
 		_storage.set((void *) 1);
 		for(uint32 i = 0; i < threadCount; i++)
 		{
@@ -20,6 +21,20 @@ public:
 
 	~thread_queue()
 	{
+		stop_threads();
+	}
+	
+	/// Stops the worker threads, waiting for a request in process to return.  Subclass members a request uses are destroyed before ~thread_queue runs, so a subclass calls this from its own destructor, once it has told process_request to finish.
+	void stop_threads()
+	{
+		_stopping = true;
+		_semaphore.increment(_threads.size());
+		for(uint32 i = 0; i < _threads.size(); i++)
+		{
+			_threads[i]->join();
+			delete _threads[i];
+		}
+		_threads.clear();
 	}
 	
 	/// Dispatches all thread_queue calls queued by worker threads.  This should
@@ -70,6 +85,23 @@ public:
 		return index;
 	}
 	
+	/// Returns the progress the worker has reported for a request, from 0 to 1, or -1 if there is no such request in flight.
+	float get_request_progress(uint32 request_index)
+	{
+		float progress = -1;
+		lock();
+		for(uint32 i = 0; i < _process_list.size(); i++)
+		{
+			if(_process_list[i]->request_index == request_index)
+			{
+				progress = _process_list[i]->progress;
+				break;
+			}
+		}
+		unlock();
+		return progress;
+	}
+	
 	/// Cancels a request in flight -- worker process must periodically check cancellation flag to actually stop the process.
 	bool cancel_request(uint32 request_index)
 	{
@@ -127,13 +159,14 @@ protected:
 			sto.set((void *) 0);
 			_thread_queue->unlock();
 			
-			for(;;)
+			while(!_thread_queue->_stopping)
 				_thread_queue->dispatch_next_call();
 			return 0;			
 		}
 	};
 	
 	uint32 _current_index;
+	volatile bool _stopping; ///< Set by stop_threads to end the worker threads.
 	friend class thread_queue_thread;
 	/// list of worker threads on this thread_queue
 	array<thread *> _threads;
@@ -158,6 +191,8 @@ protected:
 	void dispatch_next_call()
 	{
 		_semaphore.wait();
+		if(_stopping)
+			return;
 		lock();
 		process_record *the_record = 0;
 		for(uint32 i = 0; i < _process_list.size(); i++)
@@ -46,6 +46,8 @@ class torque_socket_instance : public scriptable_object
 	NPObjectRef on_packet;
 	NPObjectRef on_socket_packet;
 	NPObjectRef on_packet_delivery_notify;
+	NPObjectRef on_writable;
+	NPObjectRef on_stream_message;
 	NPObjectRef on_pong;
 public:
 	torque_socket_instance()
@@ -117,6 +119,13 @@ public:
 				case torque_connection_packet_notify_event_type:
 					call_function(on_packet_delivery_notify, &void_return_value, connection, sequence, event->delivered);
 					break;
+				case torque_connection_writable_event_type:
+					call_function(on_writable, &void_return_value, connection);
+					break;
+				case torque_connection_stream_message_event_type:
+					message.set((const char *) event->data, event->data_size);
+					call_function(on_stream_message, &void_return_value, connection, int(event->stream_index), message);
+					break;
 				case torque_socket_packet_event_type:
 					message.set((const char *) event->data, event->data_size);
 					source_address = net::address(event->source_address).to_string();
@@ -187,7 +196,14 @@ public:
 	
 	int send_to_connection(int connection_id, core::string packet_data)
 	{
-		return torque_socket_send_to_connection(_socket, connection_id, packet_data.len(), (core::uint8*) packet_data.c_str());
+		unsigned sequence;
+		send_to_connection_result result = torque_socket_send_to_connection(_socket, connection_id, packet_data.len(), (core::uint8*) packet_data.c_str(), &sequence);
+		return result == send_to_connection_sent || result == send_to_connection_queued ? int(sequence) : -1;
+	}
+	
+	bool send_to_stream(int connection_id, int stream_index, core::string message)
+	{
+		return torque_socket_send_to_stream(_socket, connection_id, stream_index, message.len(), (core::uint8*) message.c_str()) == send_to_connection_queued;
 	}
 
 	int send_to(core::string address_string, core::string packet_data)
@@ -216,6 +232,8 @@ public:
 		tnl_slot(db, torque_socket_instance, on_socket_packet, 0);		
 		tnl_slot(db, torque_socket_instance, on_packet, 0);
 		tnl_slot(db, torque_socket_instance, on_packet_delivery_notify, 0);
+		tnl_slot(db, torque_socket_instance, on_writable, 0);
+		tnl_slot(db, torque_socket_instance, on_stream_message, 0);
 		tnl_slot(db, torque_socket_instance, on_pong, 0);
 		tnl_method(db, torque_socket_instance, bind);
 		tnl_method(db, torque_socket_instance, set_key_pair);
@@ -227,6 +245,7 @@ public:
 		tnl_method(db, torque_socket_instance, accept_connection);
 		tnl_method(db, torque_socket_instance, close_connection);
 		tnl_method(db, torque_socket_instance, send_to_connection);
+		tnl_method(db, torque_socket_instance, send_to_stream);
 		tnl_method(db, torque_socket_instance, send_to);
 		tnl_method(db, torque_socket_instance, ping);
 		tnl_end_class(db);
@@ -0,0 +1,93 @@
+// ack_test.cpp - Checks selective acks, the negotiated packet window and congestion control over a lossy, reordering path.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+#include "test_harness.h"
+
+enum {
+	datagram_count = 1500,
+	host_send_interval = 16, ///< The host sends a datagram back for every this many it receives, so its acks ride on data packets that must still fit the largest datagram.
+};
+
+/// What a run sends and has seen so far.
+struct ack_run
+{
+	unsigned window_size;
+	congestion_control_type congestion_control;
+	test_flow client_flow; ///< Datagrams from the client to the host.
+	test_flow host_flow; ///< Datagrams from the host to the client.
+};
+
+static void configure(torque_socket_handle the_socket, void *data)
+{
+	ack_run *run = (ack_run *) data;
+	torque_socket_set_packet_window_size(the_socket, run->window_size);
+	torque_socket_set_congestion_control(the_socket, run->congestion_control);
+}
+
+static void handle_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	ack_run *run = (ack_run *) data;
+	bool is_host = endpoint == &pair->host;
+	test_flow *sent_flow = is_host ? &run->host_flow : &run->client_flow;
+	test_flow *received_flow = is_host ? &run->client_flow : &run->host_flow;
+	if(event->event_type == torque_connection_packet_event_type)
+	{
+		test_flow_receive(received_flow, event);
+		if(is_host && !(received_flow->received_count % host_send_interval))
+			test_flow_send(endpoint, sent_flow, sent_flow->sent_count + 1);
+	}
+	else if(event->event_type == torque_connection_packet_notify_event_type)
+		test_flow_notify(sent_flow, event);
+	else if(event->event_type == torque_connection_writable_event_type && !is_host)
+		test_flow_send(endpoint, sent_flow, datagram_count);
+	else if(event->event_type == torque_connection_disconnected_event_type || event->event_type == torque_connection_timed_out_event_type)
+		test_check(!"connection lost");
+}
+
+static bool all_notified(void *data)
+{
+	ack_run *run = (ack_run *) data;
+	return run->client_flow.sent_count == datagram_count && test_flow_notified(&run->client_flow) && test_flow_notified(&run->host_flow);
+}
+
+static void run_test(unsigned window_size, congestion_control_type congestion_control)
+{
+	static ack_run run;
+	memset(&run, 0, sizeof(run));
+	run.window_size = window_size;
+	run.congestion_control = congestion_control;
+	run.client_flow.datagram_size = torque_sockets_max_datagram_size;
+	run.host_flow.datagram_size = torque_sockets_max_datagram_size;
+
+	test_pair pair;
+	test_check(test_pair_create(&pair, configure, &run));
+	test_set_receive_conditions(&pair.host, 0.1f, 0.1f, 0, window_size + congestion_control);
+	test_set_receive_conditions(&pair.client, 0.1f, 0.1f, 0, window_size * 3 + congestion_control);
+
+	// a datagram too large for a packet is refused outright.
+	unsigned char oversize[torque_sockets_max_datagram_size + 1];
+	memset(oversize, 0, sizeof(oversize));
+	test_check(torque_socket_send_to_connection(pair.client.socket, pair.client.connection, sizeof(oversize), oversize, 0) == send_to_connection_invalid_message);
+
+	test_flow_send(&pair.client, &run.client_flow, datagram_count);
+	test_check(test_pump_until(&pair, handle_event, &run, all_notified, 60000));
+	// drain the events of whichever side was behind, then check every notify against what arrived.
+	test_pump(&pair, handle_event, &run);
+	test_flow_check(&run.client_flow);
+	test_flow_check(&run.host_flow);
+	// a congestion controller keeps the sender from overrunning the path, so most datagrams get through.
+	if(congestion_control != congestion_control_none)
+		test_check(run.client_flow.delivered_count > datagram_count / 2);
+	printf("window %u, congestion control %d: %u of %u datagrams delivered, %u of %u back\n", window_size, congestion_control, run.client_flow.delivered_count, datagram_count, run.host_flow.delivered_count, run.host_flow.sent_count);
+	test_pair_destroy(&pair);
+}
+
+int main()
+{
+	unsigned window_sizes[] = { 32, 1024 };
+	congestion_control_type congestion_controls[] = { congestion_control_none, congestion_control_aimd, congestion_control_bbr };
+	for(unsigned i = 0; i < sizeof(window_sizes) / sizeof(window_sizes[0]); i++)
+		for(unsigned j = 0; j < sizeof(congestion_controls) / sizeof(congestion_controls[0]); j++)
+			run_test(window_sizes[i], congestion_controls[j]);
+	return test_finish("ack_test");
+}
@@ -0,0 +1,6 @@
+# Builds each protocol test and runs it over a simulated network.  lib/libtommath and lib/libtomcrypt must be built first.
+for test in ack_test stream_test delivery_test security_test
+do
+	g++ -fpermissive -w -o $test $test.cpp -I../../.. -I../../../lib/libtommath -I../../../lib/libtomcrypt/src/headers -DLTM_DESC -L../../../lib/libtommath -L../../../lib/libtomcrypt -ltomcrypt -ltommath -lpthread || exit 1
+	./$test 2>/dev/null || exit 1
+done
@@ -0,0 +1,176 @@
+// delivery_test.cpp - Checks datagram coalescing, delayed acks, the reorder window and forward error correction.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+#include "test_harness.h"
+
+enum {
+	datagram_count = 1000,
+	ack_delay = 50, ///< Ack delay for the delayed ack test, well under the shortest ack probe timeout.
+	timed_datagram_count = 12, ///< Datagrams the delayed ack test times the notify of, one at a time; fewer than half the default window, past which a host that only sends ack packets acks at once.
+};
+
+/// The options and path a run is given, and what it has seen so far.
+struct delivery_run
+{
+	unsigned coalesce_delay;
+	unsigned ack_delay;
+	unsigned reorder_window;
+	unsigned fec_group_size;
+	float packet_loss;
+	float reorder_rate;
+	bool host_replies; ///< True if the host sends a datagram back for each it receives.
+	test_flow client_flow; ///< Datagrams from the client to the host.
+	test_flow host_flow; ///< Datagrams from the host to the client.
+};
+
+static void configure(torque_socket_handle the_socket, void *data)
+{
+	delivery_run *run = (delivery_run *) data;
+	torque_socket_set_coalesce_delay(the_socket, run->coalesce_delay);
+	torque_socket_set_ack_delay(the_socket, run->ack_delay);
+	torque_socket_set_reorder_window(the_socket, run->reorder_window);
+	torque_socket_set_fec_group_size(the_socket, run->fec_group_size);
+}
+
+static void handle_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	delivery_run *run = (delivery_run *) data;
+	bool is_host = endpoint == &pair->host;
+	test_flow *sent_flow = is_host ? &run->host_flow : &run->client_flow;
+	test_flow *received_flow = is_host ? &run->client_flow : &run->host_flow;
+	if(event->event_type == torque_connection_packet_event_type)
+	{
+		test_flow_receive(received_flow, event);
+		if(is_host && run->host_replies)
+			test_flow_send(endpoint, sent_flow, sent_flow->sent_count + 1);
+	}
+	else if(event->event_type == torque_connection_packet_notify_event_type)
+		test_flow_notify(sent_flow, event);
+	else if(event->event_type == torque_connection_writable_event_type && !is_host)
+		test_flow_send(endpoint, sent_flow, datagram_count);
+	else if(event->event_type == torque_connection_disconnected_event_type || event->event_type == torque_connection_timed_out_event_type)
+		test_check(!"connection lost");
+}
+
+static bool all_notified(void *data)
+{
+	delivery_run *run = (delivery_run *) data;
+	return run->client_flow.sent_count == datagram_count && test_flow_notified(&run->client_flow) && test_flow_notified(&run->host_flow);
+}
+
+static bool client_notified(void *data)
+{
+	delivery_run *run = (delivery_run *) data;
+	return test_flow_notified(&run->client_flow);
+}
+
+/// Sends datagram_count datagrams of datagram_size bytes from the client over the run's path and checks every notify.
+static void run_flow(delivery_run *run, unsigned datagram_size, unsigned seed)
+{
+	run->client_flow.datagram_size = datagram_size;
+	run->host_flow.datagram_size = datagram_size;
+	test_pair pair;
+	test_check(test_pair_create(&pair, configure, run));
+	test_set_receive_conditions(&pair.host, run->packet_loss, run->reorder_rate, 0, seed);
+	test_set_receive_conditions(&pair.client, run->packet_loss, run->reorder_rate, 0, seed + 1);
+	test_flow_send(&pair.client, &run->client_flow, datagram_count);
+	test_check(test_pump_until(&pair, handle_event, run, all_notified, 60000));
+	test_pump(&pair, handle_event, run);
+	test_flow_check(&run->client_flow);
+	test_flow_check(&run->host_flow);
+	test_pair_destroy(&pair);
+}
+
+/// Coalesced datagrams share a packet, but each arrives and is notified on its own.
+static void test_coalescing()
+{
+	static delivery_run run;
+	memset(&run, 0, sizeof(run));
+	run.coalesce_delay = 5;
+	run.packet_loss = 0.05f;
+	run.reorder_rate = 0.05f;
+	run_flow(&run, 64, 1);
+	unsigned packet_count = run.client_flow.sequences[datagram_count - 1] - run.client_flow.sequences[0] + 1;
+	test_check(packet_count < datagram_count / 4);
+	printf("coalescing: %u datagrams in %u packets, %u delivered\n", datagram_count, packet_count, run.client_flow.delivered_count);
+}
+
+/// A packet waits up to the ack delay for something to carry its ack; a reply carries it at once.
+static void test_delayed_acks()
+{
+	for(int host_replies = 0; host_replies < 2; host_replies++)
+	{
+		static delivery_run run;
+		memset(&run, 0, sizeof(run));
+		run.ack_delay = ack_delay;
+		run.host_replies = host_replies != 0;
+		run.client_flow.datagram_size = 64;
+		run.host_flow.datagram_size = 64;
+		test_pair pair;
+		test_check(test_pair_create(&pair, configure, &run));
+
+		unsigned shortest = ~0U, longest = 0;
+		for(unsigned i = 0; i < timed_datagram_count; i++)
+		{
+			unsigned start = test_get_milliseconds();
+			test_flow_send(&pair.client, &run.client_flow, i + 1);
+			test_check(test_pump_until(&pair, handle_event, &run, client_notified, 5000));
+			unsigned elapsed = test_get_milliseconds() - start;
+			shortest = elapsed < shortest ? elapsed : shortest;
+			longest = elapsed > longest ? elapsed : longest;
+		}
+		test_flow_check(&run.client_flow);
+		test_check(run.client_flow.delivered_count == timed_datagram_count);
+		if(host_replies)
+			test_check(longest < ack_delay * 4 / 5);
+		else
+			test_check(shortest >= ack_delay * 4 / 5);
+		printf("delayed acks, %s: notified in %u to %u ms\n", host_replies ? "with replies" : "without replies", shortest, longest);
+		test_pair_destroy(&pair);
+	}
+}
+
+/// Late packets within the reorder window are accepted, and notified once, as delivered; without one they're discarded.
+static void test_reorder_window()
+{
+	unsigned reorder_windows[] = { 0, 8 };
+	for(unsigned i = 0; i < 2; i++)
+	{
+		static delivery_run run;
+		memset(&run, 0, sizeof(run));
+		run.reorder_window = reorder_windows[i];
+		run.reorder_rate = 0.2f;
+		run_flow(&run, 200, 3);
+		if(run.reorder_window)
+			test_check(run.client_flow.delivered_count == datagram_count);
+		else
+			test_check(run.client_flow.delivered_count < datagram_count);
+		printf("reorder window %u: %u of %u reordered datagrams delivered\n", run.reorder_window, run.client_flow.delivered_count, datagram_count);
+	}
+}
+
+/// Parity packets rebuild lost ones, which are posted and notified as delivered like any other.
+static void test_fec()
+{
+	unsigned delivered_count[2];
+	for(unsigned i = 0; i < 2; i++)
+	{
+		static delivery_run run;
+		memset(&run, 0, sizeof(run));
+		run.fec_group_size = i ? 4 : 0;
+		run.packet_loss = 0.05f;
+		run_flow(&run, 200, 5);
+		delivered_count[i] = run.client_flow.delivered_count;
+		printf("fec group size %u: %u of %u datagrams delivered\n", run.fec_group_size, delivered_count[i], datagram_count);
+	}
+	test_check(delivered_count[1] > delivered_count[0]);
+}
+
+int main()
+{
+	test_coalescing();
+	test_delayed_acks();
+	test_reorder_window();
+	test_fec();
+	return test_finish("delivery_test");
+}
@@ -0,0 +1,181 @@
+// security_test.cpp - Checks the replay window against duplicated packets and the client puzzle difficulty following handshake load.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+#include "test_harness.h"
+
+enum {
+	datagram_count = 1000,
+	client_count = 6, ///< Clients connecting at once in the puzzle test, past its limit of one key exchange per second.
+	max_shared_secrets_per_second = 1,
+};
+
+// replay: every datagram is posted once, however many times the packet carrying it arrives.
+
+struct replay_run
+{
+	bool encrypted;
+	test_flow flow;
+};
+
+static void configure_replay(torque_socket_handle the_socket, void *data)
+{
+	replay_run *run = (replay_run *) data;
+	torque_socket_set_packet_encryption(the_socket, run->encrypted);
+	torque_socket_set_reorder_window(the_socket, 8);
+}
+
+static void replay_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	replay_run *run = (replay_run *) data;
+	if(event->event_type == torque_connection_packet_event_type && endpoint == &pair->host)
+		test_flow_receive(&run->flow, event);
+	else if(event->event_type == torque_connection_packet_notify_event_type && endpoint == &pair->client)
+		test_flow_notify(&run->flow, event);
+	else if(event->event_type == torque_connection_writable_event_type && endpoint == &pair->client)
+		test_flow_send(&pair->client, &run->flow, datagram_count);
+	else if(event->event_type == torque_connection_disconnected_event_type || event->event_type == torque_connection_timed_out_event_type)
+		test_check(!"connection lost");
+}
+
+static bool replay_done(void *data)
+{
+	replay_run *run = (replay_run *) data;
+	return run->flow.sent_count == datagram_count && test_flow_notified(&run->flow);
+}
+
+static void test_replay()
+{
+	for(int encrypted = 0; encrypted < 2; encrypted++)
+	{
+		static replay_run run;
+		memset(&run, 0, sizeof(run));
+		run.encrypted = encrypted != 0;
+		run.flow.datagram_size = 200;
+
+		test_pair pair;
+		test_check(test_pair_create(&pair, configure_replay, &run));
+		test_set_receive_conditions(&pair.host, 0.05f, 0.1f, 0.3f, 1);
+		test_set_receive_conditions(&pair.client, 0.05f, 0.1f, 0.3f, 2);
+		test_flow_send(&pair.client, &run.flow, datagram_count);
+		test_check(test_pump_until(&pair, replay_event, &run, replay_done, 60000));
+		test_pump_for(&pair, replay_event, &run, 200);
+		test_flow_check(&run.flow);
+		printf("replay, %s: %u of %u datagrams delivered once each\n", encrypted ? "sealed" : "in the clear", run.flow.delivered_count, datagram_count);
+		test_pair_destroy(&pair);
+	}
+}
+
+// puzzles: a burst of connections over the host's limits raises the puzzle difficulty, yet every client still gets in, and the difficulty drops back once the burst is over.
+
+struct puzzle_run
+{
+	test_endpoint clients[client_count];
+	unsigned established_count;
+	torque_socket_handle host_socket;
+};
+
+static void configure_puzzle(torque_socket_handle the_socket, void *data)
+{
+	torque_socket_set_puzzle_load_limits(the_socket, 0, max_shared_secrets_per_second, 0);
+}
+
+static void puzzle_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	puzzle_run *run = (puzzle_run *) data;
+	if(event->event_type == torque_connection_requested_event_type && endpoint == &pair->host)
+		torque_socket_accept_connection(pair->host.socket, event->connection);
+	else if(event->event_type == torque_connection_challenge_response_event_type && endpoint != &pair->host)
+		torque_socket_accept_challenge(endpoint->socket, event->connection);
+	else if(event->event_type == torque_connection_established_event_type && endpoint != &pair->host)
+		run->established_count++;
+	else if(event->event_type == torque_connection_disconnected_event_type || event->event_type == torque_connection_timed_out_event_type)
+		test_check(!"connection lost");
+}
+
+/// Pumps the events of the pair and of the extra clients for milliseconds, or until done returns true.
+static bool puzzle_pump(test_pair *pair, puzzle_run *run, bool (*done)(void *data), unsigned milliseconds)
+{
+	unsigned start = test_get_milliseconds();
+	while(test_get_milliseconds() - start < milliseconds)
+	{
+		if(done && done(run))
+			return true;
+		for(unsigned i = 0; i < client_count; i++)
+		{
+			torque_socket_event *event;
+			while((event = torque_socket_get_next_event(run->clients[i].socket)) != 0)
+				puzzle_event(pair, &run->clients[i], event, run);
+		}
+		test_pump(pair, puzzle_event, run);
+	}
+	return done && done(run);
+}
+
+static bool all_established(void *data)
+{
+	puzzle_run *run = (puzzle_run *) data;
+	return run->established_count == client_count;
+}
+
+static bool difficulty_lowered(void *data)
+{
+	puzzle_run *run = (puzzle_run *) data;
+	torque_socket_puzzle_stats stats;
+	torque_socket_get_puzzle_stats(run->host_socket, &stats);
+	return stats.difficulty_drops != 0;
+}
+
+static void test_puzzle_difficulty()
+{
+	static puzzle_run run;
+	memset(&run, 0, sizeof(run));
+
+	test_pair pair;
+	test_check(test_pair_create(&pair, configure_puzzle, 0));
+	torque_socket_puzzle_stats initial;
+	torque_socket_get_puzzle_stats(pair.host.socket, &initial);
+
+	sockaddr_in host_address = test_address(1);
+	unsigned char connect_data[] = "test";
+	for(unsigned i = 0; i < client_count; i++)
+	{
+		test_endpoint *client = &run.clients[i];
+		client->socket = torque_socket_create(false, 0, 0);
+		test_seed_socket(client->socket, 10 + i);
+		client->transport = torque_loopback_transport_create(pair.network);
+		torque_socket_set_transport(client->socket, client->transport);
+		sockaddr_in bind_address = test_address(10 + i);
+		test_check(torque_socket_bind(client->socket, (sockaddr *) &bind_address) == bind_success);
+		torque_socket_connect(client->socket, (sockaddr *) &host_address, sizeof(connect_data), connect_data);
+	}
+	test_check(puzzle_pump(&pair, &run, all_established, 30000));
+
+	// the difficulty is measured about once a second, and lowered only after ten measurements in a row under a quarter of the limits.
+	torque_socket_puzzle_stats raised;
+	puzzle_pump(&pair, &run, 0, 1500);
+	torque_socket_get_puzzle_stats(pair.host.socket, &raised);
+	test_check(raised.difficulty_raises > 0 && raised.current_difficulty > initial.current_difficulty);
+	test_check(raised.solutions_accepted >= client_count);
+	test_check(!raised.invalid_solutions);
+
+	run.host_socket = pair.host.socket;
+	test_check(puzzle_pump(&pair, &run, difficulty_lowered, 30000));
+	torque_socket_puzzle_stats lowered;
+	torque_socket_get_puzzle_stats(pair.host.socket, &lowered);
+	test_check(lowered.current_difficulty < raised.current_difficulty);
+	printf("puzzles: %u clients connected, difficulty %u raised to %u and lowered to %u\n", run.established_count, initial.current_difficulty, raised.current_difficulty, lowered.current_difficulty);
+
+	for(unsigned i = 0; i < client_count; i++)
+	{
+		torque_socket_destroy(run.clients[i].socket);
+		torque_transport_destroy(run.clients[i].transport);
+	}
+	test_pair_destroy(&pair);
+}
+
+int main()
+{
+	test_replay();
+	test_puzzle_difficulty();
+	return test_finish("security_test");
+}
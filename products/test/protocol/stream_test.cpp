@@ -0,0 +1,218 @@
+// stream_test.cpp - Checks the send queue, reliable message streams and message fragmentation over a lossy, reordering path.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+#include "test_harness.h"
+
+enum {
+	datagram_count = 1000,
+	queue_limit = 8192, ///< Send queue limit for the send queue test, a handful of full-size datagrams.
+	stream_count = 4,
+	messages_per_stream = 60,
+	max_test_message_size = 40000,
+	reassembly_limit = 16384, ///< Reassembly limit for the reassembly test, under the size of its message.
+};
+
+/// Sizes the stream test cycles through: the smallest, ones either side of the fragmentation threshold and several that take many fragments.
+static const unsigned message_sizes[] = { 4, 100, torque_sockets_max_stream_message_size, torque_sockets_max_stream_message_size + 1, 5000, max_test_message_size };
+
+static void configure(torque_socket_handle the_socket, void *data)
+{
+	torque_socket_set_congestion_control(the_socket, congestion_control_aimd);
+	torque_socket_set_send_queue_limit(the_socket, queue_limit);
+}
+
+static void check_connected(torque_socket_event *event)
+{
+	if(event->event_type == torque_connection_disconnected_event_type || event->event_type == torque_connection_timed_out_event_type)
+		test_check(!"connection lost");
+}
+
+// the send queue: datagrams are refused once it's full, and the connection says when to send again.
+
+struct queue_run
+{
+	test_flow flow;
+	unsigned writable_count;
+	bool waiting_for_writable; ///< True from a refused send until the writable event that follows it.
+};
+
+static void queue_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	queue_run *run = (queue_run *) data;
+	check_connected(event);
+	if(event->event_type == torque_connection_packet_event_type && endpoint == &pair->host)
+		test_flow_receive(&run->flow, event);
+	else if(event->event_type == torque_connection_packet_notify_event_type && endpoint == &pair->client)
+		test_flow_notify(&run->flow, event);
+	else if(event->event_type == torque_connection_writable_event_type && endpoint == &pair->client)
+	{
+		// writable follows only a refused send.
+		test_check(run->waiting_for_writable);
+		run->waiting_for_writable = false;
+		run->writable_count++;
+		unsigned refused_count = run->flow.queue_full_count;
+		test_flow_send(&pair->client, &run->flow, datagram_count);
+		run->waiting_for_writable = run->flow.queue_full_count != refused_count;
+	}
+}
+
+static bool queue_done(void *data)
+{
+	queue_run *run = (queue_run *) data;
+	return run->flow.sent_count == datagram_count && test_flow_notified(&run->flow);
+}
+
+static void test_send_queue()
+{
+	static queue_run run;
+	memset(&run, 0, sizeof(run));
+	run.flow.datagram_size = torque_sockets_max_datagram_size;
+
+	test_pair pair;
+	test_check(test_pair_create(&pair, configure, 0));
+	test_set_receive_conditions(&pair.host, 0.05f, 0.05f, 0, 1);
+	test_set_receive_conditions(&pair.client, 0.05f, 0.05f, 0, 2);
+	test_flow_send(&pair.client, &run.flow, datagram_count);
+	test_check(run.flow.queue_full_count == 1);
+	run.waiting_for_writable = true;
+	test_check(test_pump_until(&pair, queue_event, &run, queue_done, 60000));
+	test_pump(&pair, queue_event, &run);
+	test_flow_check(&run.flow);
+	test_check(run.writable_count == run.flow.queue_full_count);
+	printf("send queue: %u datagrams refused, %u delivered\n", run.flow.queue_full_count, run.flow.delivered_count);
+	test_pair_destroy(&pair);
+}
+
+// streams: every message arrives once, whole and in order on its own stream, however the packets carrying it fare.
+
+struct stream_run
+{
+	unsigned sent_count[stream_count];
+	unsigned received_count[stream_count];
+	unsigned queue_full_count;
+	unsigned char message[max_test_message_size];
+};
+
+/// Fills a message whose first bytes carry its index, and the rest bytes particular to its stream.
+static unsigned make_message(unsigned stream_index, unsigned index, unsigned char *buffer)
+{
+	unsigned size = message_sizes[index % (sizeof(message_sizes) / sizeof(message_sizes[0]))];
+	for(unsigned i = 0; i < size; i++)
+		buffer[i] = (unsigned char) (stream_index * 31 + index + i);
+	memcpy(buffer, &index, sizeof(index));
+	return size;
+}
+
+/// Sends messages round the streams until each has sent messages_per_stream or the send queue is full.
+static void send_messages(test_endpoint *sender, stream_run *run)
+{
+	for(bool sent = true; sent; )
+	{
+		sent = false;
+		for(unsigned stream_index = 0; stream_index < stream_count; stream_index++)
+		{
+			if(run->sent_count[stream_index] == messages_per_stream)
+				continue;
+			unsigned size = make_message(stream_index, run->sent_count[stream_index], run->message);
+			send_to_connection_result result = torque_socket_send_to_stream(sender->socket, sender->connection, stream_index, size, run->message);
+			if(result == send_to_connection_queue_full)
+			{
+				run->queue_full_count++;
+				return;
+			}
+			test_check(result == send_to_connection_sent || result == send_to_connection_queued);
+			run->sent_count[stream_index]++;
+			sent = true;
+		}
+	}
+}
+
+static void stream_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	stream_run *run = (stream_run *) data;
+	check_connected(event);
+	if(event->event_type == torque_connection_stream_message_event_type && endpoint == &pair->host)
+	{
+		test_check(event->stream_index < stream_count);
+		if(event->stream_index >= stream_count)
+			return;
+		unsigned char expected[max_test_message_size];
+		unsigned index = run->received_count[event->stream_index]++;
+		unsigned size = make_message(event->stream_index, index, expected);
+		test_check(index < run->sent_count[event->stream_index]);
+		test_check(event->data_size == size && !memcmp(event->data, expected, size));
+	}
+	else if(event->event_type == torque_connection_writable_event_type && endpoint == &pair->client)
+		send_messages(&pair->client, run);
+}
+
+static bool streams_done(void *data)
+{
+	stream_run *run = (stream_run *) data;
+	for(unsigned i = 0; i < stream_count; i++)
+		if(run->received_count[i] != messages_per_stream)
+			return false;
+	return true;
+}
+
+static void test_streams()
+{
+	static stream_run run;
+	memset(&run, 0, sizeof(run));
+
+	test_pair pair;
+	test_check(test_pair_create(&pair, configure, 0));
+	test_set_receive_conditions(&pair.host, 0.1f, 0.1f, 0.05f, 3);
+	test_set_receive_conditions(&pair.client, 0.1f, 0.1f, 0.05f, 4);
+
+	// messages must be on one of the streams and no larger than the largest message.
+	test_check(torque_socket_send_to_stream(pair.client.socket, pair.client.connection, torque_sockets_max_message_streams, 4, run.message) == send_to_connection_invalid_message);
+	test_check(torque_socket_send_to_stream(pair.client.socket, pair.client.connection, 0, torque_sockets_max_message_size + 1, run.message) == send_to_connection_invalid_message);
+
+	send_messages(&pair.client, &run);
+	test_check(test_pump_until(&pair, stream_event, &run, streams_done, 60000));
+	// nothing more arrives once every message has.
+	test_pump_for(&pair, stream_event, &run, 200);
+	printf("streams: %u messages on each of %u streams, %u sends refused\n", messages_per_stream, stream_count, run.queue_full_count);
+	test_pair_destroy(&pair);
+}
+
+// reassembly: a remote host that sends a message larger than the receiver will hold is disconnected.
+
+static void configure_reassembly(torque_socket_handle the_socket, void *data)
+{
+	torque_socket_set_reassembly_limits(the_socket, reassembly_limit, 30000);
+}
+
+static void reassembly_event(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data)
+{
+	bool *disconnected = (bool *) data;
+	test_check(event->event_type != torque_connection_stream_message_event_type);
+	if(event->event_type == torque_connection_disconnected_event_type && endpoint == &pair->client)
+		*disconnected = true;
+}
+
+static bool reassembly_done(void *data)
+{
+	return *(bool *) data;
+}
+
+static void test_reassembly_limit()
+{
+	static unsigned char message[max_test_message_size];
+	bool disconnected = false;
+
+	test_pair pair;
+	test_check(test_pair_create(&pair, configure_reassembly, 0));
+	test_check(torque_socket_send_to_stream(pair.client.socket, pair.client.connection, 0, reassembly_limit + 1, message) != send_to_connection_invalid_message);
+	test_check(test_pump_until(&pair, reassembly_event, &disconnected, reassembly_done, 10000));
+	test_pair_destroy(&pair);
+}
+
+int main()
+{
+	test_send_queue();
+	test_streams();
+	test_reassembly_limit();
+	return test_finish("stream_test");
+}
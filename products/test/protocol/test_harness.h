@@ -0,0 +1,251 @@
+// test_harness.h - Shared setup for the protocol tests: pairs of torque sockets connected over a loopback network.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+#include "products/libtorquesockets/libtorquesockets.cpp"
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static int g_test_failures = 0;
+
+/// Reports a failed condition without stopping the test, so one run shows every failure.
+#define test_check(condition) do { if(!(condition)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); g_test_failures++; } } while(0)
+
+/// One side of a test connection.
+struct test_endpoint
+{
+	torque_socket_handle socket;
+	torque_transport_handle transport;
+	torque_connection_id connection;
+};
+
+/// A host and a client, each on its own loopback transport, with a connection between them.
+struct test_pair
+{
+	torque_loopback_network_handle network;
+	test_endpoint host;
+	test_endpoint client;
+};
+
+/// Called for every event either side of a test_pair posts; endpoint is the side that posted it.
+typedef void (*test_event_handler)(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *data);
+
+/// Returns milliseconds on a monotonic clock.
+static unsigned test_get_milliseconds()
+{
+	return unsigned(core::net::time::get_current().get_milliseconds());
+}
+
+/// Returns a loopback address on the given port; loopback transports tell each other apart by port alone.
+static sockaddr_in test_address(unsigned short port)
+{
+	sockaddr_in the_address;
+	memset(&the_address, 0, sizeof(the_address));
+	the_address.sin_family = AF_INET;
+	the_address.sin_port = htons(port);
+	the_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return the_address;
+}
+
+/// Simulates a path to endpoint that drops packet_loss of the datagrams sent to it, delivers reorder_rate of the rest behind the next one and duplicate_rate twice.
+static void test_set_receive_conditions(test_endpoint *endpoint, float packet_loss, float reorder_rate, float duplicate_rate, unsigned seed)
+{
+	core::net::packet_transport *transport = (core::net::packet_transport *) endpoint->transport;
+	static_cast<core::net::loopback_transport *>(transport)->set_receive_conditions(packet_loss, reorder_rate, duplicate_rate, seed);
+}
+
+/// Delivers the events both sides have posted to handler, then sleeps a millisecond, or only a tenth of one if either side has timed work due now.
+static void test_pump(test_pair *pair, test_event_handler handler, void *data)
+{
+	test_endpoint *endpoints[2] = { &pair->host, &pair->client };
+	for(int i = 0; i < 2; i++)
+	{
+		torque_socket_event *event;
+		while((event = torque_socket_get_next_event(endpoints[i]->socket)) != 0)
+			if(handler)
+				handler(pair, endpoints[i], event, data);
+	}
+	usleep(torque_socket_get_next_timeout(pair->host.socket) && torque_socket_get_next_timeout(pair->client.socket) ? 1000 : 100);
+}
+
+/// Pumps events until done returns true or time_limit milliseconds have passed.  Returns the final value of done.
+static bool test_pump_until(test_pair *pair, test_event_handler handler, void *data, bool (*done)(void *data), unsigned time_limit)
+{
+	unsigned start = test_get_milliseconds();
+	while(!done(data))
+	{
+		if(test_get_milliseconds() - start > time_limit)
+			return false;
+		test_pump(pair, handler, data);
+	}
+	return true;
+}
+
+enum {
+	test_max_datagrams = 2000, ///< Most datagrams a test_flow tracks.
+};
+
+/// The datagrams one side of a test_pair sends, and what has become of them.
+struct test_flow
+{
+	unsigned datagram_size; ///< Bytes in each datagram, at least enough for its index.
+	unsigned sent_count;
+	unsigned notified_count;
+	unsigned delivered_count;
+	unsigned received_count;
+	unsigned queue_full_count; ///< Sends refused because the connection's send queue was full.
+	unsigned last_notified_sequence;
+	unsigned sequences[test_max_datagrams]; ///< The sequence each datagram was sent with.
+	bool received[test_max_datagrams]; ///< Whether the other side received each datagram.
+	int notified[test_max_datagrams]; ///< 0 until each datagram is notified, then 1 if delivered, -1 if dropped.
+};
+
+/// Fills a datagram whose first bytes carry its index.
+static void test_make_datagram(unsigned index, unsigned size, unsigned char *buffer)
+{
+	for(unsigned i = 0; i < size; i++)
+		buffer[i] = (unsigned char) (index + i);
+	memcpy(buffer, &index, sizeof(index));
+}
+
+/// Sends datagrams on the flow until it has sent limit or the send queue is full.
+static void test_flow_send(test_endpoint *sender, test_flow *flow, unsigned limit)
+{
+	unsigned char buffer[torque_sockets_max_datagram_size];
+	while(flow->sent_count < limit)
+	{
+		test_make_datagram(flow->sent_count, flow->datagram_size, buffer);
+		unsigned sequence;
+		send_to_connection_result result = torque_socket_send_to_connection(sender->socket, sender->connection, flow->datagram_size, buffer, &sequence);
+		if(result == send_to_connection_queue_full)
+		{
+			flow->queue_full_count++;
+			break;
+		}
+		test_check(result == send_to_connection_sent || result == send_to_connection_queued);
+		flow->sequences[flow->sent_count++] = sequence;
+	}
+}
+
+/// Checks a datagram received from the flow: it must be one that was sent, intact, and not received before.
+static void test_flow_receive(test_flow *flow, torque_socket_event *event)
+{
+	unsigned char expected[torque_sockets_max_datagram_size];
+	unsigned index;
+	memcpy(&index, event->data, sizeof(index));
+	test_check(event->data_size == flow->datagram_size && index < flow->sent_count);
+	if(event->data_size != flow->datagram_size || index >= flow->sent_count)
+		return;
+	test_make_datagram(index, flow->datagram_size, expected);
+	test_check(!memcmp(event->data, expected, flow->datagram_size));
+	test_check(!flow->received[index]);
+	flow->received[index] = true;
+	flow->received_count++;
+}
+
+/// Records a notify for the flow.  Notifies arrive once each, in the order the datagrams were sent, with the sequence each was sent with; coalesced datagrams share one.
+static void test_flow_notify(test_flow *flow, torque_socket_event *event)
+{
+	unsigned index = flow->notified_count;
+	test_check(index < flow->sent_count);
+	if(index >= flow->sent_count)
+		return;
+	test_check(event->packet_sequence == flow->sequences[index]);
+	test_check(!index || event->packet_sequence - flow->last_notified_sequence <= 1);
+	flow->last_notified_sequence = event->packet_sequence;
+	flow->notified[index] = event->delivered ? 1 : -1;
+	flow->notified_count++;
+	if(event->delivered)
+		flow->delivered_count++;
+}
+
+/// Returns true once every datagram sent on the flow has been notified.
+static bool test_flow_notified(test_flow *flow)
+{
+	return flow->notified_count == flow->sent_count;
+}
+
+/// Checks every notify on the flow against what the other side received.
+static void test_flow_check(test_flow *flow)
+{
+	for(unsigned i = 0; i < flow->notified_count; i++)
+		test_check(flow->notified[i] == (flow->received[i] ? 1 : -1));
+	test_check(flow->delivered_count == flow->received_count);
+}
+
+/// Pumps events for milliseconds, to see that nothing more arrives.
+static void test_pump_for(test_pair *pair, test_event_handler handler, void *data, unsigned milliseconds)
+{
+	unsigned start = test_get_milliseconds();
+	while(test_get_milliseconds() - start < milliseconds)
+		test_pump(pair, handler, data);
+}
+
+/// Gives a socket entropy of its own; sockets that aren't given any all make the same nonces and keys.
+static void test_seed_socket(torque_socket_handle the_socket, unsigned seed)
+{
+	unsigned char entropy[32];
+	for(unsigned i = 0; i < sizeof(entropy); i++)
+		entropy[i] = (unsigned char) (seed * 131 + i * 7 + (test_get_milliseconds() >> (i & 7)));
+	torque_socket_write_entropy(the_socket, entropy);
+}
+
+static void _test_connect_handler(test_pair *pair, test_endpoint *endpoint, torque_socket_event *event, void *)
+{
+	if(event->event_type == torque_connection_requested_event_type && endpoint == &pair->host)
+		torque_socket_accept_connection(pair->host.socket, event->connection);
+	else if(event->event_type == torque_connection_challenge_response_event_type && endpoint == &pair->client)
+		torque_socket_accept_challenge(pair->client.socket, event->connection);
+	else if(event->event_type == torque_connection_established_event_type)
+		endpoint->connection = event->connection;
+}
+
+static bool _test_connected(void *data)
+{
+	test_pair *pair = (test_pair *) data;
+	return pair->host.connection && pair->client.connection;
+}
+
+/// Creates the host and client, applies configure to each socket before it binds, and connects them.  Returns false if the connection wasn't established within ten seconds.
+static bool test_pair_create(test_pair *pair, void (*configure)(torque_socket_handle the_socket, void *data), void *configure_data)
+{
+	ltc_mp = ltm_desc;
+	pair->network = torque_loopback_network_create();
+	test_endpoint *endpoints[2] = { &pair->host, &pair->client };
+	for(unsigned short i = 0; i < 2; i++)
+	{
+		test_endpoint *endpoint = endpoints[i];
+		endpoint->socket = torque_socket_create(false, 0, 0);
+		test_seed_socket(endpoint->socket, i + 1);
+		endpoint->transport = torque_loopback_transport_create(pair->network);
+		endpoint->connection = invalid_torque_connection;
+		torque_socket_set_transport(endpoint->socket, endpoint->transport);
+		if(configure)
+			configure(endpoint->socket, configure_data);
+		sockaddr_in bind_address = test_address(i + 1);
+		if(torque_socket_bind(endpoint->socket, (sockaddr *) &bind_address) != bind_success)
+			return false;
+	}
+	torque_socket_allow_incoming_connections(pair->host.socket, 1);
+	sockaddr_in host_address = test_address(1);
+	unsigned char connect_data[] = "test";
+	torque_socket_connect(pair->client.socket, (sockaddr *) &host_address, sizeof(connect_data), connect_data);
+	return test_pump_until(pair, _test_connect_handler, pair, _test_connected, 10000);
+}
+
+/// Destroys the sockets, then their transports and network.
+static void test_pair_destroy(test_pair *pair)
+{
+	torque_socket_destroy(pair->client.socket);
+	torque_socket_destroy(pair->host.socket);
+	torque_transport_destroy(pair->client.transport);
+	torque_transport_destroy(pair->host.transport);
+	torque_loopback_network_destroy(pair->network);
+}
+
+/// Prints the result of a test program and returns its exit code.
+static int test_finish(const char *test_name)
+{
+	printf("%s: %s\n", test_name, g_test_failures ? "FAILED" : "passed");
+	return g_test_failures ? 1 : 0;
+}
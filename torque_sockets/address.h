@@ -143,7 +143,7 @@ struct address
 
 	bool operator!=(const address &the_address) const
 	{
-		return _host != the_address._host && _port != the_address._port;
+		return !(*this == the_address);
 	}
 
 	uint32 hash() const
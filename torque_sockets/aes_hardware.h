@@ -0,0 +1,119 @@
+// aes_hardware.h - AES-NI and PCLMULQDQ implementations of the AES block function and the GCM field multiply.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// aes_hardware expands AES-128 keys and encrypts blocks with the AES-NI instructions, and multiplies in the GCM hash field with PCLMULQDQ, on x86 processors that have them.  symmetric_cipher and packet_cipher ask is_available() when they are keyed, and use libtomcrypt's portable implementation when it returns false.  Round keys are kept in plain byte arrays and loaded unaligned, so ciphers holding them can be allocated anywhere.
+class aes_hardware
+{
+public:
+	enum {
+		block_size = 16,
+		key_size = 16,
+		rounds = 10, ///< Rounds of AES-128.
+	};
+
+	/// The expanded encryption key: the round keys, one block each.
+	struct key_schedule
+	{
+		uint8 round_keys[(rounds + 1) * block_size];
+	};
+
+	/// Returns true if the processor has the AES-NI, PCLMULQDQ, SSSE3 and SSE4.1 instructions and the hardware backend hasn't been turned off with set_enabled.
+	static bool is_available()
+	{
+		return _enabled() && _supported();
+	}
+
+	/// Turns the hardware backend off, or back on if the processor supports it, for ciphers keyed from now on; ciphers already keyed keep the backend they have.  Mostly useful for measuring one backend against the other.
+	static void set_enabled(bool enabled)
+	{
+		_enabled() = enabled;
+	}
+
+#ifdef CPU_X86_INTRINSICS
+	/// Expands an AES-128 key into its round keys.
+	static AES_NI_TARGET void expand_key(const uint8 key[key_size], key_schedule *schedule)
+	{
+		__m128i *round_keys = (__m128i *) schedule->round_keys;
+		__m128i round_key = _mm_loadu_si128((const __m128i *) key);
+		_mm_storeu_si128(round_keys, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x01)); _mm_storeu_si128(round_keys + 1, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x02)); _mm_storeu_si128(round_keys + 2, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x04)); _mm_storeu_si128(round_keys + 3, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x08)); _mm_storeu_si128(round_keys + 4, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x10)); _mm_storeu_si128(round_keys + 5, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x20)); _mm_storeu_si128(round_keys + 6, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x40)); _mm_storeu_si128(round_keys + 7, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x80)); _mm_storeu_si128(round_keys + 8, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x1b)); _mm_storeu_si128(round_keys + 9, round_key);
+		round_key = _expand_step(round_key, _mm_aeskeygenassist_si128(round_key, 0x36)); _mm_storeu_si128(round_keys + 10, round_key);
+	}
+
+	/// Encrypts one block held in a register.
+	static AES_NI_TARGET __m128i encrypt(__m128i block, const key_schedule &schedule)
+	{
+		const __m128i *round_keys = (const __m128i *) schedule.round_keys;
+		block = _mm_xor_si128(block, _mm_loadu_si128(round_keys));
+		for(uint32 i = 1; i < rounds; i++)
+			block = _mm_aesenc_si128(block, _mm_loadu_si128(round_keys + i));
+		return _mm_aesenclast_si128(block, _mm_loadu_si128(round_keys + rounds));
+	}
+
+	/// Encrypts one block in memory; in and out may be the same.
+	static AES_NI_TARGET void encrypt_block(const uint8 in[block_size], uint8 out[block_size], const key_schedule &schedule)
+	{
+		_mm_storeu_si128((__m128i *) out, encrypt(_mm_loadu_si128((const __m128i *) in), schedule));
+	}
+
+	/// Reverses the bytes of a block.  GCM's field elements are multiplied with their bytes reversed, so the bits of each come out in the order the carry-less multiply expects.
+	static AES_NI_TARGET __m128i byte_reverse(__m128i block)
+	{
+		return _mm_shuffle_epi8(block, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	}
+
+	/// Multiplies two byte reversed elements of the GCM field, GF(2^128) modulo x^128 + x^7 + x^2 + x + 1: a 256 bit carry-less product, shifted left a bit for the reflected bit order, then reduced.
+	static AES_NI_TARGET __m128i gcm_multiply(__m128i a, __m128i b)
+	{
+		__m128i low = _mm_clmulepi64_si128(a, b, 0x00);
+		__m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+		__m128i high = _mm_clmulepi64_si128(a, b, 0x11);
+		low = _mm_xor_si128(low, _mm_slli_si128(middle, 8));
+		high = _mm_xor_si128(high, _mm_srli_si128(middle, 8));
+
+		// shift the 256 bit product left by one.
+		__m128i low_carry = _mm_srli_epi32(low, 31);
+		__m128i high_carry = _mm_srli_epi32(high, 31);
+		low = _mm_slli_epi32(low, 1);
+		high = _mm_slli_epi32(high, 1);
+		high = _mm_or_si128(high, _mm_or_si128(_mm_slli_si128(high_carry, 4), _mm_srli_si128(low_carry, 12)));
+		low = _mm_or_si128(low, _mm_slli_si128(low_carry, 4));
+
+		// fold the low half into the high half by the field polynomial.
+		__m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+		__m128i fold_carry = _mm_srli_si128(fold, 4);
+		low = _mm_xor_si128(low, _mm_slli_si128(fold, 12));
+		__m128i reduced = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+		reduced = _mm_xor_si128(_mm_xor_si128(reduced, fold_carry), low);
+		return _mm_xor_si128(high, reduced);
+	}
+private:
+	static AES_NI_TARGET __m128i _expand_step(__m128i key, __m128i generated)
+	{
+		generated = _mm_shuffle_epi32(generated, 0xff);
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		return _mm_xor_si128(key, generated);
+	}
+#endif
+
+	static bool _supported()
+	{
+		return cpu_features::has_aes_ni();
+	}
+
+	static bool &_enabled()
+	{
+		static bool enabled = true;
+		return enabled;
+	}
+};
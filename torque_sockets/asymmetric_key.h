@@ -185,10 +185,7 @@ class asymmetric_key : public ref_object
 		crypto_shared_secret((crypto_key *) _key_data, (crypto_key *) publicKey->_key_data,
 		static_crypto_buffer, &outLen);
 
-		hash_state hashState;
-		sha256_init(&hashState);
-		sha256_process(&hashState, static_crypto_buffer, outLen);
-		sha256_done(&hashState, hash);
+		sha256::hash(static_crypto_buffer, uint32(outLen), hash);
 
 		return new byte_buffer(hash, 32);
 	}
@@ -204,12 +201,9 @@ class asymmetric_key : public ref_object
 		int descriptor_index = register_prng ( &yarrow_desc );
 
 		uint8 hash[32];
-		hash_state hashState;
 		uint8 static_crypto_buffer[static_crypto_buffer_size];
 
-		sha256_init(&hashState);
-		sha256_process(&hashState, buffer, buffer_size);
-		sha256_done(&hashState, hash);
+		sha256::hash(buffer, buffer_size, hash);
 
 		unsigned long outlen = sizeof(static_crypto_buffer);
 
@@ -226,11 +220,7 @@ class asymmetric_key : public ref_object
 	bool verify_signature(const uint8 *signed_bytes, uint32 signed_bytes_size, const byte_buffer &the_signature)
 	{
 		uint8 hash[32];
-		hash_state hashState;
-
-		sha256_init(&hashState);
-		sha256_process(&hashState, signed_bytes, signed_bytes_size);
-		sha256_done(&hashState, hash);
+		sha256::hash(signed_bytes, signed_bytes_size, hash);
 
 		int stat;
 
@@ -3,14 +3,10 @@ static void bit_stream_hash_and_encrypt(bit_stream &the_stream, uint32 hash_dige
 {
 	uint32 digest_start = the_stream.get_next_byte_position();
 	the_stream.set_byte_position(digest_start);
-	hash_state hash_state;
-	
-	uint8 hash[32];
+	uint8 hash[sha256::digest_size];
 	
 	// do a sha256 hash of the bit_stream:
-	sha256_init(&hash_state);
-	sha256_process(&hash_state, the_stream.get_buffer(), digest_start);
-	sha256_done(&hash_state, hash);
+	sha256::hash(the_stream.get_buffer(), digest_start, hash);
 	
 	// write the hash into the bit_stream:
 	the_stream.write_bytes(hash, hash_digest_size);
@@ -34,12 +30,8 @@ static bool bit_stream_decrypt_and_check_hash(bit_stream &the_stream, uint32 has
 					   buffer + decrypt_start_offset,
 					   buffer_size - decrypt_start_offset);
 	
-	hash_state hash_state;
-	uint8 hash[32];
-	
-	sha256_init(&hash_state);
-	sha256_process(&hash_state, buffer, buffer_size - hash_digest_size);
-	sha256_done(&hash_state, hash);
+	uint8 hash[sha256::digest_size];
+	sha256::hash(buffer, buffer_size - hash_digest_size, hash);
 	
 	bool ret = !memcmp(buffer + buffer_size - hash_digest_size, hash, hash_digest_size);
 	if(ret)
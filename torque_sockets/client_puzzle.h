@@ -1,42 +1,145 @@
+/// puzzle_solver solves client puzzles on a worker thread, with help from a thread for each other processor while a puzzle is being solved.  The threads claim consecutive chunks of the solution space until one of them finds a solution, and report progress as the fraction of the solutions a puzzle of its difficulty is expected to need that have been checked.  The helper threads are started for each puzzle and end with it, so sockets don't hold idle threads between puzzles.
 class puzzle_solver : public thread_queue
 {
 public:
-	puzzle_solver() : thread_queue(1) { }
+	enum {
+		solution_chunk_size = 8192, ///< Solutions a solver thread claims at a time.
+		max_solver_threads = 64, ///< Most threads, including the worker thread, a puzzle is solved with.
+	};
+	
+	puzzle_solver() : thread_queue(1)
+	{
+		_shutting_down = false;
+	}
+	
+	~puzzle_solver()
+	{
+		// end the search in progress, if any, and wait for the worker thread, which joins its helpers, before the search state is destroyed.
+		_shutting_down = true;
+		stop_threads();
+	}
+	
 	void process_request(const byte_buffer_ptr &the_request, byte_buffer_ptr &the_response, bool *cancelled, float *progress)
 	{
-		nonce the_nonce;
-		nonce remote_nonce;
-		uint32 puzzle_difficulty;
-		uint32 client_identity;
 		bit_stream s(the_request->get_buffer(), the_request->get_buffer_size());
-		core::read(s, the_nonce);
-		core::read(s, remote_nonce);
-		core::read(s, puzzle_difficulty);
-		core::read(s, client_identity);
-		uint32 solution = 0;
+		core::read(s, _nonce);
+		core::read(s, _remote_nonce);
+		core::read(s, _puzzle_difficulty);
+		core::read(s, _client_identity);
 		time start = time::get_current();
-		for(;;)
+		
+		_next_chunk = 0;
+		_chunks_checked = 0;
+		_solution_found = false;
+		_cancelled = cancelled;
+		_progress = progress;
+		
+		uint32 thread_count = get_processor_count();
+		if(thread_count > max_solver_threads)
+			thread_count = max_solver_threads;
+		array<helper_thread *> helpers;
+		for(uint32 i = 1; i < thread_count; i++)
 		{
-			if(*cancelled)
-				break;
-			if(client_puzzle_manager::check_one_solution(solution, the_nonce, remote_nonce, puzzle_difficulty, client_identity))
-				break;
-			
-			++solution;
+			helper_thread *helper = new helper_thread(this);
+			helpers.push_back(helper);
+			helper->start();
 		}
-		if(!*cancelled)
+		_search();
+		for(uint32 i = 0; i < helpers.size(); i++)
 		{
-			byte_buffer_ptr response = new byte_buffer(sizeof(solution));
+			helpers[i]->join();
+			delete helpers[i];
+		}
+		
+		if(!*cancelled && _solution_found)
+		{
+			*progress = 1;
+			byte_buffer_ptr response = new byte_buffer(sizeof(_solution));
 			bit_stream s(response->get_buffer(), response->get_buffer_size());
-			core::write(s, solution);
+			core::write(s, _solution);
 			the_response = response;
-			TorqueLogMessageFormatted(LogNettorque_socket, ("Client puzzle solved in %lli ms.", (time::get_current() - start).get_milliseconds()));
+			TorqueLogMessageFormatted(LogNettorque_socket, ("Client puzzle solved in %lli ms on %d threads.", (time::get_current() - start).get_milliseconds(), thread_count));
+		}
+	}
+private:
+	/// Searches alongside the worker thread for the length of one puzzle.
+	class helper_thread : public thread
+	{
+		puzzle_solver *_solver;
+	public:
+		helper_thread(puzzle_solver *solver)
+		{
+			_solver = solver;
+		}
+		uint32 run()
+		{
+			_solver->_search();
+			return 0;
+		}
+	};
+	friend class helper_thread;
+	
+	/// Checks chunks of solutions until one of the threads finds a solution, the request is cancelled or the solver is destroyed.  Run by the worker thread and every helper at once.
+	void _search()
+	{
+		float expected_chunks = float(uint64(1) << (_puzzle_difficulty < 63 ? _puzzle_difficulty : 63)) / float(solution_chunk_size);
+		for(;;)
+		{
+			_search_lock.lock();
+			if(_solution_found || *_cancelled || _shutting_down)
+			{
+				_search_lock.unlock();
+				return;
+			}
+			uint32 first_solution = _next_chunk++ * solution_chunk_size;
+			_search_lock.unlock();
+			
+			uint32 found = client_puzzle_manager::check_solutions(first_solution, solution_chunk_size, _nonce, _remote_nonce, _puzzle_difficulty, _client_identity);
+			
+			_search_lock.lock();
+			// threads finish their chunks out of order, so the lowest solution found is kept.
+			if(found < solution_chunk_size && (!_solution_found || first_solution + found < _solution))
+			{
+				_solution = first_solution + found;
+				_solution_found = true;
+			}
+			_chunks_checked++;
+			float fraction = float(_chunks_checked) / expected_chunks;
+			*_progress = fraction < 0.99f ? fraction : 0.99f;
+			_search_lock.unlock();
 		}
 	}
+	
+	volatile bool _shutting_down; ///< Set when the solver is destroyed, to end the search in progress.
+	mutex _search_lock; ///< Guards the search state below while a puzzle is being searched.
+	
+	nonce _nonce; ///< The puzzle being solved: client nonce,
+	nonce _remote_nonce; ///< server nonce,
+	uint32 _puzzle_difficulty; ///< difficulty,
+	uint32 _client_identity; ///< and client identity.
+	uint32 _next_chunk; ///< Next chunk of solutions for a thread to check.
+	uint32 _chunks_checked; ///< Chunks checked so far.
+	bool _solution_found; ///< True once a solution has been found.
+	uint32 _solution; ///< The lowest solution found.
+	bool *_cancelled; ///< Set by the queue if the request is cancelled.
+	float *_progress; ///< Where progress is reported.
 };
 
 /// The client_puzzle_manager class issues, solves and validates client
 /// puzzles for connection authentication.
+///
+/// The difficulty of the puzzles issued follows the socket's handshake
+/// load.  Once a second the manager compares the pending connections, the
+/// shared secrets computed for connect requests per second, and the time
+/// spent computing them, against the limits set with set_load_limits, and
+/// smooths the largest of those ratios into a load.  A load over the limit
+/// raises the difficulty a bit at a time, doubling the work a flood has to
+/// do for each connection, up to max_puzzle_difficulty; only a load under a
+/// quarter of the limit for difficulty_lower_intervals updates in a row
+/// lowers it again, so the difficulty doesn't flap while a flood is held
+/// off.  Solutions to the puzzle issued before a raise are accepted for
+/// difficulty_grace_time afterwards, so clients solving one aren't turned
+/// away.
 class client_puzzle_manager
 {
 public:
@@ -91,6 +194,16 @@ private:
 	uint32 _current_difficulty;
 	time _last_update_time;
 	time _last_tick_time;
+	
+	uint32 _grace_difficulty; ///< Lowest difficulty of a puzzle issued before the last raise, accepted until _grace_end_time.
+	time _grace_end_time; ///< When solutions at _grace_difficulty stop being accepted.
+	time _last_load_update_time; ///< When the load was last measured.
+	uint32 _interval_shared_secrets; ///< Shared secrets computed since the load was last measured.
+	uint32 _interval_shared_secret_time; ///< Milliseconds spent computing them.
+	uint32 _idle_intervals; ///< Load updates in a row the load has been under lower_load_percent.
+	uint32 _max_pending_connections; ///< Pending connections that count as full load, or 0 for no limit.
+	uint32 _max_shared_secret_rate; ///< Shared secrets per second that count as full load, or 0 for no limit.
+	uint32 _cpu_budget_percent; ///< Percent of the time spent computing shared secrets that counts as full load, or 0 for no limit.
 
 	nonce _current_nonce;
 	nonce _last_nonce;
@@ -101,12 +214,23 @@ private:
 	client_puzzle_manager(random_generator &random_gen, zone_allocator *zone)
 	{
 		_current_difficulty = initial_puzzle_difficulty;
+		_grace_difficulty = initial_puzzle_difficulty;
+		_grace_end_time = time(0);
+		_interval_shared_secrets = 0;
+		_interval_shared_secret_time = 0;
+		_idle_intervals = 0;
+		_max_pending_connections = default_max_pending_connections;
+		_max_shared_secret_rate = default_max_shared_secret_rate;
+		_cpu_budget_percent = default_cpu_budget_percent;
+		memset(&_stats, 0, sizeof(_stats));
+		_stats.current_difficulty = _current_difficulty;
 		random_gen.random_buffer((uint8 *) &_current_nonce, sizeof(nonce));
 		random_gen.random_buffer((uint8 *) &_last_nonce, sizeof(nonce));
 
 		_current_nonce_table = new nonce_table(zone);
 		_last_nonce_table = new nonce_table(zone);
 		_last_tick_time = time::get_current();
+		_last_load_update_time = _last_tick_time;
 	}
 
 	~client_puzzle_manager()
@@ -116,13 +240,15 @@ private:
 	}
 
 	/// Checks to see if a new nonce needs to be created, and if so
-	/// generates one and tosses out the current list of accepted nonces
-	void tick(time currentTime, random_generator &random_gen)
+	/// generates one and tosses out the current list of accepted nonces.
+	/// Also measures the load, given the number of connections the socket
+	/// has pending, and adjusts the puzzle difficulty, once every
+	/// difficulty_update_interval.
+	void tick(time currentTime, uint32 pending_connections, random_generator &random_gen)
 	{
-		// use delta of last tick time and current time to manage puzzle
-		// difficulty.
-
-		// not yet implemented.
+		_last_tick_time = currentTime;
+		if(currentTime - _last_load_update_time >= time(difficulty_update_interval))
+			_update_difficulty(currentTime, pending_connections);
 
 		// see if it's time to refresh the current puzzle:
 		time timeDelta = currentTime - _last_update_time;
@@ -159,12 +285,115 @@ private:
 		max_puzzle_difficulty        = 26, ///< Maximum puzzle difficulty is approx 1 minute to solve on ~2004 hardware.
 		max_solution_compute_fragment = 30, ///< Number of milliseconds spent computing solution per call to solve_puzzle.
 		solution_fragment_iterations = 50000, ///< Number of attempts to spend on the client puzzle per call to solve_puzzle.
+		solution_batch_size = sha256::batch_lanes * 8, ///< Solutions check_solutions hashes together with sha256::hash_batch.
+		difficulty_update_interval   = 1000, ///< Milliseconds between load measurements.
+		difficulty_lower_intervals   = 10, ///< Load measurements in a row under lower_load_percent before the difficulty is lowered.
+		difficulty_grace_time        = 5000, ///< Milliseconds after a raise that solutions to the puzzle issued before it are still accepted.
+		raise_load_percent           = 100, ///< Smoothed load, in percent of the limits, over which the difficulty is raised.
+		lower_load_percent           = 25, ///< Smoothed load under which the difficulty may be lowered.  Lowering it a bit doubles the load a flood can cause, so this is under half raise_load_percent.
+		default_max_pending_connections = 256, ///< Default pending connections at full load.
+		default_max_shared_secret_rate = 1000, ///< Default shared secrets per second at full load.
+		default_cpu_budget_percent   = 25, ///< Default percent of the time spent computing shared secrets at full load.
+	};
+
+	/// Counters describing the puzzle difficulty and the connect requests checked against it, returned by get_stats.
+	struct stats
+	{
+		uint32 current_difficulty; ///< Difficulty of the puzzles being issued.
+		uint32 load_percent; ///< Smoothed load at the last update, in percent of the limits.
+		uint32 pending_connections; ///< Pending connections at the last update.
+		uint32 shared_secrets_per_second; ///< Shared secrets computed for connect requests per second, over the last update interval.
+		uint32 difficulty_raises; ///< Times the difficulty has been raised.
+		uint32 difficulty_drops; ///< Times the difficulty has been lowered.
+		uint32 solutions_accepted; ///< Puzzle solutions accepted.
+		uint32 rejections[error_code_count]; ///< Puzzle solutions rejected, by result_code; rejections[success] stays 0.
 	};
 
-	/// Checks a puzzle solution submitted by a client to see if it is a valid solution for the current or previous puzzle nonces
+	/// Sets the pending connections, the shared secrets computed per second for connect requests, and the percent of the time spent computing them, at which the load is full and the difficulty starts to rise.  0 leaves that measure out of the load.
+	void set_load_limits(uint32 max_pending_connections, uint32 max_shared_secret_rate, uint32 cpu_budget_percent)
+	{
+		_max_pending_connections = max_pending_connections;
+		_max_shared_secret_rate = max_shared_secret_rate;
+		_cpu_budget_percent = cpu_budget_percent;
+	}
+
+	/// Counts a shared secret computed for a connect request, which took the given number of milliseconds, toward the load.
+	void record_shared_secret(uint32 milliseconds)
+	{
+		_interval_shared_secrets++;
+		_interval_shared_secret_time += milliseconds;
+	}
+
+	/// Returns the difficulty and load stats.
+	const stats &get_stats()
+	{
+		return _stats;
+	}
+
+	/// Checks a puzzle solution submitted by a client to see if it is a valid solution for the current or previous puzzle nonces, at the current difficulty or, just after a raise, the one before it
 	result_code check_solution(uint32 solution, nonce &client_nonce, nonce &server_nonce, uint32 puzzle_difficulty, uint32 client_identity)
 	{
-		if(puzzle_difficulty != _current_difficulty)
+		result_code result = _check_solution(solution, client_nonce, server_nonce, puzzle_difficulty, client_identity);
+		if(result == success)
+			_stats.solutions_accepted++;
+		else
+			_stats.rejections[result]++;
+		return result;
+	}
+
+	static bool check_one_solution(uint32 solution, nonce &client_nonce, nonce &server_nonce, uint32 puzzle_difficulty, uint32 client_identity)
+	{
+		uint8 buffer[solution_buffer_size];
+		_write_solution_buffer(solution, client_nonce, server_nonce, client_identity, buffer);
+		
+		uint8 hash[sha256::digest_size];
+		sha256::hash(buffer, sizeof(buffer), hash);
+		return _meets_difficulty(hash, puzzle_difficulty);
+	}
+	
+	/// Checks count consecutive solutions starting at first_solution and returns the offset of the first valid one from first_solution, or count if none is valid.  Solutions differ only in the first word of the hashed buffer, and difficulties up to 32 bits only look at the first word of the digest, so those are checked with a sha256::first_word_hasher; harder ones are hashed whole with sha256::hash_batch.
+	static uint32 check_solutions(uint32 first_solution, uint32 count, nonce &client_nonce, nonce &server_nonce, uint32 puzzle_difficulty, uint32 client_identity)
+	{
+		if(puzzle_difficulty <= 32)
+		{
+			uint8 buffer[solution_buffer_size];
+			_write_solution_buffer(first_solution, client_nonce, server_nonce, client_identity, buffer);
+			sha256::first_word_hasher hasher(buffer, sizeof(buffer));
+			uint32 mask = puzzle_difficulty ? 0xFFFFFFFF << (32 - puzzle_difficulty) : 0;
+			for(uint32 start = 0; start < count; start += sha256::batch_lanes)
+			{
+				uint32 digest_words[sha256::batch_lanes];
+				hasher.leading_digest_words(first_solution + start, digest_words);
+				for(uint32 lane = 0; lane < sha256::batch_lanes && start + lane < count; lane++)
+					if(!(digest_words[lane] & mask))
+						return start + lane;
+			}
+			return count;
+		}
+		uint8 buffers[solution_batch_size][solution_buffer_size];
+		const uint8 *messages[solution_batch_size];
+		uint8 hashes[solution_batch_size][sha256::digest_size];
+		for(uint32 start = 0; start < count; start += solution_batch_size)
+		{
+			uint32 batch_count = count - start < uint32(solution_batch_size) ? count - start : uint32(solution_batch_size);
+			for(uint32 i = 0; i < batch_count; i++)
+			{
+				_write_solution_buffer(first_solution + start + i, client_nonce, server_nonce, client_identity, buffers[i]);
+				messages[i] = buffers[i];
+			}
+			sha256::hash_batch(messages, solution_buffer_size, hashes, batch_count);
+			for(uint32 i = 0; i < batch_count; i++)
+				if(_meets_difficulty(hashes[i], puzzle_difficulty))
+					return start + i;
+		}
+		return count;
+	}
+private:
+	result_code _check_solution(uint32 solution, nonce &client_nonce, nonce &server_nonce, uint32 puzzle_difficulty, uint32 client_identity)
+	{
+		if(puzzle_difficulty > max_puzzle_difficulty)
+			return invalid_puzzle_difficulty;
+		if(puzzle_difficulty < _current_difficulty && !(_last_tick_time < _grace_end_time && puzzle_difficulty >= _grace_difficulty))
 			return invalid_puzzle_difficulty;
 		nonce_table *the_table = NULL;
 		if(server_nonce == _current_nonce)
@@ -180,21 +409,83 @@ private:
 		return success;
 	}
 
-	static bool check_one_solution(uint32 solution, nonce &client_nonce, nonce &server_nonce, uint32 puzzle_difficulty, uint32 client_identity)
+	/// Measures the load over the interval since the last update and raises or lowers the difficulty.
+	void _update_difficulty(time current_time, uint32 pending_connections)
+	{
+		uint32 elapsed = uint32((current_time - _last_load_update_time).get_milliseconds());
+		_last_load_update_time = current_time;
+		uint32 shared_secret_rate = uint32(uint64(_interval_shared_secrets) * 1000 / elapsed);
+
+		// the load is the largest of the measures as a percent of its limit.
+		uint32 load = 0;
+		if(_max_pending_connections)
+			load = _max_load(load, uint64(pending_connections) * 100 / _max_pending_connections);
+		if(_max_shared_secret_rate)
+			load = _max_load(load, uint64(shared_secret_rate) * 100 / _max_shared_secret_rate);
+		if(_cpu_budget_percent)
+			load = _max_load(load, uint64(_interval_shared_secret_time) * 10000 / (uint64(elapsed) * _cpu_budget_percent));
+		_interval_shared_secrets = 0;
+		_interval_shared_secret_time = 0;
+
+		// half of each measurement goes into the smoothed load, so a burst moves it less than a flood that keeps up.
+		_stats.load_percent = (_stats.load_percent + load) / 2;
+		_stats.pending_connections = pending_connections;
+		_stats.shared_secrets_per_second = shared_secret_rate;
+
+		// the measurement must be over the limit too, so the difficulty stops rising as soon as a flood does.
+		if(load > raise_load_percent && _stats.load_percent > raise_load_percent)
+		{
+			_idle_intervals = 0;
+			if(_current_difficulty < max_puzzle_difficulty)
+			{
+				// a grace period still running from an earlier raise keeps the lower difficulty it accepts.
+				if(!(current_time < _grace_end_time))
+					_grace_difficulty = _current_difficulty;
+				_grace_end_time = current_time + time(difficulty_grace_time);
+				_current_difficulty++;
+				_stats.difficulty_raises++;
+				TorqueLogMessageFormatted(LogNettorque_socket, ("Client puzzle difficulty raised to %d at %d%% load.", _current_difficulty, _stats.load_percent));
+			}
+		}
+		else if(_stats.load_percent < lower_load_percent)
+		{
+			if(++_idle_intervals >= difficulty_lower_intervals && _current_difficulty > initial_puzzle_difficulty)
+			{
+				_idle_intervals = 0;
+				_current_difficulty--;
+				_stats.difficulty_drops++;
+				TorqueLogMessageFormatted(LogNettorque_socket, ("Client puzzle difficulty lowered to %d.", _current_difficulty));
+			}
+		}
+		else
+			_idle_intervals = 0;
+		_stats.current_difficulty = _current_difficulty;
+	}
+
+	static uint32 _max_load(uint32 load, uint64 measure)
+	{
+		if(measure > 0xFFFFFFFF)
+			measure = 0xFFFFFFFF;
+		return load > uint32(measure) ? load : uint32(measure);
+	}
+
+	stats _stats; ///< Difficulty and load stats.
+
+	enum {
+		solution_buffer_size = 24, ///< Bytes hashed to check a solution: the solution, client identity, client nonce and server nonce.
+	};
+	
+	static void _write_solution_buffer(uint32 solution, nonce &client_nonce, nonce &server_nonce, uint32 client_identity, uint8 buffer[solution_buffer_size])
 	{
-		uint8 buffer[24];
 		write_uint32_to_buffer(solution, buffer);
 		write_uint32_to_buffer(client_identity, buffer + 4);
 		write_uint64_to_buffer(client_nonce, buffer + 8);
 		write_uint64_to_buffer(server_nonce, buffer + 16);
-		
-		hash_state hash_state;
-		uint8 hash[32];
-		
-		sha256_init(&hash_state);
-		sha256_process(&hash_state, buffer, sizeof(buffer));
-		sha256_done(&hash_state, hash);
-		
+	}
+	
+	/// Returns true if the first puzzle_difficulty bits of hash are zero.
+	static bool _meets_difficulty(const uint8 hash[sha256::digest_size], uint32 puzzle_difficulty)
+	{
 		uint32 index = 0;
 		while(puzzle_difficulty > 8)
 		{
@@ -206,7 +497,7 @@ private:
 		uint8 mask = 0xFF << (8 - puzzle_difficulty);
 		return (mask & hash[index]) == 0;
 	}
-
+public:
 	/// Returns the current server nonce
 	nonce get_current_nonce() { return _current_nonce; }
 
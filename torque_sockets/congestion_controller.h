@@ -0,0 +1,315 @@
+// congestion_controller.h - Pluggable congestion control for torque_connection.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// Describes a data packet the remote host acknowledged, as reported to congestion_controller::on_packet_acked.
+struct congestion_ack_sample
+{
+	uint32 sequence; ///< Sequence number of the acknowledged packet.
+	uint32 packets_in_flight; ///< Packets sent after this one that haven't been acknowledged or reported lost yet.
+	uint32 delivered_count; ///< Packets the connection has had acknowledged, including this one.
+	uint32 prior_delivered_count; ///< delivered_count when this packet was sent.
+	float32 delivery_rate; ///< Packets per second acknowledged while this packet was in flight.
+	float32 round_trip_time; ///< Milliseconds between sending this packet and receiving its acknowledgement, or a negative value if this ack doesn't give a clean measurement.
+};
+
+/// congestion_controller decides how many data packets a torque_connection may have in flight and how fast it may send them, from the acknowledgements and losses the notify protocol reports.
+///
+/// A torque_connection without a controller is limited only by its packet window.  torque_socket gives each new connection the controller selected with set_congestion_control; applications can install their own subclass on a connection with torque_connection::set_congestion_controller.  All counts are in packets, and sequence numbers are the connection's send sequence numbers.
+class congestion_controller : public ref_object
+{
+public:
+	/// Returns a new controller of the given type, or NULL for congestion_control_none.
+	static congestion_controller *create(congestion_control_type type)
+	{
+		switch(type)
+		{
+			case congestion_control_aimd:
+				return new aimd_congestion_controller;
+			case congestion_control_bbr:
+				return new bbr_congestion_controller;
+			default:
+				return 0;
+		}
+	}
+
+	/// Called as each data packet is sent.  packets_in_flight includes the packet.
+	virtual void on_packet_sent(time, uint32, uint32) {}
+
+	/// Called for each data packet the remote host acknowledges, oldest first.
+	virtual void on_packet_acked(time ack_time, const congestion_ack_sample &sample) = 0;
+
+	/// Called for each data packet the remote host reports didn't arrive, oldest first.  packets_in_flight counts the packets sent after it that are still outstanding.
+	virtual void on_packet_lost(time loss_time, uint32 sequence, uint32 packets_in_flight) = 0;
+
+	/// Returns the number of data packets that may be in flight.
+	virtual uint32 get_congestion_window() = 0;
+
+	/// Returns the rate, in packets per second, at which data packets may be sent, or 0 if sends aren't paced.
+	virtual float32 get_pacing_rate() { return 0; }
+};
+
+/// aimd_congestion_controller is the classic loss-based controller: the window grows by a packet per acknowledged packet until the first loss (slow start), then by a packet per window of acknowledged packets, and halves on loss, at most once per window of packets in flight.
+class aimd_congestion_controller : public congestion_controller
+{
+public:
+	enum {
+		initial_congestion_window = 10,
+		min_congestion_window = 2,
+	};
+
+	aimd_congestion_controller()
+	{
+		_congestion_window = initial_congestion_window;
+		_slow_start_threshold = float32(torque_connection::max_packet_window_size);
+		_last_sent_sequence = 0;
+		_recovery_sequence = 0;
+		_in_recovery = false;
+	}
+
+	void on_packet_sent(time, uint32 sequence, uint32)
+	{
+		_last_sent_sequence = sequence;
+	}
+
+	void on_packet_acked(time, const congestion_ack_sample &sample)
+	{
+		if(_in_recovery && int32(sample.sequence - _recovery_sequence) > 0)
+			_in_recovery = false;
+		if(_congestion_window < _slow_start_threshold)
+			_congestion_window += 1;
+		else
+			_congestion_window += 1 / _congestion_window;
+		if(_congestion_window > torque_connection::max_packet_window_size)
+			_congestion_window = float32(torque_connection::max_packet_window_size);
+	}
+
+	void on_packet_lost(time, uint32 sequence, uint32)
+	{
+		// packets sent before the last cut were sent at the old rate; losing them says nothing new.
+		if(_in_recovery && int32(sequence - _recovery_sequence) <= 0)
+			return;
+		_slow_start_threshold = _congestion_window / 2;
+		if(_slow_start_threshold < min_congestion_window)
+			_slow_start_threshold = min_congestion_window;
+		_congestion_window = _slow_start_threshold;
+		_recovery_sequence = _last_sent_sequence;
+		_in_recovery = true;
+	}
+
+	uint32 get_congestion_window()
+	{
+		return uint32(_congestion_window);
+	}
+private:
+	float32 _congestion_window; ///< Packets that may be in flight; fractional so congestion avoidance can grow it a packet per window.
+	float32 _slow_start_threshold; ///< Window below which the window grows a packet per ack rather than per window.
+	uint32 _last_sent_sequence; ///< Sequence of the most recently sent data packet.
+	uint32 _recovery_sequence; ///< Last packet sent before the most recent cut; losses up to it don't cut again.
+	bool _in_recovery; ///< True until a packet sent after the most recent cut is acknowledged.
+};
+
+/// bbr_congestion_controller is a delay-based controller modeled on BBR: rather than waiting for loss, it measures the path's bottleneck bandwidth (the highest recent delivery rate) and minimum round trip time, paces sends at the bottleneck bandwidth and keeps about two bandwidth-delay products in flight, so queues along the path stay short while delayed and stretched acks don't starve the pipe.
+///
+/// It starts by doubling its rate every round trip until the delivery rate stops growing, drains the queue that built up doing so, then cycles its pacing gain a little above and below 1 to probe for more bandwidth.  If the minimum round trip time hasn't been seen again for min_rtt_lifetime, it briefly cuts the window to probe_rtt_window to let the queues empty and measure it afresh.
+class bbr_congestion_controller : public congestion_controller
+{
+public:
+	enum {
+		initial_congestion_window = 10,
+		min_congestion_window = 4,
+		bandwidth_filter_rounds = 10, ///< Round trips the bottleneck bandwidth estimate remembers its maximum for.
+		full_bandwidth_rounds = 3, ///< Round trips without 25% growth that end startup.
+		gain_cycle_length = 8,
+		min_rtt_lifetime = 10000, ///< Milliseconds a minimum round trip time measurement stays valid.
+		probe_rtt_duration = 200, ///< Milliseconds spent with a minimal window measuring the round trip time.
+		probe_rtt_window = 4,
+	};
+	enum bbr_state
+	{
+		startup,
+		drain,
+		probe_bandwidth,
+		probe_rtt,
+	};
+
+	bbr_congestion_controller()
+	{
+		_state = startup;
+		_pacing_gain = startup_gain();
+		_window_gain = startup_gain();
+		for(uint32 i = 0; i < bandwidth_filter_rounds; i++)
+			_bandwidth_samples[i] = 0;
+		_bottleneck_bandwidth = 0;
+		_min_rtt = -1;
+		_min_rtt_stamp = time(0);
+		_round_count = 0;
+		_next_round_delivered = 0;
+		_full_bandwidth = 0;
+		_full_bandwidth_count = 0;
+		_cycle_index = 0;
+		_cycle_stamp = time(0);
+		_probe_rtt_done_stamp = time(0);
+		_packets_in_flight = 0;
+	}
+
+	void on_packet_sent(time, uint32, uint32 packets_in_flight)
+	{
+		_packets_in_flight = packets_in_flight;
+	}
+
+	void on_packet_acked(time ack_time, const congestion_ack_sample &sample)
+	{
+		_packets_in_flight = sample.packets_in_flight;
+		bool round_start = false;
+		if(sample.prior_delivered_count >= _next_round_delivered)
+		{
+			_next_round_delivered = sample.delivered_count;
+			_round_count++;
+			_bandwidth_samples[_round_count % bandwidth_filter_rounds] = 0;
+			round_start = true;
+		}
+		float32 &round_sample = _bandwidth_samples[_round_count % bandwidth_filter_rounds];
+		if(sample.delivery_rate > round_sample)
+			round_sample = sample.delivery_rate;
+		_bottleneck_bandwidth = 0;
+		for(uint32 i = 0; i < bandwidth_filter_rounds; i++)
+			if(_bandwidth_samples[i] > _bottleneck_bandwidth)
+				_bottleneck_bandwidth = _bandwidth_samples[i];
+
+		bool min_rtt_expired = _min_rtt >= 0 && (ack_time - _min_rtt_stamp).get_milliseconds() > min_rtt_lifetime;
+		if(sample.round_trip_time >= 0 && (_min_rtt < 0 || sample.round_trip_time <= _min_rtt || min_rtt_expired))
+		{
+			_min_rtt = sample.round_trip_time;
+			_min_rtt_stamp = ack_time;
+		}
+
+		switch(_state)
+		{
+			case startup:
+				if(round_start && _bottleneck_bandwidth > 0)
+				{
+					if(_bottleneck_bandwidth >= _full_bandwidth * 1.25f)
+					{
+						_full_bandwidth = _bottleneck_bandwidth;
+						_full_bandwidth_count = 0;
+					}
+					else if(++_full_bandwidth_count >= full_bandwidth_rounds)
+					{
+						_state = drain;
+						_pacing_gain = 1 / startup_gain();
+					}
+				}
+				break;
+			case drain:
+				if(_packets_in_flight <= _get_bandwidth_delay_product())
+					_enter_probe_bandwidth(ack_time);
+				break;
+			case probe_bandwidth:
+				if((ack_time - _cycle_stamp).get_milliseconds() > _get_min_rtt())
+				{
+					_cycle_index = (_cycle_index + 1) % gain_cycle_length;
+					_cycle_stamp = ack_time;
+					_pacing_gain = gain_cycle(_cycle_index);
+				}
+				break;
+			case probe_rtt:
+				if(ack_time >= _probe_rtt_done_stamp)
+				{
+					_min_rtt_stamp = ack_time;
+					if(_full_bandwidth_count >= full_bandwidth_rounds)
+						_enter_probe_bandwidth(ack_time);
+					else
+					{
+						_state = startup;
+						_pacing_gain = _window_gain = startup_gain();
+					}
+				}
+				break;
+		}
+		if(min_rtt_expired && _state != probe_rtt)
+		{
+			_state = probe_rtt;
+			_pacing_gain = 1;
+			_probe_rtt_done_stamp = ack_time + time(probe_rtt_duration);
+		}
+	}
+
+	void on_packet_lost(time, uint32, uint32 packets_in_flight)
+	{
+		// the model is driven by delivery rate and delay; a lost packet just isn't in flight any more.
+		_packets_in_flight = packets_in_flight;
+	}
+
+	uint32 get_congestion_window()
+	{
+		if(_state == probe_rtt)
+			return probe_rtt_window;
+		if(_bottleneck_bandwidth <= 0 || _min_rtt < 0)
+			return initial_congestion_window;
+		uint32 window = uint32(_window_gain * _get_bandwidth_delay_product()) + 1;
+		return window < uint32(min_congestion_window) ? uint32(min_congestion_window) : window;
+	}
+
+	float32 get_pacing_rate()
+	{
+		return _pacing_gain * _bottleneck_bandwidth;
+	}
+
+	/// Returns the bottleneck bandwidth estimate, in packets per second.
+	float32 get_bottleneck_bandwidth()
+	{
+		return _bottleneck_bandwidth;
+	}
+
+	bbr_state get_state()
+	{
+		return _state;
+	}
+private:
+	static float32 startup_gain()
+	{
+		return 2.885f; // 2 / ln(2): doubles the delivery rate each round trip.
+	}
+
+	static float32 gain_cycle(uint32 index)
+	{
+		return index == 0 ? 1.25f : index == 1 ? 0.75f : 1.0f;
+	}
+
+	/// Returns the minimum round trip time in milliseconds, at least 1 so a sub-millisecond path still gets a usable window.
+	float32 _get_min_rtt()
+	{
+		return _min_rtt < 1 ? 1 : _min_rtt;
+	}
+
+	/// Returns the number of packets that fill the path: bottleneck bandwidth times minimum round trip time.
+	float32 _get_bandwidth_delay_product()
+	{
+		return _bottleneck_bandwidth * _get_min_rtt() / 1000;
+	}
+
+	void _enter_probe_bandwidth(time now)
+	{
+		_state = probe_bandwidth;
+		_window_gain = 2;
+		_cycle_index = 0;
+		_cycle_stamp = now;
+		_pacing_gain = gain_cycle(0);
+	}
+
+	bbr_state _state;
+	float32 _pacing_gain; ///< Multiple of the bottleneck bandwidth to pace at.
+	float32 _window_gain; ///< Multiple of the bandwidth-delay product to allow in flight.
+	float32 _bandwidth_samples[bandwidth_filter_rounds]; ///< Highest delivery rate seen in each of the last few round trips.
+	float32 _bottleneck_bandwidth; ///< Highest of _bandwidth_samples, in packets per second.
+	float32 _min_rtt; ///< Lowest round trip time seen within min_rtt_lifetime, in milliseconds, or negative before the first.
+	time _min_rtt_stamp; ///< When _min_rtt was measured.
+	uint32 _round_count; ///< Round trips completed.
+	uint32 _next_round_delivered; ///< Delivered count that, once a packet sent after it is acked, ends the current round trip.
+	float32 _full_bandwidth; ///< Bandwidth at the last 25% growth during startup.
+	uint32 _full_bandwidth_count; ///< Round trips since the last 25% growth.
+	uint32 _cycle_index; ///< Position in the probe_bandwidth gain cycle.
+	time _cycle_stamp; ///< When the current gain cycle phase started.
+	time _probe_rtt_done_stamp; ///< When probe_rtt ends.
+	uint32 _packets_in_flight; ///< Packets in flight as of the last callback.
+};
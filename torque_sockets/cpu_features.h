@@ -0,0 +1,93 @@
+// cpu_features.h - Detection of the x86 instruction set extensions the hardware crypto backends use.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// cpu_features asks cpuid, the first time it is called, which of the instruction set extensions used by aes_hardware and sha256 the processor has.  Each answer also covers the SSE extensions its code uses alongside.  All answers are false on processors and compilers without CPU_X86_INTRINSICS.
+class cpu_features
+{
+public:
+	/// Returns true if the processor has AES-NI, PCLMULQDQ, SSSE3 and SSE4.1.
+	static bool has_aes_ni()
+	{
+		return (_get() & feature_aes_ni) != 0;
+	}
+
+	/// Returns true if the processor has the SHA extensions, SSSE3 and SSE4.1.
+	static bool has_sha_ni()
+	{
+		return (_get() & feature_sha_ni) != 0;
+	}
+
+	/// Returns true if the processor has AVX2 and the operating system saves the 256 bit registers.
+	static bool has_avx2()
+	{
+		return (_get() & feature_avx2) != 0;
+	}
+private:
+	enum {
+		feature_aes_ni = 1 << 0,
+		feature_sha_ni = 1 << 1,
+		feature_avx2 = 1 << 2,
+	};
+
+	static uint32 _get()
+	{
+		static uint32 features = _detect();
+		return features;
+	}
+
+	static uint32 _detect()
+	{
+		uint32 features = 0;
+#ifdef CPU_X86_INTRINSICS
+		uint32 leaf_1[4], leaf_7[4];
+		if(!_cpuid(1, leaf_1))
+			return 0;
+		if(!_cpuid(7, leaf_7))
+			memset(leaf_7, 0, sizeof(leaf_7));
+		
+		// leaf 1 ecx: SSSE3 bit 9, SSE4.1 bit 19, PCLMULQDQ bit 1, AES-NI bit 25, OSXSAVE bit 27.  leaf 7 ebx: AVX2 bit 5, SHA bit 29.
+		const uint32 sse = (1 << 9) | (1 << 19);
+		bool has_sse = (leaf_1[2] & sse) == sse;
+		if(has_sse && (leaf_1[2] & ((1 << 1) | (1 << 25))) == ((1 << 1) | (1 << 25)))
+			features |= feature_aes_ni;
+		if(has_sse && (leaf_7[1] & (1 << 29)))
+			features |= feature_sha_ni;
+		// AVX2 is only usable if the operating system saves the SSE and AVX register state, bits 1 and 2 of XCR0.
+		if((leaf_7[1] & (1 << 5)) && (leaf_1[2] & (1 << 27)) && (_read_xcr0() & 6) == 6)
+			features |= feature_avx2;
+#endif
+		return features;
+	}
+
+#ifdef CPU_X86_INTRINSICS
+	/// Runs cpuid for a leaf, with subleaf 0, into eax, ebx, ecx and edx.  Returns false if the processor doesn't have the leaf.
+	static bool _cpuid(uint32 leaf, uint32 registers[4])
+	{
+#if defined(COMPILER_GCC)
+		if(__get_cpuid_max(0, 0) < leaf)
+			return false;
+		__cpuid_count(leaf, 0, registers[0], registers[1], registers[2], registers[3]);
+#else
+		int info[4];
+		__cpuid(info, 0);
+		if(uint32(info[0]) < leaf)
+			return false;
+		__cpuidex(info, leaf, 0);
+		for(uint32 i = 0; i < 4; i++)
+			registers[i] = uint32(info[i]);
+#endif
+		return true;
+	}
+
+	static uint64 _read_xcr0()
+	{
+#if defined(COMPILER_GCC)
+		uint32 low, high;
+		__asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return (uint64(high) << 32) | low;
+#else
+		return _xgetbv(0);
+#endif
+	}
+#endif
+};
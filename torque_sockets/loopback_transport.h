@@ -0,0 +1,388 @@
+// loopback_transport.h - In-process packet_transport for tests, benchmarks and load generation.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+class loopback_transport;
+
+/// loopback_network is a datagram network that exists only inside this process.  loopback_transport endpoints bind to ports on it and exchange datagrams by copying them straight into each other's receive queues.
+///
+/// Endpoints are identified by port alone: any host part of a bind or destination address is kept for display but otherwise ignored.  The network must outlive every endpoint bound to it.
+class loopback_network
+{
+public:
+	enum {
+		port_count = 65536,
+		first_ephemeral_port = 49152, ///< Endpoints bound to port 0 are given a free port from here up.
+		port_lock_count = 256, ///< Number of locks the ports are spread across.
+	};
+
+	loopback_network()
+	{
+		_endpoints = (loopback_transport **) memory_allocate(sizeof(loopback_transport *) * port_count);
+		memset(_endpoints, 0, sizeof(loopback_transport *) * port_count);
+		_next_ephemeral_port = first_ephemeral_port;
+	}
+
+	~loopback_network()
+	{
+		memory_deallocate(_endpoints);
+	}
+private:
+	friend class loopback_transport;
+
+	/// Returns the lock guarding a port's entry in _endpoints.
+	mutex &_get_port_lock(uint32 port)
+	{
+		return _port_locks[port % port_lock_count];
+	}
+
+	mutex _lock; ///< Serializes binds and unbinds, and guards _next_ephemeral_port.
+	mutex _port_locks[port_lock_count]; ///< Each guards the _endpoints entries of the ports it is picked for by _get_port_lock; a sender holds it while handing a datagram to the port's endpoint, so the endpoint can't unbind mid-delivery.
+	loopback_transport **_endpoints; ///< Bound endpoint for each port, or NULL.  Written with both _lock and the port's lock held, so holding either is enough to read it.
+	uint32 _next_ephemeral_port; ///< Where the search for a free ephemeral port starts.
+};
+
+/// loopback_transport is a packet_transport endpoint on a loopback_network.  A torque_socket given one with set_transport runs its whole protocol, crypto included, without a single system call per packet, so thousands of endpoints can talk inside one process and benchmarks measure the protocol rather than the kernel's loopback path.
+///
+/// Sends never block: a datagram sent to a port nobody is bound to, or to an endpoint whose receive queue already holds queue_byte_limit bytes, is silently dropped, as UDP would.  Senders to different endpoints only share a lock when their ports hash to the same one of the network's port locks.  On POSIX platforms get_descriptor returns a wake_signal descriptor that is readable while the receive queue is non-empty, so endpoints can be driven by socket_reactor; it is only created once get_descriptor is called or a receive blocks, so endpoints that are polled cost no system calls per datagram.
+class loopback_transport : public packet_transport
+{
+public:
+	enum {
+		queue_byte_limit = 262144, ///< Largest number of payload bytes an endpoint queues before dropping datagrams sent to it.
+	};
+
+	loopback_transport(loopback_network *network)
+	{
+		_network = network;
+		_bound = false;
+		_non_blocking = true;
+		_queue_head = 0;
+		_queue_tail = 0;
+		_queued_bytes = 0;
+		_dropped_count = 0;
+		_wake_raised = false;
+		_packet_loss = 0;
+		_reorder_rate = 0;
+		_duplicate_rate = 0;
+		_held_packet = 0;
+		_random_state = uint32(uintptr_t(this) >> 4) | 1;
+	}
+
+	~loopback_transport()
+	{
+		unbind();
+	}
+
+	virtual bind_result bind(const address bind_address, bool non_blocking_io = true, time recv_timeout = 0, bool = true, uint32 = default_send_buffer_size, uint32 = default_recv_buffer_size)
+	{
+		if(_bound)
+			return generic_failure;
+
+		_network->_lock.lock();
+		uint32 port = bind_address.get_port();
+		if(!port)
+		{
+			for(uint32 i = 0; i < loopback_network::port_count - loopback_network::first_ephemeral_port && !port; i++)
+			{
+				uint32 candidate = _network->_next_ephemeral_port;
+				if(++_network->_next_ephemeral_port == loopback_network::port_count)
+					_network->_next_ephemeral_port = loopback_network::first_ephemeral_port;
+				if(!_network->_endpoints[candidate])
+					port = candidate;
+			}
+		}
+		if(!port || _network->_endpoints[port])
+		{
+			_network->_lock.unlock();
+			return port ? address_in_use : socket_allocation_failure;
+		}
+		_bound_address = bind_address;
+		_bound_address.set_port(uint16(port));
+		_non_blocking = non_blocking_io;
+		_recv_timeout = recv_timeout;
+		_bound = true;
+
+		mutex &port_lock = _network->_get_port_lock(port);
+		port_lock.lock();
+		_network->_endpoints[port] = this;
+		port_lock.unlock();
+		_network->_lock.unlock();
+		return bind_success;
+	}
+
+	virtual void unbind()
+	{
+		if(!_bound)
+			return;
+		uint32 port = _bound_address.get_port();
+		mutex &port_lock = _network->_get_port_lock(port);
+		_network->_lock.lock();
+		port_lock.lock();
+		_network->_endpoints[port] = 0;
+		port_lock.unlock();
+		_network->_lock.unlock();
+		_bound = false;
+
+		_queue_lock.lock();
+		while(_queue_head)
+		{
+			queued_packet *next = _queue_head->next;
+			memory_deallocate(_queue_head);
+			_queue_head = next;
+		}
+		memory_deallocate(_held_packet);
+		_held_packet = 0;
+		_queue_tail = 0;
+		_queued_bytes = 0;
+		_wake.close();
+		_wake_raised = false;
+		_queue_lock.unlock();
+	}
+
+	virtual bool is_bound()
+	{
+		return _bound;
+	}
+
+	virtual address get_bound_address()
+	{
+		return _bound_address;
+	}
+
+	virtual SOCKET get_descriptor()
+	{
+		if(!_bound)
+			return INVALID_SOCKET;
+		_queue_lock.lock();
+		_open_wake();
+		SOCKET descriptor = _wake.get_descriptor();
+		_queue_lock.unlock();
+		return descriptor;
+	}
+
+	virtual bool wait_for_readable(time timeout)
+	{
+		_queue_lock.lock();
+		bool ready = _queue_head != 0;
+		bool can_wait = !ready && _bound && timeout != time(0) && _open_wake();
+		_queue_lock.unlock();
+		if(!can_wait)
+			return ready;
+		_wake.wait(timeout);
+		_queue_lock.lock();
+		ready = _queue_head != 0;
+		_queue_lock.unlock();
+		return ready;
+	}
+
+	virtual send_to_result send_to(const address &the_address, const byte *buffer, uint32 buffer_size)
+	{
+		if(!_bound || buffer_size > max_datagram_size)
+			return send_to_failure;
+		_deliver(the_address, buffer, buffer_size);
+		return send_to_success;
+	}
+
+	virtual uint32 send_to_batch(const datagram *datagrams, uint32 datagram_count)
+	{
+		if(!_bound)
+			return 0;
+		uint32 sent_count = 0;
+		for(uint32 i = 0; i < datagram_count; i++)
+		{
+			if(datagrams[i].packet_size > max_datagram_size)
+				continue;
+			_deliver(datagrams[i].remote_address, datagrams[i].buffer, datagrams[i].packet_size);
+			sent_count++;
+		}
+		return sent_count;
+	}
+
+	virtual recv_from_result recv_from(address *sender_address, byte *buffer, uint32 buffer_size, uint32 *incoming_packet_size)
+	{
+		datagram the_datagram;
+		the_datagram.buffer = buffer;
+		the_datagram.buffer_size = buffer_size;
+		uint32 received_count;
+		recv_from_result result = recv_from_batch(&the_datagram, 1, &received_count);
+		if(result == packet_received)
+		{
+			*incoming_packet_size = the_datagram.packet_size;
+			if(sender_address)
+				*sender_address = the_datagram.remote_address;
+		}
+		return result;
+	}
+
+	virtual recv_from_result recv_from_batch(datagram *datagrams, uint32 datagram_count, uint32 *received_count)
+	{
+		*received_count = 0;
+		if(!_bound)
+			return invalid_socket;
+		if(!_non_blocking && !wait_for_readable(_recv_timeout == time(0) ? time(0x7FFFFFFF) : _recv_timeout))
+			return would_block_or_timeout;
+
+		_queue_lock.lock();
+		while(*received_count < datagram_count && _queue_head)
+		{
+			queued_packet *the_packet = _queue_head;
+			_queue_head = the_packet->next;
+			if(!_queue_head)
+				_queue_tail = 0;
+			_queued_bytes -= the_packet->size;
+
+			datagram &the_datagram = datagrams[(*received_count)++];
+			uint32 size = the_packet->size > the_datagram.buffer_size ? the_datagram.buffer_size : the_packet->size;
+			memcpy(the_datagram.buffer, the_packet->data, size);
+			the_datagram.packet_size = size;
+			the_datagram.remote_address = the_packet->source_address;
+			memory_deallocate(the_packet);
+		}
+		if(!_queue_head && _wake_raised)
+		{
+			_wake.clear();
+			_wake_raised = false;
+		}
+		_queue_lock.unlock();
+		return *received_count ? packet_received : would_block_or_timeout;
+	}
+
+	/// Returns the number of datagrams dropped because this endpoint's receive queue was full.
+	uint32 get_dropped_count()
+	{
+		return _dropped_count;
+	}
+
+	/// Simulates a lossy, reordering path to this endpoint: packet_loss is the fraction of datagrams sent to it that are dropped, reorder_rate the fraction of the rest that are held back and queued behind the next one to arrive, and duplicate_rate the fraction queued twice.  The choices come from a generator seeded with seed, so a test run can be repeated.
+	void set_receive_conditions(float32 packet_loss, float32 reorder_rate, float32 duplicate_rate = 0, uint32 seed = 1)
+	{
+		_queue_lock.lock();
+		_packet_loss = packet_loss;
+		_reorder_rate = reorder_rate;
+		_duplicate_rate = duplicate_rate;
+		_random_state = seed | 1;
+		_queue_lock.unlock();
+	}
+private:
+	/// A datagram waiting in an endpoint's receive queue.
+	struct queued_packet
+	{
+		queued_packet *next;
+		address source_address;
+		uint32 size;
+		uint8 data[1];
+	};
+
+	/// Opens the wake signal if it isn't open yet, raising it if datagrams are already waiting.  Called with the queue lock held.  Returns false if it could not be opened.
+	bool _open_wake()
+	{
+		if(_wake.is_open())
+			return true;
+		if(!_wake.open())
+			return false;
+		if(_queue_head)
+		{
+			_wake.raise();
+			_wake_raised = true;
+		}
+		return true;
+	}
+
+	/// Hands a copy of a datagram to the endpoint bound to the_address's port, if there is one.
+	void _deliver(const address &the_address, const byte *buffer, uint32 size)
+	{
+		uint32 port = the_address.get_port();
+		mutex &port_lock = _network->_get_port_lock(port);
+		port_lock.lock();
+		loopback_transport *destination = _network->_endpoints[port];
+		if(destination)
+			destination->_enqueue(_bound_address, buffer, size);
+		port_lock.unlock();
+	}
+
+	/// Returns a pseudo-random number in [0, 1) for the simulated receive conditions.  Called with the queue lock held.
+	float32 _random_unit()
+	{
+		_random_state ^= _random_state << 13;
+		_random_state ^= _random_state >> 17;
+		_random_state ^= _random_state << 5;
+		return float32(_random_state >> 8) / float32(1 << 24);
+	}
+
+	/// Appends a copy of a datagram to the receive queue, unless the simulated receive conditions drop, duplicate or hold it back.  Called by the sender with the destination port's lock held.
+	void _enqueue(const address &source_address, const byte *buffer, uint32 size)
+	{
+		_queue_lock.lock();
+		if(_queued_bytes + size > queue_byte_limit)
+		{
+			_dropped_count++;
+			_queue_lock.unlock();
+			return;
+		}
+		if(_packet_loss && _random_unit() < _packet_loss)
+		{
+			_queue_lock.unlock();
+			return;
+		}
+		queued_packet *the_packet = (queued_packet *) memory_allocate(sizeof(queued_packet) + size);
+		the_packet->next = 0;
+		the_packet->source_address = source_address;
+		the_packet->size = size;
+		memcpy(the_packet->data, buffer, size);
+		if(!_held_packet && _reorder_rate && _random_unit() < _reorder_rate)
+			_held_packet = the_packet;
+		else
+		{
+			_append(the_packet);
+			if(_duplicate_rate && _random_unit() < _duplicate_rate)
+			{
+				queued_packet *duplicate = (queued_packet *) memory_allocate(sizeof(queued_packet) + size);
+				memcpy(duplicate, the_packet, sizeof(queued_packet) + size);
+				duplicate->next = 0;
+				_append(duplicate);
+			}
+			if(_held_packet)
+			{
+				_append(_held_packet);
+				_held_packet = 0;
+			}
+		}
+		_queue_lock.unlock();
+	}
+
+	/// Links a datagram onto the end of the receive queue.  Called with the queue lock held.
+	void _append(queued_packet *the_packet)
+	{
+		if(_queue_tail)
+			_queue_tail->next = the_packet;
+		else
+		{
+			_queue_head = the_packet;
+			if(_wake.is_open())
+			{
+				_wake.raise();
+				_wake_raised = true;
+			}
+		}
+		_queue_tail = the_packet;
+		_queued_bytes += the_packet->size;
+	}
+
+	loopback_network *_network; ///< Network this endpoint binds to.
+	address _bound_address; ///< Address this endpoint is bound to; the port is its identity on the network.
+	bool _bound; ///< True while bound.
+	bool _non_blocking; ///< True if receives return immediately when the queue is empty.
+	time _recv_timeout; ///< How long a blocking receive waits; 0 waits forever.
+	mutex _queue_lock; ///< Guards the receive queue, which senders on any thread append to.
+	queued_packet *_queue_head; ///< Oldest datagram in the receive queue.
+	queued_packet *_queue_tail; ///< Newest datagram in the receive queue.
+	uint32 _queued_bytes; ///< Payload bytes in the receive queue.
+	uint32 _dropped_count; ///< Datagrams dropped because the receive queue was full.
+	wake_signal _wake; ///< Raised while the receive queue is non-empty; opened only once something waits on it.
+	bool _wake_raised; ///< True while _wake is raised.
+	float32 _packet_loss; ///< Fraction of datagrams sent to this endpoint that are dropped.
+	float32 _reorder_rate; ///< Fraction of datagrams sent to this endpoint that are queued behind the next one.
+	float32 _duplicate_rate; ///< Fraction of datagrams sent to this endpoint that are queued twice.
+	queued_packet *_held_packet; ///< Datagram held back to be queued behind the next one, or NULL.
+	uint32 _random_state; ///< State of the generator behind the simulated receive conditions.
+};
@@ -0,0 +1,303 @@
+// message_stream.h - Reliable ordered message streams carried by torque_connection data packets.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// A message on a message_stream.  Messages are allocated with their data inline, and are linked into the lists of the stream that owns them and of the data packet that last carried them.  A message too large for one packet is sent as fragment_count fragments with consecutive sequence numbers, each of which is a stream_message of its own; once reassembled the receiver holds it as one stream_message spanning all those sequence numbers.
+struct stream_message
+{
+	stream_message *next; ///< Next message in the stream's unsent or received list.
+	stream_message *next_in_packet; ///< Next message carried by the same data packet.
+	stream_message *prev_outstanding; ///< Previous message in the stream's outstanding list.
+	stream_message *next_outstanding; ///< Next message in the stream's outstanding list.
+	uint32 stream_index; ///< Index of the stream this message belongs to on its connection.
+	uint32 sequence; ///< Position of this message in its stream.
+	uint32 fragment_index; ///< Position of this fragment in its message, or 0 if the message isn't fragmented.
+	uint32 fragment_count; ///< Number of fragments, and so of sequence numbers, in the message; 1 if it isn't fragmented.
+	uint32 size; ///< Bytes of message data.
+	uint8 data[1];
+
+	/// Allocates a message of size bytes, copying data into it if data isn't NULL.
+	static stream_message *create(uint32 stream_index, uint32 sequence, const uint8 *data, uint32 size)
+	{
+		stream_message *the_message = (stream_message *) memory_allocate(sizeof(stream_message) + size);
+		the_message->next = 0;
+		the_message->next_in_packet = 0;
+		the_message->prev_outstanding = 0;
+		the_message->next_outstanding = 0;
+		the_message->stream_index = stream_index;
+		the_message->sequence = sequence;
+		the_message->fragment_index = 0;
+		the_message->fragment_count = 1;
+		the_message->size = size;
+		if(data)
+			memcpy(the_message->data, data, size);
+		return the_message;
+	}
+
+	static void destroy(stream_message *the_message)
+	{
+		memory_deallocate(the_message);
+	}
+};
+
+/// message_stream is one reliable, ordered stream of messages on a torque_connection.  It doesn't retransmit on timers of its own: each message rides in a data packet, and when the notify protocol reports that packet dropped the message goes back to the front of the unsent list to ride in the next one.  A lost packet only holds up the streams whose messages it carried.
+///
+/// On the sending side a message stays outstanding from the time it's queued until a packet carrying it is acknowledged.  On the receiving side messages that arrive ahead of a gap are held until the gap is filled, then handed out in order.  Fragments of a large message are copied straight into a buffer for the whole message as they arrive, and a bitmap records which have; the message joins the held list once all of them are in.  Sequence numbers go on the wire truncated to sequence_bit_size bits, so a message isn't sent until it's within sequence_window_size of the oldest outstanding one; the receiver is never further behind than that.
+class message_stream
+{
+public:
+	enum {
+		sequence_bit_size = 16, ///< Bits of each message's sequence number sent on the wire.
+		sequence_window_size = 1 << (sequence_bit_size - 1), ///< Largest span of sequence numbers between the oldest outstanding message and any message sent.
+	};
+
+	message_stream()
+	{
+		_outstanding_head = _outstanding_tail = 0;
+		_unsent_head = _unsent_tail = 0;
+		_received_head = 0;
+		_reassembly_head = 0;
+		_next_send_sequence = 0;
+		_next_receive_sequence = 0;
+		_outstanding_bytes = 0;
+		_received_bytes = 0;
+	}
+
+	~message_stream()
+	{
+		while(_outstanding_head)
+		{
+			stream_message *next = _outstanding_head->next_outstanding;
+			stream_message::destroy(_outstanding_head);
+			_outstanding_head = next;
+		}
+		while(_received_head)
+		{
+			stream_message *next = _received_head->next;
+			stream_message::destroy(_received_head);
+			_received_head = next;
+		}
+		while(_reassembly_head)
+		{
+			message_reassembly *next = _reassembly_head->next;
+			stream_message::destroy(_reassembly_head->message);
+			memory_deallocate(_reassembly_head);
+			_reassembly_head = next;
+		}
+	}
+
+	/// Adds a copy of data as the next message on the stream, split into fragments of at most fragment_size bytes if it's larger than that.
+	void queue_message(uint32 stream_index, const uint8 *data, uint32 size, uint32 fragment_size)
+	{
+		uint32 fragment_count = size <= fragment_size ? 1 : (size + fragment_size - 1) / fragment_size;
+		for(uint32 i = 0; i < fragment_count; i++)
+		{
+			uint32 offset = i * fragment_size;
+			uint32 fragment_bytes = i == fragment_count - 1 ? size - offset : fragment_size;
+			stream_message *the_message = stream_message::create(stream_index, _next_send_sequence++, data + offset, fragment_bytes);
+			the_message->fragment_index = i;
+			the_message->fragment_count = fragment_count;
+			the_message->prev_outstanding = _outstanding_tail;
+			if(_outstanding_tail)
+				_outstanding_tail->next_outstanding = the_message;
+			else
+				_outstanding_head = the_message;
+			_outstanding_tail = the_message;
+			_outstanding_bytes += fragment_bytes;
+			_append_unsent(the_message);
+		}
+	}
+
+	/// Returns the oldest message waiting to be sent, or NULL if there is none or it is too far ahead of the oldest outstanding message.
+	stream_message *get_next_unsent()
+	{
+		if(!_unsent_head || _unsent_head->sequence - _outstanding_head->sequence >= uint32(sequence_window_size))
+			return 0;
+		return _unsent_head;
+	}
+
+	/// Removes the message returned by get_next_unsent from the unsent list, as it has been written into a packet.
+	void mark_sent(stream_message *the_message)
+	{
+		assert(the_message == _unsent_head);
+		_unsent_head = the_message->next;
+		if(!_unsent_head)
+			_unsent_tail = 0;
+		the_message->next = 0;
+	}
+
+	/// Frees a sent message once the packet carrying it has been acknowledged.
+	void on_delivered(stream_message *the_message)
+	{
+		if(the_message->prev_outstanding)
+			the_message->prev_outstanding->next_outstanding = the_message->next_outstanding;
+		else
+			_outstanding_head = the_message->next_outstanding;
+		if(the_message->next_outstanding)
+			the_message->next_outstanding->prev_outstanding = the_message->prev_outstanding;
+		else
+			_outstanding_tail = the_message->prev_outstanding;
+		_outstanding_bytes -= the_message->size;
+		stream_message::destroy(the_message);
+	}
+
+	/// Puts a sent message back in the unsent list, in sequence order, once the packet carrying it has been reported dropped.
+	void on_dropped(stream_message *the_message)
+	{
+		the_message->next_in_packet = 0;
+		// retransmissions are almost always older than everything still unsent, so this rarely walks far.
+		stream_message **walk = &_unsent_head;
+		while(*walk && int32((*walk)->sequence - the_message->sequence) < 0)
+			walk = &(*walk)->next;
+		the_message->next = *walk;
+		*walk = the_message;
+		if(!the_message->next)
+			_unsent_tail = the_message;
+	}
+
+	/// Returns the number of bytes of message data queued and not yet acknowledged.
+	uint32 get_outstanding_bytes()
+	{
+		return _outstanding_bytes;
+	}
+
+	/// Returns the sequence number the next message queued will be given.
+	uint32 get_next_send_sequence()
+	{
+		return _next_send_sequence;
+	}
+
+	/// Accepts a message or fragment received from the remote host, given the low sequence_bit_size bits of its sequence number.  Every fragment but the last of a message must be fragment_size bytes.  Messages and fragments already handed out or already held are ignored.  Returns false if the fragment doesn't fit the message it belongs to, which only a broken or hostile remote host would send, or if it would take the bytes held past byte_limit.
+	bool receive_message(uint32 stream_index, uint32 wire_sequence, const uint8 *data, uint32 size, uint32 fragment_index, uint32 fragment_count, uint32 fragment_size, time receive_time, uint32 byte_limit)
+	{
+		uint32 sequence = _next_receive_sequence + uint32(int32(int16(uint16(wire_sequence - _next_receive_sequence))));
+		uint32 first_sequence = sequence - fragment_index;
+		if(int32(first_sequence - _next_receive_sequence) < 0)
+			return true;
+		stream_message **walk = &_received_head;
+		while(*walk && int32((*walk)->sequence - first_sequence) < 0)
+			walk = &(*walk)->next;
+		if(*walk && (*walk)->sequence == first_sequence)
+			return true;
+		if(fragment_count == 1)
+		{
+			if(size > byte_limit)
+				return false;
+			_insert_received(walk, stream_message::create(stream_index, sequence, data, size));
+			return true;
+		}
+		if(fragment_index >= fragment_count || (fragment_index < fragment_count - 1 ? size != fragment_size : size > fragment_size))
+			return false;
+		
+		message_reassembly *the_reassembly = _reassembly_head;
+		while(the_reassembly && the_reassembly->message->sequence != first_sequence)
+			the_reassembly = the_reassembly->next;
+		if(!the_reassembly)
+		{
+			// the whole message is allocated on its first fragment, so the limit is checked before a remote host can make it allocate.
+			if(fragment_count * fragment_size > byte_limit)
+				return false;
+			uint32 mask_words = (fragment_count + 31) >> 5;
+			the_reassembly = (message_reassembly *) memory_allocate(sizeof(message_reassembly) + (mask_words - 1) * sizeof(uint32));
+			the_reassembly->message = stream_message::create(stream_index, first_sequence, 0, fragment_count * fragment_size);
+			the_reassembly->message->fragment_count = fragment_count;
+			the_reassembly->received_count = 0;
+			for(uint32 i = 0; i < mask_words; i++)
+				the_reassembly->received_mask[i] = 0;
+			the_reassembly->next = _reassembly_head;
+			_reassembly_head = the_reassembly;
+			_received_bytes += the_reassembly->message->size;
+		}
+		else if(the_reassembly->message->fragment_count != fragment_count)
+			return false;
+		
+		uint32 bit = 1 << (fragment_index & 0x1F);
+		if(the_reassembly->received_mask[fragment_index >> 5] & bit)
+			return true;
+		the_reassembly->received_mask[fragment_index >> 5] |= bit;
+		the_reassembly->received_count++;
+		the_reassembly->last_receive_time = receive_time;
+		memcpy(the_reassembly->message->data + fragment_index * fragment_size, data, size);
+		if(fragment_index == fragment_count - 1)
+		{
+			// the buffer was sized for full fragments; the last one settles the message's real size.
+			_received_bytes -= fragment_size - size;
+			the_reassembly->message->size -= fragment_size - size;
+		}
+		if(the_reassembly->received_count == fragment_count)
+		{
+			message_reassembly **unlink = &_reassembly_head;
+			while(*unlink != the_reassembly)
+				unlink = &(*unlink)->next;
+			*unlink = the_reassembly->next;
+			_received_bytes -= the_reassembly->message->size;
+			_insert_received(walk, the_reassembly->message);
+			memory_deallocate(the_reassembly);
+		}
+		return true;
+	}
+
+	/// Returns the next message in order if it has been received, or NULL.  The caller frees the message with stream_message::destroy.
+	stream_message *get_next_received()
+	{
+		if(!_received_head || _received_head->sequence != _next_receive_sequence)
+			return 0;
+		stream_message *the_message = _received_head;
+		_received_head = the_message->next;
+		_next_receive_sequence += the_message->fragment_count;
+		_received_bytes -= the_message->size;
+		return the_message;
+	}
+
+	/// Returns the number of bytes held for messages received out of order or still being reassembled.
+	uint32 get_received_bytes()
+	{
+		return _received_bytes;
+	}
+
+	/// Returns true if a message being reassembled has gone without a new fragment since before cutoff_time.
+	bool has_stalled_reassembly(time cutoff_time)
+	{
+		for(message_reassembly *walk = _reassembly_head; walk; walk = walk->next)
+			if(walk->last_receive_time < cutoff_time)
+				return true;
+		return false;
+	}
+private:
+	/// A fragmented message being received, with a bit for each of its fragments that has arrived.
+	struct message_reassembly
+	{
+		message_reassembly *next; ///< Next message being reassembled on the stream.
+		stream_message *message; ///< Buffer for the whole message; its sequence is that of the first fragment.
+		uint32 received_count; ///< Fragments received.
+		time last_receive_time; ///< When a new fragment last arrived.
+		uint32 received_mask[1]; ///< One bit per fragment, allocated inline to (fragment_count + 31) / 32 words.
+	};
+
+	void _insert_received(stream_message **position, stream_message *the_message)
+	{
+		the_message->next = *position;
+		*position = the_message;
+		_received_bytes += the_message->size;
+	}
+
+	void _append_unsent(stream_message *the_message)
+	{
+		the_message->next = 0;
+		if(_unsent_tail)
+			_unsent_tail->next = the_message;
+		else
+			_unsent_head = the_message;
+		_unsent_tail = the_message;
+	}
+
+	stream_message *_outstanding_head; ///< Oldest message not yet acknowledged.
+	stream_message *_outstanding_tail; ///< Newest message not yet acknowledged.
+	stream_message *_unsent_head; ///< Oldest message waiting to be sent or resent.
+	stream_message *_unsent_tail; ///< Newest message waiting to be sent or resent.
+	stream_message *_received_head; ///< Received messages waiting for earlier ones, in sequence order.
+	message_reassembly *_reassembly_head; ///< Fragmented messages not yet received in full.
+	uint32 _next_send_sequence; ///< Sequence number of the next message queued.
+	uint32 _next_receive_sequence; ///< Sequence number of the next message to hand out.
+	uint32 _outstanding_bytes; ///< Bytes of message data not yet acknowledged.
+	uint32 _received_bytes; ///< Bytes held in _received_head and _reassembly_head.
+};
@@ -0,0 +1,193 @@
+// packet_cipher.h - Authenticated encryption of connected protocol packets.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// packet_cipher seals and opens the packets of an established torque_connection with AES-128 in GCM mode, using the AES-NI and PCLMULQDQ instructions where aes_hardware says the processor has them, and libtomcrypt's implementation otherwise.  A packet's header is authenticated but left in the clear, so the torque_socket can route it; everything after it is encrypted in place, and a truncated tag is appended.
+///
+/// Every packet is sealed under its own nonce: the connection's initialization vector with a packet number XORed into its last eight bytes.  Packet numbers must never repeat under a key, so the two directions of a connection number their packets from different halves of the 64 bit space.  The key is expanded once per connection: into round keys and the hash key for the hardware path, or into the libtomcrypt GCM state, with its 64KB of multiplication tables, for the portable one.
+class packet_cipher
+{
+public:
+	enum {
+		tag_size = 12, ///< Bytes of the GCM tag appended to each packet.
+		nonce_size = 12, ///< Bytes of the GCM nonce.
+	};
+
+	packet_cipher(const uint8 key[symmetric_cipher::key_size], const uint8 init_vector[symmetric_cipher::block_size])
+	{
+		memcpy(_init_vector, init_vector, nonce_size);
+		_gcm = 0;
+#ifdef CPU_X86_INTRINSICS
+		if(aes_hardware::is_available())
+		{
+			_setup_hardware(key);
+			return;
+		}
+#endif
+		_gcm = new gcm_state;
+		gcm_init(_gcm, register_cipher(&aes_desc), key, symmetric_cipher::key_size);
+	}
+	
+	~packet_cipher()
+	{
+		delete _gcm;
+	}
+
+	/// Encrypts the packet_size - header_size bytes after the header in place, authenticating the header along with them, and writes the tag into tag.
+	void seal(uint64 packet_number, uint8 *packet, uint32 header_size, uint32 packet_size, uint8 tag[tag_size])
+	{
+#ifdef CPU_X86_INTRINSICS
+		if(!_gcm)
+		{
+			_crypt_hardware(packet_number, packet, header_size, packet_size - header_size, true, tag);
+			return;
+		}
+#endif
+		_start(packet_number, packet, header_size);
+		gcm_process(_gcm, packet + header_size, packet_size - header_size, packet + header_size, GCM_ENCRYPT);
+		_finish(tag);
+	}
+
+	/// Decrypts a sealed packet in place, tag included in packet_size, and returns true if the tag shows it is the packet that was sealed under packet_number.  The contents are garbage if it returns false.
+	bool open(uint64 packet_number, uint8 *packet, uint32 header_size, uint32 packet_size)
+	{
+		if(packet_size < header_size + tag_size)
+			return false;
+		uint32 data_size = packet_size - header_size - tag_size;
+		uint8 tag[tag_size];
+#ifdef CPU_X86_INTRINSICS
+		if(!_gcm)
+			_crypt_hardware(packet_number, packet, header_size, data_size, false, tag);
+		else
+#endif
+		{
+			_start(packet_number, packet, header_size);
+			gcm_process(_gcm, packet + header_size, data_size, packet + header_size, GCM_DECRYPT);
+			_finish(tag);
+		}
+
+		// compare every byte, so the time taken doesn't say how much of a forged tag was right.
+		uint8 difference = 0;
+		for(uint32 i = 0; i < tag_size; i++)
+			difference |= tag[i] ^ packet[header_size + data_size + i];
+		return difference == 0;
+	}
+private:
+	void _make_nonce(uint64 packet_number, uint8 nonce[nonce_size])
+	{
+		memcpy(nonce, _init_vector, nonce_size);
+		for(uint32 i = 0; i < 8; i++)
+			nonce[nonce_size - 1 - i] ^= uint8(packet_number >> (i * 8));
+	}
+	
+	void _start(uint64 packet_number, const uint8 *header, uint32 header_size)
+	{
+		uint8 nonce[nonce_size];
+		_make_nonce(packet_number, nonce);
+		gcm_reset(_gcm);
+		gcm_add_iv(_gcm, nonce, nonce_size);
+		gcm_add_aad(_gcm, header, header_size);
+	}
+
+	void _finish(uint8 tag[tag_size])
+	{
+		uint8 full_tag[16];
+		unsigned long full_tag_size = sizeof(full_tag);
+		gcm_done(_gcm, full_tag, &full_tag_size);
+		memcpy(tag, full_tag, tag_size);
+	}
+	
+#ifdef CPU_X86_INTRINSICS
+	AES_NI_TARGET void _setup_hardware(const uint8 key[symmetric_cipher::key_size])
+	{
+		aes_hardware::expand_key(key, &_hardware_key);
+		__m128i hash_key = aes_hardware::encrypt(_mm_setzero_si128(), _hardware_key);
+		_mm_storeu_si128((__m128i *) _hash_key, aes_hardware::byte_reverse(hash_key));
+	}
+	
+	/// Folds size bytes into the byte reversed GHASH accumulator, the last block padded with zeros.
+	static AES_NI_TARGET __m128i _hash(__m128i accumulator, __m128i hash_key, const uint8 *data, uint32 size)
+	{
+		for(; size >= 16; data += 16, size -= 16)
+			accumulator = aes_hardware::gcm_multiply(_mm_xor_si128(accumulator, aes_hardware::byte_reverse(_mm_loadu_si128((const __m128i *) data))), hash_key);
+		if(size)
+		{
+			uint8 last_block[16];
+			memset(last_block, 0, sizeof(last_block));
+			memcpy(last_block, data, size);
+			accumulator = aes_hardware::gcm_multiply(_mm_xor_si128(accumulator, aes_hardware::byte_reverse(_mm_loadu_si128((const __m128i *) last_block))), hash_key);
+		}
+		return accumulator;
+	}
+	
+	/// Encrypts or decrypts the data_size bytes after the header in place with counter mode, hashing the header and the ciphertext, and computes the tag.  Four counter blocks are encrypted at a time, so the AES rounds of one overlap those of the others.
+	AES_NI_TARGET void _crypt_hardware(uint64 packet_number, uint8 *packet, uint32 header_size, uint32 data_size, bool encrypting, uint8 tag[tag_size])
+	{
+		uint8 nonce[16];
+		_make_nonce(packet_number, nonce);
+		nonce[12] = nonce[13] = nonce[14] = 0;
+		nonce[15] = 1;
+		__m128i first_counter = _mm_loadu_si128((const __m128i *) nonce);
+		__m128i hash_key = _mm_loadu_si128((const __m128i *) _hash_key);
+		
+		uint8 *data = packet + header_size;
+		__m128i accumulator = _hash(_mm_setzero_si128(), hash_key, packet, header_size);
+		if(!encrypting)
+			accumulator = _hash(accumulator, hash_key, data, data_size);
+		
+		uint32 counter = 2;
+		uint32 offset = 0;
+		for(; offset + 64 <= data_size; offset += 64, counter += 4)
+		{
+			__m128i key_stream[4];
+			for(uint32 i = 0; i < 4; i++)
+				key_stream[i] = _counter_block(first_counter, counter + i);
+			const __m128i *round_keys = (const __m128i *) _hardware_key.round_keys;
+			__m128i round_key = _mm_loadu_si128(round_keys);
+			for(uint32 i = 0; i < 4; i++)
+				key_stream[i] = _mm_xor_si128(key_stream[i], round_key);
+			for(uint32 round = 1; round < aes_hardware::rounds; round++)
+			{
+				round_key = _mm_loadu_si128(round_keys + round);
+				for(uint32 i = 0; i < 4; i++)
+					key_stream[i] = _mm_aesenc_si128(key_stream[i], round_key);
+			}
+			round_key = _mm_loadu_si128(round_keys + aes_hardware::rounds);
+			for(uint32 i = 0; i < 4; i++)
+			{
+				__m128i *block = (__m128i *) (data + offset + i * 16);
+				_mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), _mm_aesenclast_si128(key_stream[i], round_key)));
+			}
+		}
+		for(; offset < data_size; offset += 16, counter++)
+		{
+			uint8 key_stream[16];
+			_mm_storeu_si128((__m128i *) key_stream, aes_hardware::encrypt(_counter_block(first_counter, counter), _hardware_key));
+			uint32 count = data_size - offset < 16 ? data_size - offset : 16;
+			for(uint32 i = 0; i < count; i++)
+				data[offset + i] ^= key_stream[i];
+		}
+		
+		if(encrypting)
+			accumulator = _hash(accumulator, hash_key, data, data_size);
+		// the lengths block holds the bit lengths of the header and the data as big endian 64 bit numbers, so byte reversed the header's is the high half.
+		__m128i lengths = _mm_set_epi64x(int64(header_size) * 8, int64(data_size) * 8);
+		accumulator = aes_hardware::gcm_multiply(_mm_xor_si128(accumulator, lengths), hash_key);
+		
+		uint8 full_tag[16];
+		_mm_storeu_si128((__m128i *) full_tag, _mm_xor_si128(aes_hardware::byte_reverse(accumulator), aes_hardware::encrypt(first_counter, _hardware_key)));
+		memcpy(tag, full_tag, tag_size);
+	}
+	
+	/// Returns the counter block for counter: the nonce, then the counter as a big endian 32 bit number.
+	static AES_NI_TARGET __m128i _counter_block(__m128i first_counter, uint32 counter)
+	{
+		uint32 big_endian_counter = (counter >> 24) | ((counter >> 8) & 0xff00) | ((counter << 8) & 0xff0000) | (counter << 24);
+		return _mm_insert_epi32(first_counter, int(big_endian_counter), 3);
+	}
+	
+	aes_hardware::key_schedule _hardware_key; ///< Round keys for the hardware path.
+	uint8 _hash_key[16]; ///< The GHASH key, the encryption of a zero block, byte reversed for the carry-less multiply.
+#endif
+	gcm_state *_gcm; ///< GCM state with the key's tables for the portable path, reset for each packet; 0 if the hardware path is used.
+	uint8 _init_vector[nonce_size]; ///< Per connection part of every nonce.
+};
@@ -0,0 +1,119 @@
+// packet_ring.h - Bounded lock-free queue of received packets between a torque_socket's reader thread and its owner.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// packet_ring is a bounded single-producer/single-consumer ring of preallocated packet slots.
+///
+/// The background reader thread of a threaded torque_socket reserves free slots, reads datagrams straight into them and commits them; the thread that owns the torque_socket peeks and releases them in order.  Neither side takes a lock or allocates memory per packet, and the cost of an enqueue or dequeue does not depend on how many packets are waiting.  When the ring is full, the producer drops the incoming datagrams and counts them in the overflow counter.
+class packet_ring
+{
+public:
+	enum {
+		cache_line_size = 64, ///< The producer and consumer indices live on separate cache lines of this size so the two threads don't contend on them.
+		default_slot_count = 256, ///< Default number of packet slots.
+	};
+	
+	/// A single received packet.
+	struct slot
+	{
+		address remote_address; ///< Address the packet was received from.
+		uint32 packet_size; ///< Size, in bytes, of the packet data.
+		uint8 packet_data[udp_socket::max_datagram_size]; ///< Packet data.
+	};
+	
+	packet_ring()
+	{
+		_slots = 0;
+		_slot_count = 0;
+		_slot_mask = 0;
+		_write_index = 0;
+		_cached_read_index = 0;
+		_overflow_count = 0;
+		_read_index = 0;
+	}
+	
+	~packet_ring()
+	{
+		memory_deallocate(_slots);
+	}
+	
+	/// Allocates the slots of the ring.  slot_count is rounded up to a power of two.  Must be called before either thread uses the ring.
+	void allocate(uint32 slot_count = default_slot_count)
+	{
+		assert(!_slots);
+		_slot_count = get_next_power_of_2(slot_count);
+		_slot_mask = _slot_count - 1;
+		_slots = (slot *) memory_allocate(sizeof(slot) * _slot_count);
+	}
+	
+	bool is_allocated()
+	{
+		return _slots != 0;
+	}
+	
+	/// Producer: fills the_slots with up to max_count free slots, in queue order, and returns how many were reserved.  Reserved slots become visible to the consumer only when they are committed.
+	uint32 reserve(slot **the_slots, uint32 max_count)
+	{
+		uint32 free_count = _slot_count - (_write_index - _cached_read_index);
+		if(free_count < max_count)
+		{
+			// only look at the consumer's cache line when the cached view says we're short of room.
+			_cached_read_index = _read_index;
+			memory_barrier();
+			free_count = _slot_count - (_write_index - _cached_read_index);
+		}
+		if(max_count > free_count)
+			max_count = free_count;
+		for(uint32 i = 0; i < max_count; i++)
+			the_slots[i] = &_slots[(_write_index + i) & _slot_mask];
+		return max_count;
+	}
+	
+	/// Producer: publishes the first count reserved slots to the consumer.
+	void commit(uint32 count)
+	{
+		memory_barrier(); // the slot contents must be visible before the new write index.
+		_write_index += count;
+	}
+	
+	/// Producer: records count packets that were dropped because the ring was full.
+	void record_overflow(uint32 count)
+	{
+		_overflow_count += count;
+	}
+	
+	/// Consumer: returns the oldest committed slot, or NULL if the ring is empty.  The slot stays valid until release is called.
+	slot *peek()
+	{
+		uint32 write_index = _write_index;
+		memory_barrier(); // don't read the slot contents before the write index that published them.
+		if(_read_index == write_index)
+			return 0;
+		return &_slots[_read_index & _slot_mask];
+	}
+	
+	/// Consumer: returns the slot last returned by peek to the producer.
+	void release()
+	{
+		memory_barrier(); // finish reading the slot before handing it back.
+		_read_index++;
+	}
+	
+	/// Returns the number of packets dropped because the ring was full.
+	uint32 get_overflow_count()
+	{
+		return _overflow_count;
+	}
+private:
+	slot *_slots; ///< Packet slot storage.
+	uint32 _slot_count; ///< Number of slots; always a power of two.
+	uint32 _slot_mask; ///< Mask for turning an index into a slot number.
+	
+	uint8 _producer_pad[cache_line_size];
+	volatile uint32 _write_index; ///< Total number of slots committed by the producer.
+	uint32 _cached_read_index; ///< The producer's last view of _read_index.
+	volatile uint32 _overflow_count; ///< Number of packets the producer dropped because the ring was full.
+	
+	uint8 _consumer_pad[cache_line_size - 3 * sizeof(uint32)];
+	volatile uint32 _read_index; ///< Total number of slots released by the consumer.
+	uint8 _tail_pad[cache_line_size - sizeof(uint32)];
+};
@@ -32,15 +32,15 @@ public:
 	}
 	
    /// Sends this packet to the specified address through the specified socket.
-   udp_socket::send_to_result send_to(udp_socket &outgoing_socket, const address &the_address)
+   packet_transport::send_to_result send_to(packet_transport &outgoing_socket, const address &the_address)
 	{
 		return outgoing_socket.send_to(the_address, buffer, get_next_byte_position());
 	}
 
    /// Reads a packet into the stream from the specified socket.
-   udp_socket::recv_from_result recv_from(udp_socket &incoming_socket, address *recv_address)
+   packet_transport::recv_from_result recv_from(packet_transport &incoming_socket, address *recv_address)
 	{
-	   udp_socket::recv_from_result the_result;
+	   packet_transport::recv_from_result the_result;
 	   uint32 data_size;
 	   the_result = incoming_socket.recv_from(recv_address, buffer, sizeof(buffer), &data_size);
 	   set_buffer(buffer, 0, data_size * 8);
@@ -0,0 +1,92 @@
+// packet_transport.h - Interface torque_socket moves its datagrams through.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// packet_transport is the datagram service a torque_socket runs over: it binds to an address and sends and receives unreliable, unordered datagrams of at most max_datagram_size bytes.
+///
+/// udp_socket is the transport torque_socket uses unless told otherwise; loopback_transport delivers datagrams between endpoints in the same process without involving the kernel.  Receives follow the semantics requested at bind: a non-blocking transport returns would_block_or_timeout immediately when nothing is waiting, a blocking one waits up to recv_timeout (forever if it's 0).
+class packet_transport
+{
+public:
+	enum
+	{
+		default_send_buffer_size = 32768,
+		default_recv_buffer_size = 32768,
+		max_datagram_size = 1536, ///< some routers have issues with packets larger than this
+		recommended_datagram_size = 512,
+		max_batch_size = 32, ///< Maximum number of datagrams moved by a single recv_from_batch or send_to_batch call.
+	};
+
+	/// Describes one datagram of a batched send or receive.  For receives, buffer and buffer_size describe the storage the datagram is read into, and remote_address and packet_size are filled in for each datagram read.  For sends, packet_size bytes of buffer are sent to remote_address.
+	struct datagram
+	{
+		address remote_address;
+		byte *buffer;
+		uint32 buffer_size;
+		uint32 packet_size;
+	};
+
+	enum send_to_result
+	{
+		send_to_success,
+		send_to_failure,
+	};
+
+	enum recv_from_result
+	{
+		packet_received,
+		would_block_or_timeout,
+		invalid_socket,
+		unknown_error,
+	};
+
+	virtual ~packet_transport() {}
+
+	/// Binds the transport to bind_address.  Transports other than udp_socket ignore the broadcast and buffer size options.
+	virtual bind_result bind(const address bind_address, bool non_blocking_io = true, time recv_timeout = 0, bool accepts_broadcast_packets = true, uint32 send_buffer_size = default_send_buffer_size, uint32 recv_buffer_size = default_recv_buffer_size) = 0;
+	virtual void unbind() = 0;
+	virtual bool is_bound() = 0;
+	virtual address get_bound_address() = 0;
+
+	/// Returns an operating system handle that is readable while datagrams are waiting, for registering with readiness APIs such as epoll, or INVALID_SOCKET if the transport has none.
+	virtual SOCKET get_descriptor() = 0;
+
+	/// Waits up to timeout for a datagram to arrive.  Returns true if one is ready.
+	virtual bool wait_for_readable(time timeout) = 0;
+
+	virtual send_to_result send_to(const address &the_address, const byte *buffer, uint32 buffer_size) = 0;
+	virtual recv_from_result recv_from(address *sender_address, byte *buffer, uint32 buffer_size, uint32 *incoming_packet_size) = 0;
+
+	/// Reads up to datagram_count datagrams.  *received_count is set to the number of datagrams read; if any were read the result is packet_received.  A blocking transport waits for the first datagram only.
+	virtual recv_from_result recv_from_batch(datagram *datagrams, uint32 datagram_count, uint32 *received_count)
+	{
+		*received_count = 0;
+		recv_from_result result = would_block_or_timeout;
+		while(*received_count < datagram_count)
+		{
+			// only the first datagram is worth waiting for.
+			if(*received_count && !wait_for_readable(0))
+				break;
+			datagram &the_datagram = datagrams[*received_count];
+			recv_from_result datagram_result = recv_from(&the_datagram.remote_address, the_datagram.buffer, the_datagram.buffer_size, &the_datagram.packet_size);
+			if(datagram_result != packet_received)
+			{
+				if(!*received_count)
+					result = datagram_result;
+				break;
+			}
+			result = packet_received;
+			(*received_count)++;
+		}
+		return result;
+	}
+
+	/// Sends datagram_count datagrams.  Returns the number of datagrams sent; datagrams that fail to send are skipped.
+	virtual uint32 send_to_batch(const datagram *datagrams, uint32 datagram_count)
+	{
+		uint32 sent_count = 0;
+		for(uint32 i = 0; i < datagram_count; i++)
+			if(send_to(datagrams[i].remote_address, datagrams[i].buffer, datagrams[i].packet_size) == send_to_success)
+				sent_count++;
+		return sent_count;
+	}
+};
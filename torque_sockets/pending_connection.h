@@ -1,7 +1,7 @@
 class torque_socket;
 
 /// All data associated with the negotiation of the connection
-class pending_connection
+class pending_connection : public timer_wheel::timer
 {
 public:
 	/// enum of possible states of a pending connection.  A pending connection can be created in one of four states: initiator, host, introduced initiator, introduced host.  In the case of an introduced connection, the initial state will be requesting_introduction.  A connection created as an initiator will begin in the requesting_challenge_response state, and a pending_connection host will be created in the awaiting_local_accept state.
@@ -50,9 +50,16 @@ public:
 	void set_shared_secret(byte_buffer_ptr secret)
 	{
 		_shared_secret = secret;
+		if(!secret.is_null())
+			_shared_secret_cipher = new symmetric_cipher(secret);
+	}
+	/// Returns a cipher keyed with the shared secret, its key expanded once when the secret was set.  Copy it into a new symmetric_cipher to encrypt or decrypt a packet.
+	const symmetric_cipher &get_shared_secret_cipher()
+	{
+		return *_shared_secret_cipher;
 	}
 
-	pending_connection(pending_connection_type type, nonce initiator_nonce, uint32 initial_send_sequence, uint32 connection_index)
+	pending_connection(pending_connection_type type, nonce initiator_nonce, uint32 initial_send_sequence, uint32 connection_index) : timer_wheel::timer(torque_socket::pending_connection_timer)
 	{
 		_type = type;
 		if(type == connection_initiator)
@@ -66,6 +73,10 @@ public:
 		_connection_index = connection_index;
 		_initiator_nonce = initiator_nonce;
 		_initial_send_sequence = initial_send_sequence;
+		_packet_window_size = torque_connection::default_packet_window_size;
+		_fec_group_size = 0;
+		_remote_connection_index = 0;
+		_packet_encryption = false;
 		_introducer = 0;
 		_remote_client_id = 0;
 		_next = 0;
@@ -118,7 +129,12 @@ public:
 	nonce _host_nonce;
 	uint32 _initial_send_sequence;
 	uint32 _initial_recv_sequence;
+	uint32 _packet_window_size; ///< Packet window the initiator asked for, or the host granted.
+	uint32 _fec_group_size; ///< Forward error correction group size the initiator asked for, or the host granted; 0 for none.
+	uint32 _remote_connection_index; ///< The id the initiator's socket gave the connection, for the header of every packet the host sends it.
+	bool _packet_encryption; ///< True if the initiator asked for, or the host granted, sealing the connection's packets with AES-GCM.
 	byte_buffer_ptr _shared_secret; ///< The shared secret key
+	ref_ptr<symmetric_cipher> _shared_secret_cipher; ///< Cipher keyed with _shared_secret, copied for each packet encrypted with it.
 	torque_connection_id _introducer; ///< The remote host that will be introducing this connection
 	torque_connection_id _remote_client_id; ///< The connection id to the introduced party on the _introducer
 	
@@ -0,0 +1,444 @@
+// sha256.h - SHA-256 with SHA-NI, AVX2 multi-buffer and portable implementations.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// sha256 computes SHA-256 digests for the handshake: packet hashes, client identity tokens and client puzzles.  Single messages are hashed with the SHA extensions (SHA-NI) where cpu_features says the processor has them, and a portable implementation otherwise.  hash_batch hashes up to batch_lanes messages of the same size at once, one in each 32 bit lane of the AVX2 registers, for callers with many small messages to hash, like the client puzzle solver; without AVX2 it hashes them one at a time.
+///
+/// Usage is either one call to hash(), or reset(), update() any number of times, and finish().
+class sha256
+{
+public:
+	enum {
+		digest_size = 32, ///< Bytes in a digest.
+		block_size = 64, ///< Bytes the compression function consumes at a time.
+		batch_lanes = 8, ///< Messages hash_batch hashes together.
+	};
+
+	sha256()
+	{
+		reset();
+	}
+
+	/// Starts a new digest.
+	void reset()
+	{
+		memcpy(_state, _initial_state(), sizeof(_state));
+		_length = 0;
+		_buffer_size = 0;
+	}
+
+	/// Adds size bytes of data to the digest.
+	void update(const uint8 *data, uint32 size)
+	{
+		_length += size;
+		if(_buffer_size)
+		{
+			uint32 count = block_size - _buffer_size < size ? block_size - _buffer_size : size;
+			memcpy(_buffer + _buffer_size, data, count);
+			_buffer_size += count;
+			data += count;
+			size -= count;
+			if(_buffer_size < block_size)
+				return;
+			_compress(_state, _buffer, 1);
+			_buffer_size = 0;
+		}
+		if(size >= block_size)
+		{
+			_compress(_state, data, size / block_size);
+			data += size & ~(block_size - 1);
+			size &= block_size - 1;
+		}
+		memcpy(_buffer, data, size);
+		_buffer_size = size;
+	}
+
+	/// Pads the message and writes its digest.
+	void finish(uint8 digest[digest_size])
+	{
+		uint8 tail[block_size * 2];
+		uint32 tail_size = _pad(_buffer, _buffer_size, _length, tail);
+		_compress(_state, tail, tail_size / block_size);
+		for(uint32 i = 0; i < 8; i++)
+			write_word(_state[i], digest + i * 4);
+	}
+
+	/// Writes the digest of size bytes of data.
+	static void hash(const uint8 *data, uint32 size, uint8 digest[digest_size])
+	{
+		sha256 state;
+		state.update(data, size);
+		state.finish(digest);
+	}
+
+	/// Writes the digests of count messages, each size bytes long, into digests.  Messages are hashed batch_lanes at a time when the processor has AVX2.
+	static void hash_batch(const uint8 *const *messages, uint32 size, uint8 (*digests)[digest_size], uint32 count)
+	{
+#ifdef CPU_X86_INTRINSICS
+		if(_hardware_enabled() && cpu_features::has_avx2())
+		{
+			for(; count >= 2; messages += batch_lanes, digests += batch_lanes, count = count > batch_lanes ? count - batch_lanes : 0)
+				_hash_lanes_avx2(messages, size, digests, count < uint32(batch_lanes) ? count : uint32(batch_lanes));
+		}
+#endif
+		for(uint32 i = 0; i < count; i++)
+			hash(messages[i], size, digests[i]);
+	}
+
+	/// first_word_hasher hashes many one block messages, at most 55 bytes long, that differ only in their first 32 bit word, as the candidate solutions to a client puzzle do, and returns just the first word of each digest.  Everything that doesn't depend on the first word is computed once by the constructor: the schedule words that come only from the rest of the message, the constant parts of those that don't, and the parts of the first round that don't.  With AVX2 the remaining work is done for batch_lanes first words at once.
+	class first_word_hasher
+	{
+	public:
+		/// Prepares to hash message, of size bytes; its first four bytes are replaced by each first word hashed.
+		first_word_hasher(const uint8 *message, uint32 size)
+		{
+			const uint32 *k = _round_constants();
+			assert(size + 9 <= block_size);
+			uint8 padded[block_size * 2];
+			_pad(message, size, size, padded);
+			memcpy(_block, padded, block_size);
+			
+			// sort each schedule word's terms into the constant ones, summed here, and the ones that depend on the first word.
+			uint32 w[64];
+			bool varies[64];
+			for(uint32 t = 0; t < 16; t++)
+			{
+				w[t] = t ? read_word(_block + t * 4) : 0;
+				varies[t] = t == 0;
+				_varying_terms[t] = 0;
+			}
+			for(uint32 t = 16; t < 64; t++)
+			{
+				uint32 sum = 0;
+				_varying_terms[t] = 0;
+				if(varies[t - 2]) _varying_terms[t] |= term_sigma1; else sum += _sigma1(w[t - 2]);
+				if(varies[t - 7]) _varying_terms[t] |= term_7; else sum += w[t - 7];
+				if(varies[t - 15]) _varying_terms[t] |= term_sigma0; else sum += _sigma0(w[t - 15]);
+				if(varies[t - 16]) _varying_terms[t] |= term_16; else sum += w[t - 16];
+				w[t] = sum;
+				varies[t] = _varying_terms[t] != 0;
+			}
+			for(uint32 t = 0; t < 64; t++)
+				_constant[t] = k[t] + w[t];
+			memcpy(_schedule_constants, w, sizeof(_schedule_constants));
+			
+			// the first round, apart from the first word added into both new a and new e.
+			uint32 a = _initial_state()[0], b = _initial_state()[1], c = _initial_state()[2], d = _initial_state()[3];
+			uint32 e = _initial_state()[4], f = _initial_state()[5], g = _initial_state()[6], h = _initial_state()[7];
+			uint32 t1 = h + _sum1(e) + ((e & f) ^ (~e & g)) + k[0];
+			uint32 t2 = _sum0(a) + ((a & b) ^ (a & c) ^ (b & c));
+			_first_round_a = t1 + t2;
+			_first_round_e = d + t1;
+		}
+		
+		/// Writes the first word of the digests of the message with first words first_word through first_word + batch_lanes - 1.
+		void leading_digest_words(uint32 first_word, uint32 digest_words[batch_lanes])
+		{
+#ifdef CPU_X86_INTRINSICS
+			if(_hardware_enabled() && cpu_features::has_avx2())
+			{
+				_leading_digest_words_avx2(first_word, digest_words);
+				return;
+			}
+#endif
+			// without AVX2, hash each message whole, with SHA-NI where the processor has it.
+			uint8 block[block_size];
+			memcpy(block, _block, block_size);
+			for(uint32 lane = 0; lane < batch_lanes; lane++)
+			{
+				uint32 state[8];
+				memcpy(state, _initial_state(), sizeof(state));
+				write_word(first_word + lane, block);
+				_compress(state, block, 1);
+				digest_words[lane] = state[0];
+			}
+		}
+	private:
+		enum {
+			term_sigma1 = 1 << 0, ///< sigma1 of the word two before varies.
+			term_7 = 1 << 1, ///< The word seven before varies.
+			term_sigma0 = 1 << 2, ///< sigma0 of the word fifteen before varies.
+			term_16 = 1 << 3, ///< The word sixteen before varies.
+		};
+		
+#ifdef CPU_X86_INTRINSICS
+		AVX2_TARGET void _leading_digest_words_avx2(uint32 first_word, uint32 digest_words[batch_lanes])
+		{
+			const uint32 *initial = _initial_state();
+			__m256i w[64];
+			w[0] = _mm256_add_epi32(_mm256_set1_epi32(int(first_word)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			
+			__m256i a = _mm256_add_epi32(_mm256_set1_epi32(int(_first_round_a)), w[0]);
+			__m256i b = _mm256_set1_epi32(int(initial[0])), c = _mm256_set1_epi32(int(initial[1])), d = _mm256_set1_epi32(int(initial[2]));
+			__m256i e = _mm256_add_epi32(_mm256_set1_epi32(int(_first_round_e)), w[0]);
+			__m256i f = _mm256_set1_epi32(int(initial[4])), g = _mm256_set1_epi32(int(initial[5])), h = _mm256_set1_epi32(int(initial[6]));
+			
+			for(uint32 t = 1; t < 64; t++)
+			{
+				// round constant plus schedule word: a constant, plus the terms of the word that vary.
+				__m256i input = _mm256_set1_epi32(int(_constant[t]));
+				uint32 terms = _varying_terms[t];
+				if(terms)
+				{
+					__m256i varying = _mm256_setzero_si256();
+					if(terms & term_sigma1)
+					{
+						__m256i x = w[t - 2];
+						varying = _mm256_add_epi32(varying, _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(x, 17), _rotate_right_lanes(x, 19)), _mm256_srli_epi32(x, 10)));
+					}
+					if(terms & term_7)
+						varying = _mm256_add_epi32(varying, w[t - 7]);
+					if(terms & term_sigma0)
+					{
+						__m256i x = w[t - 15];
+						varying = _mm256_add_epi32(varying, _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(x, 7), _rotate_right_lanes(x, 18)), _mm256_srli_epi32(x, 3)));
+					}
+					if(terms & term_16)
+						varying = _mm256_add_epi32(varying, w[t - 16]);
+					w[t] = _mm256_add_epi32(varying, _mm256_set1_epi32(int(_schedule_constants[t])));
+					input = _mm256_add_epi32(input, varying);
+				}
+				__m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(e, 6), _rotate_right_lanes(e, 11)), _rotate_right_lanes(e, 25));
+				__m256i choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+				__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(choose, input));
+				__m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(a, 2), _rotate_right_lanes(a, 13)), _rotate_right_lanes(a, 22));
+				__m256i majority = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+				h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+				d = c; c = b; b = a; a = _mm256_add_epi32(t1, _mm256_add_epi32(sum0, majority));
+			}
+			_mm256_storeu_si256((__m256i *) digest_words, _mm256_add_epi32(a, _mm256_set1_epi32(int(initial[0]))));
+		}
+#endif
+		
+		uint8 _block[block_size]; ///< The padded message, for hashing whole.
+		uint32 _constant[64]; ///< Round constant plus the constant part of each schedule word.
+		uint32 _schedule_constants[64]; ///< The constant part of each schedule word.
+		uint32 _varying_terms[64]; ///< Which terms of each schedule word depend on the first word.
+		uint32 _first_round_a; ///< New a after the first round, less the first word.
+		uint32 _first_round_e; ///< New e after the first round, less the first word.
+	};
+
+	/// Turns the SHA-NI and AVX2 paths off, or back on if the processor supports them.  Mostly useful for measuring them against the portable implementation.
+	static void set_hardware_enabled(bool enabled)
+	{
+		_hardware_enabled() = enabled;
+	}
+
+	static void write_word(uint32 value, uint8 *buffer)
+	{
+		buffer[0] = uint8(value >> 24);
+		buffer[1] = uint8(value >> 16);
+		buffer[2] = uint8(value >> 8);
+		buffer[3] = uint8(value);
+	}
+
+	static uint32 read_word(const uint8 *buffer)
+	{
+		return (uint32(buffer[0]) << 24) | (uint32(buffer[1]) << 16) | (uint32(buffer[2]) << 8) | uint32(buffer[3]);
+	}
+private:
+	static const uint32 *_round_constants()
+	{
+		static const uint32 k[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+		return k;
+	}
+
+	static const uint32 *_initial_state()
+	{
+		static const uint32 initial_state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		return initial_state;
+	}
+
+	static uint32 _sigma0(uint32 x) { return _rotate_right(x, 7) ^ _rotate_right(x, 18) ^ (x >> 3); }
+	static uint32 _sigma1(uint32 x) { return _rotate_right(x, 17) ^ _rotate_right(x, 19) ^ (x >> 10); }
+	static uint32 _sum0(uint32 x) { return _rotate_right(x, 2) ^ _rotate_right(x, 13) ^ _rotate_right(x, 22); }
+	static uint32 _sum1(uint32 x) { return _rotate_right(x, 6) ^ _rotate_right(x, 11) ^ _rotate_right(x, 25); }
+
+	static bool &_hardware_enabled()
+	{
+		static bool enabled = true;
+		return enabled;
+	}
+
+	/// Writes the last size bytes of a message, its padding and its bit length into tail, and returns the size of that: one block or two.
+	static uint32 _pad(const uint8 *last_bytes, uint32 size, uint64 message_length, uint8 tail[block_size * 2])
+	{
+		uint32 tail_size = size + 9 > block_size ? block_size * 2 : block_size;
+		memcpy(tail, last_bytes, size);
+		tail[size] = 0x80;
+		memset(tail + size + 1, 0, tail_size - size - 1);
+		uint64 bit_length = message_length * 8;
+		write_word(uint32(bit_length >> 32), tail + tail_size - 8);
+		write_word(uint32(bit_length), tail + tail_size - 4);
+		return tail_size;
+	}
+
+	static void _compress(uint32 state[8], const uint8 *blocks, uint32 block_count)
+	{
+#ifdef CPU_X86_INTRINSICS
+		if(_hardware_enabled() && cpu_features::has_sha_ni())
+		{
+			_compress_sha_ni(state, blocks, block_count);
+			return;
+		}
+#endif
+		_compress_portable(state, blocks, block_count);
+	}
+
+	static uint32 _rotate_right(uint32 value, uint32 bits)
+	{
+		return (value >> bits) | (value << (32 - bits));
+	}
+
+	static void _compress_portable(uint32 state[8], const uint8 *blocks, uint32 block_count)
+	{
+		const uint32 *k = _round_constants();
+		for(; block_count; block_count--, blocks += block_size)
+		{
+			uint32 w[64];
+			for(uint32 t = 0; t < 16; t++)
+				w[t] = read_word(blocks + t * 4);
+			for(uint32 t = 16; t < 64; t++)
+			{
+				w[t] = w[t - 16] + _sigma0(w[t - 15]) + w[t - 7] + _sigma1(w[t - 2]);
+			}
+			uint32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+			for(uint32 t = 0; t < 64; t++)
+			{
+				uint32 t1 = h + _sum1(e) + ((e & f) ^ (~e & g)) + k[t] + w[t];
+				uint32 t2 = _sum0(a) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+	}
+
+#ifdef CPU_X86_INTRINSICS
+	/// Compresses blocks with the SHA extensions.  The instructions keep the state as ABEF and CDGH register pairs and run two rounds at a time; the message schedule for each group of four rounds is built from the previous four groups with sha256msg1 and sha256msg2.
+	static SHA_NI_TARGET void _compress_sha_ni(uint32 state[8], const uint8 *blocks, uint32 block_count)
+	{
+		const uint32 *k = _round_constants();
+		const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+		__m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0xb1);
+		__m128i hgfe = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (state + 4)), 0x1b);
+		__m128i abef = _mm_alignr_epi8(dcba, hgfe, 8);
+		__m128i cdgh = _mm_blend_epi16(hgfe, dcba, 0xf0);
+
+		for(; block_count; block_count--, blocks += block_size)
+		{
+			__m128i abef_start = abef, cdgh_start = cdgh;
+			__m128i schedule[4];
+			for(uint32 group = 0; group < 16; group++)
+			{
+				__m128i &words = schedule[group & 3];
+				if(group < 4)
+					words = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (blocks + group * 16)), byte_swap);
+				__m128i round_input = _mm_add_epi32(words, _mm_loadu_si128((const __m128i *) (k + group * 4)));
+				cdgh = _mm_sha256rnds2_epu32(cdgh, abef, round_input);
+				if(group >= 3 && group < 15)
+				{
+					__m128i &next = schedule[(group + 1) & 3];
+					next = _mm_add_epi32(next, _mm_alignr_epi8(words, schedule[(group + 3) & 3], 4));
+					next = _mm_sha256msg2_epu32(next, words);
+				}
+				abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(round_input, 0x0e));
+				if(group >= 1 && group < 13)
+					schedule[(group + 3) & 3] = _mm_sha256msg1_epu32(schedule[(group + 3) & 3], words);
+			}
+			abef = _mm_add_epi32(abef, abef_start);
+			cdgh = _mm_add_epi32(cdgh, cdgh_start);
+		}
+
+		__m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+		__m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+		_mm_storeu_si128((__m128i *) state, _mm_blend_epi16(feba, dchg, 0xf0));
+		_mm_storeu_si128((__m128i *) (state + 4), _mm_alignr_epi8(dchg, feba, 8));
+	}
+
+	static AVX2_TARGET __m256i _rotate_right_lanes(__m256i value, int bits)
+	{
+		return _mm256_or_si256(_mm256_srli_epi32(value, bits), _mm256_slli_epi32(value, 32 - bits));
+	}
+
+	/// Hashes lane_count messages of the same size at once, message i in lane i of each register; unused lanes repeat the first message and are discarded.  Messages of the same size pad the same way, so every lane compresses the same number of blocks.
+	static AVX2_TARGET void _hash_lanes_avx2(const uint8 *const *messages, uint32 size, uint8 (*digests)[digest_size], uint32 lane_count)
+	{
+		const uint32 *k = _round_constants();
+		uint32 whole_blocks = size / block_size;
+		uint32 tail_size = 0;
+		uint8 tails[batch_lanes][block_size * 2];
+		const uint8 *lane_messages[batch_lanes];
+		for(uint32 lane = 0; lane < batch_lanes; lane++)
+		{
+			lane_messages[lane] = messages[lane < lane_count ? lane : 0];
+			tail_size = _pad(lane_messages[lane] + whole_blocks * block_size, size - whole_blocks * block_size, size, tails[lane]);
+		}
+
+		__m256i state[8];
+		for(uint32 i = 0; i < 8; i++)
+			state[i] = _mm256_set1_epi32(int(_initial_state()[i]));
+
+		uint32 block_count = whole_blocks + tail_size / block_size;
+		for(uint32 block = 0; block < block_count; block++)
+		{
+			const uint8 *lane_blocks[batch_lanes];
+			for(uint32 lane = 0; lane < batch_lanes; lane++)
+				lane_blocks[lane] = block < whole_blocks ? lane_messages[lane] + block * block_size : tails[lane] + (block - whole_blocks) * block_size;
+
+			__m256i w[16];
+			for(uint32 t = 0; t < 16; t++)
+				w[t] = _mm256_setr_epi32(int(read_word(lane_blocks[0] + t * 4)), int(read_word(lane_blocks[1] + t * 4)), int(read_word(lane_blocks[2] + t * 4)), int(read_word(lane_blocks[3] + t * 4)),
+					int(read_word(lane_blocks[4] + t * 4)), int(read_word(lane_blocks[5] + t * 4)), int(read_word(lane_blocks[6] + t * 4)), int(read_word(lane_blocks[7] + t * 4)));
+
+			__m256i a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+			for(uint32 t = 0; t < 64; t++)
+			{
+				// the schedule is kept as a ring of the last sixteen words.
+				if(t >= 16)
+				{
+					__m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+					__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(w15, 7), _rotate_right_lanes(w15, 18)), _mm256_srli_epi32(w15, 3));
+					__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(w2, 17), _rotate_right_lanes(w2, 19)), _mm256_srli_epi32(w2, 10));
+					w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+				}
+				__m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(e, 6), _rotate_right_lanes(e, 11)), _rotate_right_lanes(e, 25));
+				__m256i choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+				__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(choose, _mm256_add_epi32(_mm256_set1_epi32(int(k[t])), w[t & 15])));
+				__m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(_rotate_right_lanes(a, 2), _rotate_right_lanes(a, 13)), _rotate_right_lanes(a, 22));
+				__m256i majority = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+				__m256i t2 = _mm256_add_epi32(sum0, majority);
+				h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+				d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+			}
+			state[0] = _mm256_add_epi32(state[0], a); state[1] = _mm256_add_epi32(state[1], b);
+			state[2] = _mm256_add_epi32(state[2], c); state[3] = _mm256_add_epi32(state[3], d);
+			state[4] = _mm256_add_epi32(state[4], e); state[5] = _mm256_add_epi32(state[5], f);
+			state[6] = _mm256_add_epi32(state[6], g); state[7] = _mm256_add_epi32(state[7], h);
+		}
+
+		for(uint32 i = 0; i < 8; i++)
+		{
+			uint32 words[batch_lanes];
+			_mm256_storeu_si256((__m256i *) words, state[i]);
+			for(uint32 lane = 0; lane < lane_count; lane++)
+				write_word(words[lane], digests[lane] + i * 4);
+		}
+	}
+#endif
+
+	uint32 _state[8]; ///< Hash state after the blocks compressed so far.
+	uint64 _length; ///< Bytes added so far.
+	uint8 _buffer[block_size]; ///< Bytes added that don't yet fill a block.
+	uint32 _buffer_size; ///< Bytes in _buffer.
+};
@@ -0,0 +1,142 @@
+// sharded_torque_socket.h - A server endpoint served by several torque_sockets, one per core.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// sharded_torque_socket spreads the work of a single server address across several torque_sockets, each with its own worker thread.
+///
+/// Every shard binds the same address with SO_REUSEPORT, and a BPF steering program installed on the group hashes each datagram's source address and port to one shard, so that every packet of a handshake and of the connection that follows is handled by the same torque_socket.  Each shard hands out connection ids with id % shard_count == shard index, so get_shard_for_connection can route an application's per-connection calls without a lookup.
+///
+/// Events are delivered by calling the event function from the worker thread of the shard they occurred on.  A torque_socket is not thread safe: calls on a shard (connect responses, sends, disconnects) should be made from within that shard's event function.  On platforms without reuseport steering the sharded socket runs a single shard.
+class sharded_torque_socket
+{
+public:
+	enum {
+		max_shard_count = 64, ///< Maximum number of shards.
+		shard_wait_timeout = 50, ///< Longest time in milliseconds a shard's worker waits for a packet, even if none of its timers are due sooner.
+	};
+
+	/// Called from the worker thread of shard shard_index for each event on that shard.
+	typedef void (*event_fn)(void *user_data, uint32 shard_index, torque_socket *shard, torque_socket_event *event);
+
+	sharded_torque_socket(uint32 shard_count, event_fn the_event_fn, void *event_user_data)
+	{
+#if !defined(PLATFORM_LINUX)
+		shard_count = 1;
+#endif
+		if(shard_count < 1)
+			shard_count = 1;
+		else if(shard_count > max_shard_count)
+			shard_count = max_shard_count;
+		_shard_count = shard_count;
+		_event_fn = the_event_fn;
+		_event_user_data = event_user_data;
+		_running = false;
+
+		for(uint32 i = 0; i < _shard_count; i++)
+		{
+			_shards[i] = new torque_socket(false);
+			_shards[i]->set_connection_index_shard(i, _shard_count);
+			_workers[i] = new shard_thread(this, i);
+		}
+	}
+
+	~sharded_torque_socket()
+	{
+		stop();
+		for(uint32 i = 0; i < _shard_count; i++)
+		{
+			delete _workers[i];
+			delete _shards[i];
+		}
+	}
+
+	/// Binds every shard to bind_address, steers incoming traffic across them and starts the worker threads.  The result is that of the first shard that fails to bind, or bind_success; if a shard fails, the shards bound before it are unbound again.
+	bind_result bind(const address &bind_address)
+	{
+		address shard_address = bind_address;
+		for(uint32 i = 0; i < _shard_count; i++)
+		{
+			bind_result result = _shards[i]->bind(shard_address, _shard_count > 1);
+			if(result != bind_success)
+			{
+				while(i--)
+					_shards[i]->get_transport()->unbind();
+				return result;
+			}
+			// if bind_address asked for any port, the remaining shards must share the one the first shard was given.
+			if(i == 0)
+				shard_address = _shards[0]->get_network_socket().get_bound_address();
+		}
+		if(_shard_count > 1 && !_shards[0]->get_network_socket().attach_reuseport_steering(_shard_count))
+			logprintf("sharded_torque_socket: unable to attach reuseport steering; packets will be spread by the kernel's default hash.");
+
+		_running = true;
+		for(uint32 i = 0; i < _shard_count; i++)
+			_workers[i]->start();
+		return bind_success;
+	}
+
+	/// Stops the worker threads.  Blocks until each has finished its current pass.
+	void stop()
+	{
+		if(!_running)
+			return;
+		_running = false;
+		for(uint32 i = 0; i < _shard_count; i++)
+			_workers[i]->join();
+	}
+
+	uint32 get_shard_count()
+	{
+		return _shard_count;
+	}
+
+	torque_socket *get_shard(uint32 shard_index)
+	{
+		assert(shard_index < _shard_count);
+		return _shards[shard_index];
+	}
+
+	/// Returns the index of the shard that owns the connection with the specified id.
+	uint32 get_shard_for_connection(torque_connection_id connection_id)
+	{
+		return connection_id % _shard_count;
+	}
+private:
+	class shard_thread : public thread
+	{
+		sharded_torque_socket *_owner;
+		uint32 _shard_index;
+	public:
+		shard_thread(sharded_torque_socket *owner, uint32 shard_index)
+		{
+			_owner = owner;
+			_shard_index = shard_index;
+		}
+		virtual uint32 run()
+		{
+			_owner->_shard_process(_shard_index);
+			return 0;
+		}
+	};
+
+	/// Body of a shard's worker thread: waits for packets and dispatches the shard's events until stopped.
+	void _shard_process(uint32 shard_index)
+	{
+		torque_socket *shard = _shards[shard_index];
+		while(_running)
+		{
+			uint32 wait_time = shard->get_next_timeout();
+			shard->get_transport()->wait_for_readable(wait_time < uint32(shard_wait_timeout) ? wait_time : uint32(shard_wait_timeout));
+			torque_socket_event *event;
+			while(_running && (event = shard->get_next_event()) != 0)
+				_event_fn(_event_user_data, shard_index, shard, event);
+		}
+	}
+
+	uint32 _shard_count; ///< Number of shards bound to the server address.
+	torque_socket *_shards[max_shard_count]; ///< The shards, in bind order; the steering program indexes the reuseport group in this order.
+	shard_thread *_workers[max_shard_count]; ///< Worker thread for each shard.
+	event_fn _event_fn; ///< Application event function.
+	void *_event_user_data; ///< User data passed to _event_fn.
+	volatile bool _running; ///< Cleared to make the worker threads exit.
+};
@@ -0,0 +1,223 @@
+// socket_reactor.h - Drives many non-threaded torque_sockets from a single thread.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// socket_reactor waits on the sockets of any number of non-threaded torque_sockets at once and processes each socket only when it has received data or when its next timer (see torque_socket::get_next_process_time) comes due.
+///
+/// On Linux the socket descriptors are registered with epoll, so the cost of a wait does not grow with the number of idle sockets; elsewhere the reactor falls back to select.  Events are delivered by calling the event function from whichever thread is running the reactor.  A process can run a few reactors on a few threads, each with its own set of sockets, instead of one background thread per socket.
+///
+/// Sockets must be bound before they are added, their transport must have a descriptor (see packet_transport::get_descriptor), and must not have been created with a background thread.  Sockets may be added or removed from within the event function, or while the reactor is not running; a removed socket is never touched by the reactor again, so it may be deleted as soon as remove_socket returns.
+class socket_reactor
+{
+public:
+	enum {
+		max_ready_sockets = 64, ///< Maximum number of ready sockets collected by a single wait.
+		max_wait_time = 1000, ///< Longest time in milliseconds a wait will block, even if no timers are due.
+	};
+
+	/// Called from the reactor's thread for each event on one of its sockets.
+	typedef void (*event_fn)(void *user_data, torque_socket *socket, torque_socket_event *event);
+
+	socket_reactor(event_fn the_event_fn, void *event_user_data) : _reactor_thread(this)
+	{
+		_event_fn = the_event_fn;
+		_event_user_data = event_user_data;
+		_running = false;
+		_dispatching = false;
+		_sockets_changed = false;
+		#if defined(PLATFORM_LINUX)
+			_epoll_descriptor = epoll_create1(EPOLL_CLOEXEC);
+		#endif
+	}
+
+	~socket_reactor()
+	{
+		stop();
+		#if defined(PLATFORM_LINUX)
+			if(_epoll_descriptor != -1)
+				close(_epoll_descriptor);
+		#endif
+	}
+
+	/// Adds the_socket to the set of sockets this reactor processes.  Returns false if the socket could not be registered.
+	bool add_socket(torque_socket *the_socket)
+	{
+		assert(!the_socket->is_thread_socket());
+		assert(the_socket->get_transport()->is_bound());
+		if(the_socket->get_transport()->get_descriptor() == INVALID_SOCKET)
+			return false;
+		#if defined(PLATFORM_LINUX)
+			epoll_event registration;
+			registration.events = EPOLLIN;
+			registration.data.ptr = the_socket;
+			if(epoll_ctl(_epoll_descriptor, EPOLL_CTL_ADD, the_socket->get_transport()->get_descriptor(), &registration) == -1)
+				return false;
+		#else
+			if(_sockets.size() >= FD_SETSIZE)
+				return false;
+		#endif
+		_sockets.push_back(the_socket);
+		_sockets_changed = _dispatching;
+		return true;
+	}
+
+	/// Removes the_socket from this reactor.
+	void remove_socket(torque_socket *the_socket)
+	{
+		for(uint32 i = 0; i < _sockets.size(); i++)
+		{
+			if(_sockets[i] == the_socket)
+			{
+				#if defined(PLATFORM_LINUX)
+					epoll_ctl(_epoll_descriptor, EPOLL_CTL_DEL, the_socket->get_transport()->get_descriptor(), 0);
+				#endif
+				_sockets.erase_unstable(i);
+				_sockets_changed = _dispatching;
+				return;
+			}
+		}
+	}
+
+	uint32 get_socket_count()
+	{
+		return _sockets.size();
+	}
+
+	/// Waits until one of the sockets has data or a timer is due, but at most max_wait, then processes every socket that is ready and every socket whose timer has come due.
+	void run_once(time max_wait)
+	{
+		time now = time::get_current();
+		time wait_until = now + max_wait;
+		for(uint32 i = 0; i < _sockets.size(); i++)
+		{
+			time next = _sockets[i]->get_next_process_time();
+			if(next < wait_until)
+				wait_until = next;
+		}
+		// A timer that is due has just been serviced by the previous pass (or will be by this one); wait at least a millisecond so a timer that lands exactly on the current time doesn't spin.
+		int64 wait_milliseconds = (wait_until - now).get_milliseconds();
+		if(wait_milliseconds < 1)
+			wait_milliseconds = 1;
+
+		torque_socket *ready[max_ready_sockets];
+		uint32 ready_count = _wait(wait_milliseconds, ready);
+
+		_dispatching = true;
+		_sockets_changed = false;
+		for(uint32 i = 0; i < ready_count; i++)
+		{
+			if(_sockets_changed && !_contains(ready[i]))
+				continue;
+			_dispatch(ready[i]);
+		}
+		now = time::get_current();
+		for(uint32 i = 0; i < _sockets.size(); i++)
+		{
+			if(_sockets[i]->get_next_process_time() <= now)
+			{
+				torque_socket *the_socket = _sockets[i];
+				_sockets_changed = false;
+				_dispatch(the_socket);
+				// the event function may have rearranged the socket list; restart the walk, since each socket that has been serviced is no longer due.
+				if(_sockets_changed)
+					i = uint32(-1);
+			}
+		}
+		_dispatching = false;
+	}
+
+	/// Starts a thread that runs this reactor until stop is called.
+	void start()
+	{
+		_running = true;
+		_reactor_thread.start();
+	}
+
+	/// Stops the reactor thread.  Blocks until its current pass has finished.
+	void stop()
+	{
+		if(!_running)
+			return;
+		_running = false;
+		_reactor_thread.join();
+	}
+private:
+	class reactor_thread : public thread
+	{
+		socket_reactor *_reactor;
+	public:
+		reactor_thread(socket_reactor *reactor)
+		{
+			_reactor = reactor;
+		}
+		virtual uint32 run()
+		{
+			while(_reactor->_running)
+				_reactor->run_once(time(max_wait_time));
+			return 0;
+		}
+	};
+
+	/// Processes the_socket's packets and timers, handing each resulting event to the event function.  Stops early if the event function removes the socket.
+	void _dispatch(torque_socket *the_socket)
+	{
+		torque_socket_event *event;
+		while((event = the_socket->get_next_event()) != 0)
+		{
+			_event_fn(_event_user_data, the_socket, event);
+			if(_sockets_changed && !_contains(the_socket))
+				break;
+		}
+	}
+
+	bool _contains(torque_socket *the_socket)
+	{
+		for(uint32 i = 0; i < _sockets.size(); i++)
+			if(_sockets[i] == the_socket)
+				return true;
+		return false;
+	}
+
+	/// Blocks for up to wait_milliseconds until at least one socket is readable and fills ready with the readable sockets.  Returns the number of readable sockets.
+	uint32 _wait(int64 wait_milliseconds, torque_socket **ready)
+	{
+		uint32 ready_count = 0;
+		#if defined(PLATFORM_LINUX)
+			epoll_event events[max_ready_sockets];
+			int result = epoll_wait(_epoll_descriptor, events, max_ready_sockets, int(wait_milliseconds));
+			for(int i = 0; i < result; i++)
+				ready[ready_count++] = (torque_socket *) events[i].data.ptr;
+		#else
+			fd_set read_set;
+			FD_ZERO(&read_set);
+			SOCKET max_descriptor = 0;
+			for(uint32 i = 0; i < _sockets.size(); i++)
+			{
+				SOCKET descriptor = _sockets[i]->get_transport()->get_descriptor();
+				FD_SET(descriptor, &read_set);
+				if(descriptor > max_descriptor)
+					max_descriptor = descriptor;
+			}
+			timeval tv;
+			tv.tv_sec = long(wait_milliseconds / 1000);
+			tv.tv_usec = long(wait_milliseconds % 1000) * 1000;
+			if(select(int(max_descriptor + 1), &read_set, 0, 0, &tv) > 0)
+			{
+				for(uint32 i = 0; i < _sockets.size() && ready_count < max_ready_sockets; i++)
+					if(FD_ISSET(_sockets[i]->get_transport()->get_descriptor(), &read_set))
+						ready[ready_count++] = _sockets[i];
+			}
+		#endif
+		return ready_count;
+	}
+
+	array<torque_socket *> _sockets; ///< Sockets processed by this reactor.
+	event_fn _event_fn; ///< Application event function.
+	void *_event_user_data; ///< User data passed to _event_fn.
+	reactor_thread _reactor_thread; ///< Thread running the reactor between start and stop.
+	volatile bool _running; ///< Cleared to make the reactor thread exit.
+	bool _dispatching; ///< True while run_once is processing sockets.
+	bool _sockets_changed; ///< Set if a socket is added or removed while dispatching, so that cached socket pointers are checked before they are used.
+	#if defined(PLATFORM_LINUX)
+		int _epoll_descriptor; ///< epoll instance the sockets' descriptors are registered with.
+	#endif
+};
@@ -1,5 +1,6 @@
 /// Class for symmetric encryption of data across a connection.  Internally it uses
-/// the libtomcrypt AES algorithm to encrypt the data.
+/// AES, with the AES-NI instructions where aes_hardware says the processor has them
+/// and libtomcrypt's portable implementation otherwise.
 
 class symmetric_cipher : public ref_object
 {
@@ -20,14 +21,53 @@ class symmetric_cipher : public ref_object
 	uint8 _pad[block_size];
 	
 	key _symmetric_key;
+	aes_hardware::key_schedule _hardware_key; ///< The expanded key, if _hardware is set.
+	bool _hardware; ///< True if blocks are encrypted with the AES-NI instructions.
 	uint32 _pad_len;
+	
+	void _setup_key(const uint8 key[key_size])
+	{
+		_hardware = aes_hardware::is_available();
+#ifdef CPU_X86_INTRINSICS
+		if(_hardware)
+		{
+			aes_hardware::expand_key(key, &_hardware_key);
+			return;
+		}
+#endif
+		rijndael_setup(key, key_size, 0, (symmetric_key *) &_symmetric_key);
+	}
+	
+	void _encrypt_block(const uint8 in[block_size], uint8 out[block_size])
+	{
+#ifdef CPU_X86_INTRINSICS
+		if(_hardware)
+		{
+			aes_hardware::encrypt_block(in, out, _hardware_key);
+			return;
+		}
+#endif
+		rijndael_ecb_encrypt(in, out, (symmetric_key *) &_symmetric_key);
+	}
 	public:
 	symmetric_cipher(const uint8 key[key_size], const uint8 init_vector[block_size])
 	{
-		rijndael_setup(key, key_size, 0, (symmetric_key *) &_symmetric_key);
+		_setup_key(key);
 		memcpy(_init_vector, init_vector, block_size);
 		memcpy(_counter, init_vector, block_size);
-		rijndael_ecb_encrypt((uint8 *) _counter, _pad, (symmetric_key *) &_symmetric_key);
+		_encrypt_block((uint8 *) _counter, _pad);
+		_pad_len = 0;
+	}
+	
+	/// Starts a new cipher with the key and init vector of the_cipher, without expanding the key again.  Used to encrypt or decrypt a packet with a connection's shared secret, since a cipher's state moves on as it is used.
+	symmetric_cipher(const symmetric_cipher &the_cipher) : ref_object()
+	{
+		_symmetric_key = the_cipher._symmetric_key;
+		_hardware_key = the_cipher._hardware_key;
+		_hardware = the_cipher._hardware;
+		memcpy(_init_vector, the_cipher._init_vector, block_size);
+		memcpy(_counter, _init_vector, block_size);
+		_encrypt_block((uint8 *) _counter, _pad);
 		_pad_len = 0;
 	}
 
@@ -37,16 +77,16 @@ class symmetric_cipher : public ref_object
 		{
 			uint8 buffer[key_size];
 			memset(buffer, 0, key_size);
-			rijndael_setup(buffer, key_size, 0, (symmetric_key *) &_symmetric_key);
+			_setup_key(buffer);
 			memcpy(_init_vector, buffer, block_size);
 		}
 		else
 		{
-			rijndael_setup(the_bytes->get_buffer(), key_size, 0, (symmetric_key *) &_symmetric_key);
+			_setup_key(the_bytes->get_buffer());
 			memcpy(_init_vector, the_bytes->get_buffer() + key_size, block_size);
 		}
 		memcpy(_counter, _init_vector, block_size);
-		rijndael_ecb_encrypt((uint8 *) _counter, _pad, (symmetric_key *) &_symmetric_key);
+		_encrypt_block((uint8 *) _counter, _pad);
 		_pad_len = 0;
 	}
 	void get_init_vector(uint8 iv[block_size])
@@ -70,38 +110,52 @@ class symmetric_cipher : public ref_object
 		for(uint32 i = 0; i < 4; i++)
 			host_to_little_endian(_counter[i]);
 
-		rijndael_ecb_encrypt((uint8 *) _counter, _pad, (symmetric_key *) &_symmetric_key);
+		_encrypt_block((uint8 *) _counter, _pad);
 		_pad_len = 0;
 	}
 
 	void encrypt(const uint8 *plain_text, uint8 *cipher_text, uint32 len)
 	{
-		while(len-- > 0)
+		while(len > 0)
 		{
 			if(_pad_len == block_size)
 			{
 				// we've reached the end of the pad, so compute a new pad
-				rijndael_ecb_encrypt(_pad, _pad, (symmetric_key *) &_symmetric_key);
+				_encrypt_block(_pad, _pad);
 				_pad_len = 0;
 			}
-			uint8 encrypted_char = *plain_text++ ^ _pad[_pad_len];
-			_pad[_pad_len++] = *cipher_text++ = encrypted_char;
+			// the rest of the pad is used a run at a time, so the loop runs without a branch per byte.
+			uint32 count = block_size - _pad_len < len ? block_size - _pad_len : len;
+			for(uint32 i = 0; i < count; i++)
+				_pad[_pad_len + i] = cipher_text[i] = plain_text[i] ^ _pad[_pad_len + i];
+			_pad_len += count;
+			plain_text += count;
+			cipher_text += count;
+			len -= count;
 		}
 	}
 
 
 	void decrypt(const uint8 *cipher_text, uint8 *plain_text, uint32 len)
 	{
-		while(len-- > 0)
+		while(len > 0)
 		{
 			if(_pad_len == block_size)
 			{
-				rijndael_ecb_encrypt(_pad, _pad, (symmetric_key *) &_symmetric_key);
+				_encrypt_block(_pad, _pad);
 				_pad_len = 0;
 			}
-			uint8 encrypted_char = *cipher_text++;
-			*plain_text++ = encrypted_char ^ _pad[_pad_len];
-			_pad[_pad_len++] = encrypted_char;
+			uint32 count = block_size - _pad_len < len ? block_size - _pad_len : len;
+			for(uint32 i = 0; i < count; i++)
+			{
+				uint8 encrypted_char = cipher_text[i];
+				plain_text[i] = encrypted_char ^ _pad[_pad_len + i];
+				_pad[_pad_len + i] = encrypted_char;
+			}
+			_pad_len += count;
+			plain_text += count;
+			cipher_text += count;
+			len -= count;
 		}
 	}
 };
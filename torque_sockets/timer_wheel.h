@@ -0,0 +1,262 @@
+// timer_wheel.h - Hierarchical timing wheel for protocol timers.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// timer_wheel holds any number of timers and hands them back as they expire, at a cost per timer that doesn't depend on how many others are scheduled.
+///
+/// The wheel ticks once per millisecond.  A timer due within slot_count ticks is kept in the level 0 slot for its tick; a timer due further out is kept in a coarser slot of a higher level, each of which spans slot_count slots of the level below, and is moved down a level each time the wheel turns past the start of its slot.  Scheduling and cancelling are constant time, and advancing the wheel costs a constant amount per tick plus one move per level a timer passes through.  Timers further out than the top level can represent are parked in its last slot and re-filed until they come within range.
+///
+/// Objects with timed work derive from timer_wheel::timer, passing a type tag that tells the code draining the wheel what to cast an expired timer to; a timer cancels itself when destroyed.  Timers expiring on the same tick are returned in the order they were scheduled.
+class timer_wheel
+{
+public:
+	enum {
+		slot_bits = 6,
+		slot_count = 1 << slot_bits, ///< Slots per level.
+		slot_mask = slot_count - 1,
+		level_count = 4, ///< Levels; the wheel spans slot_count ^ level_count milliseconds, about four and a half hours.
+	};
+
+	/// A timer that can be scheduled on a timer_wheel.
+	class timer
+	{
+		friend class timer_wheel;
+		timer *_next; ///< Next timer in the slot this timer is filed in.
+		timer *_prev; ///< Previous timer in the slot this timer is filed in.
+		timer_wheel *_wheel; ///< Wheel this timer is scheduled on, or NULL.
+		int64 _expire_tick; ///< Tick (millisecond) at which this timer expires.
+		uint32 _level; ///< Level this timer is filed in, or level_count while it waits in the expired list.
+		uint32 _timer_type; ///< Tag the owner of the wheel uses to tell what kind of object an expired timer belongs to.
+	public:
+		timer(uint32 timer_type = 0)
+		{
+			_timer_type = timer_type;
+			_next = _prev = 0;
+			_wheel = 0;
+			_expire_tick = 0;
+			_level = 0;
+		}
+
+		~timer()
+		{
+			cancel();
+		}
+
+		/// Returns true if this timer is scheduled and hasn't been returned by get_next_expired yet.
+		bool is_scheduled() const
+		{
+			return _wheel != 0;
+		}
+
+		uint32 get_timer_type() const
+		{
+			return _timer_type;
+		}
+
+		/// Returns the time this timer was last scheduled to expire.
+		time get_expire_time() const
+		{
+			return time(_expire_tick);
+		}
+
+		/// Removes this timer from its wheel, if it's scheduled.
+		void cancel()
+		{
+			if(_wheel)
+				_wheel->_remove(this);
+		}
+	};
+
+	/// Constructs an empty wheel whose first tick is start_time.
+	timer_wheel(time start_time)
+	{
+		_current_tick = start_time.get_milliseconds();
+		_timer_count = 0;
+		for(uint32 level = 0; level <= level_count; level++)
+			_level_timer_count[level] = 0;
+		for(uint32 level = 0; level < level_count; level++)
+			for(uint32 slot = 0; slot < slot_count; slot++)
+				_make_empty(&_slots[level][slot]);
+		_make_empty(&_expired);
+	}
+
+	~timer_wheel()
+	{
+		// timers outliving the wheel must not try to unlink themselves from it.
+		for(uint32 level = 0; level < level_count; level++)
+			for(uint32 slot = 0; slot < slot_count; slot++)
+				_orphan(&_slots[level][slot]);
+		_orphan(&_expired);
+	}
+
+	/// Schedules the_timer to expire at expire_time, rescheduling it if it's already scheduled.  A time at or before the wheel's current tick expires on the next call to get_next_expired.
+	void schedule(timer *the_timer, time expire_time)
+	{
+		if(the_timer->_wheel)
+			the_timer->_wheel->_remove(the_timer);
+		the_timer->_wheel = this;
+		the_timer->_expire_tick = expire_time.get_milliseconds();
+		_timer_count++;
+		_file(the_timer);
+	}
+
+	/// Turns the wheel up to current_time and returns the next timer that has expired, or NULL if none have.  The returned timer is no longer scheduled.  Timers may be scheduled and cancelled between calls, including the ones that have expired but not yet been returned.
+	timer *get_next_expired(time current_time)
+	{
+		int64 current_tick = current_time.get_milliseconds();
+		while(_is_empty(&_expired) && _current_tick <= current_tick)
+		{
+			if(!_timer_count)
+				_current_tick = current_tick + 1;
+			else if(!_level_timer_count[0] && (_current_tick & slot_mask))
+			{
+				// nothing is filed at level 0, so nothing can happen before the next tick that cascades the higher levels.
+				int64 next_cascade = (_current_tick | slot_mask) + 1;
+				_current_tick = next_cascade < current_tick + 1 ? next_cascade : current_tick + 1;
+			}
+			else
+				_turn();
+		}
+		if(_is_empty(&_expired))
+			return 0;
+		timer *the_timer = _expired._next;
+		_remove(the_timer);
+		return the_timer;
+	}
+
+	/// Returns a time no later than the earliest scheduled expiration, or no_later_than if that's sooner or nothing is scheduled.  Timers in the higher levels report the tick at which they'll be moved down a level, so the result may be earlier than the timer itself; waking then just lets the wheel turn.
+	time get_next_expire_time(time no_later_than)
+	{
+		int64 next = no_later_than.get_milliseconds();
+		if(!_timer_count)
+			return no_later_than;
+		if(!_is_empty(&_expired))
+			return time(_current_tick - 1 < next ? _current_tick - 1 : next);
+		for(uint32 offset = 0; offset < slot_count; offset++)
+		{
+			if(!_is_empty(&_slots[0][(_current_tick + offset) & slot_mask]))
+			{
+				if(_current_tick + offset < next)
+					next = _current_tick + offset;
+				break;
+			}
+		}
+		for(uint32 level = 1; level < level_count; level++)
+		{
+			uint32 shift = level * slot_bits;
+			int64 level_tick = _current_tick >> shift;
+			// if the current tick starts a slot at this level, that slot hasn't been moved down yet.
+			uint32 first_offset = (_current_tick & ((int64(1) << shift) - 1)) ? 1 : 0;
+			for(uint32 offset = first_offset; offset < first_offset + slot_count; offset++)
+			{
+				if(!_is_empty(&_slots[level][(level_tick + offset) & slot_mask]))
+				{
+					int64 cascade_tick = (level_tick + offset) << shift;
+					if(cascade_tick < next)
+						next = cascade_tick;
+					break;
+				}
+			}
+		}
+		return time(next);
+	}
+
+	/// Returns the number of scheduled timers.
+	uint32 get_timer_count()
+	{
+		return _timer_count;
+	}
+private:
+	static void _make_empty(timer *list)
+	{
+		list->_next = list->_prev = list;
+	}
+
+	static bool _is_empty(timer *list)
+	{
+		return list->_next == list;
+	}
+
+	static void _append(timer *list, timer *the_timer)
+	{
+		the_timer->_prev = list->_prev;
+		the_timer->_next = list;
+		list->_prev->_next = the_timer;
+		list->_prev = the_timer;
+	}
+
+	static void _orphan(timer *list)
+	{
+		for(timer *walk = list->_next; walk != list; walk = walk->_next)
+			walk->_wheel = 0;
+	}
+
+	/// Files the_timer in the slot for its expire tick relative to the current tick.
+	void _file(timer *the_timer)
+	{
+		int64 delta = the_timer->_expire_tick - _current_tick;
+		int64 tick = the_timer->_expire_tick;
+		if(delta < 0)
+			tick = _current_tick;
+		else if(delta >= (int64(1) << (slot_bits * level_count)))
+			tick = _current_tick + (int64(1) << (slot_bits * level_count)) - 1;
+
+		uint32 level = 0;
+		while(level < level_count - 1 && tick - _current_tick >= (int64(1) << (slot_bits * (level + 1))))
+			level++;
+		the_timer->_level = level;
+		_level_timer_count[level]++;
+		_append(&_slots[level][(tick >> (slot_bits * level)) & slot_mask], the_timer);
+	}
+
+	void _remove(timer *the_timer)
+	{
+		the_timer->_prev->_next = the_timer->_next;
+		the_timer->_next->_prev = the_timer->_prev;
+		the_timer->_next = the_timer->_prev = 0;
+		the_timer->_wheel = 0;
+		_level_timer_count[the_timer->_level]--;
+		_timer_count--;
+	}
+
+	/// Processes the current tick: moves any higher level slots that start on this tick down the wheel, moves the timers due on this tick to the expired list, and advances to the next tick.
+	void _turn()
+	{
+		if(!(_current_tick & slot_mask))
+		{
+			for(uint32 level = 1; level < level_count; level++)
+			{
+				uint32 index = uint32((_current_tick >> (slot_bits * level)) & slot_mask);
+				timer *slot = &_slots[level][index];
+				while(!_is_empty(slot))
+				{
+					timer *the_timer = slot->_next;
+					the_timer->_prev->_next = the_timer->_next;
+					the_timer->_next->_prev = the_timer->_prev;
+					_level_timer_count[level]--;
+					_file(the_timer);
+				}
+				// the next level only turns over when this one wraps.
+				if(index)
+					break;
+			}
+		}
+		timer *slot = &_slots[0][_current_tick & slot_mask];
+		while(!_is_empty(slot))
+		{
+			timer *the_timer = slot->_next;
+			the_timer->_prev->_next = the_timer->_next;
+			the_timer->_next->_prev = the_timer->_prev;
+			_level_timer_count[0]--;
+			the_timer->_level = level_count;
+			_level_timer_count[level_count]++;
+			_append(&_expired, the_timer);
+		}
+		_current_tick++;
+	}
+
+	int64 _current_tick; ///< Next tick to be processed.
+	uint32 _timer_count; ///< Number of scheduled timers, including expired timers not yet returned.
+	uint32 _level_timer_count[level_count + 1]; ///< Number of timers filed in each level, plus the expired list.
+	timer _slots[level_count][slot_count]; ///< Circular list heads of the timers filed in each slot.
+	timer _expired; ///< Circular list head of the timers that have expired but haven't been returned.
+};
@@ -1,6 +1,6 @@
 /// torque_connection class that manages an individual data connection in torque sockets. It implements a notification protocol on the unreliable packet transport of UDP.  torque_connection manages the flow of packets over the network, and posts torque_socket_event events to the torque_socket event queue for data packets and packet delivery notification.
 
-class torque_connection
+class torque_connection : public timer_wheel::timer
 {
 public:
 	torque_connection *_next; ///< next connection in the doubly-linked list of connections on a socket.
@@ -16,25 +16,47 @@ public:
 		// sequence_number_bit_size bits - sequence number
 		// ack_sequence_number_bit_size bits - high ack sequence received
 		// these values should be set to align to a byte boundary, otherwise
-		// bits will just be wasted.
+		// bits will just be wasted.  The sequence number windows must be
+		// comfortably larger than max_packet_window_size so that stale packets
+		// can't be mistaken for new ones.
 		
-		max_packet_window_size_shift = 5, ///< Packet window size is 2^max_packet_window_size_shift.
+		max_packet_window_size_shift = 10, ///< The largest packet window is 2^max_packet_window_size_shift packets.
 		max_packet_window_size = (1 << max_packet_window_size_shift), ///< Maximum number of packets in the packet window.
-		packet_window_mask = max_packet_window_size - 1, ///< Mask for accessing the packet window.
-		max_ack_mask_size = 1 << (max_packet_window_size_shift - 5), ///< Each ack word can ack 32 packets.
-		max_ack_byte_count = max_ack_mask_size << 2, ///< The maximum number of ack bytes sent in each packet.
-		sequence_number_bit_size = 11, ///< Bit size of the send and sequence number.
+		min_packet_window_size = 8, ///< Smallest packet window a connection will negotiate.
+		default_packet_window_size = 32, ///< Packet window a torque_socket asks for unless it's told otherwise.
+		max_ack_mask_size = max_packet_window_size >> 5, ///< Each ack word can ack 32 packets.
+		sack_run_group_bits = 4, ///< Selective ack run lengths are sent in groups of this many bits, each followed by a continuation bit.
+		sack_run_group_mask = (1 << sack_run_group_bits) - 1,
+		sequence_number_bit_size = 15, ///< Bit size of the send and sequence number.
 		sequence_number_window_size = (1 << sequence_number_bit_size), ///< Size of the send sequence number window.
 		sequence_number_mask = -sequence_number_window_size, ///< Mask used to reconstruct the full send sequence number of the packet from the partial sequence number sent.
-		ack_sequence_number_bit_size = 10, ///< Bit size of the ack receive sequence number.
+		ack_sequence_number_bit_size = 14, ///< Bit size of the ack receive sequence number.
 		ack_sequence_number_window_size = (1 << ack_sequence_number_bit_size), ///< Size of the ack receive sequence number window.
 		ack_sequence_number_mask = -ack_sequence_number_window_size, ///< Mask used to reconstruct the full ack receive sequence number of the packet from the partial sequence number sent.
 		
-		packet_header_bit_size = 3 + ack_sequence_number_bit_size + sequence_number_bit_size, ///< Size, in bits, of the packet header sequence number section
+		connection_id_bit_size = 32, ///< Bit size of the connection id, the id the receiving torque_socket gave the connection, that every packet header carries.
+		packet_header_bit_size = 3 + ack_sequence_number_bit_size + sequence_number_bit_size + connection_id_bit_size, ///< Size, in bits, of the packet header sequence number and connection id section
 		packet_header_byte_size = (packet_header_bit_size + 7) >> 3, ///< Size, in bytes, of the packet header sequence number information
 		packet_header_pad_bits = (packet_header_byte_size << 3) - packet_header_bit_size, ///< Padding bits to get header bytes to align on a byte boundary, for encryption purposes.
 		
 		message_signature_bytes = 5, ///< Special data bytes written into the end of the packet to guarantee data consistency
+		
+		packet_number_bit_size = 16, ///< Bit size of the packet number that follows the header of a sealed packet: the low bits of a count of every packet sent, from which the GCM nonce is made.
+		packet_number_window_size = (1 << packet_number_bit_size), ///< Size of the packet number window.
+		sealed_header_byte_size = packet_header_byte_size + (packet_number_bit_size >> 3), ///< Bytes at the start of a sealed packet that are authenticated but not encrypted.
+		replay_window_size = 1024, ///< Packet numbers behind the newest authenticated one that are tracked, so each is accepted once; older ones are discarded.
+		max_packet_body_byte_size = torque_sockets_max_datagram_size + 2, ///< Largest data packet body after the acks: the largest datagram the API accepts, behind its flag bits and alignment.  Stream messages only take the room left.
+		max_ack_bit_size = (packet_transport::max_datagram_size - packet_cipher::tag_size - sealed_header_byte_size - max_packet_body_byte_size) * 8, ///< Bits a data packet always has for its acks.
+		ack_delay_bit_size = 8, ///< Bit size of the milliseconds the newest packet acked waited for its ack; a longer wait isn't reported, and its ack gives no round trip measurement.
+		max_ack_flag_bit_size = max_ack_bit_size - 4 - ack_delay_bit_size - 2 * (max_packet_window_size_shift + 1), ///< Ack flags that fit in max_ack_bit_size beside the ack and pending counts, the ack delay and the format bits.
+		path_challenge_slot_count = 8, ///< Path challenges a connection keeps outstanding at once, each to a different address, chosen by the address's hash.
+	};
+	/// A challenge sent to a new address packets for this connection have arrived from.
+	struct path_challenge
+	{
+		nonce challenge; ///< Random value the remote host must return encrypted with the shared secret before the connection moves to challenge_address.
+		address challenge_address; ///< The address challenge was sent to.
+		time send_time; ///< When challenge was sent, or 0 if the slot is free.
 	};
 	enum net_packet_type
 	{
@@ -42,6 +64,7 @@ public:
 		ping_packet, ///< Ping packet, sent if this instance hasn't heard from the remote host for a while.  Sending a
 		///  ping packet does not increment the packet sequence number.
 		ack_packet,  ///< Packet sent in response to a ping packet.  Sending an ack packet does not increment the sequence number.
+		fec_parity_packet, ///< Parity over the bodies of a group of data packets, from which the remote host can rebuild any one of them that was lost.  Sending a parity packet does not increment the sequence number.
 		invalid_packet_type,
 	};
 	/// Constants controlling the behavior of pings and timeouts
@@ -49,9 +72,46 @@ public:
 		default_ping_timeout = 5000,  ///< Default milliseconds to wait before sending a ping packet.
 		default_ping_retry_count = 5, ///< Default number of unacknowledged pings to send before timing out.
 	};
+	/// Constants controlling acknowledgement and send pacing
+	enum flow_constants {
+		ack_data_packet_interval = 2, ///< Data packets received without sending anything back before an ack packet is sent, if acks aren't delayed, so a sender limited by its congestion window keeps hearing back.
+		default_ack_delay = 5, ///< Milliseconds acks for received data packets wait for an outgoing packet to carry them before an ack packet is sent.
+		max_delayed_ack_packets = 8, ///< Data packets received without sending anything back before an ack packet is sent, even while acks are delayed.
+		initial_reorder_delay = 25, ///< Milliseconds a missing packet is waited for, with a reorder window, until the round trip time has been measured.
+		min_pacing_burst = 2, ///< Packets a paced connection may always send back to back.
+		pacing_burst_time = 2, ///< Milliseconds of sends at the pacing rate a paced connection may send back to back.
+		initial_ack_probe_timeout = 1000, ///< Milliseconds to wait for acks before probing for them, until the round trip time has been measured.
+		min_ack_probe_timeout = 100, ///< Shortest wait for acks before probing for them.
+		default_send_queue_limit = 65536, ///< Bytes of data a connection queues while its window is full before refusing more.
+		max_coalesced_datagram_size = 256, ///< Largest datagram held for coalescing; larger ones gain little from sharing a packet and are sent on their own.
+	};
+	/// Constants controlling forward error correction.  A connection that negotiates it byte aligns the header of its data packets, so each packet's body is a whole number of bytes, and follows every group of data packets with a parity packet: the XOR of their bodies and of their body sizes.
+	enum fec_constants {
+		max_fec_group_size = 16, ///< Most data packets one parity packet covers.
+		fec_group_size_bit_size = 4, ///< Bits in a parity packet's count of the data packets it covers, less one.
+		max_fec_body_size = 1024, ///< Largest data packet body covered by parity; a larger one ends the group before it and goes unprotected.
+		fec_body_size_bit_size = 11, ///< Bits in a parity packet's XOR of body sizes.
+		fec_history_size = 2 * max_fec_group_size, ///< Bodies of recent data packets a receiver keeps for rebuilding a lost one.
+		fec_group_timeout = 20, ///< Milliseconds after a group's first data packet that its parity is sent, however few packets it holds.
+		fec_target_loss_percent = 1, ///< Loss, after recovery, above which groups shrink, and a quarter of which they grow below.
+		fec_loss_rate_window = 64, ///< Data packets the loss rate steering group size is averaged over.
+	};
+	/// Constants controlling reliable message streams.  Each data packet carries, after its header, a flag saying whether it holds a datagram and, if it does, a flag saying whether that is several coalesced ones, then any number of stream messages each preceded by a 1 bit, then a 0 bit.  The datagram, or the length-prefixed coalesced datagrams, follow on the next byte boundary.
+	enum stream_constants {
+		stream_index_bit_size = 4, ///< Bits used to send a message's stream index.
+		max_message_streams = torque_sockets_max_message_streams, ///< Reliable ordered streams on each connection.
+		max_stream_message_size = torque_sockets_max_stream_message_size, ///< Largest message, or fragment of a larger one, a stream puts in a packet; small enough to fit behind the largest header.
+		stream_message_size_bit_size = 11, ///< Bits used to send a message's size.
+		fragment_index_bit_size = 10, ///< Bits used to send a fragment's index and its message's fragment count.
+		max_message_size = torque_sockets_max_message_size, ///< Largest message a stream will fragment and reassemble.
+		stream_message_header_bit_size = 2 + stream_index_bit_size + message_stream::sequence_bit_size + stream_message_size_bit_size, ///< Bits written ahead of each message's data.
+		stream_fragment_header_bit_size = stream_message_header_bit_size + 2 * fragment_index_bit_size, ///< Bits written ahead of each fragment's data.
+		default_reassembly_limit = 4194304, ///< Bytes a connection will hold for messages received out of order or still being reassembled.
+		default_reassembly_timeout = 30000, ///< Milliseconds a message being reassembled may go without a new fragment.
+	};
 protected:
-	/// Reads a raw packet from a bit_stream, as dispatched from torque_socket.
-	bool read_raw_packet(bit_stream &bstream)
+	/// Reads a raw packet from a bit_stream, as dispatched from torque_socket.  is_opened is true if the packet was sealed and authenticate_packet has already opened it.
+	bool read_raw_packet(bit_stream &bstream, bool is_opened = false)
 	{
 		if(_simulated_packet_loss && _torque_socket->random().random_unit_float() < _simulated_packet_loss)
 		{
@@ -60,35 +120,196 @@ protected:
 		}
 		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: RECV bytes", _connection_index));
 		
-		if(read_packet_header(bstream))
+		if(read_packet_header(bstream, is_opened))
 		{
-			torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_event_type);
-			event->packet_sequence = get_last_received_sequence();
-			event->connection = get_connection_index();
-			event->data_size = bstream.get_stream_byte_size() - bstream.get_byte_position();
-			event->data = _torque_socket->_event_queue.allocate_queue_data(event->data_size);
-			memcpy(event->data, bstream.get_buffer() + bstream.get_byte_position(), event->data_size);
-			return true;
+			// the body of a data packet on a connection with forward error correction starts on a byte boundary, and is kept in case a later parity packet is needed to rebuild a packet lost near it.
+			if(_fec_history)
+				_store_fec_body(_received_packet_seq, bstream.get_buffer() + bstream.get_byte_position(), bstream.get_stream_byte_size() - bstream.get_byte_position());
+			return _read_packet_body(bstream);
 		}
 		return false;
 	}
 	
-	/// Sends a packet that was written into a bit_stream to the remote host, or the _remote_connection on this host.
-	void send_packet(net_packet_type packet_type, uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	/// Reads the body of a data packet, after its header: its stream messages and datagrams, posting events for them.
+	bool _read_packet_body(bit_stream &bstream)
+	{
+		bool has_datagram = bstream.read_bool();
+		bool is_coalesced = has_datagram && bstream.read_bool();
+		uint32 received_streams = 0;
+		while(bstream.read_bool())
+		{
+			uint32 stream_index = bstream.read_integer(stream_index_bit_size);
+			uint32 wire_sequence = bstream.read_integer(message_stream::sequence_bit_size);
+			uint32 size = bstream.read_integer(stream_message_size_bit_size);
+			uint32 fragment_index = 0;
+			uint32 fragment_count = 1;
+			bool is_fragment = bstream.read_bool();
+			if(is_fragment)
+			{
+				fragment_index = bstream.read_integer(fragment_index_bit_size);
+				fragment_count = bstream.read_integer(fragment_index_bit_size);
+			}
+			if(size > max_stream_message_size || bstream.get_bit_space_available() < size * 8 || (is_fragment && (fragment_count < 2 || (fragment_count - 1) * max_stream_message_size >= max_message_size)))
+			{
+				TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: bad stream message", _connection_index));
+				return false;
+			}
+			uint8 message_data[max_stream_message_size];
+			bstream.read_bytes(message_data, size);
+			uint32 received_bytes = _get_received_stream_bytes();
+			uint32 byte_limit = received_bytes < _reassembly_limit ? _reassembly_limit - received_bytes : 0;
+			if(!_message_streams[stream_index].receive_message(stream_index, wire_sequence, message_data, size, fragment_index, fragment_count, max_stream_message_size, _torque_socket->get_process_start_time(), byte_limit))
+			{
+				TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: stream reassembly failed", _connection_index));
+				_reassembly_failed = true;
+				return false;
+			}
+			received_streams |= 1 << stream_index;
+		}
+		bstream.advance_to_next_byte();
+		for(uint32 stream_index = 0; received_streams; stream_index++, received_streams >>= 1)
+			if(received_streams & 1)
+				_post_stream_messages(stream_index);
+		if(!has_datagram)
+			return true;
+		
+		uint8 *data = bstream.get_buffer() + bstream.get_byte_position();
+		uint32 data_size = bstream.get_stream_byte_size() - bstream.get_byte_position();
+		if(!is_coalesced)
+		{
+			_post_datagram(data, data_size);
+			return true;
+		}
+		// coalesced datagrams are each prefixed with their size, in one byte below 0x80 or two bytes with the high bit of the first set; check them all before posting any.
+		for(uint32 offset = 0; offset < data_size; )
+		{
+			uint32 prefix_size = data[offset] & 0x80 ? 2 : 1;
+			if(offset + prefix_size > data_size || offset + prefix_size + _read_coalesced_size(data + offset) > data_size)
+			{
+				TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: bad coalesced datagram", _connection_index));
+				return false;
+			}
+			offset += prefix_size + _read_coalesced_size(data + offset);
+		}
+		while(data_size)
+		{
+			uint32 prefix_size = data[0] & 0x80 ? 2 : 1;
+			uint32 size = _read_coalesced_size(data);
+			_post_datagram(data + prefix_size, size);
+			data += prefix_size + size;
+			data_size -= prefix_size + size;
+		}
+		return true;
+	}
+	
+	/// Posts a torque_connection_packet_event_type event for a datagram in the packet just received.
+	void _post_datagram(uint8 *data, uint32 data_size)
+	{
+		torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_event_type);
+		event->packet_sequence = _received_packet_seq;
+		event->connection = get_connection_index();
+		event->data_size = data_size;
+		event->data = _torque_socket->_event_queue.allocate_queue_data(data_size);
+		memcpy(event->data, data, data_size);
+	}
+	
+	/// Returns the size in the length prefix of a coalesced datagram.
+	static uint32 _read_coalesced_size(const uint8 *prefix)
+	{
+		return prefix[0] & 0x80 ? ((prefix[0] & 0x7F) << 8) | prefix[1] : prefix[0];
+	}
+	
+	/// Posts a torque_connection_stream_message_event_type event for each message on the stream that is now next in order.
+	void _post_stream_messages(uint32 stream_index)
+	{
+		stream_message *the_message;
+		while((the_message = _message_streams[stream_index].get_next_received()) != 0)
+		{
+			torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_stream_message_event_type, _connection_index);
+			event->stream_index = stream_index;
+			event->packet_sequence = the_message->sequence;
+			_torque_socket->_event_queue.set_event_data(event, the_message->data, the_message->size);
+			stream_message::destroy(the_message);
+		}
+	}
+	
+	/// Writes as many unsent stream messages as fit in the packet, leaving room for reserved_bytes of datagram, and links them into packet_messages, the list of messages carried by the packet being sent.  Streams take turns going first, so one busy stream can't starve the others.
+	void _write_stream_messages(bit_stream &stream, stream_message **packet_messages, uint32 reserved_bytes)
+	{
+		// room for the terminating bit and alignment, plus the tag the packet may be sealed with.
+		uint32 bit_end = (packet_transport::max_datagram_size - reserved_bytes - packet_cipher::tag_size - 1) * 8;
+		uint32 bit_position = uint32(stream.get_bit_position());
+		for(uint32 i = 0; i < max_message_streams; i++)
+		{
+			uint32 stream_index = (_next_stream_index + i) & (max_message_streams - 1);
+			message_stream &the_stream = _message_streams[stream_index];
+			stream_message *the_message;
+			while((the_message = the_stream.get_next_unsent()) != 0)
+			{
+				uint32 message_bits = (the_message->fragment_count > 1 ? stream_fragment_header_bit_size : stream_message_header_bit_size) + the_message->size * 8;
+				if(bit_position + message_bits > bit_end)
+					break;
+				stream.write_bool(true);
+				stream.write_integer(stream_index, stream_index_bit_size);
+				stream.write_integer(the_message->sequence, message_stream::sequence_bit_size);
+				stream.write_integer(the_message->size, stream_message_size_bit_size);
+				if(stream.write_bool(the_message->fragment_count > 1))
+				{
+					stream.write_integer(the_message->fragment_index, fragment_index_bit_size);
+					stream.write_integer(the_message->fragment_count, fragment_index_bit_size);
+				}
+				stream.write_bytes(the_message->data, the_message->size);
+				bit_position += message_bits;
+				the_stream.mark_sent(the_message);
+				the_message->next_in_packet = *packet_messages;
+				*packet_messages = the_message;
+			}
+		}
+		stream.write_bool(false);
+		_next_stream_index = (_next_stream_index + 1) & (max_message_streams - 1);
+	}
+	
+	/// Sends a packet that was written into a bit_stream to the remote host, or the _remote_connection on this host.  Data packets also carry whatever unsent stream messages fit.  datagram_count is the number of the application's datagrams in data: a data packet sent with none carries only stream messages, and one sent with more than one carries them coalesced, each behind its length prefix.  Returns false, sending nothing, if the packet overflowed its buffer; a data packet that does is notified as dropped.
+	bool send_packet(net_packet_type packet_type, uint8 *data, uint32 data_size, uint32 *sequence = 0, uint32 datagram_count = 1)
 	{
 		packet_stream ps;
 		write_packet_header(ps, packet_type);
+		uint32 body_start = ps.get_next_byte_position();
 		if(packet_type == data_packet)
 		{
+			sent_packet_record &record = _sent_packets[_last_send_seq & (_packet_window_size - 1)];
+			record.datagram_count = datagram_count;
+			record.messages = 0;
+			if(ps.write_bool(datagram_count != 0))
+				ps.write_bool(datagram_count > 1);
+			_write_stream_messages(ps, &record.messages, datagram_count ? data_size : 0);
+			ps.advance_to_next_byte();
+			
 			int32 start = ps.get_bit_position();
 			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: START", _connection_index) );
 			ps.write_bytes(data, data_size);
 			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: END - %llu bits", _connection_index, ps.get_bit_position() - start) );			
+			
+			// a body too big for parity to cover ends the group before it.
+			uint32 body_size = ps.get_next_byte_position() - body_start;
+			if(_fec_min_group_size && body_size <= max_fec_body_size)
+				_add_to_fec_group(ps.get_buffer() + body_start, body_size);
+		}
+		else if(packet_type == fec_parity_packet)
+		{
+			ps.write_integer(_fec_group_count - 1, fec_group_size_bit_size);
+			ps.write_bool(_fec_group_last != _last_send_seq);
+			ps.write_integer(_fec_length_xor, fec_body_size_bit_size);
+			ps.advance_to_next_byte();
+			ps.write_bytes(data, data_size);
 		}
-		if(!_symmetric_cipher.is_null())
+		if(_packet_cipher)
 		{
-			_symmetric_cipher->setup_counter(_last_send_seq, _last_seq_recvd, packet_type, 0);
-			// bit_stream_hash_and_encrypt(ps, message_signature_bytes, packet_header_byte_size, _symmetric_cipher);
+			uint32 packet_size = ps.get_next_byte_position();
+			uint8 tag[packet_cipher::tag_size];
+			_packet_cipher->seal(_send_packet_number, ps.get_buffer(), sealed_header_byte_size, packet_size, tag);
+			ps.set_byte_position(packet_size);
+			ps.write_bytes(tag, packet_cipher::tag_size);
 		}
 		if(_simulated_packet_loss && _torque_socket->random().random_unit_float() < _simulated_packet_loss)
 		{
@@ -97,6 +318,12 @@ protected:
 		
 		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: SEND - %d bytes", _connection_index, ps.get_next_byte_position()));
 		
+		if(ps.was_error_detected())
+		{
+			// the truncated packet would only fail the remote host's checks.
+			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: packet overflowed its buffer, not sent", _connection_index));
+			return false;
+		}
 		if(_simulated_latency)
 		{
 			_torque_socket->send_to_delayed(get_address(), ps, _simulated_latency);
@@ -105,6 +332,9 @@ protected:
 			_torque_socket->send_to(get_address(), ps.get_next_byte_position(),  ps.get_buffer());
 		if(sequence)
 			*sequence = _last_send_seq;
+		if(packet_type == data_packet && _fec_group_count && (_fec_group_count >= _fec_group_size || _fec_group_last != _last_send_seq))
+			send_fec_parity();
+		return true;
 	}
 
 	/// Writes the notify protocol's packet header into the bit_stream.
@@ -112,8 +342,27 @@ protected:
 	{
 		assert(!window_full() || packet_type != data_packet);
 		
-		int32 ack_byte_count = ((_last_seq_recvd - _last_recv_ack_ack + 7) >> 3);
-		assert(ack_byte_count <= max_ack_byte_count);
+		_update_reorder_horizon();
+		uint32 ack_high = _last_seq_recvd;
+		uint32 ack_count = _last_seq_recvd - _last_recv_ack_ack;
+		assert(ack_count <= _packet_window_size);
+		
+		// the acks go out as alternating runs of received and dropped packets, counting back from ack_high, unless a plain bit mask would be smaller.
+		uint32 run_bits = 1;
+		for(uint32 start = 0; start < ack_count; )
+		{
+			uint32 end = _get_ack_run_end(start, ack_count);
+			run_bits += _get_sack_run_bit_size(end - start);
+			start = end;
+		}
+		bool write_runs = run_bits < ack_count;
+		if(packet_type == data_packet && (write_runs ? run_bits : ack_count) > max_ack_flag_bit_size)
+		{
+			// acks for a large window may not fit beside the largest datagram.  The oldest packets are acked, since the remote host has waited longest to hear about them, and the rest are left to later packets.
+			ack_count = max_ack_flag_bit_size;
+			ack_high = _last_recv_ack_ack + ack_count;
+			write_runs = false;
+		}
 		
 		if(packet_type == data_packet)
 			_last_send_seq++;
@@ -122,17 +371,55 @@ protected:
 		stream.write_integer(_last_send_seq, 5); // write the first 5 bits of the send sequence
 		stream.write_bool(true); // high bit of first byte indicates this is a data packet.
 		stream.write_integer(_last_send_seq >> 5, sequence_number_bit_size - 5); // write the rest of the send sequence
-		stream.write_integer(_last_seq_recvd, ack_sequence_number_bit_size);
+		stream.write_integer(ack_high, ack_sequence_number_bit_size);
+		stream.write_integer(_remote_connection_index, connection_id_bit_size);
 		stream.write_integer(0, packet_header_pad_bits);
+		if(_packet_cipher)
+			stream.write_integer(uint32(++_send_packet_number), packet_number_bit_size);
 		
-		stream.write_ranged_uint32(ack_byte_count, 0, max_ack_byte_count);
-		
-		uint32 word_count = (ack_byte_count + 3) >> 2;
-		
-		for(uint32 i = 0; i < word_count; i++)
-			stream.write_integer(_ack_mask[i], i == word_count - 1 ?
-								  (ack_byte_count - (i * 4)) * 8 : 32);
-		stream.advance_to_next_byte();
+		stream.write_ranged_uint32(ack_count, 0, _packet_window_size);
+		if(ack_count)
+		{
+			// packets newer than the reorder horizon that haven't arrived may still, so the remote host holds off reporting them lost.
+			uint32 pending_count = int32(ack_high - _reorder_horizon) > 0 ? ack_high - _reorder_horizon : 0;
+			if(stream.write_bool(pending_count != 0))
+				stream.write_ranged_uint32(pending_count, 1, ack_count);
+			if(stream.write_bool(write_runs))
+			{
+				stream.write_bool(_is_acked(0));
+				for(uint32 start = 0; start < ack_count; )
+				{
+					uint32 end = _get_ack_run_end(start, ack_count);
+					_write_sack_run(stream, end - start);
+					start = end;
+				}
+			}
+			else if(ack_high == _last_seq_recvd)
+			{
+				for(uint32 i = 0; i < ack_count; i += 32)
+					stream.write_integer(_ack_mask[i >> 5], ack_count - i < 32 ? ack_count - i : 32);
+			}
+			else
+			{
+				uint32 offset = _last_seq_recvd - ack_high;
+				for(uint32 i = 0; i < ack_count; i += 32)
+				{
+					uint32 bit_count = ack_count - i < 32 ? ack_count - i : 32;
+					uint32 word = 0;
+					for(uint32 j = 0; j < bit_count; j++)
+						if(_is_acked(offset + i + j))
+							word |= 1 << j;
+					stream.write_integer(word, bit_count);
+				}
+			}
+			// the time the newest packet acked waited for its ack, so the remote host can take it out of the round trip it measures.
+			uint32 ack_delay = uint32((time::get_current() - _last_seq_recvd_time).get_milliseconds());
+			if(stream.write_bool(ack_high == _last_seq_recvd && _is_acked(0) && ack_delay < (1 << ack_delay_bit_size)))
+				stream.write_integer(ack_delay, ack_delay_bit_size);
+		}
+		// data packets go on to their stream messages without padding the header out, unless forward error correction needs their bodies byte aligned.
+		if(packet_type != data_packet || _fec_min_group_size)
+			stream.advance_to_next_byte();
 		logprintf("header write %d bits.", stream.get_bit_position());
 
 		// if we're resending this header, we can't advance the
@@ -140,19 +427,44 @@ protected:
 		// goes through) 
 		
 		if(packet_type == data_packet)
-			_last_seq_recvd_at_send[_last_send_seq & packet_window_mask] = _last_seq_recvd;
+		{
+			_last_seq_recvd_at_send[_last_send_seq & (_packet_window_size - 1)] = int32(ack_high - _reorder_horizon) < 0 ? ack_high : _reorder_horizon;
+			_record_data_packet_send();
+		}
+		if(ack_high != _last_seq_recvd)
+		{
+			// the newest packets weren't acked; if nothing else carries their acks within the ack delay, an ack packet will.
+			if(!_ack_due_time.get_milliseconds())
+			{
+				_ack_due_time = time::get_current() + time(_ack_delay);
+				if(!is_scheduled() || _ack_due_time < get_expire_time())
+					_torque_socket->_schedule_connection_timeout(this);
+			}
+		}
+		else
+		{
+			// every packet carries acks, so the remote host has now heard about everything received.  If it was told a missing packet is still awaited, it hears again once that wait is up, whether or not anything else is sent by then.
+			_data_packets_since_send = 0;
+			_ack_due_time = time(0);
+			if(_reorder_stall_time.get_milliseconds())
+			{
+				_ack_due_time = _reorder_stall_time + _get_reorder_delay();
+				if(!is_scheduled() || _ack_due_time < get_expire_time())
+					_torque_socket->_schedule_connection_timeout(this);
+			}
+		}
 		
 		//if(is_network_connection())
 		//{
-		//   TorqueLogMessageFormatted(LogBlah, ("SND: mLSQ: %08x  pkLS: %08x  pt: %d abc: %d",
-		//      _last_send_seq, _last_seq_recvd, packet_type, ack_byte_count));
+		//   TorqueLogMessageFormatted(LogBlah, ("SND: mLSQ: %08x  pkLS: %08x  pt: %d ac: %d",
+		//      _last_send_seq, _last_seq_recvd, packet_type, ack_count));
 		//}
 		
 		TorqueLogMessageFormatted(LogConnectionProtocol, ("build hdr %d %d", _last_send_seq, packet_type));
 	}
 	
 	/// Reads a notify protocol packet header from the bit_stream and returns true if it was a data packet that needs more processing.
-	bool read_packet_header(bit_stream &pstream)
+	bool read_packet_header(bit_stream &pstream, bool is_opened)
 	{
 		// read in the packet header:
 		//
@@ -161,17 +473,22 @@ protected:
 		//   1 bit game packet
 		//   sequence_number_bit_size-5 bits (packet seq number >> 5)
 		//   ack_sequence_number_bit_size bits ackstart seq number
+		//   connection_id_bit_size bits connection id, already used by the torque_socket to find this connection
 		//   packet_header_pad_bits = 0 - padding to byte boundary
-		//   after this point, if this is an encrypted packet, all the rest of the data will be encrypted
+		//   packet_number_bit_size bits packet number, if packets are sealed
+		//   after this point, if packets are sealed, all the rest of the data is encrypted, and followed by the GCM tag
 		
-		//   rangedU32 - 0...max_ack_byte_count
+		//   rangedU32 - 0..._packet_window_size ack count
 		//
 		// type is:
 		//    00 data packet
 		//    01 ping packet
 		//    02 ack packet
 		
-		// next 0...ack_byte_count bytes are ack flags
+		// if the ack count is non-zero, it's followed by a bit saying whether any of the newest packets acked as dropped are still awaited, and if so a rangedU32 - 1..ack count of how many of the newest are; then a bit selecting the ack format:
+		//   1 - the received flag of the first run, then the length of each alternating run of received and dropped packets
+		//   0 - ack count bits of ack flags
+		// and then a bit saying whether the newest packet acked arrived and had its ack held under 2^ack_delay_bit_size milliseconds, and if so ack_delay_bit_size bits of how long it was held.
 		//
 		// return value is true if this is a valid data packet or false if there is nothing more that should be read
 		
@@ -181,6 +498,7 @@ protected:
 		pk_sequence_number = pk_sequence_number | (pstream.read_integer(sequence_number_bit_size - 5) << 5);
 		
 		uint32 pk_highest_ack = pstream.read_integer(ack_sequence_number_bit_size);
+		pstream.read_integer(connection_id_bit_size);
 		uint32 pk_pad_bits = pstream.read_integer(packet_header_pad_bits);
 		
 		if(pk_pad_bits != 0)
@@ -196,10 +514,16 @@ protected:
 			pk_sequence_number += sequence_number_window_size;
 		
 		// in the following test, account for wrap around from 0
-		if(pk_sequence_number - _last_seq_recvd > (max_packet_window_size - 1))
+		uint32 late_by = 0;
+		if(pk_sequence_number - _last_seq_recvd > (_packet_window_size - 1))
 		{
-			// the sequence number is outside the window... must be out of order discard.
-			return false;
+			// the sequence number is outside the window... must be out of order.  A data packet the reorder horizon is still waiting for is accepted, as is a parity packet that may rebuild one; anything else is discarded.
+			late_by = _last_seq_recvd + sequence_number_window_size - pk_sequence_number;
+			if(late_by >= _get_reorder_window())
+				return false;
+			if(pk_packet_type == data_packet ? late_by >= _last_seq_recvd - _reorder_horizon || _is_acked(late_by) : pk_packet_type != fec_parity_packet)
+				return false;
+			pk_sequence_number = _last_seq_recvd - late_by;
 		}
 		
 		pk_highest_ack |= (_highest_acked_seq & ack_sequence_number_mask);
@@ -208,33 +532,78 @@ protected:
 		if(pk_highest_ack < _highest_acked_seq)
 			pk_highest_ack += ack_sequence_number_window_size;
 		
+		bool stale_acks = late_by != 0;
 		if(pk_highest_ack > _last_send_seq)
 		{
-			// the ack number is outside the window... must be an out of order packet, discard.
-			return false;
+			// the ack number is outside the window.  A late packet's acks are just older than ones already read, as are those of a packet that only had room to ack the oldest packets the remote host had yet to report on, or that was overtaken by one acking more; they are ignored below.  Anything else must be an out of order packet, so it's discarded.
+			if(!late_by && _highest_acked_seq - (pk_highest_ack - ack_sequence_number_window_size) > _packet_window_size)
+				return false;
+			stale_acks = true;
 		}
 		
-		if(!_symmetric_cipher.is_null())
+		if(is_opened)
+			pstream.set_bit_position(sealed_header_byte_size << 3);
+		else if(_packet_cipher && !_open_packet(pstream))
 		{
-			_symmetric_cipher->setup_counter(pk_sequence_number, pk_highest_ack, pk_packet_type, 0);
-			/*if(!bit_stream_decrypt_and_check_hash(pstream, message_signature_bytes, packet_header_byte_size, _symmetric_cipher))
-			{
-				TorqueLogMessage(LogNetConnection, ("Packet failed crypto"));
-				return false;
-			}*/
+			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: packet failed authentication or was replayed", _connection_index));
+			return false;
 		}
 		
-		uint32 pk_ack_byte_count = pstream.read_ranged_uint32(0, max_ack_byte_count);
-		if(pk_ack_byte_count > max_ack_byte_count || pk_packet_type >= invalid_packet_type)
+		uint32 pk_ack_count = pstream.read_ranged_uint32(0, _packet_window_size);
+		if(pk_ack_count > _packet_window_size || pk_packet_type >= invalid_packet_type)
 			return false;
 		
 		uint32 pk_ack_mask[max_ack_mask_size];
-		uint32 pk_ack_word_count = (pk_ack_byte_count + 3) >> 2;
+		uint32 pk_ack_word_count = (pk_ack_count + 31) >> 5;
+		uint32 pk_pending_count = 0;
+		int32 pk_ack_delay = -1;
 		
-		for(uint32 i = 0; i < pk_ack_word_count; i++)
-			pk_ack_mask[i] = pstream.read_integer(i == pk_ack_word_count - 1 ? (pk_ack_byte_count - (i * 4)) * 8 : 32);
-		pstream.advance_to_next_byte();
+		if(pk_ack_count)
+		{
+			if(pstream.read_bool())
+				pk_pending_count = pstream.read_ranged_uint32(1, pk_ack_count);
+			if(pstream.read_bool())
+			{
+				for(uint32 i = 0; i < pk_ack_word_count; i++)
+					pk_ack_mask[i] = 0;
+				bool received = pstream.read_bool();
+				for(uint32 start = 0; start < pk_ack_count; received = !received)
+				{
+					uint32 run_length = _read_sack_run(pstream);
+					if(!run_length || run_length > pk_ack_count - start)
+						return false;
+					if(received)
+						for(uint32 i = start; i < start + run_length; i++)
+							pk_ack_mask[i >> 5] |= 1 << (i & 0x1F);
+					start += run_length;
+				}
+			}
+			else
+			{
+				for(uint32 i = 0; i < pk_ack_word_count; i++)
+					pk_ack_mask[i] = pstream.read_integer(i == pk_ack_word_count - 1 ? pk_ack_count - (i * 32) : 32);
+			}
+			if(pstream.read_bool())
+				pk_ack_delay = pstream.read_integer(ack_delay_bit_size);
+		}
+		if(pk_packet_type != data_packet || _fec_min_group_size)
+			pstream.advance_to_next_byte();
 		logprintf("header read %d bits.", pstream.get_bit_position());
+		if(stale_acks)
+			pk_highest_ack = _highest_acked_seq;
+		
+		// the time since the newest packet acked was sent, less the time the remote host held its ack, is a round trip measurement.  Acks that don't report how long they were held, because it was too long to say or the newest packet acked never arrived, give none.
+		time now = time::get_current();
+		float32 round_trip_sample = -1;
+		if(pk_highest_ack > _highest_ack_received && pk_ack_delay >= 0)
+		{
+			round_trip_sample = float32((now - _sent_packets[pk_highest_ack & (_packet_window_size - 1)].send_time).get_milliseconds() - pk_ack_delay);
+			if(round_trip_sample < 0)
+				round_trip_sample = 0;
+			_update_round_trip_time(round_trip_sample);
+		}
+		if(pk_highest_ack > _highest_ack_received)
+			_highest_ack_received = pk_highest_ack;
 		//if(is_network_connection())
 		//{
 		//   TorqueLogMessageFormatted(LogBlah, ("RCV: mHA: %08x  pkHA: %08x  mLSQ: %08x  pkSN: %08x  pkLS: %08x  pkAM: %08x",
@@ -246,6 +615,7 @@ protected:
 			"data_packet",
 			"ping_packet",
 			"ack_packet",
+			"fec_parity_packet",
 		};
 		
 		TorqueLogBlock(LogConnectionProtocol,
@@ -254,28 +624,36 @@ protected:
 					   logprintf("Recv %d %s", pk_sequence_number, packet_type_names[pk_packet_type]);
 					   );
 		
-		// shift up the ack mask by the packet difference this essentially nacks all the packets dropped
+		// a ping or ack packet sent after a data packet may get here first and carry the same sequence, so a data packet with the newest sequence is new if it hasn't been acked, as received or as dropped for good.
+		bool is_new_data_packet = pk_packet_type == data_packet && (late_by || pk_sequence_number != _last_seq_recvd || (!_is_acked(0) && _reorder_horizon != _last_seq_recvd));
+		
+		// shift up the ack mask by the packet difference this essentially nacks all the packets dropped; a late packet just fills in its hole.
 		
-		uint32 ack_mask_shift = pk_sequence_number - _last_seq_recvd;
+		uint32 ack_mask_shift = late_by ? 0 : pk_sequence_number - _last_seq_recvd;
+		uint32 ack_mask_word_count = _ack_mask.size();
 		
 		// if we've missed more than a full word of packets, shift up by words
-		while(ack_mask_shift > 32)
+		uint32 ack_mask_word_shift = ack_mask_shift >> 5;
+		if(ack_mask_word_shift)
 		{
-			for(int32 i = max_ack_mask_size - 1; i > 0; i--)
-				_ack_mask[i] = _ack_mask[i-1];
-			_ack_mask[0] = 0;
-			ack_mask_shift -= 32;
+			for(int32 i = ack_mask_word_count - 1; i >= 0; i--)
+				_ack_mask[i] = uint32(i) >= ack_mask_word_shift ? _ack_mask[i - ack_mask_word_shift] : 0;
+			ack_mask_shift &= 0x1F;
 		}
 		
-		// the first word upshifts all NACKs, except for the low bit, which is a 1 if this is a data packet (i.e. not a ping packet or an ack packet)
-		uint32 up_shifted = (pk_packet_type == data_packet) ? 1 : 0; 
-		
-		for(uint32 i = 0; i < max_ack_mask_size; i++)
+		if(ack_mask_shift)
 		{
-			uint32 next_shift = _ack_mask[i] >> (32 - ack_mask_shift);
-			_ack_mask[i] = (_ack_mask[i] << ack_mask_shift) | up_shifted;
-			up_shifted = next_shift;
+			uint32 up_shifted = 0;
+			for(uint32 i = 0; i < ack_mask_word_count; i++)
+			{
+				uint32 next_shift = _ack_mask[i] >> (32 - ack_mask_shift);
+				_ack_mask[i] = (_ack_mask[i] << ack_mask_shift) | up_shifted;
+				up_shifted = next_shift;
+			}
 		}
+		// the low bit is a 1 if this is a data packet (i.e. not a ping packet or an ack packet)
+		if(is_new_data_packet)
+			_ack_mask[late_by >> 5] |= 1 << (late_by & 0x1F);
 		
 		// do all the notifies...
 		uint32 notify_count = pk_highest_ack - _highest_acked_seq;
@@ -283,38 +661,706 @@ protected:
 		{
 			uint32 notify_index = _highest_acked_seq + i + 1;
 			
-			uint32 ack_mask_bit = (pk_highest_ack - notify_index) & 0x1F;
-			uint32 ack_mask_word = (pk_highest_ack - notify_index) >> 5;
-			
-			bool packet_transmit_success = (pk_ack_mask[ack_mask_word] & (1 << ack_mask_bit)) != 0;
+			// packets older than the acks sent are ones the remote host had already reported on, so they didn't arrive.
+			uint32 ack_index = pk_highest_ack - notify_index;
+			bool packet_transmit_success = ack_index < pk_ack_count && (pk_ack_mask[ack_index >> 5] & (1 << (ack_index & 0x1F))) != 0;
+			// a packet the remote host is still waiting on, in case it was only reordered, is reported on once it arrives or is given up on; the packets after it wait so notifies stay in order.
+			if(!packet_transmit_success && ack_index < pk_pending_count)
+			{
+				notify_count = i;
+				break;
+			}
 			TorqueLogMessageFormatted(LogConnectionProtocol, ("Ack %d %d", notify_index, packet_transmit_success));
+			if(_fec_min_group_size)
+				_fec_loss_rate += ((packet_transmit_success ? 0.0f : 1.0f) - _fec_loss_rate) / fec_loss_rate_window;
 			
-			torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_notify_event_type, _connection_index);
-			event->delivered = packet_transmit_success;
-			event->packet_sequence = notify_index;
-						
+			// packets sent only to carry stream messages were never seen by the application, so only the messages hear about them.
+			sent_packet_record &record = _sent_packets[notify_index & (_packet_window_size - 1)];
+			for(uint32 j = 0; j < record.datagram_count; j++)
+			{
+				torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_notify_event_type, _connection_index);
+				event->delivered = packet_transmit_success;
+				event->packet_sequence = notify_index;
+			}
+			while(record.messages)
+			{
+				stream_message *the_message = record.messages;
+				record.messages = the_message->next_in_packet;
+				if(packet_transmit_success)
+					_message_streams[the_message->stream_index].on_delivered(the_message);
+				else
+					_message_streams[the_message->stream_index].on_dropped(the_message);
+			}
 			if(packet_transmit_success)
-				_last_recv_ack_ack = _last_seq_recvd_at_send[notify_index & packet_window_mask];
+			{
+				_delivered_count++;
+				_delivered_time = now;
+				_first_sent_time = record.send_time;
+			}
+			if(!_congestion_controller.is_null())
+			{
+				if(packet_transmit_success)
+				{
+					congestion_ack_sample sample;
+					sample.sequence = notify_index;
+					sample.packets_in_flight = _last_send_seq - notify_index;
+					sample.delivered_count = _delivered_count;
+					sample.prior_delivered_count = record.delivered_count;
+					// the slower of the send and ack rates over the packet's flight is the rate the path delivered; the faster one reflects bunching.
+					int64 interval = (now - record.delivered_time).get_milliseconds();
+					int64 send_interval = (record.send_time - record.first_sent_time).get_milliseconds();
+					if(send_interval > interval)
+						interval = send_interval;
+					sample.delivery_rate = (_delivered_count - record.delivered_count) * 1000.0f / (interval < 1 ? 1 : interval);
+					sample.round_trip_time = notify_index == pk_highest_ack ? round_trip_sample : -1;
+					_congestion_controller->on_packet_acked(now, sample);
+				}
+				else
+					_congestion_controller->on_packet_lost(now, notify_index, _last_send_seq - notify_index);
+			}
+						
+			// a packet whose acks were cut short may have told the remote host less than one sent before it.
+			uint32 acks_sent = _last_seq_recvd_at_send[notify_index & (_packet_window_size - 1)];
+			if(packet_transmit_success && int32(acks_sent - _last_recv_ack_ack) > 0)
+				_last_recv_ack_ack = acks_sent;
 		}
 		// the other side knows more about its window than we do.
-		if(pk_sequence_number - _last_recv_ack_ack > max_packet_window_size)
-			_last_recv_ack_ack = pk_sequence_number - max_packet_window_size;
+		if(pk_sequence_number - _last_recv_ack_ack > _packet_window_size)
+			_last_recv_ack_ack = pk_sequence_number - _packet_window_size;
 		
-		_highest_acked_seq = pk_highest_ack;
+		_highest_acked_seq += notify_count;
+		if(notify_count)
+		{
+			_ack_probe_count = 0;
+			_ack_probe_time = has_unacked_sent_packets() ? now + _get_ack_probe_timeout() : time(0);
+		}
 		
 		// first things first... ackback any pings or half-full windows
 		
 		keep_alive(); // notification that the connection is ok
 		
-		uint32 prev_last_sequence = _last_seq_recvd;
-		_last_seq_recvd = pk_sequence_number;
+		if(!late_by)
+			_last_seq_recvd = pk_sequence_number;
+		if(is_new_data_packet && !late_by)
+			_last_seq_recvd_time = now;
+		_received_packet_seq = pk_sequence_number;
+		if(is_new_data_packet)
+			_data_packets_since_send++;
+		if(pk_packet_type == fec_parity_packet)
+			_read_fec_parity(pstream, pk_sequence_number);
+		
+		// acks may have opened the window; queued data sent now carries the acks for this packet too.
+		if(notify_count)
+			flush_send_queue();
 		
-		if(pk_packet_type == ping_packet || (pk_sequence_number - _last_recv_ack_ack > (max_packet_window_size >> 1)))
+		// only data packets change what there is to ack; answering an ack packet with another could bounce acks back and forth for as long as both sides are waiting on their windows.  Pings are answered at once, since the remote host is waiting on the answer to measure the round trip or probe for lost acks.
+		uint32 ack_packet_interval = _ack_delay ? max_delayed_ack_packets : ack_data_packet_interval;
+		if(pk_packet_type == ping_packet || (pk_packet_type == data_packet && (_data_packets_since_send >= ack_packet_interval || pk_sequence_number - _last_recv_ack_ack > (_packet_window_size >> 1))))
 		{
 			// send an ack to the other side the ack will have the same packet sequence as our last sent packet if the last packet we sent was the connection accepted packet we must resend that packet
 			send_ack_packet();
 		}
-		return prev_last_sequence != pk_sequence_number && pk_packet_type == data_packet;
+		else if(_data_packets_since_send && _ack_delay && !_ack_due_time.get_milliseconds())
+		{
+			// give the application a few milliseconds to send something the acks can ride on.
+			_ack_due_time = now + time(_ack_delay);
+			if(!is_scheduled() || _ack_due_time < get_expire_time())
+				_torque_socket->_schedule_connection_timeout(this);
+		}
+		return is_new_data_packet;
+	}
+	
+	/// Returns true if a packet that arrived from an address other than this connection's was sealed by the remote host, opening it in place so it can't be replayed from yet another address.  Packets sent in the clear can't be told apart from ones spoofed by anyone who guessed the connection id, so this is always false if the connection's packets aren't sealed.
+	bool authenticate_packet(bit_stream &pstream)
+	{
+		if(!_packet_cipher)
+			return false;
+		if(pstream.get_stream_byte_size() < sealed_header_byte_size)
+			return false;
+		pstream.set_bit_position(packet_header_byte_size << 3);
+		return _open_packet(pstream);
+	}
+	
+	/// Returns the path challenge slot for packets from the_address.
+	path_challenge &get_path_challenge(const address &the_address)
+	{
+		return _path_challenges[the_address.hash() % path_challenge_slot_count];
+	}
+	
+	/// Reads the packet number that follows the header of a sealed packet, and opens the packet in place, leaving the stream positioned at the start of its decrypted body and ending before the tag.  Returns false if the packet isn't one the remote host sealed, or if a packet with its number has already been opened.
+	bool _open_packet(bit_stream &pstream)
+	{
+		// the packet number is the one nearest the highest opened so far with the same low bits; a wrong guess just fails the tag check, since the number is part of the nonce.
+		uint32 low_bits = pstream.read_integer(packet_number_bit_size);
+		uint64 packet_number = _recv_packet_number + int16(uint16(low_bits - uint32(_recv_packet_number)));
+		
+		if(packet_number + replay_window_size <= _recv_packet_number)
+			return false;
+		uint32 bit = uint32(packet_number) & (replay_window_size - 1);
+		if(packet_number <= _recv_packet_number && (_replay_window[bit >> 5] & (1 << (bit & 31))))
+			return false;
+		
+		uint32 packet_size = pstream.get_stream_byte_size();
+		if(!_packet_cipher->open(packet_number, pstream.get_buffer(), sealed_header_byte_size, packet_size))
+			return false;
+		pstream.set_stream_byte_size(packet_size - packet_cipher::tag_size);
+		
+		// slide the window up to a new highest packet number, forgetting the numbers that fall out of it.
+		if(packet_number > _recv_packet_number)
+		{
+			if(packet_number - _recv_packet_number >= replay_window_size)
+				memset(_replay_window, 0, sizeof(_replay_window));
+			else
+				for(uint64 i = _recv_packet_number + 1; i < packet_number; i++)
+				{
+					uint32 cleared = uint32(i) & (replay_window_size - 1);
+					_replay_window[cleared >> 5] &= ~(1 << (cleared & 31));
+				}
+			_recv_packet_number = packet_number;
+		}
+		_replay_window[bit >> 5] |= 1 << (bit & 31);
+		return true;
+	}
+	
+	/// Records the send of the data packet just given sequence _last_send_seq, for round trip and delivery rate measurement, and tells the congestion controller.
+	void _record_data_packet_send()
+	{
+		time now = time::get_current();
+		uint32 packets_in_flight = _last_send_seq - _highest_acked_seq;
+		// if nothing else is in flight the connection was idle, and the idle time shouldn't count against the delivery rate.
+		if(packets_in_flight == 1)
+			_delivered_time = _first_sent_time = now;
+		sent_packet_record &record = _sent_packets[_last_send_seq & (_packet_window_size - 1)];
+		record.send_time = now;
+		record.delivered_count = _delivered_count;
+		record.delivered_time = _delivered_time;
+		record.first_sent_time = _first_sent_time;
+		if(!_congestion_controller.is_null())
+		{
+			if(_congestion_controller->get_pacing_rate() > 0)
+				_pacing_credit -= 1;
+			_congestion_controller->on_packet_sent(now, _last_send_seq, packets_in_flight);
+		}
+		if(!_ack_probe_time.get_milliseconds())
+		{
+			_ack_probe_time = now + _get_ack_probe_timeout();
+			if(_ack_probe_time < get_expire_time())
+				_torque_socket->_schedule_connection_timeout(this);
+		}
+	}
+	
+	/// Returns how long to wait for acks of packets in flight before probing for them: the round trip time plus four times its variation, as TCP waits before retransmitting, doubled for each probe that went unanswered.
+	time _get_ack_probe_timeout()
+	{
+		uint32 timeout = initial_ack_probe_timeout;
+		if(_round_trip_time >= 0)
+		{
+			timeout = uint32(_round_trip_time + 4 * _round_trip_time_variance);
+			if(timeout < min_ack_probe_timeout)
+				timeout = min_ack_probe_timeout;
+		}
+		timeout <<= (_ack_probe_count < 6 ? _ack_probe_count : 6);
+		return time(timeout);
+	}
+	
+	/// Folds a round trip time measurement into the smoothed round trip time and its variation, weighting new measurements by 1/8 and 1/4 as TCP does.
+	void _update_round_trip_time(float32 sample)
+	{
+		if(_round_trip_time < 0)
+		{
+			_round_trip_time = sample;
+			_round_trip_time_variance = sample / 2;
+			return;
+		}
+		float32 error = sample - _round_trip_time;
+		_round_trip_time_variance = 0.75f * _round_trip_time_variance + 0.25f * (error < 0 ? -error : error);
+		_round_trip_time = 0.875f * _round_trip_time + 0.125f * sample;
+	}
+	
+	/// Adds the pacing credit earned since it was last updated, up to the largest burst a paced connection may send.
+	void _update_pacing_credit(time now, float32 pacing_rate)
+	{
+		float32 elapsed = float32((now - _pacing_update_time).get_milliseconds());
+		_pacing_update_time = now;
+		_pacing_credit += pacing_rate * elapsed / 1000;
+		float32 burst = pacing_rate * pacing_burst_time / 1000;
+		if(burst < min_pacing_burst)
+			burst = min_pacing_burst;
+		if(_pacing_credit > burst)
+			_pacing_credit = burst;
+	}
+	
+	/// Returns true if the packet index packets before _last_seq_recvd was received.
+	bool _is_acked(uint32 index)
+	{
+		return (_ack_mask[index >> 5] & (1 << (index & 0x1F))) != 0;
+	}
+	
+	/// Returns the index of the first packet after start, counting back from _last_seq_recvd, whose received state differs from start's, or ack_count if none before it does.
+	uint32 _get_ack_run_end(uint32 start, uint32 ack_count)
+	{
+		bool received = _is_acked(start);
+		uint32 uniform_word = received ? 0xFFFFFFFF : 0;
+		uint32 index = start + 1;
+		while(index < ack_count)
+		{
+			if(!(index & 0x1F) && index + 32 <= ack_count && _ack_mask[index >> 5] == uniform_word)
+				index += 32;
+			else if(_is_acked(index) == received)
+				index++;
+			else
+				break;
+		}
+		return index;
+	}
+	
+	/// Returns the number of bits _write_sack_run writes for a run of run_length packets.
+	static uint32 _get_sack_run_bit_size(uint32 run_length)
+	{
+		uint32 bit_size = sack_run_group_bits + 1;
+		for(uint32 value = (run_length - 1) >> sack_run_group_bits; value; value >>= sack_run_group_bits)
+			bit_size += sack_run_group_bits + 1;
+		return bit_size;
+	}
+	
+	/// Writes the length of a selective ack run, which is at least 1, as groups of sack_run_group_bits bits, low group first, each followed by a bit set if another group follows.
+	static void _write_sack_run(bit_stream &stream, uint32 run_length)
+	{
+		uint32 value = run_length - 1;
+		do
+		{
+			stream.write_integer(value & sack_run_group_mask, sack_run_group_bits);
+			value >>= sack_run_group_bits;
+		} while(stream.write_bool(value != 0));
+	}
+	
+	/// Reads a selective ack run length written by _write_sack_run.  Returns 0 if the run is longer than any packet window.
+	static uint32 _read_sack_run(bit_stream &stream)
+	{
+		uint32 value = 0;
+		uint32 shift = 0;
+		do
+		{
+			if(shift > max_packet_window_size_shift)
+				return 0;
+			value |= stream.read_integer(sack_run_group_bits) << shift;
+			shift += sack_run_group_bits;
+		} while(stream.read_bool());
+		return value + 1;
+	}
+	
+	/// Sends data_size bytes of data as a data packet if the window allows, or queues it to be sent once the window does.  Queued packets keep their order and are sent before any data packet sent after them, so sequence is set to the sequence number the packet is, or will be, sent with.  Returns send_to_connection_invalid_message if data_size is over torque_sockets_max_datagram_size, or send_to_connection_queue_full, queuing nothing, if the queue already holds data and this would take it past its limit.
+	///
+	/// If coalescing is on, datagrams up to max_coalesced_datagram_size are instead held for up to the coalesce delay and sent together in one packet, whose sequence number they share and are each notified with.
+	send_to_connection_result send_data_packet(uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	{
+		if(data_size > torque_sockets_max_datagram_size)
+			return send_to_connection_invalid_message;
+		if(_send_queue_head && _send_queue_bytes + _coalesce_size + data_size > _send_queue_limit)
+		{
+			_send_queue_blocked = true;
+			return send_to_connection_queue_full;
+		}
+		if(!_coalesce_delay || data_size > max_coalesced_datagram_size)
+		{
+			flush_coalesced_datagrams();
+			return _send_data_packet(data, data_size, 1, sequence);
+		}
+		uint32 prefix_size = data_size < 0x80 ? 1 : 2;
+		if(_coalesce_size + prefix_size + data_size > sizeof(_coalesce_buffer))
+			flush_coalesced_datagrams();
+		if(prefix_size == 1)
+			_coalesce_buffer[_coalesce_size++] = uint8(data_size);
+		else
+		{
+			_coalesce_buffer[_coalesce_size++] = uint8(0x80 | (data_size >> 8));
+			_coalesce_buffer[_coalesce_size++] = uint8(data_size);
+		}
+		memcpy(_coalesce_buffer + _coalesce_size, data, data_size);
+		_coalesce_size += data_size;
+		if(!_coalesce_count++)
+		{
+			_coalesce_flush_time = time::get_current() + time(_coalesce_delay);
+			if(!is_scheduled() || _coalesce_flush_time < get_expire_time())
+				_torque_socket->_schedule_connection_timeout(this);
+		}
+		if(sequence)
+			*sequence = _last_send_seq + _send_queue_count + 1;
+		return send_to_connection_queued;
+	}
+	
+	/// Sends data, holding datagram_count datagrams, as a data packet if the window allows, or appends it to the send queue.
+	send_to_connection_result _send_data_packet(uint8 *data, uint32 data_size, uint32 datagram_count, uint32 *sequence)
+	{
+		if(!_send_queue_head && !window_full())
+			return send_packet(data_packet, data, data_size, sequence, datagram_count) ? send_to_connection_sent : send_to_connection_invalid_message;
+		queued_packet *the_packet = (queued_packet *) memory_allocate(sizeof(queued_packet) + data_size);
+		the_packet->next = 0;
+		the_packet->size = data_size;
+		the_packet->datagram_count = datagram_count;
+		memcpy(the_packet->data, data, data_size);
+		if(_send_queue_tail)
+			_send_queue_tail->next = the_packet;
+		else
+			_send_queue_head = the_packet;
+		_send_queue_tail = the_packet;
+		_send_queue_count++;
+		_send_queue_bytes += data_size;
+		if(sequence)
+			*sequence = _last_send_seq + _send_queue_count;
+		flush_send_queue();
+		return send_to_connection_queued;
+	}
+	
+	/// Sets how many milliseconds a small datagram may be held so that later ones can share its packet, or 0 to send each datagram in a packet of its own.
+	void set_coalesce_delay(uint32 delay)
+	{
+		_coalesce_delay = delay;
+		if(!delay)
+			flush_coalesced_datagrams();
+	}
+	
+	/// Sends the datagrams held for coalescing now, together in one data packet, or queues that packet if the window is full.
+	void flush_coalesced_datagrams()
+	{
+		if(!_coalesce_count)
+			return;
+		uint8 data[torque_sockets_max_datagram_size];
+		uint32 data_size;
+		uint32 datagram_count = _take_coalesced_datagrams(data, &data_size);
+		_send_data_packet(data, data_size, datagram_count, 0);
+	}
+	
+	/// Moves the datagrams held for coalescing into data, as the payload of a single data packet, and returns how many there are.  A lone datagram is sent the ordinary way, without its length prefix.
+	uint32 _take_coalesced_datagrams(uint8 *data, uint32 *data_size)
+	{
+		uint32 datagram_count = _coalesce_count;
+		uint32 offset = datagram_count == 1 ? (_coalesce_buffer[0] & 0x80 ? 2 : 1) : 0;
+		*data_size = _coalesce_size - offset;
+		memcpy(data, _coalesce_buffer + offset, *data_size);
+		_coalesce_size = 0;
+		_coalesce_count = 0;
+		_coalesce_flush_time = time(0);
+		return datagram_count;
+	}
+	
+	/// Queues a copy of data as the next message on stream stream_index.  The message is sent in the next data packet with room for it, and resent in a later one each time a packet carrying it is reported dropped, until it is delivered.  A message larger than max_stream_message_size is split into fragments that are sent, and resent, the same way, and reassembled by the remote host.  Returns send_to_connection_invalid_message if the stream index or size is out of range, or send_to_connection_queue_full, queuing nothing, if the connection already holds data and this would take it past its send queue limit.
+	send_to_connection_result send_stream_message(uint32 stream_index, const uint8 *data, uint32 data_size)
+	{
+		if(stream_index >= max_message_streams || data_size > max_message_size)
+			return send_to_connection_invalid_message;
+		uint32 pending_bytes = _get_pending_send_bytes();
+		if(pending_bytes && pending_bytes + data_size > _send_queue_limit)
+		{
+			_send_queue_blocked = true;
+			return send_to_connection_queue_full;
+		}
+		_message_streams[stream_index].queue_message(stream_index, data, data_size, max_stream_message_size);
+		flush_send_queue();
+		return send_to_connection_queued;
+	}
+	
+	/// Returns the bytes of data the connection holds for sending: queued datagrams, and stream messages that haven't been delivered.
+	uint32 _get_pending_send_bytes()
+	{
+		uint32 pending_bytes = _send_queue_bytes;
+		for(uint32 i = 0; i < max_message_streams; i++)
+			pending_bytes += _message_streams[i].get_outstanding_bytes();
+		return pending_bytes;
+	}
+	
+	/// Returns the bytes held for stream messages received out of order or still being reassembled.
+	uint32 _get_received_stream_bytes()
+	{
+		uint32 received_bytes = 0;
+		for(uint32 i = 0; i < max_message_streams; i++)
+			received_bytes += _message_streams[i].get_received_bytes();
+		return received_bytes;
+	}
+	
+	/// Sets the bytes this connection will hold for stream messages received out of order or being reassembled, and how long, in milliseconds, a message being reassembled may go without a new fragment.  Past either limit the remote host is dropped.
+	void set_reassembly_limits(uint32 byte_limit, uint32 timeout)
+	{
+		_reassembly_limit = byte_limit;
+		_reassembly_timeout = time(timeout);
+	}
+	
+	/// Returns true if the remote host sent stream messages this connection couldn't or wouldn't reassemble, and should be dropped.
+	bool reassembly_failed()
+	{
+		return _reassembly_failed;
+	}
+	
+	/// Returns true if any stream has a message that may be sent now.
+	bool _has_unsent_stream_messages()
+	{
+		for(uint32 i = 0; i < max_message_streams; i++)
+			if(_message_streams[i].get_next_unsent())
+				return true;
+		return false;
+	}
+	
+	/// Sends as many queued data packets as the window allows, then packets of unsent stream messages.  Posts a torque_connection_writable_event_type event if a send was refused for a full queue and the queue has drained to half its limit.  If sends are being held back only by the pacing rate, arranges to be called again when the next is allowed.
+	void flush_send_queue()
+	{
+		_send_wakeup_time = time(0);
+		while(_send_queue_head && !window_full())
+		{
+			queued_packet *the_packet = _send_queue_head;
+			_send_queue_head = the_packet->next;
+			if(!_send_queue_head)
+				_send_queue_tail = 0;
+			_send_queue_count--;
+			_send_queue_bytes -= the_packet->size;
+			send_packet(data_packet, the_packet->data, the_packet->size, 0, the_packet->datagram_count);
+			memory_deallocate(the_packet);
+		}
+		// queued datagrams were promised the sequence numbers right after the last one sent, so stream-only packets wait for them, and the first one carries any datagrams held for coalescing.
+		bool has_unsent_messages = !_send_queue_head && _has_unsent_stream_messages();
+		while(has_unsent_messages && !window_full())
+		{
+			if(_coalesce_count)
+			{
+				uint8 data[torque_sockets_max_datagram_size];
+				uint32 data_size;
+				uint32 datagram_count = _take_coalesced_datagrams(data, &data_size);
+				send_packet(data_packet, data, data_size, 0, datagram_count);
+			}
+			else
+				send_packet(data_packet, 0, 0, 0, 0);
+			has_unsent_messages = _has_unsent_stream_messages();
+		}
+		if(_send_queue_blocked && _get_pending_send_bytes() <= _send_queue_limit / 2)
+		{
+			_send_queue_blocked = false;
+			_torque_socket->_event_queue.post_event(torque_connection_writable_event_type, _connection_index);
+		}
+		if((_send_queue_head || has_unsent_messages) && !_congestion_controller.is_null())
+		{
+			uint32 window = _packet_window_size - 2;
+			uint32 congestion_window = _congestion_controller->get_congestion_window();
+			if(congestion_window < window)
+				window = congestion_window;
+			float32 pacing_rate = _congestion_controller->get_pacing_rate();
+			if(_last_send_seq - _highest_acked_seq < window && pacing_rate > 0)
+			{
+				uint32 delay = uint32((1 - _pacing_credit) * 1000 / pacing_rate) + 1;
+				_send_wakeup_time = time::get_current() + time(delay);
+				if(!is_scheduled() || _send_wakeup_time < get_expire_time())
+					_torque_socket->_schedule_connection_timeout(this);
+			}
+		}
+	}
+	
+	/// Returns the number of data packets waiting in the send queue.
+	uint32 get_send_queue_count()
+	{
+		return _send_queue_count;
+	}
+	
+	/// Returns the number of bytes of data waiting in the send queue.
+	uint32 get_send_queue_bytes()
+	{
+		return _send_queue_bytes;
+	}
+	
+	/// Sets how many packets behind the newest one received a data packet may arrive and still be accepted, rather than discarded as out of order, up to half the packet window.  Packets the remote host sends that haven't arrived are not reported lost until they are this far behind, or have been missing for a quarter of the round trip time.
+	void set_reorder_window(uint32 reorder_window)
+	{
+		_reorder_window = reorder_window < (_packet_window_size >> 1) ? reorder_window : (_packet_window_size >> 1);
+	}
+	
+	/// Moves the reorder horizon past packets that have arrived, that are more than the reorder window behind the newest, or that went missing at least the reorder delay ago.  Packets at or before it are acked as received or dropped for good.
+	void _update_reorder_horizon()
+	{
+		uint32 reorder_window = _get_reorder_window();
+		if(_last_seq_recvd - _reorder_horizon > reorder_window)
+			_reorder_horizon = _last_seq_recvd - reorder_window;
+		if(int32(_last_recv_ack_ack - _reorder_horizon) > 0)
+			_reorder_horizon = _last_recv_ack_ack;
+		while(_reorder_horizon != _last_seq_recvd && _is_acked(_last_seq_recvd - _reorder_horizon - 1))
+			_reorder_horizon++;
+		if(_reorder_horizon == _last_seq_recvd)
+		{
+			_reorder_stall_time = time(0);
+			return;
+		}
+		// every packet missing when the stall was first seen has been missing at least that long.
+		time now = time::get_current();
+		if(!_reorder_stall_time.get_milliseconds() || now - _reorder_stall_time >= _get_reorder_delay())
+		{
+			if(_reorder_stall_time.get_milliseconds() && int32(_reorder_stall_seq - _reorder_horizon) > 0)
+			{
+				_reorder_horizon = _reorder_stall_seq;
+				while(_reorder_horizon != _last_seq_recvd && _is_acked(_last_seq_recvd - _reorder_horizon - 1))
+					_reorder_horizon++;
+			}
+			_reorder_stall_seq = _last_seq_recvd;
+			_reorder_stall_time = _reorder_horizon == _last_seq_recvd ? time(0) : now;
+		}
+	}
+	
+	/// Returns how many packets behind the newest received a late one is still accepted: the reorder window, widened with forward error correction so a lost packet stays awaited until the parity of its group, and the group after it, have had time to arrive.
+	uint32 _get_reorder_window()
+	{
+		if(_fec_min_group_size && _reorder_window < _fec_max_group_size * 2)
+			return _fec_max_group_size * 2;
+		return _reorder_window;
+	}
+	
+	/// Returns how long a missing packet is waited for before it is acked as dropped: a quarter of the round trip time, as reordering beyond that is rare, or with forward error correction at least until the parity of its group is due, unless that parity has already been read.
+	time _get_reorder_delay()
+	{
+		uint32 delay = _round_trip_time >= 0 ? uint32(_round_trip_time / 4) + 1 : uint32(initial_reorder_delay);
+		if(_fec_min_group_size && delay < fec_group_timeout * 2 && int32(_fec_parity_last - _reorder_horizon) <= 0)
+			delay = fec_group_timeout * 2;
+		return time(delay);
+	}
+	
+	/// Turns on forward error correction, as negotiated with the remote host, with each parity packet covering at least min_group_size data packets; 0 leaves it off.  Groups grow while few packets are lost after recovery, up to max_fec_group_size or a quarter of the packet window, and shrink when more are.
+	void set_fec_group_size(uint32 min_group_size)
+	{
+		uint32 max_group_size = _packet_window_size >> 2;
+		if(max_group_size > max_fec_group_size)
+			max_group_size = max_fec_group_size;
+		if(min_group_size > max_group_size)
+			min_group_size = max_group_size;
+		_fec_min_group_size = min_group_size;
+		_fec_max_group_size = max_group_size;
+		_fec_group_size = min_group_size;
+		_fec_parity_last = _last_seq_recvd;
+		if(!min_group_size || _fec_history)
+			return;
+		_fec_parity = new uint8[max_fec_body_size];
+		_fec_history = new fec_body[fec_history_size];
+		for(uint32 i = 0; i < fec_history_size; i++)
+			_fec_history[i].is_valid = false;
+	}
+	
+	/// Returns the number of lost data packets that have been rebuilt from parity packets.
+	uint32 get_fec_recovered_count()
+	{
+		return _fec_recovered_count;
+	}
+	
+	/// XORs the body of the data packet just sent into the parity of the current group, starting a new group if there is none.
+	void _add_to_fec_group(const uint8 *body, uint32 body_size)
+	{
+		if(!_fec_group_count)
+		{
+			// each group is sized by the loss seen since the last one started.
+			uint32 target_loss = fec_target_loss_percent;
+			if(_fec_loss_rate * 100 > target_loss && _fec_group_size > _fec_min_group_size)
+				_fec_group_size--;
+			else if(_fec_loss_rate * 400 < target_loss && _fec_group_size < _fec_max_group_size)
+				_fec_group_size++;
+			_fec_parity_size = 0;
+			_fec_length_xor = 0;
+			_fec_flush_time = time::get_current() + time(fec_group_timeout);
+			if(!is_scheduled() || _fec_flush_time < get_expire_time())
+				_torque_socket->_schedule_connection_timeout(this);
+		}
+		if(body_size > _fec_parity_size)
+		{
+			memset(_fec_parity + _fec_parity_size, 0, body_size - _fec_parity_size);
+			_fec_parity_size = body_size;
+		}
+		for(uint32 i = 0; i < body_size; i++)
+			_fec_parity[i] ^= body[i];
+		_fec_length_xor ^= body_size;
+		_fec_group_count++;
+		_fec_group_last = _last_send_seq;
+	}
+	
+	/// Sends the parity packet for the current group, if there is one.
+	void send_fec_parity()
+	{
+		if(!_fec_group_count)
+			return;
+		send_packet(fec_parity_packet, _fec_parity, _fec_parity_size);
+		_fec_group_count = 0;
+		_fec_flush_time = time(0);
+	}
+	
+	/// Keeps the body of the data packet just received with the given sequence, if parity can cover it.
+	void _store_fec_body(uint32 sequence, const uint8 *body, uint32 body_size)
+	{
+		fec_body &slot = _fec_history[sequence & (fec_history_size - 1)];
+		slot.is_valid = body_size <= max_fec_body_size;
+		if(!slot.is_valid)
+			return;
+		slot.sequence = sequence;
+		slot.size = body_size;
+		memcpy(slot.data, body, body_size);
+	}
+	
+	/// Reads the body of a parity packet whose header carried the given sequence and, if exactly one data packet of its group is missing and still awaited, rebuilds that packet and processes it as if it had arrived late.
+	void _read_fec_parity(bit_stream &pstream, uint32 sequence)
+	{
+		uint32 group_count = pstream.read_integer(fec_group_size_bit_size) + 1;
+		uint32 group_last = sequence - (pstream.read_bool() ? 1 : 0);
+		uint32 length_xor = pstream.read_integer(fec_body_size_bit_size);
+		pstream.advance_to_next_byte();
+		uint32 parity_size = pstream.get_stream_byte_size() - pstream.get_byte_position();
+		if(!_fec_history || group_count > _fec_max_group_size || parity_size > max_fec_body_size)
+			return;
+		if(int32(group_last - _fec_parity_last) > 0)
+			_fec_parity_last = group_last;
+		
+		uint32 missing = 0, missing_count = 0;
+		for(uint32 i = 0; i < group_count; i++)
+		{
+			fec_body &slot = _fec_history[(group_last - i) & (fec_history_size - 1)];
+			if(!slot.is_valid || slot.sequence != group_last - i)
+			{
+				missing = group_last - i;
+				missing_count++;
+			}
+		}
+		// the rebuilt packet must be one a late arrival would be accepted as.
+		uint32 late_by = _last_seq_recvd - missing;
+		if(missing_count != 1 || late_by >= _get_reorder_window() || late_by >= _last_seq_recvd - _reorder_horizon || _is_acked(late_by))
+			return;
+		
+		uint8 body[max_fec_body_size];
+		pstream.read_bytes(body, parity_size);
+		uint32 body_size = length_xor;
+		for(uint32 i = 0; i < group_count; i++)
+		{
+			if(group_last - i == missing)
+				continue;
+			fec_body &slot = _fec_history[(group_last - i) & (fec_history_size - 1)];
+			if(slot.size > parity_size)
+				return;
+			for(uint32 j = 0; j < slot.size; j++)
+				body[j] ^= slot.data[j];
+			body_size ^= slot.size;
+		}
+		if(body_size > parity_size)
+			return;
+		
+		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: FEC recovered %d", _connection_index, missing));
+		_ack_mask[late_by >> 5] |= 1 << (late_by & 0x1F);
+		if(!late_by)
+			_last_seq_recvd_time = time::get_current();
+		_data_packets_since_send++;
+		_fec_recovered_count++;
+		_received_packet_seq = missing;
+		bit_stream body_stream(body, body_size);
+		_read_packet_body(body_stream);
+		_received_packet_seq = sequence;
+	}
+	
+	/// Sets how many milliseconds acks for received data packets may wait for an outgoing packet to carry them before an ack packet is sent, or 0 to send an ack packet every ack_data_packet_interval data packets received.
+	void set_ack_delay(uint32 delay)
+	{
+		_ack_delay = delay;
+	}
+	
+	/// Sets the number of bytes of data the send queue may hold before send_data_packet refuses more.
+	void set_send_queue_limit(uint32 limit)
+	{
+		_send_queue_limit = limit;
 	}
 	
 	/// Sends a ping packet to the remote host, to determine if it is still alive and what its packet window status is.
@@ -342,7 +1388,7 @@ public:
 	/// Sets the initial sequence number of packets read from the remote host.
 	void set_initial_recv_sequence(uint32 sequence)
 	{ 
-		_initial_recv_seq = _last_seq_recvd = _last_recv_ack_ack = sequence;
+		_initial_recv_seq = _last_seq_recvd = _last_recv_ack_ack = _reorder_horizon = sequence;
 	}
 	
 	/// Returns the initial sequence number of packets sent from the remote host.
@@ -384,12 +1430,80 @@ public:
 		return _connection_index;
 	}
 	
-	/// Returns true if the packet send window is full and no more data packets can be sent.
+	/// Returns the number of packets in this connection's packet window, as negotiated with the remote host.
+	uint32 get_packet_window_size()
+	{
+		return _packet_window_size;
+	}
+	
+	/// Rounds a requested packet window size down to a power of two between min_packet_window_size and max_packet_window_size.
+	static uint32 clamp_packet_window_size(uint32 packet_window_size)
+	{
+		uint32 clamped = min_packet_window_size;
+		while(clamped < max_packet_window_size && clamped * 2 <= packet_window_size)
+			clamped *= 2;
+		return clamped;
+	}
+	
+	/// Returns fec_group_size limited to max_fec_group_size; 0 stays 0, meaning forward error correction is off.
+	static uint32 clamp_fec_group_size(uint32 fec_group_size)
+	{
+		return fec_group_size < uint32(max_fec_group_size) ? fec_group_size : uint32(max_fec_group_size);
+	}
+	
+	/// Returns true if no more data packets can be sent right now, because the packet window or the congestion window is full or the pacing rate has been reached.
 	bool window_full()
 	{
-		if(_last_send_seq - _highest_acked_seq >= (max_packet_window_size - 2))
-			return true;
-		return false;
+		return get_send_budget() == 0;
+	}
+	
+	/// Returns the number of data packets that may be sent right now: the room left in the packet window, limited by the congestion controller's window and pacing rate.
+	uint32 get_send_budget()
+	{
+		uint32 packets_in_flight = _last_send_seq - _highest_acked_seq;
+		uint32 window = _packet_window_size - 2;
+		if(_congestion_controller.is_null())
+			return packets_in_flight >= window ? 0 : window - packets_in_flight;
+		
+		uint32 congestion_window = _congestion_controller->get_congestion_window();
+		if(congestion_window < window)
+			window = congestion_window;
+		if(packets_in_flight >= window)
+			return 0;
+		uint32 budget = window - packets_in_flight;
+		float32 pacing_rate = _congestion_controller->get_pacing_rate();
+		if(pacing_rate > 0)
+		{
+			_update_pacing_credit(time::get_current(), pacing_rate);
+			if(_pacing_credit < budget)
+				budget = _pacing_credit < 0 ? 0 : uint32(_pacing_credit);
+		}
+		return budget;
+	}
+	
+	/// Returns the smoothed round trip time to the remote host in milliseconds, or a negative value if it hasn't been measured yet.
+	float32 get_round_trip_time()
+	{
+		return _round_trip_time;
+	}
+	
+	/// Returns the smoothed mean deviation of the round trip time in milliseconds.
+	float32 get_round_trip_time_variance()
+	{
+		return _round_trip_time_variance;
+	}
+	
+	/// Sets the congestion_controller that limits this connection's data sends, or NULL to be limited only by the packet window.
+	void set_congestion_controller(congestion_controller *controller)
+	{
+		_congestion_controller = controller;
+		_pacing_credit = 0;
+		_pacing_update_time = time::get_current();
+	}
+	
+	congestion_controller *get_congestion_controller()
+	{
+		return _congestion_controller;
 	}
 	
 	//----------------------------------------------------------------
@@ -418,6 +1532,23 @@ public:
 	{
 		return _symmetric_cipher;
 	}
+	
+	/// Seals every packet this connection sends from now on, and requires every packet it reads to be sealed, with AES-GCM under the connection's symmetric key.  The initiator numbers the packets it sends from the top half of the 64 bit space and the host from the bottom half, so no nonce is used in both directions.
+	void set_packet_encryption(const uint8 key[symmetric_cipher::key_size], const uint8 init_vector[symmetric_cipher::block_size])
+	{
+		delete _packet_cipher;
+		_packet_cipher = new packet_cipher(key, init_vector);
+		uint64 initiator_base = uint64(1) << 63;
+		_send_packet_number = _is_initiator ? initiator_base : 0;
+		_recv_packet_number = _is_initiator ? 0 : initiator_base;
+		memset(_replay_window, 0, sizeof(_replay_window));
+	}
+	
+	/// Returns true if this connection's packets are sealed with AES-GCM.
+	bool is_packet_encryption_enabled()
+	{
+		return _packet_cipher != 0;
+	}
 
 	byte_buffer_ptr &get_shared_secret()
 	{
@@ -426,12 +1557,21 @@ public:
 	void set_shared_secret(byte_buffer_ptr secret)
 	{
 		_shared_secret = secret;
+		if(!secret.is_null())
+			_shared_secret_cipher = new symmetric_cipher(secret);
+	}
+	/// Returns a cipher keyed with the shared secret, its key expanded once when the secret was set.  Copy it into a new symmetric_cipher to encrypt or decrypt a packet.
+	const symmetric_cipher &get_shared_secret_cipher()
+	{
+		return *_shared_secret_cipher;
 	}
 	/// Sets the ping/timeout characteristics for a fixed-rate connection.  Total timeout is msPerPing * ping_retry_count.
 	void set_ping_timeouts(time time_per_ping, uint32 ping_retry_count)
 	{
 		_ping_retry_count = ping_retry_count;
 		_ping_timeout = time_per_ping;
+		if(is_scheduled())
+			_torque_socket->_schedule_connection_timeout(this);
 	}
 	
 	/// Simulates a network situation with a percentage random packet loss and a connection one way latency as specified.
@@ -441,6 +1581,18 @@ public:
 		_simulated_latency = latency;
 	}
 	
+	/// Reads the connection id from the header of a connected protocol packet, leaving the stream where it was.  Returns false if the packet is too short to have a header.
+	static bool read_connection_id(bit_stream &stream, torque_connection_id *connection_id)
+	{
+		if(stream.get_stream_byte_size() < packet_header_byte_size)
+			return false;
+		bit_stream::bit_position position = stream.get_bit_position();
+		stream.set_bit_position(3 + sequence_number_bit_size + ack_sequence_number_bit_size);
+		*connection_id = stream.read_integer(connection_id_bit_size);
+		stream.set_bit_position(position);
+		return true;
+	}
+	
 	/// Returns the remote address of the host we're connected or trying to connect to.
 	const address &get_address()
 	{
@@ -483,6 +1635,27 @@ public:
 		if(_last_ping_send_time.get_milliseconds() == 0)
 			_last_ping_send_time = current_time;
 		
+		// no packet went out to carry the acks for data received, so they go on their own.
+		if(_ack_due_time.get_milliseconds() && current_time >= _ack_due_time)
+			send_ack_packet();
+		
+		// if the last packets sent or their acks were lost, nothing will come back to report it; a ping makes the remote host ack.
+		if(_ack_probe_time.get_milliseconds() && current_time >= _ack_probe_time)
+		{
+			if(has_unacked_sent_packets())
+			{
+				send_ping_packet();
+				_ack_probe_count++;
+				_ack_probe_time = current_time + _get_ack_probe_timeout();
+			}
+			else
+				_ack_probe_time = time(0);
+		}
+		
+		for(uint32 i = 0; i < max_message_streams && !_reassembly_failed; i++)
+			if(_message_streams[i].has_stalled_reassembly(current_time - _reassembly_timeout))
+				_reassembly_failed = true;
+		
 		time timeout = _ping_timeout;
 		uint32 timeout_count = _ping_retry_count;
 
@@ -497,10 +1670,16 @@ public:
 		return false;
 	}
 
-	torque_connection(nonce initiator_nonce, uint32 initial_send_sequence, uint32 connection_index, bool is_initiator)
+	torque_connection(nonce initiator_nonce, uint32 initial_send_sequence, uint32 connection_index, bool is_initiator, uint32 packet_window_size = default_packet_window_size) : timer_wheel::timer(torque_socket::connection_timer)
 	{
 		_is_initiator = is_initiator;
 		_connection_index = connection_index;
+		_remote_connection_index = 0;
+		for(uint32 i = 0; i < path_challenge_slot_count; i++)
+		{
+			_path_challenges[i].challenge = 0;
+			_path_challenges[i].send_time = time(0);
+		}
 		_initial_send_seq = initial_send_sequence;
 		_initiator_nonce = initiator_nonce;
 		
@@ -511,35 +1690,199 @@ public:
 		_ping_send_count = 0;
 		
 		_last_seq_recvd = 0;
+		_last_seq_recvd_time = time(0);
 		_highest_acked_seq = _initial_send_seq;
+		_highest_ack_received = _initial_send_seq;
 		_last_send_seq = _initial_send_seq; // start sending at _initial_send_seq + 1
-		_ack_mask[0] = 0;
 		_last_recv_ack_ack = 0;
 		
+		_packet_window_size = clamp_packet_window_size(packet_window_size);
+		_last_seq_recvd_at_send.resize(_packet_window_size);
+		for(uint32 i = 0; i < _packet_window_size; i++)
+			_last_seq_recvd_at_send[i] = 0;
+		_ack_mask.resize((_packet_window_size + 31) >> 5);
+		for(uint32 i = 0; i < _ack_mask.size(); i++)
+			_ack_mask[i] = 0;
+		_sent_packets.resize(_packet_window_size);
+		for(uint32 i = 0; i < _packet_window_size; i++)
+			_sent_packets[i].messages = 0;
+		_data_packets_since_send = 0;
+		_received_packet_seq = 0;
+		_reorder_window = 0;
+		_reorder_horizon = 0;
+		_reorder_stall_seq = 0;
+		_reorder_stall_time = time(0);
+		_ack_delay = default_ack_delay;
+		_ack_due_time = time(0);
+		
+		_round_trip_time = -1;
+		_round_trip_time_variance = 0;
+		_delivered_count = 0;
+		_delivered_time = time::get_current();
+		_first_sent_time = _delivered_time;
+		_pacing_credit = 0;
+		_pacing_update_time = _delivered_time;
+		_ack_probe_time = time(0);
+		_ack_probe_count = 0;
+		
+		_send_queue_head = 0;
+		_send_queue_tail = 0;
+		_send_queue_count = 0;
+		_send_queue_bytes = 0;
+		_send_queue_limit = default_send_queue_limit;
+		_send_queue_blocked = false;
+		_send_wakeup_time = time(0);
+		_coalesce_delay = 0;
+		_coalesce_size = 0;
+		_coalesce_count = 0;
+		_coalesce_flush_time = time(0);
+		_fec_min_group_size = 0;
+		_fec_max_group_size = 0;
+		_fec_group_size = 0;
+		_fec_group_count = 0;
+		_fec_group_last = 0;
+		_fec_parity = 0;
+		_fec_parity_size = 0;
+		_fec_length_xor = 0;
+		_fec_flush_time = time(0);
+		_fec_loss_rate = 0;
+		_fec_history = 0;
+		_fec_parity_last = 0;
+		_fec_recovered_count = 0;
+		_packet_cipher = 0;
+		_send_packet_number = 0;
+		_recv_packet_number = 0;
+		memset(_replay_window, 0, sizeof(_replay_window));
+		_next_stream_index = 0;
+		_reassembly_limit = default_reassembly_limit;
+		_reassembly_timeout = time(default_reassembly_timeout);
+		_reassembly_failed = false;
+		
 		_ping_timeout = time(default_ping_timeout);
 		_ping_retry_count = default_ping_retry_count;
 	}
+	
+	~torque_connection()
+	{
+		while(_send_queue_head)
+		{
+			queued_packet *next = _send_queue_head->next;
+			memory_deallocate(_send_queue_head);
+			_send_queue_head = next;
+		}
+		delete[] _fec_parity;
+		delete[] _fec_history;
+		delete _packet_cipher;
+	}
 protected:
 	safe_ptr<torque_socket> _torque_socket; ///< The torque_socket of which this torque_connection is a member.
 	address _address; ///< The network address of the host this instance is connected to.
 	uint32 _connection_index; ///< The id of this connection on its socket.
+	uint32 _remote_connection_index; ///< The id of this connection on the remote host's socket, written into every packet header so the remote host finds the connection by it rather than by the address the packet came from.
+	path_challenge _path_challenges[path_challenge_slot_count]; ///< Outstanding path challenges, each in the slot its address hashes to, so packets spoofed from other addresses can only displace a challenge that shares its slot and has gone unanswered for path_challenge_retry_time.
 	bool _is_initiator; ///< True if this host initiated the arranged connection.
 	nonce _initiator_nonce; ///< Unique nonce generated for this connection to send to the server.
 	nonce _host_nonce; ///< Unique nonce generated by the server for the connection.	
 	byte_buffer_ptr _shared_secret; ///< The shared secret key 
+	ref_ptr<symmetric_cipher> _shared_secret_cipher; ///< Cipher keyed with _shared_secret, copied for each packet encrypted with it.
 	ref_ptr<symmetric_cipher> _symmetric_cipher; ///< The helper object that performs symmetric encryption on packets
 
-	uint32 _last_seq_recvd_at_send[max_packet_window_size]; ///< The sequence number of the last packet received from the remote host when we sent the packet with sequence X & packet_window_mask.
+	uint32 _packet_window_size; ///< Maximum number of packets in flight in each direction; a power of two agreed on during connection negotiation.
+	array<uint32> _last_seq_recvd_at_send; ///< The sequence number of the last packet received from the remote host when we sent the packet with sequence X & (_packet_window_size - 1).
 	uint32 _last_seq_recvd; ///< The sequence number of the most recently received packet from the remote host.
+	time _last_seq_recvd_time; ///< When the data packet with sequence _last_seq_recvd arrived, from which the time its ack was held is reported.
 	uint32 _highest_acked_seq; ///< The highest sequence number the remote side has acknowledged.
 	uint32 _last_send_seq; ///< The sequence number of the last packet sent.
-	uint32 _ack_mask[max_ack_mask_size]; ///< long string of bits, each acking a packet sent by the remote host.
+	array<uint32> _ack_mask; ///< long string of _packet_window_size bits, each acking a packet sent by the remote host.
 	///< The bit associated with _last_seq_recvd is the low bit of the 0'th word of _ack_mask.
 	uint32 _last_recv_ack_ack; ///< The highest sequence this side knows the other side has received an ACK or NACK for.
 	uint32 _initial_send_seq; ///< The first _last_send_seq for this side of the torque_connection.
 	uint32 _initial_recv_seq; ///< The first _last_seq_recvd (the first _last_send_seq for the remote host).
-	time _highest_acked_send_time; ///< The send time of the highest packet sequence acked by the remote host.  Used in the computation of round trip time.
-	time _last_update_time; ///< The last time a packet was sent from this instance.
+	uint32 _data_packets_since_send; ///< Data packets received since this side last sent a packet, and with it acks.
+	uint32 _ack_delay; ///< Milliseconds acks for received data wait for an outgoing packet to carry them, or 0 to send ack packets without waiting.
+	time _ack_due_time; ///< When an ack packet must be sent if no other packet has carried the acks by then, or 0 if none is owed.
+	uint32 _received_packet_seq; ///< Sequence number of the packet being read, which is older than _last_seq_recvd if it arrived late.
+	uint32 _highest_ack_received; ///< Highest sequence number the remote host has acked, which may be past _highest_acked_seq while an earlier packet's fate is still awaited.
+	uint32 _reorder_window; ///< Packets behind the newest received that a late data packet may be and still be accepted.
+	uint32 _reorder_horizon; ///< Sequence number up to which the fate of every packet from the remote host is settled and has been, or is about to be, acked; later packets that are missing may still arrive.
+	uint32 _reorder_stall_seq; ///< _last_seq_recvd when the reorder horizon was last seen stuck at a missing packet.
+	time _reorder_stall_time; ///< When the reorder horizon was last seen stuck at a missing packet, or 0 if it isn't.
+	
+	/// What was known when a data packet was sent, for measuring its round trip and the delivery rate while it was in flight.
+	struct sent_packet_record
+	{
+		time send_time; ///< When the packet was sent.
+		uint32 delivered_count; ///< _delivered_count when the packet was sent.
+		time delivered_time; ///< _delivered_time when the packet was sent.
+		time first_sent_time; ///< _first_sent_time when the packet was sent.
+		uint32 datagram_count; ///< Datagrams from the application the packet carried, each of which is told of its fate.
+		stream_message *messages; ///< Stream messages the packet carried, linked through next_in_packet.
+	};
+	array<sent_packet_record> _sent_packets; ///< Record of each data packet in flight, indexed by sequence & (_packet_window_size - 1).
+	float32 _round_trip_time; ///< Smoothed round trip time in milliseconds, or negative until measured.
+	float32 _round_trip_time_variance; ///< Smoothed mean deviation of the round trip time in milliseconds.
+	uint32 _delivered_count; ///< Data packets the remote host has acknowledged.
+	time _delivered_time; ///< When _delivered_count last grew, or when sending resumed after the connection was idle.
+	time _first_sent_time; ///< Send time of the packet most recently acknowledged, or when sending resumed after the connection was idle.
+	ref_ptr<congestion_controller> _congestion_controller; ///< Limits data sends beyond the packet window, or NULL.
+	float32 _pacing_credit; ///< Data packets a paced connection may send now; negative after a send ahead of the rate.
+	time _pacing_update_time; ///< When _pacing_credit was last updated.
+	time _ack_probe_time; ///< When to ping for acks if none arrive for the packets in flight, or 0 if nothing is in flight.
+	uint32 _ack_probe_count; ///< Ack probes sent since the last ack arrived.
+	
+	/// A data packet waiting in the send queue for room in the window.
+	struct queued_packet
+	{
+		queued_packet *next;
+		uint32 size;
+		uint32 datagram_count; ///< Datagrams in data; more than one if they were coalesced.
+		uint8 data[1];
+	};
+	queued_packet *_send_queue_head; ///< Oldest data packet waiting to be sent.
+	queued_packet *_send_queue_tail; ///< Newest data packet waiting to be sent.
+	uint32 _send_queue_count; ///< Data packets waiting to be sent.
+	uint32 _send_queue_bytes; ///< Bytes of data waiting to be sent.
+	uint32 _send_queue_limit; ///< Bytes of data the send queue may hold before refusing more.
+	bool _send_queue_blocked; ///< True if a send was refused for a full queue, so a writable event is owed once it drains.
+	time _send_wakeup_time; ///< When the pacing rate next allows a queued packet to be sent, or 0 if sends aren't waiting on the pacing rate.
+	uint32 _coalesce_delay; ///< Milliseconds a small datagram may be held for others to share its packet, or 0 if coalescing is off.
+	uint8 _coalesce_buffer[torque_sockets_max_datagram_size]; ///< Datagrams held for coalescing, each behind its length prefix.
+	uint32 _coalesce_size; ///< Bytes in _coalesce_buffer.
+	uint32 _coalesce_count; ///< Datagrams in _coalesce_buffer.
+	time _coalesce_flush_time; ///< When the datagrams held for coalescing must be sent, or 0 if none are held.
+	
+	/// Body of a recently received data packet, kept for rebuilding a lost one from parity.
+	struct fec_body
+	{
+		bool is_valid; ///< False until a body parity can cover is stored here.
+		uint32 sequence;
+		uint32 size;
+		uint8 data[max_fec_body_size];
+	};
+	uint32 _fec_min_group_size; ///< Fewest data packets a parity packet covers, or 0 if forward error correction is off.
+	uint32 _fec_max_group_size; ///< Most data packets a parity packet covers.
+	uint32 _fec_group_size; ///< Data packets the current group is sent with parity after.
+	uint32 _fec_group_count; ///< Data packets in the current group, or 0 if there is none.
+	uint32 _fec_group_last; ///< Sequence of the newest data packet in the current group.
+	uint8 *_fec_parity; ///< XOR of the bodies in the current group.
+	uint32 _fec_parity_size; ///< Bytes in _fec_parity: the size of the group's biggest body.
+	uint32 _fec_length_xor; ///< XOR of the body sizes in the current group.
+	time _fec_flush_time; ///< When the current group's parity must be sent, or 0 if there is no group.
+	float32 _fec_loss_rate; ///< Average fraction of data packets reported lost after recovery.
+	fec_body *_fec_history; ///< Bodies of recently received data packets, indexed by sequence, or 0 if forward error correction is off.
+	uint32 _fec_parity_last; ///< Sequence of the newest data packet covered by a parity packet received.
+	uint32 _fec_recovered_count; ///< Lost data packets rebuilt from parity.
+	
+	packet_cipher *_packet_cipher; ///< Seals and opens this connection's packets, or 0 if they are sent in the clear.
+	uint64 _send_packet_number; ///< Number of the last sealed packet sent.
+	uint64 _recv_packet_number; ///< Highest number of a packet opened.
+	uint32 _replay_window[replay_window_size >> 5]; ///< Bit set for each packet number up to replay_window_size behind _recv_packet_number that has been opened.
+	
+	message_stream _message_streams[max_message_streams]; ///< Reliable ordered message streams.
+	uint32 _next_stream_index; ///< Stream whose messages go first in the next data packet.
+	uint32 _reassembly_limit; ///< Bytes this connection will hold for stream messages received out of order or being reassembled.
+	time _reassembly_timeout; ///< How long a message being reassembled may go without a new fragment.
+	bool _reassembly_failed; ///< True if the remote host went past a reassembly limit or sent fragments that don't fit together.
 	
 	time _ping_timeout; ///< time to wait before sending a ping packet.
 	uint32 _ping_retry_count; ///< Number of unacknowledged pings to send before timing out.
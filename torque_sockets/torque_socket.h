@@ -25,10 +25,20 @@ public:
 		introduced_connection_request_packet, ///< sent from the initiator and host to the introducer.  An introducer will ignore introduced_connection_request packets until a call to torque_socket_introduce is made.  Once introduced_connection_request packets are received from both initiator and host, and upon subsequent receipt of introduced_connection_request packets, the introducer will send connection_introduction packets to introducer and host.
 		connection_introduction_packet, ///< Packet sent by introducer to properly connect initiator and host.
 		punch_packet, ///< Packets sent by initiator or host of an introduced connection to "punch" a connection hole through NATs and firewalls.
+		path_challenge_packet, ///< Sent to a new address that packets for an established connection arrive from, as when the remote host's NAT rebinds its port, carrying a random challenge.
+		path_response_packet, ///< Sent back from the new address with the challenge encrypted under the connection's shared secret, proving the remote host is there; the connection then moves to that address.
 
 		first_valid_info_packet_id = 32, ///< The first valid first byte of an info packet sent from a torque_socekt
 		last_valid_info_packet_id = 127, ///< The last valid first byte of an info packet sent from a torque_socekt 
 	};
+	
+	/// Kinds of timer_wheel::timer scheduled on _timers.
+	enum timer_type
+	{
+		delayed_send_timer, ///< A packet_record waiting out its simulated latency.
+		pending_connection_timer, ///< A pending_connection due to retry its current handshake step or time out.
+		connection_timer, ///< A torque_connection due to send queued data, send a ping, probe for acks or time out.
+	};
 protected:
 	enum torque_socket_constants
 	{
@@ -37,12 +47,14 @@ protected:
 		
 		connect_retry_count = 4, ///< Number of times to send connect requests before giving up.
 		connect_retry_time = 2500, ///< Timeout interval in milliseconds before retrying connect request.
+		path_challenge_retry_time = 250, ///< Milliseconds before another path challenge may be sent for a connection, so packets from new addresses can't make a socket send challenges faster than this.
 		
 		punch_retry_count = 6, ///< Number of times to send groups of firewall punch packets before giving up.
 		punch_retry_time = 2500, ///< Timeout interval in milliseconds before retrying punch sends.
 		
 		introduced_connection_connect_timeout = 45000, ///< interval a pending hosted introduced connection will wait between challenge response and connect request
-		timeout_check_interval = 1500, ///< Interval in milliseconds between checking for connection timeouts.
+		idle_process_interval = 1500, ///< Longest time in milliseconds a socket goes without running process_connections, so the client puzzle manager keeps ticking.
+		puzzle_result_poll_interval = 20, ///< Interval in milliseconds at which process_connections polls for a client puzzle solution while one is being solved in the background.
 		puzzle_solution_timeout = 30000, ///< If the server gives us a puzzle that takes more than 30 seconds, time out.
 		introduction_timeout = 30000, ///< Amount of time the introducer tracks a connection introduction request.
 	};
@@ -54,22 +66,22 @@ protected:
 		reason_shutdown,
 		reason_reconnecting,
 		reason_disconnect_call,
+		reason_reassembly_failed,
 	};
 	
 	/// Computes an identity token for the connecting client based on the address of the client and the client's unique nonce value.
 	uint32 compute_client_identity_token(const address &the_address, const nonce &the_nonce)
 	{
-		hash_state state;
+		sha256 state;
 		uint32 hash[8];
 		uint32 host = htonl(the_address.get_host());
 		uint32 port = htonl(the_address.get_port());
 		
-		sha256_init(&state);
-		sha256_process(&state, (uint8 *) &host, sizeof(host));
-		sha256_process(&state, (uint8 *) &port, sizeof(port));
-		sha256_process(&state, (uint8 *) &the_nonce, sizeof(the_nonce));
-		sha256_process(&state, _random_hash_data, sizeof(_random_hash_data));
-		sha256_done(&state, (uint8 *) hash);
+		state.update((uint8 *) &host, sizeof(host));
+		state.update((uint8 *) &port, sizeof(port));
+		state.update((uint8 *) &the_nonce, sizeof(the_nonce));
+		state.update(_random_hash_data, sizeof(_random_hash_data));
+		state.finish((uint8 *) hash);
 		
 		return hash[0];
 	}
@@ -77,7 +89,7 @@ protected:
 	/// Returns the address of the first network torque_socket in the list that the socket on this torque_socket is bound to.
 	address get_first_bound_interface_address()
 	{
-		address the_address = _socket.get_bound_address();
+		address the_address = _transport->get_bound_address();
 		
 		if(the_address.is_same_host(address(address::any, 0)))
 		{
@@ -110,7 +122,7 @@ protected:
 		core::write(out, introducing_connection->get_initiator_nonce());
 		core::write(out, uint32(the_connection->_remote_client_id));
 		core::write(out, uint8(the_connection->get_type() == pending_connection::introduced_connection_initiator));
-		out.send_to(_socket, introducing_connection->get_address());		
+		_send_stream(out, introducing_connection->get_address());		
 	}
 	
 	void _handle_introduction_request(const address &addr, bit_stream &stream)
@@ -189,7 +201,7 @@ protected:
 		core::write(out, initiator_nonce);
 		core::write(out, host_nonce);
 		
-		out.send_to(_socket, connection->get_address());
+		_send_stream(out, connection->get_address());
 	}
 
 	void _handle_introduction(const address &the_address, bit_stream &packet_stream)
@@ -217,9 +229,7 @@ protected:
 				walk->_host_nonce = host_nonce;
 				walk->_possible_addresses.push_back(remote_address);
 				walk->set_state(pending_connection::sending_punch_packets);
-				walk->_state_send_retry_count = punch_retry_count;
-				walk->_state_send_retry_interval = introduced_connection_connect_timeout;
-				walk->_state_last_send_time = get_process_start_time();
+				_set_pending_retries(walk, punch_retry_count, introduced_connection_connect_timeout);
 				_send_punch(walk);
 				return;
 			}
@@ -235,7 +245,7 @@ protected:
 			core::write(out, uint8(punch_packet));
 			core::write(out, the_connection->get_initiator_nonce());
 			core::write(out, the_connection->get_host_nonce());
-			out.send_to(_socket, the_connection->_possible_addresses[i]);			
+			_send_stream(out, the_connection->_possible_addresses[i]);			
 		}
 	}
 	
@@ -252,9 +262,7 @@ protected:
 			{
 				walk->set_state(pending_connection::requesting_challenge_response);
 				walk->_address = the_address;
-				walk->_state_send_retry_count = challenge_retry_count;
-				walk->_state_send_retry_interval = challenge_retry_time;
-				walk->_state_last_send_time = get_process_start_time();
+				_set_pending_retries(walk, challenge_retry_count, challenge_retry_time);
 				_send_challenge_request(walk);
 			}
 		}
@@ -268,7 +276,7 @@ protected:
 		core::write(out, uint8(connect_challenge_request_packet));
 		core::write(out, the_connection->get_initiator_nonce());
 		core::write(out, the_connection->get_host_nonce());
-		out.send_to(_socket, the_connection->get_address());
+		_send_stream(out, the_connection->get_address());
 	}
 	
 	/// Handles a connect challenge request by replying to the requestor of a connection with a unique token for that connection, as well as (possibly) a client puzzle (for DoS prevention), or this torque_socket's public key.
@@ -290,9 +298,7 @@ protected:
 			{
 				conn->_address = addr;
 				conn->set_state(pending_connection::awaiting_connect_request);
-				conn->_state_send_retry_count = 0;
-				conn->_state_send_retry_interval = introduced_connection_connect_timeout;
-				conn->_state_last_send_time = get_process_start_time();
+				_set_pending_retries(conn, 0, introduced_connection_connect_timeout);
 				break;
 			}
 		}
@@ -317,7 +323,7 @@ protected:
 		core::write(out, _challenge_response);
 
 		TorqueLogMessageFormatted(LogNettorque_socket, ("Sending Challenge Response: %8x", identity_token));
-		out.send_to(_socket, addr);
+		_send_stream(out, addr);
 	}
 	
 	/// Processes a connect_challenge_response; if it's correctly formed and for a pending connection that is requesting_challenge_response, post a challenge_response event and awayt a local_challenge_accept.
@@ -368,9 +374,7 @@ protected:
 		_event_queue.set_event_data(event, response_data->get_buffer(), response_data->get_buffer_size());
 
 		conn->set_state(pending_connection::awaiting_local_challenge_accept);
-		conn->_state_send_retry_count = 0;
-		conn->_state_send_retry_interval = introduction_timeout;
-		conn->_state_last_send_time = get_process_start_time();
+		_set_pending_retries(conn, 0, introduction_timeout);
 	}
 	
 	/// Sends a connect request on behalf of a pending connection.
@@ -394,12 +398,19 @@ protected:
 		out.write_bytes(conn->_symmetric_key, symmetric_cipher::key_size);
 
 		core::write(out, conn->get_initial_send_sequence());
+		conn->_packet_window_size = _packet_window_size;
+		core::write(out, conn->_packet_window_size);
+		conn->_fec_group_size = _fec_group_size;
+		core::write(out, conn->_fec_group_size);
+		core::write(out, conn->_connection_index);
+		conn->_packet_encryption = _packet_encryption;
+		out.write_bool(conn->_packet_encryption);
 		core::write(out, conn->_packet_data);
 		
 		// Write a hash of everything written into the packet, then  symmetrically encrypt the packet from the end of the public key to the end of the signature.
-		symmetric_cipher the_cipher(conn->get_shared_secret());
+		symmetric_cipher the_cipher(conn->get_shared_secret_cipher());
 		bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
-		out.send_to(_socket, conn->get_address());
+		_send_stream(out, conn->get_address());
 	}
 	
 	/// Handles a connection request from a remote host.
@@ -460,7 +471,10 @@ protected:
 		uint32 decrypt_pos = stream.get_next_byte_position();
 		
 		stream.set_byte_position(decrypt_pos);
+		// timed to the millisecond: one that takes less crosses a millisecond boundary about as often as the fraction of one it takes, so the total over many is about right.
+		time secret_start = time::get_current();
 		byte_buffer_ptr shared_secret = _private_key->compute_shared_secret_key(public_key);
+		_puzzle_manager.record_shared_secret(uint32((time::get_current() - secret_start).get_milliseconds()));
 		//logprintf("shared secret (server) %s", shared_secret->encodeBase64()->get_buffer());
 		
 		symmetric_cipher the_cipher(shared_secret);
@@ -468,8 +482,10 @@ protected:
 		if(!bit_stream_decrypt_and_check_hash(stream, torque_connection::message_signature_bytes, decrypt_pos, &the_cipher))
 			return;
 		
-		if(!pending)
-			pending = new pending_connection(pending_connection::connection_host, initiator_nonce, _random_generator.random_integer(), _next_connection_index++);
+		// an introduced connection's pending_connection is already in the list.
+		bool new_pending = !pending;
+		if(new_pending)
+			pending = new pending_connection(pending_connection::connection_host, initiator_nonce, _random_generator.random_integer(), _allocate_connection_index());
 		
 		// now read the first part of the connection's symmetric key
 		stream.read_bytes(pending->_symmetric_key, symmetric_cipher::key_size);
@@ -477,6 +493,22 @@ protected:
 		
 		uint32 connect_sequence;
 		core::read(stream, connect_sequence);
+		
+		// grant the window the initiator asked for, up to this socket's own.
+		uint32 requested_window_size;
+		core::read(stream, requested_window_size);
+		requested_window_size = torque_connection::clamp_packet_window_size(requested_window_size);
+		pending->_packet_window_size = requested_window_size < _packet_window_size ? requested_window_size : _packet_window_size;
+		
+		// forward error correction is only used if both sides want it, with the larger of their minimum group sizes.
+		uint32 requested_fec_group_size;
+		core::read(stream, requested_fec_group_size);
+		requested_fec_group_size = torque_connection::clamp_fec_group_size(requested_fec_group_size);
+		pending->_fec_group_size = requested_fec_group_size && _fec_group_size ? (requested_fec_group_size > _fec_group_size ? requested_fec_group_size : _fec_group_size) : 0;
+		core::read(stream, pending->_remote_connection_index);
+		
+		// packets are only sealed if both sides want it.
+		pending->_packet_encryption = stream.read_bool() && _packet_encryption;
 		TorqueLogMessageFormatted(LogNettorque_socket, ("Received Connect Request %8x", client_identity));
 		
 		if(existing)
@@ -492,7 +524,12 @@ protected:
 		byte_buffer_ptr connect_request_data;
 		core::read(stream, connect_request_data);
 
-		_add_pending_connection(pending);
+		if(new_pending)
+			_add_pending_connection(pending);
+		pending->set_state(pending_connection::awaiting_local_accept);
+		
+		// the initiator gives up once its connect request retries run out, so a request the application never answers times out on the same schedule instead of staying pending.
+		_set_pending_retries(pending, connect_retry_count, connect_retry_time);
 
 		torque_socket_event *event = _event_queue.post_event(torque_connection_requested_event_type, pending->_connection_index);
 		_event_queue.set_event_key(event, public_key->get_public_key()->get_buffer(), public_key->get_public_key()->get_buffer_size());
@@ -512,15 +549,19 @@ protected:
 		out.set_byte_position(encrypt_pos);
 		
 		core::write(out, conn->get_initial_send_sequence());
+		core::write(out, conn->get_packet_window_size());
+		core::write(out, conn->_fec_min_group_size);
+		core::write(out, conn->_connection_index);
+		out.write_bool(conn->is_packet_encryption_enabled());
 
 		uint8 init_vector[symmetric_cipher::block_size];
 		conn->get_symmetric_cipher()->get_init_vector(init_vector);
 		out.write_bytes(init_vector, symmetric_cipher::key_size);
 		
-		symmetric_cipher the_cipher(conn->get_shared_secret());
+		symmetric_cipher the_cipher(conn->get_shared_secret_cipher());
 		bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
 
-		out.send_to(_socket, conn->get_address());
+		_send_stream(out, conn->get_address());
 	}
 	
 	/// Handles a connect accept packet, putting the connection associated with the remote host (if there is one) into an active state.
@@ -537,7 +578,7 @@ protected:
 		if(!pending || pending->get_state() != pending_connection::requesting_connection || pending->get_initiator_nonce() != initiator_nonce || pending->get_host_nonce() != host_nonce)
 			return;
 		
-		symmetric_cipher the_cipher(pending->get_shared_secret());
+		symmetric_cipher the_cipher(pending->get_shared_secret_cipher());
 
 		if(!bit_stream_decrypt_and_check_hash(stream, torque_connection::message_signature_bytes, decrypt_pos, &the_cipher))
 			return;
@@ -545,13 +586,32 @@ protected:
 		uint32 recv_sequence;
 		core::read(stream, recv_sequence);
 		
+		uint32 packet_window_size;
+		core::read(stream, packet_window_size);
+		if(packet_window_size > pending->_packet_window_size || packet_window_size != torque_connection::clamp_packet_window_size(packet_window_size))
+			return;
+		uint32 fec_group_size;
+		core::read(stream, fec_group_size);
+		if(fec_group_size != torque_connection::clamp_fec_group_size(fec_group_size) || (fec_group_size && !pending->_fec_group_size))
+			return;
+		uint32 remote_connection_index;
+		core::read(stream, remote_connection_index);
+		bool packet_encryption = stream.read_bool();
+		if(packet_encryption && !pending->_packet_encryption)
+			return;
+		
 		uint8 init_vector[symmetric_cipher::block_size];
 		
 		stream.read_bytes(init_vector, symmetric_cipher::block_size);
 		symmetric_cipher *cipher = new symmetric_cipher(pending->_symmetric_key, init_vector);
 		
-		torque_connection *the_connection = new torque_connection(pending->get_initiator_nonce(), pending->get_initial_send_sequence(), pending->_connection_index, true);
+		torque_connection *the_connection = new torque_connection(pending->get_initiator_nonce(), pending->get_initial_send_sequence(), pending->_connection_index, true, packet_window_size);
 		the_connection->set_initial_recv_sequence(recv_sequence);
+		the_connection->set_fec_group_size(fec_group_size);
+		the_connection->_remote_connection_index = remote_connection_index;
+		the_connection->set_symmetric_cipher(cipher);
+		if(packet_encryption)
+			the_connection->set_packet_encryption(pending->_symmetric_key, init_vector);
 		the_connection->set_address(pending->get_address());
 		the_connection->set_shared_secret(pending->get_shared_secret());
 		the_connection->_host_nonce = pending->_host_nonce;
@@ -572,7 +632,7 @@ protected:
 		core::write(out, initiator_nonce);
 		core::write(out, host_nonce);
 		core::write(out, reason);
-		out.send_to(_socket, the_address);
+		_send_stream(out, the_address);
 	}
 	
 	
@@ -602,9 +662,7 @@ protected:
 		{
 			pending->_puzzle_retried = true;
 			pending->set_state(pending_connection::requesting_challenge_response);
-			pending->_state_send_retry_count = challenge_retry_count;
-			pending->_state_send_retry_interval = challenge_retry_time;
-			pending->_state_last_send_time = get_process_start_time();
+			_set_pending_retries(pending, challenge_retry_count, challenge_retry_time);
 			pending->_initiator_nonce = _random_generator.random_nonce();
 			
 			_send_challenge_request(pending);
@@ -616,6 +674,95 @@ protected:
 		_remove_pending_connection(pending);
 	}
 	
+	/// Sends a path challenge to new_address, which packets for the connection have started arriving from, unless the challenge slot new_address hashes to was filled too recently, by a challenge to it or to another address.
+	void _send_path_challenge(torque_connection *conn, const address &new_address)
+	{
+		time now = time::get_current();
+		torque_connection::path_challenge &slot = conn->get_path_challenge(new_address);
+		if(slot.send_time.get_milliseconds() && now - slot.send_time < time(path_challenge_retry_time))
+			return;
+		TorqueLogMessageFormatted(LogNettorque_socket, ("Sending path challenge to %s", new_address.to_string().c_str()));
+		slot.challenge = _random_generator.random_nonce();
+		slot.challenge_address = new_address;
+		slot.send_time = now;
+		
+		packet_stream out;
+		core::write(out, uint8(path_challenge_packet));
+		core::write(out, conn->get_initiator_nonce());
+		core::write(out, conn->get_host_nonce());
+		uint32 encrypt_pos = out.get_next_byte_position();
+		out.set_byte_position(encrypt_pos);
+		core::write(out, slot.challenge);
+		
+		symmetric_cipher the_cipher(conn->get_shared_secret_cipher());
+		bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
+		_send_stream(out, new_address);
+	}
+	
+	/// Answers a path challenge from the remote host of a connection, proving this host knows the connection's shared secret.  The response goes out from whatever address this host's packets now leave from.
+	void _handle_path_challenge(const address &the_address, bit_stream &stream)
+	{
+		nonce initiator_nonce, host_nonce, challenge;
+		core::read(stream, initiator_nonce);
+		core::read(stream, host_nonce);
+		
+		torque_connection *conn = _find_connection(the_address);
+		if(!conn || initiator_nonce != conn->get_initiator_nonce() || host_nonce != conn->get_host_nonce())
+			return;
+		uint32 decrypt_pos = stream.get_next_byte_position();
+		stream.set_byte_position(decrypt_pos);
+		
+		symmetric_cipher the_cipher(conn->get_shared_secret_cipher());
+		if(!bit_stream_decrypt_and_check_hash(stream, torque_connection::message_signature_bytes, decrypt_pos, &the_cipher))
+			return;
+		core::read(stream, challenge);
+		
+		packet_stream out;
+		core::write(out, uint8(path_response_packet));
+		core::write(out, conn->_remote_connection_index);
+		core::write(out, conn->get_initiator_nonce());
+		core::write(out, conn->get_host_nonce());
+		uint32 encrypt_pos = out.get_next_byte_position();
+		out.set_byte_position(encrypt_pos);
+		core::write(out, challenge);
+		
+		symmetric_cipher response_cipher(conn->get_shared_secret_cipher());
+		bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &response_cipher);
+		_send_stream(out, the_address);
+	}
+	
+	/// Moves a connection to the address a path response arrived from, if it answers the connection's outstanding challenge to that address.
+	void _handle_path_response(const address &the_address, bit_stream &stream)
+	{
+		torque_connection_id connection_id;
+		nonce initiator_nonce, host_nonce, challenge;
+		core::read(stream, connection_id);
+		core::read(stream, initiator_nonce);
+		core::read(stream, host_nonce);
+		
+		torque_connection *conn = _find_connection(connection_id);
+		if(!conn || initiator_nonce != conn->get_initiator_nonce() || host_nonce != conn->get_host_nonce())
+			return;
+		torque_connection::path_challenge &slot = conn->get_path_challenge(the_address);
+		if(!slot.send_time.get_milliseconds() || slot.challenge_address != the_address || _find_connection(the_address))
+			return;
+		uint32 decrypt_pos = stream.get_next_byte_position();
+		stream.set_byte_position(decrypt_pos);
+		
+		symmetric_cipher the_cipher(conn->get_shared_secret_cipher());
+		if(!bit_stream_decrypt_and_check_hash(stream, torque_connection::message_signature_bytes, decrypt_pos, &the_cipher))
+			return;
+		core::read(stream, challenge);
+		if(challenge != slot.challenge)
+			return;
+		
+		TorqueLogMessageFormatted(LogNettorque_socket, ("Connection %d moved from %s to %s", connection_id, conn->get_address().to_string().c_str(), the_address.to_string().c_str()));
+		_connection_address_lookup_table.remove(conn->get_address());
+		conn->set_address(the_address);
+		_connection_address_lookup_table.insert(the_address, conn);
+		slot.send_time = time(0);
+	}
+	
 	/// Dispatches a disconnect packet for a specified connection.
 	void _handle_disconnect(const address &the_address, bit_stream &stream)
 	{
@@ -635,7 +782,7 @@ protected:
 			uint32 decrypt_pos = stream.get_next_byte_position();
 			stream.set_byte_position(decrypt_pos);
 			
-			symmetric_cipher the_cipher(conn->get_shared_secret());
+			symmetric_cipher the_cipher(conn->get_shared_secret_cipher());
 			if(!bit_stream_decrypt_and_check_hash(stream, torque_connection::message_signature_bytes, decrypt_pos, &the_cipher))
 				return;
 			core::read(stream, reason_code);
@@ -678,11 +825,30 @@ protected:
 		
 		if(packet_stream.get_buffer()[0] & 0x80) // it's a protocol packet...
 		{
-			// if the MSB of the first byte is set, it's a protocol data packet so pass it to the appropriate connection.
+			// if the MSB of the first byte is set, it's a protocol data packet so pass it to the connection its header names.  One arriving from somewhere other than the connection's address must open with the connection's key before it is read, and is answered with a path challenge; anything the connection sends back still goes to its old address until the remote host proves it has moved.  Connection ids are easy to guess, so a connection whose packets aren't sealed never moves.
 			logprintf("got data packet");
-			torque_connection *conn = _find_connection(the_address);
-			if(conn)
+			torque_connection_id connection_id;
+			if(!torque_connection::read_connection_id(packet_stream, &connection_id))
+				return;
+			torque_connection *conn = _find_connection(connection_id);
+			if(conn && conn->get_address() != the_address)
+			{
+				if(conn->authenticate_packet(packet_stream))
+				{
+					_send_path_challenge(conn, the_address);
+					// opening the packet used up its packet number, so it is read now rather than dropped.
+					packet_stream.set_bit_position(0);
+					conn->read_raw_packet(packet_stream, true);
+					if(conn->reassembly_failed())
+						_drop_for_reassembly_failure(conn);
+				}
+			}
+			else if(conn)
+			{
 				conn->read_raw_packet(packet_stream);
+				if(conn->reassembly_failed())
+					_drop_for_reassembly_failure(conn);
+			}
 		}
 		else
 		{
@@ -725,17 +891,22 @@ protected:
 					case punch_packet:
 						_handle_punch(the_address, packet_stream);
 						break;
+					case path_challenge_packet:
+						_handle_path_challenge(the_address, packet_stream);
+						break;
+					case path_response_packet:
+						_handle_path_response(the_address, packet_stream);
+						break;
 				}
 			}
 		}
 	}
 protected:
-	/// Structure used to track packets that read by the background packet reader or are delayed in sending for simulating a high-latency connection.  The packet_record is allocated as sizeof(packet_record) + packet_size;
-	struct packet_record
+	/// Structure used to track packets that are delayed in sending for simulating a high-latency connection.  The packet_record is allocated as sizeof(packet_record) + packet_size, and waits on _timers until its send time.
+	struct packet_record : public timer_wheel::timer
 	{
-		packet_record *next_packet; ///< The next packet in the list of delayed packets.
+		packet_record() : timer_wheel::timer(delayed_send_timer) {}
 		address remote_address; ///< The address to send this packet to.
-		time send_time; ///< time when we should send the packet.
 		uint32 packet_size; ///< Size, in bytes, of the packet data.
 		uint8 packet_data[1]; ///< Packet data.
 	};
@@ -744,66 +915,44 @@ protected:
 	void process_connections()
 	{
 		_process_start_time = time::get_current();
-		_puzzle_manager.tick(_process_start_time, _random_generator);
-		
-		// first see if there are any delayed packets that need to be sent...
-		while(_send_packet_list && _send_packet_list->send_time < get_process_start_time())
-		{
-			packet_record *next = _send_packet_list->next_packet;
-			_socket.send_to(_send_packet_list->remote_address,
-							_send_packet_list->packet_data, _send_packet_list->packet_size);
-			memory_deallocate(_send_packet_list);
-			_send_packet_list = next;
-		}
+		_puzzle_manager.tick(_process_start_time, _pending_connection_count, _random_generator);
 		
-		if(get_process_start_time() > _last_timeout_check_time + time(timeout_check_interval))
+		// service the delayed sends, handshake retries and connection timeouts that have come due.
+		timer_wheel::timer *expired;
+		while((expired = _timers.get_next_expired(get_process_start_time())) != 0)
 		{
-			_last_timeout_check_time = get_process_start_time();
-			for(pending_connection **walk = &_pending_connections; *walk;)
+			switch(expired->get_timer_type())
 			{
-				pending_connection *pending = *walk;
-				if(get_process_start_time() > pending->_state_last_send_time + time(pending->_state_send_retry_interval))
+				case delayed_send_timer:
+				{
+					packet_record *the_packet = static_cast<packet_record *>(expired);
+					send_to(the_packet->remote_address, the_packet->packet_size, the_packet->packet_data);
+					destroy(the_packet);
+					memory_deallocate(the_packet);
+					break;
+				}
+				case pending_connection_timer:
+					_process_pending_timeout(static_cast<pending_connection *>(expired));
+					break;
+				case connection_timer:
 				{
-					if(!pending->_state_send_retry_count)
+					torque_connection *the_connection = static_cast<torque_connection *>(expired);
+					if(the_connection->_send_wakeup_time.get_milliseconds() && the_connection->_send_wakeup_time <= get_process_start_time())
+						the_connection->flush_send_queue();
+					if(the_connection->_coalesce_flush_time.get_milliseconds() && the_connection->_coalesce_flush_time <= get_process_start_time())
+						the_connection->flush_coalesced_datagrams();
+					if(the_connection->_fec_flush_time.get_milliseconds() && the_connection->_fec_flush_time <= get_process_start_time())
+						the_connection->send_fec_parity();
+					if(the_connection->check_timeout(get_process_start_time()))
 					{
-						// this pending connection request has timed out.
-						_event_queue.post_event(torque_connection_timed_out_event_type, pending->_connection_index);
-						*walk = pending->_next;
-						delete pending;
+						_event_queue.post_event(torque_connection_timed_out_event_type, the_connection->_connection_index);
+						_remove_connection(the_connection);
 					}
+					else if(the_connection->reassembly_failed())
+						_drop_for_reassembly_failure(the_connection);
 					else
-					{
-						pending->_state_send_retry_count--;
-						switch(pending->get_state())
-						{
-							case pending_connection::requesting_introduction:
-								_send_introduction_request(pending);
-								break;
-							case pending_connection::sending_punch_packets:
-								_send_punch(pending);
-								break;
-						case pending_connection::requesting_challenge_response:
-								_send_challenge_request(pending);
-								break;
-						default:
-								break;
-						}
-						walk = &pending->_next;
-					}
-				}
-				else
-					walk = &pending->_next;
-
-			}
-			for(torque_connection *connection_walk = _connection_list; connection_walk;)
-			{
-				torque_connection *the_connection = connection_walk;
-				connection_walk = connection_walk->_next;
-
-				if(the_connection->check_timeout(get_process_start_time()))
-				{
-					_event_queue.post_event(torque_connection_timed_out_event_type, the_connection->_connection_index);
-					_remove_connection(the_connection);
+						_schedule_connection_timeout(the_connection);
+					break;
 				}
 			}
 		}
@@ -832,6 +981,110 @@ protected:
 				}
 			}
 		}
+		_update_next_process_time();
+	}
+	
+	/// Recomputes _next_process_time from the timer wheel and any client puzzles being solved.  Called at the end of each process_connections pass; between passes, _schedule_timer keeps it up to date.
+	void _update_next_process_time()
+	{
+		time next = _timers.get_next_expire_time(get_process_start_time() + time(idle_process_interval));
+		for(pending_connection *walk = _pending_connections; walk; walk = walk->_next)
+		{
+			if(walk->get_state() == pending_connection::computing_puzzle_solution)
+			{
+				time puzzle_check = get_process_start_time() + time(puzzle_result_poll_interval);
+				if(puzzle_check < next)
+					next = puzzle_check;
+				break;
+			}
+		}
+		_next_process_time = next;
+	}
+	
+	/// Schedules the_timer on _timers, pulling _next_process_time in if it is now the earliest deadline.
+	void _schedule_timer(timer_wheel::timer *the_timer, time expire_time)
+	{
+		_timers.schedule(the_timer, expire_time);
+		if(expire_time < _next_process_time)
+			_next_process_time = expire_time;
+	}
+	
+	/// Called when a pending connection's current handshake step has gone unanswered for its retry interval: resends the step's request, or times the connection out once its retries are used up.
+	void _process_pending_timeout(pending_connection *pending)
+	{
+		if(!pending->_state_send_retry_count)
+		{
+			// this pending connection request has timed out.
+			_event_queue.post_event(torque_connection_timed_out_event_type, pending->_connection_index);
+			_remove_pending_connection(pending);
+			return;
+		}
+		pending->_state_send_retry_count--;
+		pending->_state_last_send_time = get_process_start_time();
+		_schedule_pending_timeout(pending);
+		switch(pending->get_state())
+		{
+			case pending_connection::requesting_introduction:
+				_send_introduction_request(pending);
+				break;
+			case pending_connection::sending_punch_packets:
+				_send_punch(pending);
+				break;
+			case pending_connection::requesting_challenge_response:
+				_send_challenge_request(pending);
+				break;
+			default:
+				break;
+		}
+	}
+	
+	/// Starts a new handshake step on a pending connection: it will be retried retry_count times, retry_interval milliseconds apart, before timing out.
+	void _set_pending_retries(pending_connection *pending, uint32 retry_count, uint32 retry_interval)
+	{
+		pending->_state_send_retry_count = retry_count;
+		pending->_state_send_retry_interval = retry_interval;
+		pending->_state_last_send_time = get_process_start_time();
+		_schedule_pending_timeout(pending);
+	}
+	
+	void _schedule_pending_timeout(pending_connection *pending)
+	{
+		_schedule_timer(pending, pending->_state_last_send_time + time(pending->_state_send_retry_interval));
+	}
+	
+	/// Schedules the_connection's timer for the moment check_timeout would next have something to do, if no packet arrives from the remote host in the meantime.  Packets that do arrive just push the deadline back, which check_timeout notices when the timer fires.
+	void _schedule_connection_timeout(torque_connection *the_connection)
+	{
+		time last_ping_send_time = the_connection->_last_ping_send_time.get_milliseconds() ? the_connection->_last_ping_send_time : get_process_start_time();
+		time timeout = last_ping_send_time + the_connection->_ping_timeout + time(1);
+		if(the_connection->_ack_probe_time.get_milliseconds() && the_connection->_ack_probe_time < timeout)
+			timeout = the_connection->_ack_probe_time;
+		if(the_connection->_send_wakeup_time.get_milliseconds() && the_connection->_send_wakeup_time < timeout)
+			timeout = the_connection->_send_wakeup_time;
+		if(the_connection->_coalesce_flush_time.get_milliseconds() && the_connection->_coalesce_flush_time < timeout)
+			timeout = the_connection->_coalesce_flush_time;
+		if(the_connection->_fec_flush_time.get_milliseconds() && the_connection->_fec_flush_time < timeout)
+			timeout = the_connection->_fec_flush_time;
+		if(the_connection->_ack_due_time.get_milliseconds() && the_connection->_ack_due_time < timeout)
+			timeout = the_connection->_ack_due_time;
+		_schedule_timer(the_connection, timeout);
+	}
+	
+	/// Disconnects a connection whose remote host went past its stream reassembly limits, posting a torque_connection_disconnected_event_type event that says so.
+	void _drop_for_reassembly_failure(torque_connection *the_connection)
+	{
+		static const char reason[] = "reassembly failed";
+		torque_socket_event *event = _event_queue.post_event(torque_connection_disconnected_event_type, the_connection->get_connection_index());
+		_event_queue.set_event_data(event, (uint8 *) reason, sizeof(reason) - 1);
+		_disconnect(the_connection->get_connection_index(), reason_reassembly_failed, (uint8 *) reason, sizeof(reason) - 1);
+	}
+	
+	/// Returns a new connection id for this socket.  Ids step by _connection_index_step so that sockets sharing a server endpoint hand out disjoint ids.
+	torque_connection_id _allocate_connection_index()
+	{
+		torque_connection_id ret = _next_connection_index;
+		_next_connection_index += _connection_index_step;
+		return ret;
 	}
 	
 	/// looks up a connected connection on this torque_socket
@@ -876,6 +1129,7 @@ protected:
 			if(*walk == the_connection)
 			{
 				*walk = the_connection->_next;
+				_pending_connection_count--;
 				delete the_connection;
 				return;
 			}
@@ -886,6 +1140,7 @@ protected:
 	{
 		the_connection->_next = _pending_connections;
 		_pending_connections = the_connection;
+		_pending_connection_count++;
 	}
 	
 	/// Adds a connection to the internal connection list.
@@ -900,6 +1155,13 @@ protected:
 		_connection_id_lookup_table.insert(the_connection->_connection_index, the_connection);
 		logprintf("inserting connection %d at %s", the_connection->_connection_index, the_connection->get_address().to_string().c_str());
 		_connection_address_lookup_table.insert(the_connection->get_address(), the_connection);
+		the_connection->set_congestion_controller(congestion_controller::create(_congestion_control));
+		the_connection->set_send_queue_limit(_send_queue_limit);
+		the_connection->set_reassembly_limits(_reassembly_limit, _reassembly_timeout);
+		the_connection->set_coalesce_delay(_coalesce_delay);
+		the_connection->set_ack_delay(_ack_delay);
+		the_connection->set_reorder_window(_reorder_window);
+		_schedule_connection_timeout(the_connection);
 	}
 	
 	void _remove_connection(torque_connection *the_connection)
@@ -936,62 +1198,130 @@ protected:
 		uint32 data_size = stream.get_next_byte_position();
 		
 		// allocate the send packet, with the data size added on
-		packet_record *the_packet = (packet_record *) memory_allocate(sizeof(packet_record) + data_size);
+		packet_record *the_packet = construct((packet_record *) memory_allocate(sizeof(packet_record) + data_size));
 		the_packet->remote_address = the_address;
 		the_packet->packet_size = data_size;
 		memcpy(the_packet->packet_data, stream.get_buffer(), data_size);
-		the_packet->next_packet = 0;
 		return the_packet;
 	}
 
+	/// Body of the background reader thread: reads datagrams in batches straight into free slots of _received_packets.  If the ring is full, the batch is read into scratch storage and dropped.
 	void thread_socket_process()
 	{
-		packet_stream stream;
-		address addr;
-		for(;;)
+		uint8 overflow_buffers[udp_socket::max_batch_size][udp_socket::max_datagram_size];
+		udp_socket::datagram batch[udp_socket::max_batch_size];
+		packet_ring::slot *slots[udp_socket::max_batch_size];
+		while(!_packet_thread_stopping)
 		{
-			udp_socket::recv_from_result result = stream.recv_from(_socket, &addr);
+			uint32 slot_count = _received_packets.reserve(slots, udp_socket::max_batch_size);
+			uint32 batch_size = slot_count ? slot_count : uint32(udp_socket::max_batch_size);
+			for(uint32 i = 0; i < batch_size; i++)
+			{
+				batch[i].buffer = slot_count ? slots[i]->packet_data : overflow_buffers[i];
+				batch[i].buffer_size = udp_socket::max_datagram_size;
+			}
+			
+			uint32 received_count;
+			udp_socket::recv_from_result result = _transport->recv_from_batch(batch, batch_size, &received_count);
 			if(result == udp_socket::invalid_socket)
 				return;
 			
 			if(result == udp_socket::packet_received)
 			{
-				stream.set_bit_position(stream.get_stream_bit_size());
-				packet_record *new_packet = allocate_packet_record(addr, stream);
-				_packet_queue_mutex.lock();
-				packet_record **walk = &_received_packet_list;
-				while(*walk)
-					walk = &((*walk)->next_packet);
-				*walk = new_packet;
-				_packet_queue_mutex.unlock();
+				if(!slot_count)
+				{
+					_received_packets.record_overflow(received_count);
+					continue;
+				}
+				for(uint32 i = 0; i < received_count; i++)
+				{
+					slots[i]->remote_address = batch[i].remote_address;
+					slots[i]->packet_size = batch[i].packet_size;
+				}
+				_received_packets.commit(received_count);
+				
+				// only the batch that finds the consumer waiting on an empty ring wakes it; later batches are picked up by the same drain.
+				memory_barrier();
+				if(!_wait_signal_armed)
+					continue;
+				_wait_signal_armed = false;
+				_wait_signal.raise();
 			}
+			// a receive timeout notifies too, so that a consumer driven only by the notify function still services its timers.
 			if(_event_ready_notify_fn)
 				_event_ready_notify_fn(_event_ready_user_data);
 		}
 	}
 	
+	/// Called by the consumer of a threaded socket once it has drained every event: lowers the wait signal and arms it to be raised by the next packet the reader thread queues.
+	void _arm_wait_signal()
+	{
+		if(_wait_signal_armed)
+			return;
+		_wait_signal.clear();
+		_wait_signal_armed = true;
+		memory_barrier();
+		// a packet committed before the reader thread saw the signal armed would otherwise sit unannounced.
+		if(_received_packets.peek())
+		{
+			_wait_signal_armed = false;
+			_wait_signal.raise();
+		}
+	}
+	
 	bool _get_next_packet(packet_stream &stream, address &addr)
 	{
 		if(_thread_socket)
 		{
-			_packet_queue_mutex.lock();
-			packet_record *packet = _received_packet_list;
-			if(_received_packet_list)
-				_received_packet_list = _received_packet_list->next_packet;
-			_packet_queue_mutex.unlock();
-			if(!packet)
+			packet_ring::slot *the_slot = _received_packets.peek();
+			if(!the_slot)
 				return false;
-			stream.set_from_buffer(packet->packet_data, packet->packet_size);
-			addr = packet->remote_address;
-			memory_deallocate(packet);
+			stream.set_from_buffer(the_slot->packet_data, the_slot->packet_size);
+			addr = the_slot->remote_address;
+			_received_packets.release();
 			return true;
 		}
 		else
 		{
-			udp_socket::recv_from_result result;
-			return stream.recv_from(_socket, &addr) == udp_socket::packet_received;
+			if(_recv_batch_index == _recv_batch_count)
+			{
+				_recv_batch_index = _recv_batch_count = 0;
+				if(_transport->recv_from_batch(_recv_batch, udp_socket::max_batch_size, &_recv_batch_count) != udp_socket::packet_received)
+					return false;
+			}
+			udp_socket::datagram &the_datagram = _recv_batch[_recv_batch_index++];
+			stream.set_from_buffer(the_datagram.buffer, the_datagram.packet_size);
+			addr = the_datagram.remote_address;
+			return true;
 		}
 	}
+	
+	/// Sends the contents of a packet_stream to the remote address.
+	void _send_stream(packet_stream &stream, const address &the_address)
+	{
+		send_to(the_address, stream.get_next_byte_position(), stream.get_buffer());
+	}
+	
+	/// Opens a send batch; until the matching _end_send_batch, packets sent through send_to are collected and handed to the socket in as few system calls as possible.  Batches may be nested.
+	void _begin_send_batch()
+	{
+		_send_batch_depth++;
+	}
+	
+	/// Closes a send batch opened by _begin_send_batch, flushing the collected packets when the outermost batch closes.
+	void _end_send_batch()
+	{
+		assert(_send_batch_depth);
+		if(!--_send_batch_depth)
+			_flush_send_batch();
+	}
+	
+	void _flush_send_batch()
+	{
+		if(_send_batch_count)
+			_transport->send_to_batch(_send_batch, _send_batch_count);
+		_send_batch_count = 0;
+	}
 public:
 	/// Sets the private key this torque_socket will use for authentication and key exchange
 	void set_private_key(asymmetric_key *the_key)
@@ -999,12 +1329,49 @@ public:
 		_private_key = the_key;
 	}
 	
-	/// Returns the udp_socket associated with this torque_socket
+	/// Returns the number of packets the background reader thread dropped because the received packet queue was full.
+	uint32 get_received_packet_overflow_count()
+	{
+		return _received_packets.get_overflow_count();
+	}
+	
+	/// Returns true if this socket reads packets on a background thread.
+	bool is_thread_socket()
+	{
+		return _thread_socket;
+	}
+	
+	/// Returns the udp_socket associated with this torque_socket.  Its options must be set before bind; it isn't used if another transport has been set.
 	udp_socket &get_network_socket()
 	{
 		return _socket;
 	}	
 	
+	/// Sets whether the UDP socket moves its datagrams through an io_uring once it is bound, where the kernel supports it.  Must be called before bind.  See udp_socket::set_io_uring.
+	void set_io_uring(bool enabled)
+	{
+		_socket.set_io_uring(enabled);
+	}
+	
+	/// Sets whether the UDP socket sends and receives with segmentation offload once it is bound.  Must be called before bind.  See udp_socket::set_segmentation_offload.
+	void set_segmentation_offload(bool enabled)
+	{
+		_socket.set_segmentation_offload(enabled);
+	}
+	
+	/// Makes this torque_socket send and receive through the_transport instead of its UDP socket.  Must be called before bind; the torque_socket does not take ownership of the transport, which must outlive it.
+	void set_transport(packet_transport *the_transport)
+	{
+		assert(!_transport->is_bound());
+		_transport = the_transport;
+	}
+	
+	/// Returns the transport this torque_socket sends and receives through.
+	packet_transport *get_transport()
+	{
+		return _transport;
+	}
+	
 	void set_challenge_response(byte_buffer_ptr data)
 	{
 		_challenge_response = data;
@@ -1027,6 +1394,28 @@ public:
 		_allow_connections = conn;
 	}
 	
+	/// Sets the packet window this torque_socket negotiates for new connections: the number of packets that may be in flight, unacknowledged, in each direction.  The size is rounded down to a power of two between torque_connection::min_packet_window_size and torque_connection::max_packet_window_size.  An initiator asks for this window, and a host grants the smaller of it and the window asked for; connections already established or being negotiated keep theirs.  Larger windows keep fast, high latency paths full at the cost of per-connection memory.
+	void set_packet_window_size(uint32 packet_window_size)
+	{
+		_packet_window_size = torque_connection::clamp_packet_window_size(packet_window_size);
+	}
+	
+	uint32 get_packet_window_size()
+	{
+		return _packet_window_size;
+	}
+	
+	/// Selects the congestion controller given to connections established from now on.  The default, congestion_control_aimd, backs off on loss as TCP does; congestion_control_bbr paces sends to the measured path bandwidth and keeps queues short; congestion_control_none sends as fast as the packet window allows.
+	void set_congestion_control(congestion_control_type type)
+	{
+		_congestion_control = type;
+	}
+	
+	congestion_control_type get_congestion_control()
+	{
+		return _congestion_control;
+	}
+	
 	void _disconnect_existing_connection(const address &remote_host)
 	{
 		
@@ -1037,16 +1426,16 @@ public:
 	{
 		logprintf("socket->connect\n%s", net::buffer_encode_base_16(connect_data, connect_data_size)->get_buffer());
 		
+		// process_connections may not have run for up to idle_process_interval, so the retries are timed from now.
+		_process_start_time = time::get_current();
 		_disconnect_existing_connection(remote_host);
 		uint32 initial_send_sequence = _random_generator.random_integer();
 		
-		pending_connection *new_connection = new pending_connection(pending_connection::connection_initiator, _random_generator.random_nonce(), initial_send_sequence, _next_connection_index++);
+		pending_connection *new_connection = new pending_connection(pending_connection::connection_initiator, _random_generator.random_nonce(), initial_send_sequence, _allocate_connection_index());
 		
 		new_connection->_packet_data = new byte_buffer(connect_data, connect_data_size);
 		new_connection->_address = remote_host;
-		new_connection->_state_send_retry_count = challenge_retry_count;
-		new_connection->_state_send_retry_interval = challenge_retry_time;
-		new_connection->_state_last_send_time = get_process_start_time();
+		_set_pending_retries(new_connection, challenge_retry_count, challenge_retry_time);
 		
 		_add_pending_connection(new_connection);
 		_send_challenge_request(new_connection);
@@ -1094,16 +1483,15 @@ public:
 		if(!introducing_connection)
 			return invalid_torque_connection;
 		
+		_process_start_time = time::get_current();
 		uint32 initial_send_sequence = _random_generator.random_integer();
 		
-		pending_connection *new_connection = new pending_connection(is_host ? pending_connection::introduced_connection_host : pending_connection::introduced_connection_initiator, _random_generator.random_nonce(), initial_send_sequence, _next_connection_index++);
+		pending_connection *new_connection = new pending_connection(is_host ? pending_connection::introduced_connection_host : pending_connection::introduced_connection_initiator, _random_generator.random_nonce(), initial_send_sequence, _allocate_connection_index());
 		
 		new_connection->_introducer = introducer;
 		new_connection->_remote_client_id = remote_client_identity;
 		new_connection->_packet_data = new byte_buffer(connect_data, connect_data_size);
-		new_connection->_state_send_retry_count = challenge_retry_count;
-		new_connection->_state_send_retry_interval = challenge_retry_time;
-		new_connection->_state_last_send_time = get_process_start_time();
+		_set_pending_retries(new_connection, challenge_retry_count, challenge_retry_time);
 		
 		_add_pending_connection(new_connection);
 		_send_introduction_request(new_connection);
@@ -1116,10 +1504,9 @@ public:
 		if(!conn || conn->get_state() != pending_connection::awaiting_local_challenge_accept)
 			return;
 		
+		_process_start_time = time::get_current();
 		conn->set_state(pending_connection::computing_puzzle_solution);
-		conn->_state_send_retry_count = 0;
-		conn->_state_send_retry_interval = puzzle_solution_timeout;
-		conn->_state_last_send_time = get_process_start_time();
+		_set_pending_retries(conn, 0, puzzle_solution_timeout);
 		
 		packet_stream s;
 		core::write(s, conn->get_initiator_nonce());
@@ -1129,6 +1516,9 @@ public:
 		logprintf("Attempting to solve a client puzzle.");
 		byte_buffer_ptr request = new byte_buffer(s.get_buffer(), s.get_next_byte_position());		
 		conn->_puzzle_request_index = _puzzle_solver.post_request(request);
+		time puzzle_check = get_process_start_time() + time(puzzle_result_poll_interval);
+		if(puzzle_check < _next_process_time)
+			_next_process_time = puzzle_check;
 	}
 	
 	/// accept an incoming connection request.
@@ -1140,11 +1530,16 @@ public:
 			TorqueLogMessageFormatted(LogNettorque_socket, ("Trying to accept a non-pending connection."));
 			return;
 		}
-		torque_connection *new_connection = new torque_connection(pending->_initiator_nonce, pending->_initial_send_sequence, pending->_connection_index, false);
+		_process_start_time = time::get_current();
+		torque_connection *new_connection = new torque_connection(pending->_initiator_nonce, pending->_initial_send_sequence, pending->_connection_index, false, pending->_packet_window_size);
 		new_connection->set_torque_socket(this);
 		new_connection->set_symmetric_cipher(pending->get_symmetric_cipher());
 		new_connection->set_shared_secret(pending->get_shared_secret());
 		new_connection->set_initial_recv_sequence(pending->_initial_recv_sequence);
+		new_connection->set_fec_group_size(pending->_fec_group_size);
+		new_connection->_remote_connection_index = pending->_remote_connection_index;
+		if(pending->_packet_encryption)
+			new_connection->set_packet_encryption(pending->_symmetric_key, pending->_init_vector);
 		new_connection->_host_nonce = pending->_host_nonce;
 		new_connection->set_address(pending->get_address());
 		
@@ -1180,10 +1575,10 @@ public:
 			core::write(out, reason_code);
 			core::write(out, disconnect_data_size);
 			out.write_bytes(disconnect_data, disconnect_data_size);
-			symmetric_cipher the_cipher(connection->get_shared_secret());
+			symmetric_cipher the_cipher(connection->get_shared_secret_cipher());
 			bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
 			
-			out.send_to(_socket, connection->get_address());
+			_send_stream(out, connection->get_address());
 			
 			_remove_connection(connection);
 			return;
@@ -1194,11 +1589,100 @@ public:
 			_remove_pending_connection(pending);
 		}
 	}
-	/// Send a datagram packet to the remote host on the other side of the connection.  Returns the sequence number of the packet sent.
-	void send_to_connection(torque_connection_id connection_id, uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	/// Send a datagram packet to the remote host on the other side of the connection, storing its sequence number in sequence.  If the connection's window or congestion controller won't allow it to be sent yet, it is queued and sent as soon as they do; if the queue is over its limit it is refused with send_to_connection_queue_full, and a torque_connection_writable_event_type event is posted once the queue has drained to half its limit.  A datagram larger than torque_sockets_max_datagram_size is refused with send_to_connection_invalid_message.
+	send_to_connection_result send_to_connection(torque_connection_id connection_id, uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		if(!conn)
+			return send_to_connection_invalid_connection;
+		return conn->send_data_packet(data, data_size, sequence);
+	}
+	
+	/// Sends a message reliably and in order on stream stream_index of the connection.  See torque_connection::send_stream_message.
+	send_to_connection_result send_to_stream(torque_connection_id connection_id, uint32 stream_index, uint8 *data, uint32 data_size)
 	{
 		torque_connection *conn = _find_connection(connection_id);
-		conn->send_packet(torque_connection::data_packet, data, data_size, sequence);
+		if(!conn)
+			return send_to_connection_invalid_connection;
+		return conn->send_stream_message(stream_index, data, data_size);
+	}
+	
+	/// Returns the number of packets that would be sent on the connection right now rather than queued, as allowed by its packet window and congestion controller, or 0 if there is no such connection.
+	uint32 get_send_budget(torque_connection_id connection_id)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		return conn && !conn->get_send_queue_count() ? conn->get_send_budget() : 0;
+	}
+	
+	/// Sets the number of bytes of data each connection established from now on may queue while its window is full, before send_to_connection refuses more.
+	void set_send_queue_limit(uint32 limit)
+	{
+		_send_queue_limit = limit;
+	}
+	
+	/// Sets how many milliseconds each connection established from now on may hold a small datagram so that later ones can share its packet, or 0, the default, to send each datagram in a packet of its own.
+	void set_coalesce_delay(uint32 delay)
+	{
+		_coalesce_delay = delay;
+	}
+	
+	/// Sets how many milliseconds each connection established from now on lets acks for received data wait for an outgoing packet to carry them before sending an ack packet, or 0 to send ack packets without waiting.
+	void set_ack_delay(uint32 delay)
+	{
+		_ack_delay = delay;
+	}
+	
+	/// Sets how many packets behind the newest one received each connection established from now on accepts a late data packet, rather than discarding it as out of order; 0, the default, accepts none.  See torque_connection::set_reorder_window.
+	void set_reorder_window(uint32 reorder_window)
+	{
+		_reorder_window = reorder_window;
+	}
+	
+	/// Sets the smallest group of data packets each connection established from now on follows with a parity packet, from which the remote host can rebuild any one of the group that was lost without waiting for a resend; 0, the default, turns forward error correction off.  Both sides must set it for a connection to use it, and the larger of the two sizes is used.  Groups grow, up to torque_connection::max_fec_group_size, while few packets are lost.  See torque_connection::set_fec_group_size.
+	void set_fec_group_size(uint32 min_group_size)
+	{
+		_fec_group_size = torque_connection::clamp_fec_group_size(min_group_size);
+	}
+	
+	/// Sets whether connections established from now on seal their packets with AES-GCM under the key agreed in the handshake: the packet header is authenticated, the rest encrypted, and packets that fail authentication or were already received are discarded.  On by default; a connection's packets are sealed only if both sides allow it.
+	void set_packet_encryption(bool enabled)
+	{
+		_packet_encryption = enabled;
+	}
+	
+	/// Sets the pending connections, the shared secrets computed per second for connect requests, and the percent of the time spent computing them, past which the difficulty of the client puzzles this socket issues rises; 0 leaves that measure out.  The difficulty drops back once the load has stayed low for a while.  See client_puzzle_manager::set_load_limits.
+	void set_puzzle_load_limits(uint32 max_pending_connections, uint32 max_shared_secret_rate, uint32 cpu_budget_percent)
+	{
+		_puzzle_manager.set_load_limits(max_pending_connections, max_shared_secret_rate, cpu_budget_percent);
+	}
+	
+	/// Returns the current client puzzle difficulty, the load it follows, and counts of the puzzle solutions accepted and rejected.
+	const client_puzzle_manager::stats &get_puzzle_stats()
+	{
+		return _puzzle_manager.get_stats();
+	}
+	
+	/// Sends the datagrams the connection is holding for coalescing now, without waiting for the coalesce delay.  Returns send_to_connection_invalid_connection if there is no such connection.
+	send_to_connection_result flush_connection(torque_connection_id connection_id)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		if(!conn)
+			return send_to_connection_invalid_connection;
+		conn->flush_coalesced_datagrams();
+		return send_to_connection_sent;
+	}
+	
+	/// Sets how many bytes each connection established from now on will hold for stream messages received out of order or being reassembled, and how many milliseconds a message being reassembled may go without a new fragment.  A remote host that goes past either limit is disconnected.
+	void set_reassembly_limits(uint32 byte_limit, uint32 timeout)
+	{
+		_reassembly_limit = byte_limit;
+		_reassembly_timeout = timeout;
+	}
+	
+	/// Returns the established connection with the given id, or NULL, for adjusting its settings or reading its round trip time.
+	torque_connection *get_connection(torque_connection_id connection_id)
+	{
+		return _find_connection(connection_id);
 	}
 	
 	/// Sends a packet to the remote address over this torque_socket's socket.
@@ -1208,27 +1692,34 @@ public:
 		
 		logprintf("send: %s %s", addr_string.c_str(), buffer_encode_base_16(data, data_size)->get_buffer());
 		
-		return _socket.send_to(the_address, data, data_size);
+		if(!_send_batch_depth)
+			return _transport->send_to(the_address, data, data_size);
+		
+		if(data_size > udp_socket::max_datagram_size)
+			return udp_socket::send_to_failure;
+		if(_send_batch_count == udp_socket::max_batch_size)
+			_flush_send_batch();
+		udp_socket::datagram &the_datagram = _send_batch[_send_batch_count++];
+		the_datagram.remote_address = the_address;
+		the_datagram.packet_size = data_size;
+		memcpy(the_datagram.buffer, data, data_size);
+		return udp_socket::send_to_success;
 	}
 	
 	/// Sends a packet to the remote address after millisecond_delay time has elapsed.  This is used to simulate network latency on a LAN or single computer.
 	void send_to_delayed(const address &the_address, bit_stream &stream, uint32 millisecond_delay)
 	{
 		packet_record *the_packet = allocate_packet_record(the_address, stream);
-		the_packet->send_time = get_process_start_time() + time(millisecond_delay);
-
-		// insert it into the packet_record list, sorted by time
-		packet_record **list;
-		for(list = &_send_packet_list; *list && ((*list)->send_time <= the_packet->send_time); list = &((*list)->next_packet))
-			;
-		the_packet->next_packet = *list;
-		*list = the_packet;
+		// called from send_to_connection as well as process_connections, so the delay is timed from the clock rather than the last process time.
+		_schedule_timer(the_packet, time::get_current() + time(millisecond_delay));
 	}
 	
-	/// Gets the next event on this socket; returns NULL if there are no events to be read.
+	/// Gets the next event on this socket; returns NULL if there are no events to be read.  Timed work is only done when get_next_process_time has come due, so draining a burst of packet events costs one clock read per call.
 	torque_socket_event *get_next_event()
 	{
-		process_connections();
+		_begin_send_batch();
+		if(time::get_current() >= _next_process_time)
+			process_connections();
 		if(!_event_queue.has_event())
 		{
 			_event_queue.clear();
@@ -1245,23 +1736,61 @@ public:
 					break;
 			}
 		}
+		_end_send_batch();
 		if(_event_queue.has_event())
 			return _event_queue.dequeue();
-		else
-			return 0;
+		if(_thread_socket)
+			_arm_wait_signal();
+		return 0;
 	}	
 	
-	bind_result bind(const address &bind_address)
+	/// Returns a descriptor that becomes readable when this socket has events to deliver, for waiting in poll, epoll or select alongside other I/O; or INVALID_SOCKET if there is none.  On a threaded socket the descriptor is raised only when the reader thread queues packets while the socket is idle, so a burst costs one wakeup; the caller must call get_next_event until it returns NULL before waiting again.  On a non-threaded socket it is the transport's descriptor.  Timed work doesn't raise it; wait no longer than get_next_timeout.
+	SOCKET get_wait_descriptor()
+	{
+		if(_thread_socket)
+			return _wait_signal.get_descriptor();
+		return _transport->get_descriptor();
+	}
+	
+	/// Returns the time at which process_connections next has timed work to do on this socket: sending a delayed packet, retrying or timing out a pending connection, pinging or timing out a connection, or collecting a client puzzle solution from the solver thread.  A non-threaded socket that has no packets waiting need not be processed before then.  The deadline is kept up to date as timers are scheduled, so this is cheap enough to call on every pass of an event loop.
+	time get_next_process_time()
+	{
+		return _next_process_time;
+	}
+	
+	/// Returns the number of milliseconds until get_next_process_time, or 0 if timed work is already due.  An event loop can sleep this long, or until the socket is readable, before calling get_next_event again.
+	uint32 get_next_timeout()
+	{
+		int64 remaining = (_next_process_time - time::get_current()).get_milliseconds();
+		return remaining > 0 ? uint32(remaining) : 0;
+	}
+	
+	/// Makes this socket shard shard_index of shard_count sockets serving the same endpoint: the connection ids it hands out will all satisfy id % shard_count == shard_index.  Must be called before any connections are made.
+	void set_connection_index_shard(uint32 shard_index, uint32 shard_count)
+	{
+		assert(shard_index < shard_count);
+		_next_connection_index = shard_count + shard_index;
+		_connection_index_step = shard_count;
+	}
+	
+	/// Binds the socket's transport to bind_address.  If reuse_port is set, other UDP sockets may bind the same address the same way and the kernel will spread incoming packets across them.
+	bind_result bind(const address &bind_address, bool reuse_port = false)
 	{
 		time block_timeout = 0;
 		if(_thread_socket)
 			block_timeout = 500;
 		
-		bind_result the_result = _socket.bind(bind_address, !_thread_socket, block_timeout);
+		_socket.set_reuse_port(reuse_port);
+		bind_result the_result = _transport->bind(bind_address, !_thread_socket, block_timeout);
 		
 		logprintf("Bind result = %d", the_result);
 		if(_thread_socket && (the_result == bind_success) && !_packet_thread.is_running())
+		{
+			if(!_received_packets.is_allocated())
+				_received_packets.allocate();
+			_wait_signal.open();
 			_packet_thread.start();
+		}
 		return the_result;
 	}
 	
@@ -1272,53 +1801,98 @@ public:
 		while(_connection_list)
 			_disconnect(_connection_list->get_connection_index(), reason_self_disconnect, 0, 0);
 		logprintf("Done.");
+		
+		// the reader thread must be off the socket before the socket is destroyed; it notices within one receive timeout.
+		if(_packet_thread.is_running())
+		{
+			_packet_thread_stopping = true;
+			_packet_thread.join();
+		}
 
 	}
 	
 	/// @param bind_address Local network address to bind this torque_socket to.
-	torque_socket(bool thread_socket = false, void (*socket_notify_fn)(void *) = 0, void *socket_notify_data = 0) : _puzzle_manager(_random_generator, &_allocator), _event_queue(&_allocator), _packet_thread(this)
+	torque_socket(bool thread_socket = false, void (*socket_notify_fn)(void *) = 0, void *socket_notify_data = 0) : _puzzle_manager(_random_generator, &_allocator), _event_queue(&_allocator), _packet_thread(this), _timers(time::get_current())
 	{
 		_next_connection_index = 1;
+		_connection_index_step = 1;
+		_packet_thread_stopping = false;
+		_wait_signal_armed = true;
+		_transport = &_socket;
 		_random_generator.random_buffer(_random_hash_data, sizeof(_random_hash_data));
 
 		_private_key = new asymmetric_key(20, _random_generator);
 		
-		_last_timeout_check_time = time(0);
 		_allow_connections = true;
+		_packet_window_size = torque_connection::default_packet_window_size;
+		_congestion_control = congestion_control_aimd;
+		_send_queue_limit = torque_connection::default_send_queue_limit;
+		_reassembly_limit = torque_connection::default_reassembly_limit;
+		_reassembly_timeout = torque_connection::default_reassembly_timeout;
+		_coalesce_delay = 0;
+		_ack_delay = torque_connection::default_ack_delay;
+		_reorder_window = 0;
+		_fec_group_size = 0;
+		_packet_encryption = true;
 		
-		_send_packet_list = NULL;
 		_process_start_time = time::get_current();
+		_next_process_time = time(0);
 		
 		_event_ready_notify_fn = socket_notify_fn;
 		_event_ready_user_data = socket_notify_data;
 		_thread_socket = thread_socket;
-		_received_packet_list = 0;
+		
+		_recv_batch_count = 0;
+		_recv_batch_index = 0;
+		_send_batch_count = 0;
+		_send_batch_depth = 0;
+		for(uint32 i = 0; i < udp_socket::max_batch_size; i++)
+		{
+			_recv_batch[i].buffer = _recv_batch_buffers[i];
+			_recv_batch[i].buffer_size = udp_socket::max_datagram_size;
+			_send_batch[i].buffer = _send_batch_buffers[i];
+			_send_batch[i].buffer_size = udp_socket::max_datagram_size;
+		}
 
 		// Supply our own (small) unique private key for the time being.
 		_private_key = new asymmetric_key(16, _random_generator);
 		_challenge_response = new byte_buffer();
 		_pending_connections = 0;
+		_pending_connection_count = 0;
 		_connection_list = 0;
 	}
 	
 	socket_event_queue _event_queue;
 	
-	mutex _packet_queue_mutex;
-	packet_record *_received_packet_list;
+	packet_ring _received_packets; ///< Packets read by the background reader thread, waiting to be processed.
 	bool _thread_socket;
 	socket_thread _packet_thread; ///< background thread that blocks on socket read and calls the socket_notify_fn whenever it posts something into the packet queue
+	volatile bool _packet_thread_stopping; ///< Set by the destructor to make _packet_thread exit.
 	void *_event_ready_user_data;
-	void (*_event_ready_notify_fn)(void *); ///< When the socket operates with a background reader thread, this function is called when each new packet arrives.  This function is called from the background thread, so beware of thread safety issues.  Mostly this is just here for the NPAPI version.
-	udp_socket _socket; ///< Network socket this torque_socket communicates over.
+	void (*_event_ready_notify_fn)(void *); ///< When the socket operates with a background reader thread, this function is called when packets arrive while the socket is idle, and whenever a receive times out.  This function is called from the background thread, so beware of thread safety issues.  Mostly this is just here for the NPAPI version.
+	wake_signal _wait_signal; ///< Raised by the reader thread of a threaded socket when packets arrive while the socket is idle; see get_wait_descriptor.
+	volatile bool _wait_signal_armed; ///< Set by the consumer once it has drained every event, cleared by the reader thread when it raises _wait_signal.
+	udp_socket _socket; ///< Network socket this torque_socket communicates over, unless set_transport has replaced it.
+	packet_transport *_transport; ///< Transport this torque_socket sends and receives through; &_socket by default.
+	udp_socket::datagram _recv_batch[udp_socket::max_batch_size]; ///< Datagrams read by the last batched receive on a non-threaded socket.
+	uint32 _recv_batch_count; ///< Number of valid datagrams in _recv_batch.
+	uint32 _recv_batch_index; ///< Index of the next datagram in _recv_batch to be processed.
+	uint8 _recv_batch_buffers[udp_socket::max_batch_size][udp_socket::max_datagram_size]; ///< Storage for _recv_batch.
+	udp_socket::datagram _send_batch[udp_socket::max_batch_size]; ///< Outgoing datagrams collected while a send batch is open.
+	uint32 _send_batch_count; ///< Number of datagrams waiting in _send_batch.
+	uint32 _send_batch_depth; ///< Nesting depth of _begin_send_batch calls.
+	uint8 _send_batch_buffers[udp_socket::max_batch_size][udp_socket::max_datagram_size]; ///< Storage for _send_batch.
 	random_generator _random_generator;	///< cryptographic random number generator for this socket
 	puzzle_solver _puzzle_solver; ///< helper class for solving client puzzles
 	zone_allocator _allocator; ///< memory allocator helper class for this socket
 
 	pending_connection *_pending_connections; ///< Linked list of all the pending connections on this socket
+	uint32 _pending_connection_count; ///< Number of connections in _pending_connections, which the client puzzle difficulty follows.
 	torque_connection *_connection_list; ///< Doubly-linked list of all the connections that are in a connected state on this torque_socket.
 	hash_table_flat<torque_connection_id, torque_connection *> _connection_id_lookup_table; ///< quick lookup table for active connections by id.
 	hash_table_flat<address, torque_connection *> _connection_address_lookup_table; ///< quick lookup table for active connections by address.
 	uint32 _next_connection_index; ///< Next available connection id
+	uint32 _connection_index_step; ///< Amount _next_connection_index advances per connection; the shard count when this socket is one shard of a sharded_torque_socket.
 
 	byte_buffer_ptr _challenge_response; ///< Challenge response set by the host as response to all incoming challenge requests on this socket.
 	
@@ -1326,12 +1900,22 @@ public:
 	client_puzzle_manager _puzzle_manager; ///< The ref_object that tracks the current client puzzle difficulty, current puzzle and solutions for this torque_socket.
 
 	time _process_start_time; ///< Current time tracked by this torque_socket.
+	time _next_process_time; ///< Time by which process_connections must next run; may be earlier than strictly necessary, never later.
 	bool _requires_key_exchange; ///< True if all connections outgoing and incoming require key exchange.
-	time _last_timeout_check_time; ///< Last time all the active connections were checked for timeouts.
 	uint8  _random_hash_data[12]; ///< Data that gets hashed with connect challenge requests to prevent connection spoofing.
 	bool _allow_connections; ///< Set if this torque_socket allows connections from remote instances.
+	uint32 _packet_window_size; ///< Packet window this torque_socket asks for as an initiator, and the largest it grants as a host.
+	congestion_control_type _congestion_control; ///< Kind of congestion_controller new connections are given.
+	uint32 _send_queue_limit; ///< Send queue limit, in bytes, new connections are given.
+	uint32 _reassembly_limit; ///< Stream reassembly limit, in bytes, new connections are given.
+	uint32 _reassembly_timeout; ///< Milliseconds new connections let a message being reassembled go without a new fragment.
+	uint32 _coalesce_delay; ///< Milliseconds new connections may hold a small datagram for coalescing, or 0 if they don't coalesce.
+	uint32 _ack_delay; ///< Milliseconds new connections let acks wait for an outgoing packet to carry them.
+	uint32 _reorder_window; ///< Packets behind the newest that new connections accept a late data packet.
+	uint32 _fec_group_size; ///< Smallest forward error correction group new connections ask for or accept, or 0 if they don't use it.
+	bool _packet_encryption; ///< True if new connections ask for or accept sealing their packets with AES-GCM.
 	
 	hash_table_flat<uint32, torque_connection *> _connection_index_table;
 
-	packet_record *_send_packet_list; ///< List of delayed packets pending to send.
+	timer_wheel _timers; ///< Delayed sends, pending connection retries and connection timeouts, each scheduled for when it next needs attention.
 };
@@ -2,16 +2,30 @@
 
 #include "nonce.h"
 #include "random_generator.h"
+#include "cpu_features.h"
+#include "aes_hardware.h"
+#include "sha256.h"
 #include "symmetric_cipher.h"
+#include "packet_cipher.h"
 #include "asymmetric_key.h"
 #include "buffer_utils.h"
 #include "time.h"
 #include "address.h"
+#include "wake_signal.h"
+#include "packet_transport.h"
+#include "udp_uring.h"
 #include "udp_socket.h"
+#include "loopback_transport.h"
 #include "sockets.h"
 #include "packet_stream.h"
+#include "packet_ring.h"
+#include "timer_wheel.h"
 #include "client_puzzle.h"
 #include "pending_connection.h"
 #include "socket_event_queue.h"
+#include "congestion_controller.h"
+#include "message_stream.h"
 #include "torque_socket.h"
 #include "torque_connection.h"
+#include "sharded_torque_socket.h"
+#include "socket_reactor.h"
@@ -3,6 +3,8 @@
 
 
 typedef void *torque_socket_handle;
+typedef void *torque_loopback_network_handle;
+typedef void *torque_transport_handle;
 typedef unsigned torque_connection_id;
 static const torque_connection_id invalid_torque_connection = 0;
 	
@@ -11,6 +13,10 @@ enum torque_sockets_constants {
 	torque_sockets_max_status_datagram_size = 511,
 	torque_sockets_max_public_key_size = 512,
 	torque_sockets_packet_window_size = 31,
+	torque_sockets_max_packet_window_size = 1024,
+	torque_sockets_max_message_streams = 16,
+	torque_sockets_max_stream_message_size = 1280,
+	torque_sockets_max_message_size = 1048576,
 	torque_sockets_info_packet_first_byte_min = 32,
 	torque_sockets_info_packet_first_byte_max = 127,
 };
@@ -26,6 +32,8 @@ enum torque_socket_event_type
 	torque_connection_packet_event_type,
 	torque_connection_packet_notify_event_type,
 	torque_socket_packet_event_type,
+	torque_connection_writable_event_type,
+	torque_connection_stream_message_event_type,
 };
 
 enum bind_result
@@ -38,6 +46,22 @@ enum bind_result
 	generic_failure,
 };
 
+enum congestion_control_type
+{
+	congestion_control_none, ///< Connections are limited only by their packet window.
+	congestion_control_aimd, ///< Loss-based: the window grows steadily and halves when packets are lost.
+	congestion_control_bbr, ///< Delay-based: sends are paced at the measured bottleneck bandwidth with about two bandwidth-delay products in flight.
+};
+
+enum send_to_connection_result
+{
+	send_to_connection_sent, ///< The datagram was sent.
+	send_to_connection_queued, ///< The datagram was queued, and will be sent as the connection's window allows.
+	send_to_connection_queue_full, ///< The connection's send queue is over its limit, so the datagram was dropped; a torque_connection_writable_event_type event follows once the queue drains.
+	send_to_connection_invalid_connection, ///< There is no such connection.
+	send_to_connection_invalid_message, ///< The datagram is larger than torque_sockets_max_datagram_size, or the stream index is not below torque_sockets_max_message_streams, or the message is larger than torque_sockets_max_message_size.
+};
+
 struct torque_socket_event
 {
 	unsigned event_type;
@@ -52,6 +76,22 @@ struct torque_socket_event
 	unsigned packet_sequence;
 	int delivered;
 	struct sockaddr source_address;
+	unsigned stream_index;
+};
+
+struct torque_socket_puzzle_stats
+{
+	unsigned current_difficulty; ///< Bits of difficulty of the client puzzles the socket is issuing.
+	unsigned load_percent; ///< Smoothed handshake load at the last update, in percent of the limits set with set_puzzle_load_limits.
+	unsigned pending_connections; ///< Connections pending at the last update.
+	unsigned shared_secrets_per_second; ///< Key exchanges computed for connect requests per second over the last update interval.
+	unsigned difficulty_raises; ///< Times the difficulty has been raised.
+	unsigned difficulty_drops; ///< Times the difficulty has been lowered.
+	unsigned solutions_accepted; ///< Connect requests whose puzzle solutions were accepted.
+	unsigned invalid_solutions; ///< Connect requests rejected for a wrong solution.
+	unsigned invalid_server_nonces; ///< Connect requests rejected for solving a puzzle that has expired.
+	unsigned invalid_client_nonces; ///< Connect requests rejected for reusing a solution.
+	unsigned invalid_puzzle_difficulties; ///< Connect requests rejected for solving a puzzle easier than the socket is issuing.
 };
 
 struct torque_socket_interface
@@ -86,6 +126,29 @@ struct torque_socket_interface
 	
 	void (*close_connection)(torque_socket_handle, torque_connection_id, unsigned disconnect_data_size, unsigned char *disconnect_data); ///< Close an open connection or rejects a pending connection
 	
-	int (*send_to_connection)(torque_socket_handle, torque_connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size]); ///< Send a datagram packet to the remote host on the other side of the connection.  Returns the sequence number of the packet sent.
+	enum send_to_connection_result (*send_to_connection)(torque_socket_handle, torque_connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size], unsigned *sequence_number); ///< Send a datagram packet to the remote host on the other side of the connection, storing the sequence number it is sent with in sequence_number if that isn't NULL.  Datagrams beyond the connection's send budget are queued and sent in order as the budget allows, up to the send queue limit.
 	struct torque_socket_event *(*get_next_event)(torque_socket_handle); ///< Gets the next event on this socket; returns NULL if there are no events to be read.
+	void (*set_io_uring)(torque_socket_handle, int enabled); ///< Sets whether the socket, once bound, sends and receives through an io_uring rather than a system call per batch.  Linux only, and off by default; must be called before bind.  If the kernel lacks the io_uring features needed the socket uses system calls as usual.
+	void (*set_segmentation_offload)(torque_socket_handle, int enabled); ///< Sets whether the socket, once bound, hands the kernel runs of same-size datagrams to one address as single UDP_SEGMENT sends, and has it coalesce received datagrams from one sender (UDP_GRO).  Linux only, and off by default; must be called before bind.  Suits sockets carrying a few high-rate streams rather than many light peers.  Ignored when the socket uses io_uring.
+	int (*get_wait_fd)(torque_socket_handle); ///< Returns a descriptor that becomes readable when the socket has events, for waiting in poll, epoll or select with the application's other I/O, or -1 if there is none.  For a socket with a background thread it is raised once per burst: call get_next_event until it returns NULL before waiting on it again.  Wait no longer than get_next_timeout.
+	unsigned (*get_next_timeout)(torque_socket_handle); ///< Returns the number of milliseconds until the socket next has timed work to do (retries, pings, timeouts), or 0 if it has some now.  An event loop can wait this long, or until a packet arrives, before calling get_next_event again.
+	void (*set_packet_window_size)(torque_socket_handle, unsigned packet_window_size); ///< Sets the number of unacknowledged packets connections negotiated from now on may have in flight, rounded down to a power of two no larger than torque_sockets_max_packet_window_size.  Each connection uses the smaller of the initiator's and the host's setting.
+	void (*set_congestion_control)(torque_socket_handle, enum congestion_control_type type); ///< Selects the congestion control given to connections established from now on; the default is congestion_control_aimd.
+	unsigned (*get_send_budget)(torque_socket_handle, torque_connection_id); ///< Returns the number of datagrams that may be sent on the connection right now.  send_to_connection queues datagrams once this reaches 0; the budget grows again as the remote host acknowledges packets and, for a paced connection, as time passes.
+	void (*set_send_queue_limit)(torque_socket_handle, unsigned queue_byte_limit); ///< Sets the number of bytes of datagrams each connection established from now on may queue beyond its send budget before send_to_connection returns send_to_connection_queue_full.
+	enum send_to_connection_result (*send_to_stream)(torque_socket_handle, torque_connection_id, unsigned stream_index, unsigned message_size, unsigned char *message); ///< Sends a message reliably and in order on one of the connection's torque_sockets_max_message_streams streams; it is posted to the remote host as a torque_connection_stream_message_event_type event with the same stream_index, after every earlier message on that stream.  Messages lost in transit are resent, and only hold up later messages on their own stream.  Messages larger than torque_sockets_max_stream_message_size, up to torque_sockets_max_message_size, are sent in fragments and reassembled; only fragments lost in transit are resent.  Undelivered messages count against the send queue limit, though a message is always accepted when nothing else is queued.
+	void (*set_reassembly_limits)(torque_socket_handle, unsigned byte_limit, unsigned timeout); ///< Sets how many bytes each connection established from now on will hold for stream messages received out of order or being reassembled (4 MB by default), and how many milliseconds a message being reassembled may go without a new fragment (30 seconds by default).  A remote host that goes past either limit is disconnected with a torque_connection_disconnected_event_type event.
+	void (*set_coalesce_delay)(torque_socket_handle, unsigned delay); ///< Sets how many milliseconds each connection established from now on may hold a datagram of up to 256 bytes so that later ones can be sent with it in one packet, or 0, the default, to send each datagram in a packet of its own.  Coalesced datagrams share their packet's sequence number, and each is posted to the remote host as its own torque_connection_packet_event_type event, and notified as its own torque_connection_packet_notify_event_type event.
+	enum send_to_connection_result (*flush_connection)(torque_socket_handle, torque_connection_id); ///< Sends the datagrams the connection is holding for coalescing now, rather than when the coalesce delay runs out.
+	void (*set_ack_delay)(torque_socket_handle, unsigned delay); ///< Sets how many milliseconds each connection established from now on lets acknowledgements of received data wait to ride on an outgoing data packet before sending them in a packet of their own (5 by default), or 0 to acknowledge every second data packet received without waiting.  Pings and a half-full window are acknowledged at once either way.
+	void (*set_reorder_window)(torque_socket_handle, unsigned reorder_window); ///< Sets how many packets behind the newest one received each connection established from now on accepts a late data packet, up to half its packet window, instead of discarding it as out of order (0 by default).  The sender isn't notified that a packet was dropped until it falls out of the receiver's reorder window or has been missing for a quarter of the round trip time, so a reordered packet is notified once, as delivered.
+	void (*set_fec_group_size)(torque_socket_handle, unsigned min_group_size); ///< Sets the smallest group of data packets, up to 16, that each connection established from now on follows with a parity packet, so the remote host can rebuild one lost packet per group without waiting for it to be resent, or 0, the default, for none.  Connections use it only if both sides set it, with the larger of the two sizes; groups grow while few packets are lost and shrink back when more are.  A rebuilt packet is posted like any other and notified as delivered.  Suited to real-time traffic on lossy links, at the cost of one extra packet per group.
+	void (*set_packet_encryption)(torque_socket_handle, int enabled); ///< Sets whether connections established from now on seal their packets with AES-GCM under the key agreed in the handshake, authenticating each header and encrypting the rest, and discard any packet that fails authentication or arrives a second time.  Only connections with sealed packets follow the remote host to a new address, as when its NAT rebinds.  On by default; a connection's packets are sealed only if both sides allow it.
+	void (*set_puzzle_load_limits)(torque_socket_handle, unsigned max_pending_connections, unsigned max_shared_secrets_per_second, unsigned cpu_budget_percent); ///< Sets the pending connections, key exchanges computed per second for connect requests, and percent of the time spent computing them, past which the socket raises the difficulty of the client puzzles it issues, a bit each second, up to 26 bits; 0 leaves that measure out.  The difficulty drops back a bit at a time once the load has stayed under a quarter of the limits for ten seconds.  The defaults are 256 connections, 1000 per second and 25 percent.
+	void (*get_puzzle_stats)(torque_socket_handle, struct torque_socket_puzzle_stats *stats); ///< Fills in stats with the current client puzzle difficulty, the load it follows, and counts of the puzzle solutions accepted and rejected.
+	torque_loopback_network_handle (*create_loopback_network)(); ///< Creates a datagram network that exists only inside this process, for tests, benchmarks and load generation.  Transports on it are told apart by port alone.
+	void (*destroy_loopback_network)(torque_loopback_network_handle); ///< Destroys a loopback network.  Every transport created on it must have been destroyed first.
+	torque_transport_handle (*create_loopback_transport)(torque_loopback_network_handle); ///< Creates an unbound transport on a loopback network.  Datagrams between loopback transports are copied from one to the other without a system call, and are dropped, as UDP would, when the receiver's queue is full or nothing is bound to the destination port.
+	void (*destroy_transport)(torque_transport_handle); ///< Destroys a transport.  The socket it was given to must have been destroyed first.
+	void (*set_transport)(torque_socket_handle, torque_transport_handle); ///< Makes the socket send and receive through the transport instead of its UDP socket.  Must be called before bind; the socket does not take ownership of the transport, which must outlive it.
 };
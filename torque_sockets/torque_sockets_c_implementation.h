@@ -85,11 +85,9 @@ void torque_socket_close_connection(torque_socket_handle the_socket, torque_conn
 	((core::net::torque_socket *) the_socket)->disconnect(connection_id, disconnect_data,  disconnect_data_size);
 }
 
-int torque_socket_send_to_connection(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size])
+enum send_to_connection_result torque_socket_send_to_connection(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size], unsigned *sequence_number)
 {
-	unsigned sequence;
-	((core::net::torque_socket *) the_socket)->send_to_connection(connection_id, buffer, datagram_size, &sequence);
-	return sequence;
+	return ((core::net::torque_socket *) the_socket)->send_to_connection(connection_id, buffer, datagram_size, sequence_number);
 }
 
 struct torque_socket_event *torque_socket_get_next_event(torque_socket_handle the_socket)
@@ -97,6 +95,134 @@ struct torque_socket_event *torque_socket_get_next_event(torque_socket_handle th
 	return ((core::net::torque_socket *) the_socket)->get_next_event();
 }
 
+void torque_socket_set_io_uring(torque_socket_handle the_socket, int enabled)
+{
+	((core::net::torque_socket *) the_socket)->set_io_uring(enabled != 0);
+}
+
+void torque_socket_set_segmentation_offload(torque_socket_handle the_socket, int enabled)
+{
+	((core::net::torque_socket *) the_socket)->set_segmentation_offload(enabled != 0);
+}
+
+int torque_socket_get_wait_fd(torque_socket_handle the_socket)
+{
+	SOCKET descriptor = ((core::net::torque_socket *) the_socket)->get_wait_descriptor();
+	return descriptor == INVALID_SOCKET ? -1 : int(descriptor);
+}
+
+unsigned torque_socket_get_next_timeout(torque_socket_handle the_socket)
+{
+	return ((core::net::torque_socket *) the_socket)->get_next_timeout();
+}
+
+void torque_socket_set_packet_window_size(torque_socket_handle the_socket, unsigned packet_window_size)
+{
+	((core::net::torque_socket *) the_socket)->set_packet_window_size(packet_window_size);
+}
+
+void torque_socket_set_congestion_control(torque_socket_handle the_socket, enum congestion_control_type type)
+{
+	((core::net::torque_socket *) the_socket)->set_congestion_control(type);
+}
+
+unsigned torque_socket_get_send_budget(torque_socket_handle the_socket, torque_connection_id connection_id)
+{
+	return ((core::net::torque_socket *) the_socket)->get_send_budget(connection_id);
+}
+
+void torque_socket_set_send_queue_limit(torque_socket_handle the_socket, unsigned queue_byte_limit)
+{
+	((core::net::torque_socket *) the_socket)->set_send_queue_limit(queue_byte_limit);
+}
+
+enum send_to_connection_result torque_socket_send_to_stream(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned stream_index, unsigned message_size, unsigned char *message)
+{
+	return ((core::net::torque_socket *) the_socket)->send_to_stream(connection_id, stream_index, message, message_size);
+}
+
+void torque_socket_set_reassembly_limits(torque_socket_handle the_socket, unsigned byte_limit, unsigned timeout)
+{
+	((core::net::torque_socket *) the_socket)->set_reassembly_limits(byte_limit, timeout);
+}
+
+void torque_socket_set_coalesce_delay(torque_socket_handle the_socket, unsigned delay)
+{
+	((core::net::torque_socket *) the_socket)->set_coalesce_delay(delay);
+}
+
+enum send_to_connection_result torque_socket_flush_connection(torque_socket_handle the_socket, torque_connection_id connection_id)
+{
+	return ((core::net::torque_socket *) the_socket)->flush_connection(connection_id);
+}
+
+void torque_socket_set_ack_delay(torque_socket_handle the_socket, unsigned delay)
+{
+	((core::net::torque_socket *) the_socket)->set_ack_delay(delay);
+}
+
+void torque_socket_set_reorder_window(torque_socket_handle the_socket, unsigned reorder_window)
+{
+	((core::net::torque_socket *) the_socket)->set_reorder_window(reorder_window);
+}
+
+void torque_socket_set_fec_group_size(torque_socket_handle the_socket, unsigned min_group_size)
+{
+	((core::net::torque_socket *) the_socket)->set_fec_group_size(min_group_size);
+}
+
+void torque_socket_set_packet_encryption(torque_socket_handle the_socket, int enabled)
+{
+	((core::net::torque_socket *) the_socket)->set_packet_encryption(enabled != 0);
+}
+
+void torque_socket_set_puzzle_load_limits(torque_socket_handle the_socket, unsigned max_pending_connections, unsigned max_shared_secrets_per_second, unsigned cpu_budget_percent)
+{
+	((core::net::torque_socket *) the_socket)->set_puzzle_load_limits(max_pending_connections, max_shared_secrets_per_second, cpu_budget_percent);
+}
+
+void torque_socket_get_puzzle_stats(torque_socket_handle the_socket, struct torque_socket_puzzle_stats *stats)
+{
+	const core::net::client_puzzle_manager::stats &puzzle_stats = ((core::net::torque_socket *) the_socket)->get_puzzle_stats();
+	stats->current_difficulty = puzzle_stats.current_difficulty;
+	stats->load_percent = puzzle_stats.load_percent;
+	stats->pending_connections = puzzle_stats.pending_connections;
+	stats->shared_secrets_per_second = puzzle_stats.shared_secrets_per_second;
+	stats->difficulty_raises = puzzle_stats.difficulty_raises;
+	stats->difficulty_drops = puzzle_stats.difficulty_drops;
+	stats->solutions_accepted = puzzle_stats.solutions_accepted;
+	stats->invalid_solutions = puzzle_stats.rejections[core::net::client_puzzle_manager::invalid_solution];
+	stats->invalid_server_nonces = puzzle_stats.rejections[core::net::client_puzzle_manager::invalid_server_nonce];
+	stats->invalid_client_nonces = puzzle_stats.rejections[core::net::client_puzzle_manager::invalid_client_nonce];
+	stats->invalid_puzzle_difficulties = puzzle_stats.rejections[core::net::client_puzzle_manager::invalid_puzzle_difficulty];
+}
+
+torque_loopback_network_handle torque_loopback_network_create()
+{
+	return (void *) new core::net::loopback_network;
+}
+
+void torque_loopback_network_destroy(torque_loopback_network_handle the_network)
+{
+	delete (core::net::loopback_network *) the_network;
+}
+
+torque_transport_handle torque_loopback_transport_create(torque_loopback_network_handle the_network)
+{
+	core::net::packet_transport *ret = new core::net::loopback_transport((core::net::loopback_network *) the_network);
+	return (void *) ret;
+}
+
+void torque_transport_destroy(torque_transport_handle the_transport)
+{
+	delete (core::net::packet_transport *) the_transport;
+}
+
+void torque_socket_set_transport(torque_socket_handle the_socket, torque_transport_handle the_transport)
+{
+	((core::net::torque_socket *) the_socket)->set_transport((core::net::packet_transport *) the_transport);
+}
+
 torque_socket_interface g_torque_socket_interface =
 {
 	torque_socket_create,
@@ -116,4 +242,27 @@ torque_socket_interface g_torque_socket_interface =
 	torque_socket_close_connection,
 	torque_socket_send_to_connection,
 	torque_socket_get_next_event,
+	torque_socket_set_io_uring,
+	torque_socket_set_segmentation_offload,
+	torque_socket_get_wait_fd,
+	torque_socket_get_next_timeout,
+	torque_socket_set_packet_window_size,
+	torque_socket_set_congestion_control,
+	torque_socket_get_send_budget,
+	torque_socket_set_send_queue_limit,
+	torque_socket_send_to_stream,
+	torque_socket_set_reassembly_limits,
+	torque_socket_set_coalesce_delay,
+	torque_socket_flush_connection,
+	torque_socket_set_ack_delay,
+	torque_socket_set_reorder_window,
+	torque_socket_set_fec_group_size,
+	torque_socket_set_packet_encryption,
+	torque_socket_set_puzzle_load_limits,
+	torque_socket_get_puzzle_stats,
+	torque_loopback_network_create,
+	torque_loopback_network_destroy,
+	torque_loopback_transport_create,
+	torque_transport_destroy,
+	torque_socket_set_transport,
 };
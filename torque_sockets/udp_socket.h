@@ -1,19 +1,34 @@
 // Copyright Mark Frohnmayer and GarageGames.  See /license/info.txt in this distribution for licensing terms.
 
-class udp_socket
+#if defined(PLATFORM_LINUX) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define TORQUE_SOCKETS_UDP_OFFLOAD
+#endif
+
+/// packet_transport over an operating system UDP socket.
+class udp_socket : public packet_transport
 {
 public:
 	enum
 	{
-		default_send_buffer_size = 32768,
-		default_recv_buffer_size = 32768,
-		max_datagram_size = 1536, ///< some routers have issues with packets larger than this
-		recommended_datagram_size = 512,
+		max_offload_size = 65536, ///< Largest run of datagrams the kernel will coalesce into one segmentation offload send or receive.
+		gro_batch_size = 8, ///< Number of coalesced runs read by one recvmmsg when UDP_GRO is on.
 	};
-	
+
 	udp_socket()
 	{
 		_socket = INVALID_SOCKET;
+		_reuse_port = false;
+		_use_io_uring = false;
+		_segmentation_offload = false;
+		_gso_enabled = false;
+		_gro_enabled = false;
+		_gro_buffer = 0;
+		_gro_run_count = 0;
+		_gro_run_index = 0;
+		_gro_offset = 0;
+		#if defined(TORQUE_SOCKETS_IO_URING)
+			_uring = 0;
+		#endif
 	}
 
 	~udp_socket()
@@ -21,7 +36,7 @@ public:
 		unbind();
 	}
 
-	bind_result bind(const address bind_address, bool non_blocking_io = true, time recv_timeout = 0, bool accepts_broadcast_packets = true, uint32 send_buffer_size = default_send_buffer_size, uint32 recv_buffer_size = default_recv_buffer_size)
+	virtual bind_result bind(const address bind_address, bool non_blocking_io = true, time recv_timeout = 0, bool accepts_broadcast_packets = true, uint32 send_buffer_size = default_send_buffer_size, uint32 recv_buffer_size = default_recv_buffer_size)
 	{
 		if(!sockets_init())
 			return initialization_failure;
@@ -29,6 +44,18 @@ public:
 		if(_socket == INVALID_SOCKET)
 			return socket_allocation_failure;
 
+		#if defined(SO_REUSEPORT)
+		if(_reuse_port)
+		{
+			int32 reuse = 1;
+			if(setsockopt(_socket, SOL_SOCKET, SO_REUSEPORT, (char *) &reuse, sizeof(reuse)) == SOCKET_ERROR)
+			{
+				unbind();
+				return generic_failure;
+			}
+		}
+		#endif
+
 		SOCKADDR sockaddr;
 		bind_address.to_sockaddr(&sockaddr);
 
@@ -90,12 +117,48 @@ public:
 				setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 			#endif
 		}
+		#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+		if(_segmentation_offload)
+		{
+			int32 enable = 1;
+			_gso_enabled = true;
+			_gro_enabled = setsockopt(_socket, SOL_UDP, UDP_GRO, (char *) &enable, sizeof(enable)) != SOCKET_ERROR;
+			if(_gro_enabled)
+				_gro_buffer = (uint8 *) memory_allocate(gro_batch_size * max_offload_size);
+		}
+		#endif
+		#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_use_io_uring)
+		{
+			_uring = new udp_uring;
+			if(!_uring->open(_socket, max_datagram_size, non_blocking_io, recv_timeout))
+			{
+				logprintf("udp socket: io_uring unavailable, using system calls.");
+				delete _uring;
+				_uring = 0;
+			}
+		}
+		#endif
 			
 		return bind_success;
 	}
 
-	void unbind()
+	virtual void unbind()
 	{
+		#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_uring)
+		{
+			delete _uring;
+			_uring = 0;
+		}
+		#endif
+		memory_deallocate(_gro_buffer);
+		_gro_buffer = 0;
+		_gro_run_count = 0;
+		_gro_run_index = 0;
+		_gro_offset = 0;
+		_gso_enabled = false;
+		_gro_enabled = false;
 		if(_socket != INVALID_SOCKET)
 		{
 			closesocket(_socket);
@@ -103,7 +166,7 @@ public:
 		}
 	}
 
-	address get_bound_address()
+	virtual address get_bound_address()
 	{
 		SOCKADDR sockaddr;
 		socklen_t address_size = sizeof(sockaddr);
@@ -113,20 +176,113 @@ public:
 		return ret;
 	}
 
-	bool is_bound()
+	virtual bool is_bound()
 	{
 		return _socket != INVALID_SOCKET;
 	}
 
-	enum send_to_result
+	/// Returns the operating system handle to wait on for incoming datagrams, for registering with readiness APIs such as epoll.  This is the socket itself, or the io_uring instance when the socket receives through io_uring.
+	virtual SOCKET get_descriptor()
 	{
-		send_to_success,
-		send_to_failure,
-	};
-	send_to_result send_to(const address &the_address, const byte *buffer, uint32 buffer_size)
+		#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_receiving_through_uring())
+			return _uring->get_descriptor();
+		#endif
+		return _socket;
+	}
+
+	/// Sets whether the next bind will share its address with other sockets bound the same way (SO_REUSEPORT).  On Linux the kernel spreads incoming datagrams across the sockets of such a group.
+	void set_reuse_port(bool reuse_port)
+	{
+		_reuse_port = reuse_port;
+	}
+
+	/// Sets whether the next bind will move this socket's datagrams through an io_uring (multishot receives into registered buffers, batched send submission) rather than one system call per datagram.  Only has an effect on Linux; if the kernel lacks the needed io_uring features the socket uses the system calls as usual.
+	void set_io_uring(bool use_io_uring)
+	{
+		_use_io_uring = use_io_uring;
+	}
+
+	/// Sets whether the next bind enables UDP segmentation offload on Linux.  When it is on, send_to_batch hands runs of same-size datagrams bound for the same address to the kernel as a single UDP_SEGMENT send, and receives ask the kernel to coalesce (UDP_GRO) datagrams from one sender, which recv_from_batch splits back apart.  Each recvmmsg then reads up to gro_batch_size coalesced runs of up to max_offload_size bytes each, so a bound socket holds a receive buffer of gro_batch_size * max_offload_size bytes.  Worthwhile for sockets carrying high-rate streams; sockets with many light peers are better served by the plain batched calls.  Ignored when the socket sends and receives through io_uring.
+	void set_segmentation_offload(bool segmentation_offload)
+	{
+		_segmentation_offload = segmentation_offload;
+	}
+
+	/// Returns true if the socket is bound and sending through io_uring.
+	bool is_using_io_uring()
+	{
+		#if defined(TORQUE_SOCKETS_IO_URING)
+			return _uring != 0;
+		#else
+			return false;
+		#endif
+	}
+
+	/// Installs a classic BPF program on the SO_REUSEPORT group this socket belongs to that hashes each datagram's source address and port to one of the first group_size sockets of the group, in bind order.  All datagrams from a given remote address are thus delivered to the same socket.  Returns false if the platform doesn't support reuseport steering.
+	bool attach_reuseport_steering(uint32 group_size)
+	{
+		#if defined(PLATFORM_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+			struct sock_filter code[] = {
+				{ BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32(SKF_NET_OFF + 12) }, // A = IPv4 source address
+				{ BPF_ST, 0, 0, 0 }, // M[0] = A
+				{ BPF_LDX | BPF_B | BPF_MSH, 0, 0, uint32(SKF_NET_OFF) }, // X = IPv4 header length, options included
+				{ BPF_LD | BPF_H | BPF_IND, 0, 0, uint32(SKF_NET_OFF) }, // A = UDP source port, just past the IPv4 header
+				{ BPF_LDX | BPF_MEM, 0, 0, 0 }, // X = M[0]
+				{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 }, // A ^= X
+				{ BPF_MISC | BPF_TAX, 0, 0, 0 }, // X = A
+				{ BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16 }, // A >>= 16
+				{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 }, // A ^= X, folding the high half into the low half
+				{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, group_size }, // A %= group_size
+				{ BPF_RET | BPF_A, 0, 0, 0 }, // deliver to socket A of the group
+			};
+			struct sock_fprog program;
+			program.len = sizeof(code) / sizeof(code[0]);
+			program.filter = code;
+			return setsockopt(_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != SOCKET_ERROR;
+		#else
+			return false;
+		#endif
+	}
+
+	/// Waits up to timeout for a datagram to become readable on this socket.  Returns true if one is ready.
+	virtual bool wait_for_readable(time timeout)
+	{
+		#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_receiving_through_uring())
+			return _uring->wait_for_completion(timeout);
+		#endif
+		#if defined(PLATFORM_WIN32)
+			fd_set read_set;
+			FD_ZERO(&read_set);
+			FD_SET(_socket, &read_set);
+			timeval tv;
+			tv.tv_sec = long(timeout.get_milliseconds() / 1000);
+			tv.tv_usec = long(timeout.get_milliseconds() % 1000) * 1000;
+			return select(0, &read_set, 0, 0, &tv) > 0;
+		#else
+			pollfd poll_entry;
+			poll_entry.fd = _socket;
+			poll_entry.events = POLLIN;
+			poll_entry.revents = 0;
+			return poll(&poll_entry, 1, int(timeout.get_milliseconds())) > 0;
+		#endif
+	}
+
+	virtual send_to_result send_to(const address &the_address, const byte *buffer, uint32 buffer_size)
 	{
 		logprintf("udp socket sending to %s: %s.", the_address.to_string().c_str(), string((const char *) buffer_encode_base_16(buffer, buffer_size)->get_buffer()).c_str());
 
+		#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_uring)
+		{
+			datagram the_datagram;
+			the_datagram.remote_address = the_address;
+			the_datagram.buffer = (byte *) buffer;
+			the_datagram.packet_size = buffer_size;
+			return _uring->send_batch(&the_datagram, 1) ? send_to_success : send_to_failure;
+		}
+		#endif
 		SOCKADDR dest_address;
 		the_address.to_sockaddr(&dest_address);
 		if(sendto(_socket, (const char *) buffer, int(buffer_size), 0, &dest_address, sizeof(dest_address)) == SOCKET_ERROR)
@@ -134,32 +290,44 @@ public:
 		return send_to_success;
 	}
 
-	enum recv_from_result
-	{
-		packet_received,
-		would_block_or_timeout,
-		invalid_socket,
-		unknown_error,
-	};
-
-	recv_from_result recv_from(address *sender_address, byte *buffer, uint32 buffer_size, uint32 *incoming_packet_size)
+	virtual recv_from_result recv_from(address *sender_address, byte *buffer, uint32 buffer_size, uint32 *incoming_packet_size)
 	{
+		#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_receiving_through_uring())
+		{
+			datagram the_datagram;
+			the_datagram.buffer = buffer;
+			the_datagram.buffer_size = buffer_size;
+			if(!_uring->receive_batch(&the_datagram, 1))
+				return would_block_or_timeout;
+			*incoming_packet_size = the_datagram.packet_size;
+			if(sender_address)
+				*sender_address = the_datagram.remote_address;
+			return packet_received;
+		}
+		#endif
+		#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+		if(_gro_enabled)
+		{
+			datagram the_datagram;
+			the_datagram.buffer = buffer;
+			the_datagram.buffer_size = buffer_size;
+			uint32 received_count;
+			recv_from_result result = _recv_from_gro(&the_datagram, 1, &received_count);
+			if(result != packet_received)
+				return result;
+			*incoming_packet_size = the_datagram.packet_size;
+			if(sender_address)
+				*sender_address = the_datagram.remote_address;
+			return packet_received;
+		}
+		#endif
 		SOCKADDR sender_sockaddr;
 		socklen_t addr_len = sizeof(sender_sockaddr);
 		int32 bytes_read = recvfrom(_socket, (char *) buffer, buffer_size, 0, &sender_sockaddr, &addr_len);
 		//logprintf("recv_from result = %d", errno);
 		if(bytes_read == SOCKET_ERROR)
-		{
-			switch(errno)
-			{
-				case EAGAIN:
-					return would_block_or_timeout;
-				case EBADF:
-					return invalid_socket;
-				default:
-					return unknown_error;
-			}
-		}
+			return _get_recv_error();
 		*incoming_packet_size = uint32(bytes_read);
 
 		if(sender_address)
@@ -170,8 +338,266 @@ public:
 
 		return packet_received;
 	}
+
+	/// Reads up to datagram_count datagrams from the socket with as few system calls as the platform allows.  *received_count is set to the number of datagrams read; if any were read the result is packet_received.  On a blocking socket this call waits for the first datagram only.
+	virtual recv_from_result recv_from_batch(datagram *datagrams, uint32 datagram_count, uint32 *received_count)
+	{
+		*received_count = 0;
+		if(datagram_count > max_batch_size)
+			datagram_count = max_batch_size;
+#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_receiving_through_uring())
+		{
+			*received_count = _uring->receive_batch(datagrams, datagram_count);
+			return *received_count ? packet_received : would_block_or_timeout;
+		}
+#endif
+#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+		if(_gro_enabled)
+			return _recv_from_gro(datagrams, datagram_count, received_count);
+#endif
+#if defined(PLATFORM_LINUX)
+		mmsghdr headers[max_batch_size];
+		iovec vectors[max_batch_size];
+		SOCKADDR sender_sockaddrs[max_batch_size];
+		
+		for(uint32 i = 0; i < datagram_count; i++)
+		{
+			vectors[i].iov_base = datagrams[i].buffer;
+			vectors[i].iov_len = datagrams[i].buffer_size;
+			memset(&headers[i], 0, sizeof(mmsghdr));
+			headers[i].msg_hdr.msg_name = &sender_sockaddrs[i];
+			headers[i].msg_hdr.msg_namelen = sizeof(SOCKADDR);
+			headers[i].msg_hdr.msg_iov = &vectors[i];
+			headers[i].msg_hdr.msg_iovlen = 1;
+		}
+		int32 count = recvmmsg(_socket, headers, datagram_count, MSG_WAITFORONE, 0);
+		if(count == SOCKET_ERROR)
+			return _get_recv_error();
+		
+		for(int32 i = 0; i < count; i++)
+		{
+			datagrams[i].packet_size = headers[i].msg_len;
+			datagrams[i].remote_address.from_sockaddr(sender_sockaddrs[i]);
+		}
+		*received_count = uint32(count);
+		return packet_received;
+#else
+		return packet_transport::recv_from_batch(datagrams, datagram_count, received_count);
+#endif
+	}
+
+	/// Sends datagram_count datagrams, using as few system calls as the platform allows.  Returns the number of datagrams handed to the network stack; datagrams that fail to send are skipped.
+	virtual uint32 send_to_batch(const datagram *datagrams, uint32 datagram_count)
+	{
+#if defined(TORQUE_SOCKETS_IO_URING)
+		if(_uring)
+			return _uring->send_batch(datagrams, datagram_count);
+#endif
+#if defined(PLATFORM_LINUX)
+		uint32 sent_count = 0;
+		mmsghdr headers[max_batch_size];
+		iovec vectors[max_batch_size];
+		SOCKADDR dest_sockaddrs[max_batch_size];
+		uint32 header_datagram_counts[max_batch_size];
+		#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+			uint8 controls[max_batch_size][CMSG_SPACE(sizeof(uint16))];
+		#endif
+		
+		while(datagram_count)
+		{
+			// gather up to max_batch_size datagrams into messages.  With segmentation offload, each run of datagrams of one size (the last may be shorter) bound for one address becomes a single message.
+			uint32 header_count = 0;
+			uint32 vector_count = 0;
+			while(vector_count < datagram_count && vector_count < max_batch_size)
+			{
+				const datagram &first = datagrams[vector_count];
+				uint32 run = 1;
+				#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+				if(_gso_enabled && first.packet_size)
+				{
+					while(vector_count + run < datagram_count && vector_count + run < max_batch_size &&
+						datagrams[vector_count + run].remote_address == first.remote_address &&
+						datagrams[vector_count + run - 1].packet_size == first.packet_size &&
+						datagrams[vector_count + run].packet_size <= first.packet_size &&
+						(run + 1) * first.packet_size <= max_offload_size)
+						run++;
+				}
+				#endif
+				mmsghdr &header = headers[header_count];
+				memset(&header, 0, sizeof(mmsghdr));
+				first.remote_address.to_sockaddr(&dest_sockaddrs[header_count]);
+				header.msg_hdr.msg_name = &dest_sockaddrs[header_count];
+				header.msg_hdr.msg_namelen = sizeof(SOCKADDR);
+				header.msg_hdr.msg_iov = &vectors[vector_count];
+				header.msg_hdr.msg_iovlen = run;
+				for(uint32 i = 0; i < run; i++)
+				{
+					const datagram &the_datagram = datagrams[vector_count + i];
+					vectors[vector_count + i].iov_base = the_datagram.buffer;
+					vectors[vector_count + i].iov_len = the_datagram.packet_size;
+				}
+				#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+				if(run > 1)
+				{
+					header.msg_hdr.msg_control = controls[header_count];
+					header.msg_hdr.msg_controllen = sizeof(controls[header_count]);
+					cmsghdr *control = CMSG_FIRSTHDR(&header.msg_hdr);
+					control->cmsg_level = SOL_UDP;
+					control->cmsg_type = UDP_SEGMENT;
+					control->cmsg_len = CMSG_LEN(sizeof(uint16));
+					uint16 segment_size = uint16(first.packet_size);
+					memcpy(CMSG_DATA(control), &segment_size, sizeof(segment_size));
+				}
+				#endif
+				header_datagram_counts[header_count++] = run;
+				vector_count += run;
+			}
+			int32 result = sendmmsg(_socket, headers, header_count, 0);
+			uint32 consumed = 0;
+			if(result == SOCKET_ERROR)
+			{
+				#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+				if(header_datagram_counts[0] > 1 && (errno == EIO || errno == EINVAL))
+				{
+					// the route can't do segmentation offload; send the datagrams one at a time from now on.
+					logprintf("udp socket: segmentation offload send failed, disabling.");
+					_gso_enabled = false;
+					continue;
+				}
+				#endif
+				// the first message of the batch failed; skip it and keep going with the rest.
+				consumed = header_datagram_counts[0];
+			}
+			else if(result == 0)
+			{
+				// nothing was accepted and no error reported; stop rather than retry the same batch forever.
+				break;
+			}
+			else
+			{
+				for(int32 i = 0; i < result; i++)
+					consumed += header_datagram_counts[i];
+				sent_count += consumed;
+			}
+			datagrams += consumed;
+			datagram_count -= consumed;
+		}
+		return sent_count;
+#else
+		return packet_transport::send_to_batch(datagrams, datagram_count);
+#endif
+	}
 private:
+	#if defined(TORQUE_SOCKETS_UDP_OFFLOAD)
+	/// recv_from_batch for a socket with UDP_GRO enabled.  Each recvmmsg reads up to gro_batch_size coalesced runs, each from one sender; their datagrams are handed out one at a time, and any that don't fit in this call are kept for the next.
+	recv_from_result _recv_from_gro(datagram *datagrams, uint32 datagram_count, uint32 *received_count)
+	{
+		*received_count = 0;
+		if(_gro_run_index >= _gro_run_count)
+		{
+			mmsghdr headers[gro_batch_size];
+			iovec vectors[gro_batch_size];
+			SOCKADDR sender_sockaddrs[gro_batch_size];
+			uint8 controls[gro_batch_size][CMSG_SPACE(sizeof(int32))];
+			for(uint32 i = 0; i < gro_batch_size; i++)
+			{
+				vectors[i].iov_base = _gro_buffer + i * max_offload_size;
+				vectors[i].iov_len = max_offload_size;
+				memset(&headers[i], 0, sizeof(mmsghdr));
+				headers[i].msg_hdr.msg_name = &sender_sockaddrs[i];
+				headers[i].msg_hdr.msg_namelen = sizeof(SOCKADDR);
+				headers[i].msg_hdr.msg_iov = &vectors[i];
+				headers[i].msg_hdr.msg_iovlen = 1;
+				headers[i].msg_hdr.msg_control = controls[i];
+				headers[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+			}
+			int32 count = recvmmsg(_socket, headers, gro_batch_size, MSG_WAITFORONE, 0);
+			if(count == SOCKET_ERROR)
+				return _get_recv_error();
+			for(int32 i = 0; i < count; i++)
+			{
+				gro_run &run = _gro_runs[i];
+				run.size = headers[i].msg_len;
+				run.segment_size = run.size;
+				for(cmsghdr *control = CMSG_FIRSTHDR(&headers[i].msg_hdr); control; control = CMSG_NXTHDR(&headers[i].msg_hdr, control))
+				{
+					if(control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO)
+					{
+						int32 segment_size;
+						memcpy(&segment_size, CMSG_DATA(control), sizeof(segment_size));
+						run.segment_size = uint32(segment_size);
+					}
+				}
+				run.sender.from_sockaddr(sender_sockaddrs[i]);
+			}
+			_gro_run_count = uint32(count);
+			_gro_run_index = 0;
+			_gro_offset = 0;
+		}
+		while(*received_count < datagram_count && _gro_run_index < _gro_run_count)
+		{
+			gro_run &run = _gro_runs[_gro_run_index];
+			datagram &the_datagram = datagrams[(*received_count)++];
+			uint32 size = run.size - _gro_offset;
+			if(size > run.segment_size)
+				size = run.segment_size;
+			uint32 copy_size = size > the_datagram.buffer_size ? the_datagram.buffer_size : size;
+			memcpy(the_datagram.buffer, _gro_buffer + _gro_run_index * max_offload_size + _gro_offset, copy_size);
+			the_datagram.packet_size = copy_size;
+			the_datagram.remote_address = run.sender;
+			_gro_offset += size;
+			if(_gro_offset >= run.size)
+			{
+				_gro_run_index++;
+				_gro_offset = 0;
+			}
+		}
+		return *received_count ? packet_received : would_block_or_timeout;
+	}
+	#endif
+
+	#if defined(TORQUE_SOCKETS_IO_URING)
+	bool _receiving_through_uring()
+	{
+		return _uring && _uring->is_receiving();
+	}
+	#endif
+
+	recv_from_result _get_recv_error()
+	{
+		switch(errno)
+		{
+			case EAGAIN:
+				return would_block_or_timeout;
+			case EBADF:
+				return invalid_socket;
+			default:
+				return unknown_error;
+		}
+	}
+
 	SOCKET _socket;
+	bool _reuse_port; ///< True if the socket is bound with SO_REUSEPORT.
+	bool _use_io_uring; ///< True if the socket should be bound with an io_uring backend.
+	bool _segmentation_offload; ///< True if the socket should be bound with UDP segmentation offload.
+	bool _gso_enabled; ///< True while send_to_batch coalesces runs of datagrams with UDP_SEGMENT.
+	bool _gro_enabled; ///< True if the kernel may hand this socket coalesced (UDP_GRO) datagrams.
+	/// One coalesced run read from a UDP_GRO socket.
+	struct gro_run
+	{
+		uint32 size; ///< Number of bytes in the run.
+		uint32 segment_size; ///< Size of each datagram in the run; the last may be shorter.
+		address sender; ///< Sender of the datagrams in the run.
+	};
+	uint8 *_gro_buffer; ///< Holds gro_batch_size runs of max_offload_size bytes, filled by the last recvmmsg while their datagrams are handed out.
+	gro_run _gro_runs[gro_batch_size]; ///< The runs in _gro_buffer.
+	uint32 _gro_run_count; ///< Number of runs read by the last recvmmsg.
+	uint32 _gro_run_index; ///< Index of the run holding the next datagram to hand out.
+	uint32 _gro_offset; ///< Offset in the current run of the next datagram to hand out.
+	#if defined(TORQUE_SOCKETS_IO_URING)
+		udp_uring *_uring; ///< io_uring backend, if the socket is bound with one.
+	#endif
 };
 
 static void udp_socket_unit_test()
@@ -0,0 +1,478 @@
+// udp_uring.h - io_uring backend for udp_socket on Linux.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+#if defined(PLATFORM_LINUX) && defined(IORING_RECV_MULTISHOT)
+#define TORQUE_SOCKETS_IO_URING
+
+/// udp_uring moves a udp_socket's datagrams through an io_uring instead of one system call per send or receive.
+///
+/// A single multishot recvmsg stays posted on the socket, and the kernel writes each arriving datagram, with its sender address, straight into one of a ring of buffers registered with the kernel; receive_batch only has to reap completions and copy the payloads out.  Sends are copied into preallocated send slots and a whole batch is submitted with a single io_uring_enter.  Send completions are reaped lazily to free the slots, and send errors are not reported, just as with sendto on a UDP socket.
+///
+/// The receive path needs multishot receives and provided buffer rings (Linux 6.0 and later).  If the kernel refuses the ring, open fails and udp_socket keeps using the plain system calls; if the kernel refuses the multishot receive, is_receiving becomes false and udp_socket goes back to reading the socket directly.
+///
+/// A threaded torque_socket receives on its reader thread while sending from its owner's thread, so the rings are guarded by a mutex.  A receiver blocked in receive_batch also waits on an eventfd, so that it wakes when another thread reaps a receive completion on its behalf.
+class udp_uring
+{
+public:
+	enum {
+		ring_entries = 256, ///< Submission queue size; the completion queue is twice this.
+		recv_buffer_count = 256, ///< Number of provided receive buffers.  Must be a power of two.
+		recv_buffer_group = 0, ///< Buffer group id the receive buffers are registered under.
+		send_slot_count = 64, ///< Number of sends that may be in flight at once.
+		recv_user_data = 0, ///< user_data of the multishot receive; sends use their slot index + 1.
+		cancel_user_data = send_slot_count + 1, ///< user_data of the request that cancels the multishot receive.
+		close_wait_time = 1000, ///< Longest time in milliseconds close waits for the kernel to let go of the socket.
+	};
+
+	udp_uring()
+	{
+		_ring_fd = -1;
+		_wake_fd = -1;
+		_ring_ptr = 0;
+		_ring_size = 0;
+		_sqes = 0;
+		_sqes_size = 0;
+		_buf_ring = 0;
+		_buf_ring_size = 0;
+		_recv_buffers = 0;
+		_send_buffers = 0;
+		_recv_armed = false;
+		_recv_failed = false;
+		_receiver_waiting = false;
+		_completed_head = 0;
+		_completed_count = 0;
+		_free_send_count = 0;
+	}
+
+	~udp_uring()
+	{
+		close();
+	}
+
+	/// Sets up the rings for the bound socket the_socket.  non_blocking and recv_timeout give the receive semantics of the socket, as passed to udp_socket::bind.  Returns false if the kernel doesn't support the rings this backend needs.
+	bool open(SOCKET the_socket, uint32 max_packet_size, bool non_blocking, time recv_timeout)
+	{
+		_socket = the_socket;
+		_max_packet_size = max_packet_size;
+		_non_blocking = non_blocking;
+		_recv_timeout = recv_timeout;
+
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		_ring_fd = int(syscall(__NR_io_uring_setup, ring_entries, &params));
+		if(_ring_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP))
+		{
+			close();
+			return false;
+		}
+
+		// map the submission and completion rings, which share one mapping, and the submission queue entries.
+		uint32 sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32);
+		uint32 cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		_ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+		_ring_ptr = (uint8 *) mmap(0, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+		_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		_sqes = (io_uring_sqe *) mmap(0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+		if(_ring_ptr == MAP_FAILED || _sqes == MAP_FAILED)
+		{
+			if(_ring_ptr == MAP_FAILED)
+				_ring_ptr = 0;
+			if(_sqes == MAP_FAILED)
+				_sqes = 0;
+			close();
+			return false;
+		}
+		_sq_head = (volatile uint32 *) (_ring_ptr + params.sq_off.head);
+		_sq_tail = (volatile uint32 *) (_ring_ptr + params.sq_off.tail);
+		_sq_mask = *(uint32 *) (_ring_ptr + params.sq_off.ring_mask);
+		_sq_entries = params.sq_entries;
+		_sq_local_tail = *_sq_tail;
+		uint32 *sq_array = (uint32 *) (_ring_ptr + params.sq_off.array);
+		for(uint32 i = 0; i < params.sq_entries; i++)
+			sq_array[i] = i;
+		_cq_head = (volatile uint32 *) (_ring_ptr + params.cq_off.head);
+		_cq_tail = (volatile uint32 *) (_ring_ptr + params.cq_off.tail);
+		_cq_mask = *(uint32 *) (_ring_ptr + params.cq_off.ring_mask);
+		_cqes = (io_uring_cqe *) (_ring_ptr + params.cq_off.cqes);
+
+		// register the provided receive buffer ring.  Each buffer holds the recvmsg header, the sender's address and the payload.
+		_buf_ring_size = recv_buffer_count * sizeof(io_uring_buf);
+		_buf_ring = (io_uring_buf *) mmap(0, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(_buf_ring == MAP_FAILED)
+		{
+			_buf_ring = 0;
+			close();
+			return false;
+		}
+		io_uring_buf_reg registration;
+		memset(&registration, 0, sizeof(registration));
+		registration.ring_addr = uint64(_buf_ring);
+		registration.ring_entries = recv_buffer_count;
+		registration.bgid = recv_buffer_group;
+		if(syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+		{
+			munmap(_buf_ring, _buf_ring_size);
+			_buf_ring = 0;
+			close();
+			return false;
+		}
+		_recv_buffer_size = sizeof(io_uring_recvmsg_out) + sizeof(SOCKADDR) + _max_packet_size;
+		_recv_buffers = (uint8 *) memory_allocate(_recv_buffer_size * recv_buffer_count);
+		_buf_ring_tail = 0;
+		for(uint32 i = 0; i < recv_buffer_count; i++)
+			_provide_recv_buffer(uint16(i));
+		_publish_recv_buffers();
+
+		_send_buffers = (uint8 *) memory_allocate(_max_packet_size * send_slot_count);
+		for(uint32 i = 0; i < send_slot_count; i++)
+			_free_send_slots[_free_send_count++] = send_slot_count - 1 - i;
+
+		_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		memset(&_recv_header, 0, sizeof(_recv_header));
+		_recv_header.msg_namelen = sizeof(SOCKADDR);
+		_arm_recv();
+		_submit();
+		return true;
+	}
+
+	/// Tears down the rings.  The socket itself is left open.
+	void close()
+	{
+		if(_ring_fd != -1 && _ring_ptr && _sqes)
+		{
+			// posted requests hold a reference to the socket until they complete, and the kernel tears a closed ring down asynchronously; cancel the receive and let the sends finish here, so the socket's address is free as soon as udp_socket closes it.
+			if(_recv_armed)
+			{
+				io_uring_sqe *sqe = _get_sqe();
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = recv_user_data;
+				sqe->user_data = cancel_user_data;
+				_submit();
+			}
+			time give_up_time = time::get_current() + time(close_wait_time);
+			while((_recv_armed || _free_send_count < send_slot_count) && time::get_current() < give_up_time)
+			{
+				_wait(10);
+				_reap_completions();
+			}
+		}
+		if(_ring_fd != -1)
+		{
+			if(_buf_ring)
+			{
+				io_uring_buf_reg registration;
+				memset(&registration, 0, sizeof(registration));
+				registration.bgid = recv_buffer_group;
+				syscall(__NR_io_uring_register, _ring_fd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+			}
+			::close(_ring_fd);
+			_ring_fd = -1;
+		}
+		if(_wake_fd != -1)
+		{
+			::close(_wake_fd);
+			_wake_fd = -1;
+		}
+		if(_ring_ptr)
+			munmap(_ring_ptr, _ring_size);
+		if(_sqes)
+			munmap(_sqes, _sqes_size);
+		if(_buf_ring)
+			munmap(_buf_ring, _buf_ring_size);
+		memory_deallocate(_recv_buffers);
+		memory_deallocate(_send_buffers);
+		_ring_ptr = 0;
+		_sqes = 0;
+		_buf_ring = 0;
+		_recv_buffers = 0;
+		_send_buffers = 0;
+	}
+
+	/// Returns false once the kernel has refused the multishot receive; the socket should then be read directly.
+	bool is_receiving()
+	{
+		return !_recv_failed;
+	}
+
+	/// Returns the descriptor that becomes readable when a completion is posted to the ring.
+	int get_descriptor()
+	{
+		return _ring_fd;
+	}
+
+	/// Waits up to timeout for a receive completion.  Returns true if one may be ready.
+	bool wait_for_completion(time timeout)
+	{
+		_lock.lock();
+		_reap_completions();
+		bool ready = _completed_count != 0;
+		if(!ready)
+			_receiver_waiting = true;
+		_lock.unlock();
+		if(ready)
+			return true;
+		ready = _wait(int(timeout.get_milliseconds()));
+		_receiver_waiting = false;
+		return ready;
+	}
+
+	/// Copies up to count received datagrams into datagrams, whose buffer and buffer_size describe the storage for each.  Waits for the first datagram as udp_socket::recv_from would.  Returns the number of datagrams received.  Datagrams too large for their buffer are truncated.
+	template<class datagram_type> uint32 receive_batch(datagram_type *datagrams, uint32 count)
+	{
+		_lock.lock();
+		_reap_completions();
+		if(!_completed_count && !_non_blocking && !_recv_failed)
+		{
+			_receiver_waiting = true;
+			_lock.unlock();
+			_wait(_recv_timeout == time(0) ? -1 : int(_recv_timeout.get_milliseconds()));
+			_lock.lock();
+			_receiver_waiting = false;
+			_reap_completions();
+		}
+		uint32 received = 0;
+		while(received < count && _completed_count)
+		{
+			uint16 buffer_id = _completed[_completed_head];
+			_completed_head = (_completed_head + 1) & (recv_buffer_count - 1);
+			_completed_count--;
+
+			uint8 *buffer = _recv_buffers + buffer_id * _recv_buffer_size;
+			io_uring_recvmsg_out *header = (io_uring_recvmsg_out *) buffer;
+			SOCKADDR *sender = (SOCKADDR *) (header + 1);
+			uint8 *payload = buffer + sizeof(io_uring_recvmsg_out) + sizeof(SOCKADDR);
+			datagram_type &the_datagram = datagrams[received++];
+			uint32 size = header->payloadlen;
+			if(size > _max_packet_size)
+				size = _max_packet_size;
+			if(size > the_datagram.buffer_size)
+				size = the_datagram.buffer_size;
+			memcpy(the_datagram.buffer, payload, size);
+			the_datagram.packet_size = size;
+			the_datagram.remote_address.from_sockaddr(*sender);
+			_provide_recv_buffer(buffer_id);
+		}
+		if(received)
+			_publish_recv_buffers();
+		if(!_recv_armed && !_recv_failed)
+		{
+			_arm_recv();
+			_submit();
+		}
+		_lock.unlock();
+		return received;
+	}
+
+	/// Queues count datagrams for sending and submits them with a single system call.  Returns the number of datagrams queued.
+	template<class datagram_type> uint32 send_batch(const datagram_type *datagrams, uint32 count)
+	{
+		_lock.lock();
+		uint32 queued = 0;
+		for(uint32 i = 0; i < count; i++)
+		{
+			const datagram_type &the_datagram = datagrams[i];
+			if(the_datagram.packet_size > _max_packet_size)
+				continue;
+			if(!_free_send_count)
+			{
+				// every slot is in flight; push what we have and wait for the kernel to finish some of them.
+				_submit();
+				_reap_completions();
+				while(!_free_send_count)
+				{
+					syscall(__NR_io_uring_enter, _ring_fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+					_reap_completions();
+				}
+			}
+			io_uring_sqe *sqe = _get_sqe();
+			uint32 slot_index = _free_send_slots[--_free_send_count];
+			send_slot &slot = _send_slots[slot_index];
+			uint8 *data = _send_buffers + slot_index * _max_packet_size;
+			memcpy(data, the_datagram.buffer, the_datagram.packet_size);
+			the_datagram.remote_address.to_sockaddr(&slot.destination);
+			slot.vector.iov_base = data;
+			slot.vector.iov_len = the_datagram.packet_size;
+			memset(&slot.header, 0, sizeof(slot.header));
+			slot.header.msg_name = &slot.destination;
+			slot.header.msg_namelen = sizeof(SOCKADDR);
+			slot.header.msg_iov = &slot.vector;
+			slot.header.msg_iovlen = 1;
+
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = _socket;
+			sqe->addr = uint64(&slot.header);
+			sqe->len = 1;
+			sqe->user_data = slot_index + 1;
+			queued++;
+		}
+		_submit();
+		_lock.unlock();
+		return queued;
+	}
+private:
+	/// Everything a sendmsg in flight needs to stay valid until it completes.
+	struct send_slot
+	{
+		msghdr header;
+		iovec vector;
+		SOCKADDR destination;
+	};
+
+	/// Returns a zeroed submission queue entry, submitting queued entries first if the queue is full.
+	io_uring_sqe *_get_sqe()
+	{
+		memory_barrier();
+		if(_sq_local_tail - *_sq_head >= _sq_entries)
+			_submit();
+		io_uring_sqe *sqe = &_sqes[_sq_local_tail & _sq_mask];
+		_sq_local_tail++;
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		return sqe;
+	}
+
+	/// Publishes the prepared submission queue entries and hands them to the kernel.
+	void _submit()
+	{
+		uint32 to_submit = _sq_local_tail - *_sq_tail;
+		if(!to_submit)
+			return;
+		memory_barrier();
+		*_sq_tail = _sq_local_tail;
+		memory_barrier();
+		syscall(__NR_io_uring_enter, _ring_fd, to_submit, 0, 0, 0, 0);
+	}
+
+	/// Posts the multishot receive.
+	void _arm_recv()
+	{
+		io_uring_sqe *sqe = _get_sqe();
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = _socket;
+		sqe->addr = uint64(&_recv_header);
+		sqe->len = 1;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = recv_buffer_group;
+		sqe->user_data = recv_user_data;
+		_recv_armed = true;
+	}
+
+	/// Adds receive buffer buffer_id back to the provided buffer ring.  The kernel doesn't see it until _publish_recv_buffers.
+	void _provide_recv_buffer(uint16 buffer_id)
+	{
+		io_uring_buf &entry = _buf_ring[_buf_ring_tail & (recv_buffer_count - 1)];
+		entry.addr = uint64(_recv_buffers + buffer_id * _recv_buffer_size);
+		entry.len = _recv_buffer_size;
+		entry.bid = buffer_id;
+		_buf_ring_tail++;
+	}
+
+	void _publish_recv_buffers()
+	{
+		memory_barrier();
+		// the ring's tail overlays the resv field of the first entry (see io_uring_buf_ring).
+		*((volatile uint16 *) &_buf_ring[0].resv) = _buf_ring_tail;
+	}
+
+	/// Drains the completion queue: receive completions are queued for receive_batch, and send completions free their slots.
+	void _reap_completions()
+	{
+		uint32 head = *_cq_head;
+		memory_barrier();
+		uint32 tail = *_cq_tail;
+		memory_barrier();
+		bool received = false;
+		for(; head != tail; head++)
+		{
+			io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+			if(cqe->user_data == recv_user_data)
+			{
+				if(!(cqe->flags & IORING_CQE_F_MORE))
+					_recv_armed = false;
+				if(cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+				{
+					_completed[(_completed_head + _completed_count) & (recv_buffer_count - 1)] = uint16(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+					_completed_count++;
+					received = true;
+				}
+				else if(cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+				{
+					// anything other than running out of buffers means the kernel can't do multishot receives on this socket.
+					logprintf("udp_uring: multishot receive failed (%d); reading the socket directly.", cqe->res);
+					_recv_failed = true;
+				}
+			}
+			else if(cqe->user_data <= send_slot_count)
+				_free_send_slots[_free_send_count++] = uint32(cqe->user_data - 1);
+		}
+		memory_barrier();
+		*_cq_head = head;
+		if(received && _receiver_waiting)
+		{
+			uint64 one = 1;
+			::write(_wake_fd, &one, sizeof(one));
+		}
+	}
+
+	/// Blocks until the ring has a completion, another thread has reaped a receive on our behalf, or timeout_milliseconds pass (-1 waits forever).  Returns true if woken before the timeout.
+	bool _wait(int timeout_milliseconds)
+	{
+		pollfd poll_entries[2];
+		poll_entries[0].fd = _ring_fd;
+		poll_entries[0].events = POLLIN;
+		poll_entries[0].revents = 0;
+		poll_entries[1].fd = _wake_fd;
+		poll_entries[1].events = POLLIN;
+		poll_entries[1].revents = 0;
+		int result = poll(poll_entries, 2, timeout_milliseconds);
+		if(poll_entries[1].revents & POLLIN)
+		{
+			uint64 count;
+			::read(_wake_fd, &count, sizeof(count));
+		}
+		return result > 0;
+	}
+
+	SOCKET _socket; ///< The udp_socket's socket.
+	uint32 _max_packet_size; ///< Largest datagram sent or received.
+	bool _non_blocking; ///< True if receive_batch should return immediately when nothing has been received.
+	time _recv_timeout; ///< How long a blocking receive_batch waits; 0 waits forever.
+	mutex _lock; ///< Guards the rings, which the reader and owner threads of a threaded torque_socket share.
+	int _ring_fd; ///< The io_uring instance.
+	int _wake_fd; ///< eventfd used to wake a blocked receiver.
+
+	uint8 *_ring_ptr; ///< Shared mapping of the submission and completion rings.
+	uint32 _ring_size; ///< Size of _ring_ptr's mapping.
+	io_uring_sqe *_sqes; ///< Submission queue entries.
+	uint32 _sqes_size; ///< Size of _sqes's mapping.
+	volatile uint32 *_sq_head; ///< Submission queue head, advanced by the kernel.
+	volatile uint32 *_sq_tail; ///< Submission queue tail, advanced by _submit.
+	uint32 _sq_local_tail; ///< Submission queue tail including entries prepared but not yet submitted.
+	uint32 _sq_mask;
+	uint32 _sq_entries;
+	volatile uint32 *_cq_head; ///< Completion queue head, advanced by _reap_completions.
+	volatile uint32 *_cq_tail; ///< Completion queue tail, advanced by the kernel.
+	uint32 _cq_mask;
+	io_uring_cqe *_cqes; ///< Completion queue entries.
+
+	io_uring_buf *_buf_ring; ///< Provided buffer ring the multishot receive takes its buffers from.  Accessed as an array of io_uring_buf rather than through io_uring_buf_ring, whose flexible array member is laid out differently when the kernel header is compiled as C++.
+	uint32 _buf_ring_size; ///< Size of _buf_ring's mapping.
+	uint16 _buf_ring_tail; ///< Tail of _buf_ring including buffers provided but not yet published.
+	uint8 *_recv_buffers; ///< Storage for the receive buffers.
+	uint32 _recv_buffer_size; ///< Size of each receive buffer.
+	msghdr _recv_header; ///< Template header for the multishot receive; tells the kernel how much room to leave for the sender address.
+	bool _recv_armed; ///< True while the multishot receive is posted.
+	bool _recv_failed; ///< Set if the kernel refuses the multishot receive.
+	volatile bool _receiver_waiting; ///< True while a receiver is blocked in _wait.
+	uint16 _completed[recv_buffer_count]; ///< Buffer ids of received datagrams not yet handed out, in arrival order.
+	uint32 _completed_head; ///< Index in _completed of the oldest received datagram.
+	uint32 _completed_count; ///< Number of received datagrams waiting in _completed.
+
+	send_slot _send_slots[send_slot_count]; ///< Headers for the sends in flight.
+	uint8 *_send_buffers; ///< Payload storage for the send slots.
+	uint32 _free_send_slots[send_slot_count]; ///< Stack of idle send slot indices.
+	uint32 _free_send_count; ///< Number of idle send slots.
+};
+
+#endif
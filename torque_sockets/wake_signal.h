@@ -0,0 +1,127 @@
+// wake_signal.h - A flag one thread raises to wake another, usable from readiness APIs.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+/// wake_signal is a flag that one thread raises and another waits on.  While it is raised its descriptor is readable, so the waiting side can sleep in poll, epoll or select alongside its other I/O instead of blocking in wait.
+///
+/// The signal is an eventfd on Linux, a non-blocking pipe on other POSIX platforms and a manual-reset event on Windows, where there is no descriptor to hand out.  Raising an already raised signal has no further effect; clear lowers it however many times it was raised.
+class wake_signal
+{
+public:
+	wake_signal()
+	{
+		#if defined(PLATFORM_WIN32)
+			_event = 0;
+		#else
+			_descriptors[0] = -1;
+			_descriptors[1] = -1;
+		#endif
+	}
+
+	~wake_signal()
+	{
+		close();
+	}
+
+	/// Allocates the operating system object behind the signal.  Returns false if it could not be created.
+	bool open()
+	{
+		if(is_open())
+			return true;
+		#if defined(PLATFORM_WIN32)
+			_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		#elif defined(PLATFORM_LINUX)
+			_descriptors[0] = _descriptors[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		#else
+			if(!pipe(_descriptors))
+			{
+				fcntl(_descriptors[0], F_SETFL, O_NONBLOCK);
+				fcntl(_descriptors[1], F_SETFL, O_NONBLOCK);
+			}
+			else
+				_descriptors[0] = _descriptors[1] = -1;
+		#endif
+		return is_open();
+	}
+
+	void close()
+	{
+		#if defined(PLATFORM_WIN32)
+			if(_event)
+				CloseHandle(_event);
+			_event = 0;
+		#else
+			if(_descriptors[0] != -1)
+				::close(_descriptors[0]);
+			if(_descriptors[1] != _descriptors[0])
+				::close(_descriptors[1]);
+			_descriptors[0] = -1;
+			_descriptors[1] = -1;
+		#endif
+	}
+
+	bool is_open()
+	{
+		#if defined(PLATFORM_WIN32)
+			return _event != 0;
+		#else
+			return _descriptors[0] != -1;
+		#endif
+	}
+
+	/// Returns a descriptor that is readable while the signal is raised, or INVALID_SOCKET if the platform has none or the signal isn't open.
+	SOCKET get_descriptor()
+	{
+		#if defined(PLATFORM_WIN32)
+			return INVALID_SOCKET;
+		#else
+			return _descriptors[0];
+		#endif
+	}
+
+	void raise()
+	{
+		#if defined(PLATFORM_WIN32)
+			SetEvent(_event);
+		#elif defined(PLATFORM_LINUX)
+			uint64 count = 1;
+			::write(_descriptors[1], &count, sizeof(count));
+		#else
+			uint8 signal = 1;
+			::write(_descriptors[1], &signal, 1);
+		#endif
+	}
+
+	void clear()
+	{
+		#if defined(PLATFORM_WIN32)
+			ResetEvent(_event);
+		#elif defined(PLATFORM_LINUX)
+			uint64 count;
+			::read(_descriptors[0], &count, sizeof(count));
+		#else
+			uint8 drain[16];
+			while(::read(_descriptors[0], drain, sizeof(drain)) > 0)
+				;
+		#endif
+	}
+
+	/// Waits up to timeout for the signal to be raised.  Returns true if it is.
+	bool wait(time timeout)
+	{
+		#if defined(PLATFORM_WIN32)
+			return WaitForSingleObject(_event, DWORD(timeout.get_milliseconds())) == WAIT_OBJECT_0;
+		#else
+			pollfd poll_entry;
+			poll_entry.fd = _descriptors[0];
+			poll_entry.events = POLLIN;
+			poll_entry.revents = 0;
+			return poll(&poll_entry, 1, int(timeout.get_milliseconds())) > 0;
+		#endif
+	}
+private:
+	#if defined(PLATFORM_WIN32)
+		HANDLE _event; ///< Manual-reset event that is signaled while the signal is raised.
+	#else
+		int _descriptors[2]; ///< Read and write ends; both are the same eventfd on Linux.
+	#endif
+};
@@ -9,6 +9,10 @@ enum torque_sockets_constants {
 	torque_sockets_max_status_datagram_size = 511,
 	torque_sockets_max_public_key_size = 512,
 	torque_sockets_packet_window_size = 31,
+	torque_sockets_max_packet_window_size = 1024,
+	torque_sockets_max_message_streams = 16,
+	torque_sockets_max_stream_message_size = 1280,
+	torque_sockets_max_message_size = 1048576,
 	torque_sockets_info_packet_first_byte_min = 32,
 	torque_sockets_info_packet_first_byte_max = 127,
 };
@@ -24,6 +28,24 @@ enum torque_socket_event_type
 	torque_socket_connection_packet_event,
 	torque_socket_packet_notify_event,
 	torque_socket_info_packet_event,
+	torque_socket_connection_writable_event,
+	torque_socket_stream_message_event,
+};
+
+enum congestion_control_type
+{
+	congestion_control_none,
+	congestion_control_aimd,
+	congestion_control_bbr,
+};
+
+enum send_to_connection_result
+{
+	send_to_connection_sent,
+	send_to_connection_queued,
+	send_to_connection_queue_full,
+	send_to_connection_invalid_connection,
+	send_to_connection_invalid_message,
 };
 
 struct torque_socket_event
@@ -38,6 +60,22 @@ struct torque_socket_event
 	uint32 delivered;
 	uint32 disconnection_reason;
 	struct sockaddr source_address;
+	uint32 stream_index;
+};
+
+struct torque_socket_puzzle_stats
+{
+	uint32 current_difficulty;
+	uint32 load_percent;
+	uint32 pending_connections;
+	uint32 shared_secrets_per_second;
+	uint32 difficulty_raises;
+	uint32 difficulty_drops;
+	uint32 solutions_accepted;
+	uint32 invalid_solutions;
+	uint32 invalid_server_nonces;
+	uint32 invalid_client_nonces;
+	uint32 invalid_puzzle_difficulties;
 };
 
 torque_socket torque_socket_create(struct sockaddr*); ///< Create a torque socket and bind it to the specified socket address interface.
@@ -46,6 +84,14 @@ void torque_socket_destroy(torque_socket); ///< Close the specified socket; any
 
 void torque_socket_allow_incoming_connections(torque_socket, int allowed, ?from_domains?); ///< Sets whether or not this connection accepts incoming connections; if not, all incoming connection challenges and requests will be silently ignored.
 
+void torque_socket_set_packet_window_size(torque_socket, unsigned packet_window_size); ///< Sets the number of unacknowledged packets new connections may have in flight, rounded down to a power of two no larger than torque_sockets_max_packet_window_size.  Each connection uses the smaller of the initiator's and the host's setting.
+
+void torque_socket_set_congestion_control(torque_socket, enum congestion_control_type type); ///< Selects the congestion control new connections use: congestion_control_aimd (the default) backs off on loss, congestion_control_bbr paces to the measured path bandwidth, congestion_control_none is limited only by the packet window.
+
+unsigned torque_socket_get_send_budget(torque_socket, torque_connection); ///< Returns the number of datagrams that may be sent on the connection right now.  torque_socket_send_to_connection queues datagrams when it is 0.
+
+void torque_socket_set_send_queue_limit(torque_socket, unsigned queue_byte_limit); ///< Sets the number of bytes of datagrams new connections may queue beyond their send budget before torque_socket_send_to_connection returns send_to_connection_queue_full.  A torque_socket_connection_writable_event follows once a full queue has drained to half this limit.
+
 void torque_socket_set_private_key(torque_socket, unsigned key_data_size, unsigned char *the_key); ///< Sets the private/public key pair to be used for this connection;  In the prototype implementation these are formatted as libtomcrypt keys, and currently only ECC key format is supported.
 	
 void torque_socket_set_challenge_response(torque_socket, unsigned challenge_response_size, unsigned char *challenge_response); ///< Sets the data to be sent back upon challenge request along with the client puzzle and public key.  challenge_response_data_size must be <= torque_max_status_datagram_size	
@@ -54,6 +100,20 @@ void torque_socket_write_entropy(torque_socket, unsigned char entropy[32]); ///<
 	
 void torque_socket_read_entropy(torque_socket, unsigned char entropy[32]); ///< Read some random data from the socket
 
+void torque_socket_set_io_uring(torque_socket, int enabled); ///< Sets whether the socket sends and receives through an io_uring once bound, on Linux kernels that support it.  Must be called before bind.
+
+void torque_socket_set_segmentation_offload(torque_socket, int enabled); ///< Sets whether the socket uses UDP segmentation offload (GSO sends, GRO receives) once bound, on Linux.  Suits a few high-rate streams.  Must be called before bind.
+
+torque_loopback_network torque_loopback_network_create(); ///< Creates a datagram network that exists only inside this process, for tests and benchmarks.
+
+void torque_loopback_network_destroy(torque_loopback_network); ///< Destroys a loopback network once every transport on it has been destroyed.
+
+torque_transport torque_loopback_transport_create(torque_loopback_network); ///< Creates a transport on a loopback network; datagrams between loopback transports never reach the kernel.
+
+void torque_transport_destroy(torque_transport); ///< Destroys a transport once the socket using it has been destroyed.
+
+void torque_socket_set_transport(torque_socket, torque_transport); ///< Makes the socket send and receive through the transport instead of UDP.  Must be called before bind.
+
 int torque_socket_send_to(torque_socket, struct sockaddr* remote_host, unsigned data_size, unsigned char *data); ///< sends an unconnected datagram to the remote_host from the specified socket.  This function is not available for security reasons in the plugin version of the API.
 	
 torque_connection torque_socket_connect(torque_socket, struct sockaddr* remote_host, unsigned connect_data_size, unsigned char *connect_data); ///< open a connection to the remote host
@@ -70,4 +130,28 @@ void torque_socket_disconnect(torque_connection, uint32 reason_code, unsigned di
 
 struct torque_socket_event *torque_socket_get_next_event(torque_socket); ///< Gets the next event on this socket; returns NULL if there are no events to be read.
 
-int torque_socket_send_to_connection(torque_socket, torque_connection, unsigned datagram_size, unsigned char buffer[torque_max_datagram_size], unsigned *sequence_number); ///< Send a datagram packet to the remote host on the other side of the connection.  Returns the sequence number of the packet sent.
\ No newline at end of file
+int torque_socket_get_wait_fd(torque_socket); ///< Returns a descriptor that becomes readable when the socket has events, for use with poll, epoll or select, or -1 if there is none.  Call torque_socket_get_next_event until it returns NULL before waiting on it again.
+
+unsigned torque_socket_get_next_timeout(torque_socket); ///< Returns the number of milliseconds until the socket next has timed work to do, or 0 if it has some now.  Wait this long, or until a packet arrives, before calling torque_socket_get_next_event again.
+
+enum send_to_connection_result torque_socket_send_to_connection(torque_socket, torque_connection, unsigned datagram_size, unsigned char buffer[torque_max_datagram_size], unsigned *sequence_number); ///< Send a datagram packet to the remote host on the other side of the connection, or queue it behind the connection's send budget, storing the sequence number it is sent with in sequence_number.
+
+enum send_to_connection_result torque_socket_send_to_stream(torque_socket, torque_connection, unsigned stream_index, unsigned message_size, unsigned char *message); ///< Send a message reliably and in order on one of the connection's torque_sockets_max_message_streams streams.  The remote host receives it as a torque_socket_stream_message_event after every earlier message on the same stream; a lost packet only holds up the streams whose messages it carried.  Messages up to torque_sockets_max_message_size are fragmented and reassembled, resending only the fragments that were lost.
+
+void torque_socket_set_reassembly_limits(torque_socket, unsigned byte_limit, unsigned timeout); ///< Sets how many bytes new connections will hold for stream messages received out of order or being reassembled, and how many milliseconds a message being reassembled may go without a new fragment, before the remote host is disconnected.
+
+void torque_socket_set_coalesce_delay(torque_socket, unsigned delay); ///< Sets how many milliseconds new connections may hold a small datagram so that datagrams sent after it share its packet, with one header and one system call between them, or 0 to turn coalescing off.  The remote host still receives each datagram as its own torque_socket_packet_event.
+
+enum send_to_connection_result torque_socket_flush_connection(torque_socket, torque_connection); ///< Sends the datagrams a connection is holding for coalescing without waiting out the coalesce delay.
+
+void torque_socket_set_ack_delay(torque_socket, unsigned delay); ///< Sets how many milliseconds new connections let acknowledgements of received data wait for an outgoing data packet to carry them before sending a standalone ack, or 0 to ack without waiting.
+
+void torque_socket_set_reorder_window(torque_socket, unsigned reorder_window); ///< Sets how many packets behind the newest one new connections accept a late data packet instead of discarding it, so reordering on the path isn't mistaken for loss.
+
+void torque_socket_set_fec_group_size(torque_socket, unsigned min_group_size); ///< Sets the smallest group of data packets new connections follow with a parity packet, from which the remote host rebuilds a lost packet without a resend, or 0 for none.  Both sides must set it.
+
+void torque_socket_set_packet_encryption(torque_socket, int enabled); ///< Sets whether new connections seal their packets with AES-GCM, authenticating headers, encrypting bodies and discarding forged or replayed packets.  On by default; both sides must allow it.
+
+void torque_socket_set_puzzle_load_limits(torque_socket, unsigned max_pending_connections, unsigned max_shared_secrets_per_second, unsigned cpu_budget_percent); ///< Sets the pending connections, key exchanges per second and percent of the time spent on them past which the socket makes the client puzzles it issues harder, so a connection flood has to do more work for each request.  The difficulty eases back once the load has stayed low; 0 leaves a measure out.
+
+void torque_socket_get_puzzle_stats(torque_socket, struct torque_socket_puzzle_stats *stats); ///< Fills in the current client puzzle difficulty, the load it follows, and counts of accepted and rejected puzzle solutions.
\ No newline at end of file